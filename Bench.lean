@@ -0,0 +1,180 @@
+import Lean.Data.Json
+import LeanPq
+
+/-
+Benchmarks against the Postgres of `tests/docker-compose.yml`.
+
+  lake exe bench [output.json]
+
+The connection string is read from `LEAN_PQ_BENCH_CONNINFO`. Results are printed as JSON
+(and written to `output.json` when given) so that runs can be compared across releases.
+-/
+
+open Lean
+open LeanPq
+open Extern
+
+def defaultConninfo := "host=localhost port=5432 dbname=postgres user=postgres password=test"
+
+def liftPq (act : EIO LeanPq.Error α) : IO α :=
+  act.toIO (fun e => IO.userError (toString e))
+
+/-- Timing summary of one benchmark; durations in nanoseconds. -/
+structure Sample where
+  name : String
+  iterations : Nat
+  totalNs : Nat
+  minNs : Nat
+  p50Ns : Nat
+  p95Ns : Nat
+  maxNs : Nat
+  /-- Benchmark-specific figures (rows/s, bytes, ...). -/
+  extra : List (String × Json) := []
+
+def Sample.toJson (s : Sample) : Json :=
+  Json.mkObj <| [
+    ("name", Json.str s.name),
+    ("iterations", toJson s.iterations),
+    ("total_ns", toJson s.totalNs),
+    ("mean_ns", toJson (s.totalNs / max s.iterations 1)),
+    ("min_ns", toJson s.minNs),
+    ("p50_ns", toJson s.p50Ns),
+    ("p95_ns", toJson s.p95Ns),
+    ("max_ns", toJson s.maxNs)
+  ] ++ s.extra
+
+/-- Runs `act` `iterations` times and summarizes the duration of each run. -/
+def measure (name : String) (iterations : Nat) (act : IO Unit) : IO Sample := do
+  let mut durations : Array Nat := Array.mkEmpty iterations
+  for _ in [0:iterations] do
+    let t0 ← IO.monoNanosNow
+    act
+    let t1 ← IO.monoNanosNow
+    durations := durations.push (t1 - t0)
+  let sorted := durations.qsort (· < ·)
+  let at_ (q : Nat) := sorted[(sorted.size - 1) * q / 100]!
+  return {
+    name, iterations, totalNs := durations.foldl (· + ·) 0,
+    minNs := at_ 0, p50Ns := at_ 50, p95Ns := at_ 95, maxNs := at_ 100
+  }
+
+/-- Items per second for `items` processed in `ns` nanoseconds. -/
+def perSecond (items ns : Nat) : Json :=
+  toJson ((items.toFloat * 1.0e9) / (max ns 1).toFloat)
+
+/-- Peak resident set size (`VmHWM`) in kB, 0 where `/proc` is not available. -/
+def peakRssKb : IO Nat := do
+  let status ← try IO.FS.readFile "/proc/self/status" catch _ => return 0
+  for line in status.splitOn "\n" do
+    if line.startsWith "VmHWM:" then
+      return ((line.drop 6).trim.takeWhile Char.isDigit).toNat!
+  return 0
+
+def check (res : PGresult) : IO Unit := do
+  let status ← liftPq (PqResultStatus res)
+  unless status == .commandOk || status == .tuplesOk do
+    let msg ← liftPq (PqResultErrorMessage res)
+    throw (IO.userError s!"{status}: {msg}")
+
+def exec (conn : Handle) (sql : String) : IO PGresult := do
+  let res ← liftPq (PqExec conn sql)
+  check res
+  return res
+
+def benchConnect (conninfo : String) : IO Sample :=
+  measure "connect" 20 do
+    discard <| liftPq (PqConnectDb conninfo)
+
+def benchExec (conn : Handle) : IO Sample :=
+  measure "exec_round_trip" 2000 do
+    discard <| exec conn "SELECT 1"
+
+def benchExecParams (conn : Handle) : IO Sample :=
+  measure "exec_params_round_trip" 2000 do
+    let res ← liftPq (PqExecParams conn "SELECT $1::int8 + 1" #[Param.ofInt64 41])
+    check res
+
+def decodeQuery (rows : Nat) : String :=
+  s!"SELECT g AS id, g::text AS label, g * 0.5::float8 AS score FROM generate_series(1, {rows}) g"
+
+/-- Memory of a large result: the process peak RSS growth and libpq's own accounting. -/
+def benchLargeResult (conn : Handle) : IO Sample := do
+  let rows := 1000000
+  let before ← liftPq (PqConnectionStats conn)
+  let rssBefore ← peakRssKb
+  let s ← measure "large_result" 1 do
+    discard <| exec conn (decodeQuery rows)
+  let after ← liftPq (PqConnectionStats conn)
+  let rssAfter ← peakRssKb
+  return { s with extra := [
+    ("rows", toJson rows),
+    ("result_bytes", toJson (after.bytesReceived - before.bytesReceived).toNat),
+    ("peak_rss_growth_kb", toJson (rssAfter - rssBefore))
+  ] }
+
+/-- Decoding the same result cell by cell, in bulk, and as typed columns. -/
+def benchDecode (conn : Handle) : IO (Array Sample) := do
+  let rows := 100000
+  let res ← exec conn (decodeQuery rows)
+  let ncols := (← liftPq (PqNfields res)).toNat
+  let cells := rows * ncols
+  let perCell ← measure "decode_per_cell" 5 do
+    for row in [0:rows] do
+      for col in [0:ncols] do
+        discard <| liftPq (PqGetvalue res row col)
+  let bulk ← measure "decode_fetch_all" 5 do
+    discard <| liftPq (PqFetchAll res)
+  let typed ← measure "decode_columns" 5 do
+    for col in [0:ncols] do
+      discard <| liftPq (PqDecodeColumn res col)
+  return #[perCell, bulk, typed].map fun s =>
+    { s with extra := [("cells", toJson cells), ("cells_per_s", perSecond (cells * s.iterations) s.totalNs)] }
+
+/-- Loading rows with binary COPY and with a pipelined prepared INSERT. -/
+def benchInsert (conn : Handle) : IO (Array Sample) := do
+  let rows := 100000
+  let batch := 10000
+  let _ ← exec conn "DROP TABLE IF EXISTS lean_pq_bench"
+  let _ ← exec conn "CREATE UNLOGGED TABLE lean_pq_bench (id int8, label text, score float8)"
+  let data : Array (Array Value) := (List.range rows).toArray.map fun i =>
+    #[.int i.toInt64, .text s!"row {i}", .float (i.toFloat * 0.5)]
+  let copy ← measure "insert_copy_binary" 3 do
+    let _ ← exec conn "TRUNCATE lean_pq_bench"
+    let c ← liftPq (CopyIn.start conn "lean_pq_bench"
+      #[("id", .bigint), ("label", .text), ("score", .double_precision)])
+    for start in [0:rows:batch] do
+      liftPq (c.sendBinary (data.extract start (start + batch)))
+    discard <| liftPq c.finish
+  check (← liftPq (PqPrepare conn "lean_pq_bench_insert"
+    "INSERT INTO lean_pq_bench VALUES ($1, $2, $3)"))
+  let paramSets : Array (Array Param) := (List.range rows).toArray.map fun i =>
+    #[Param.ofInt64 i.toInt64, Param.ofString s!"row {i}", Param.ofFloat (i.toFloat * 0.5)]
+  let pipelined ← measure "insert_pipelined" 3 do
+    let _ ← exec conn "TRUNCATE lean_pq_bench"
+    let results ← liftPq (execPipelined conn "lean_pq_bench_insert" paramSets)
+    liftPq (Pipeline.check results)
+  let _ ← exec conn "DROP TABLE lean_pq_bench"
+  return #[copy, pipelined].map fun s =>
+    { s with extra := [("rows", toJson rows), ("rows_per_s", perSecond (rows * s.iterations) s.totalNs)] }
+
+def main (args : List String) : IO Unit := do
+  let conninfo := (← IO.getEnv "LEAN_PQ_BENCH_CONNINFO").getD defaultConninfo
+  let conn ← liftPq (PqConnectDb conninfo)
+  let serverVersion ← liftPq (PqServerVersion conn)
+  let mut samples : Array Sample := #[]
+  samples := samples.push (← benchConnect conninfo)
+  samples := samples.push (← benchExec conn)
+  samples := samples.push (← benchExecParams conn)
+  -- Before the other large allocations, so that the peak RSS growth is its own.
+  samples := samples.push (← benchLargeResult conn)
+  samples := samples ++ (← benchDecode conn)
+  samples := samples ++ (← benchInsert conn)
+  let report := Json.mkObj [
+    ("library", Json.str "lean-pq"),
+    ("server_version", toJson serverVersion),
+    ("benchmarks", Json.arr (samples.map Sample.toJson))
+  ]
+  let out := report.pretty
+  IO.println out
+  if let some path := args.head? then
+    IO.FS.writeFile path (out ++ "\n")
@@ -5,19 +5,19 @@ open Lean
 open LeanPq
 open Extern
 
-/-- Fetch all results as a list of lists (rows × columns) -/
-def fetchAllResults (result : PGresult) : EIO LeanPq.Error (List (List String)) := do
+/-- Fetch all results cell by cell with `PqGetvalue` (rows × columns) -/
+def fetchAllResults (result : PGresult) : EIO LeanPq.Error (Array (Array String)) := do
   let nrows ← PqNtuples result
   let ncols ← PqNfields result
 
-  let mut rows : List (List String) := []
+  let mut rows : Array (Array String) := Array.mkEmpty nrows.toNat
 
   for row in [0:nrows.toNat] do
-    let mut cols : List String := []
+    let mut cols : Array String := Array.mkEmpty ncols.toNat
     for col in [0:ncols.toNat] do
       let value ← PqGetvalue result (Int.ofNat row) (Int.ofNat col)
-      cols := cols ++ [value]
-    rows := rows ++ [cols]
+      cols := cols.push value
+    rows := rows.push cols
 
   return rows
 
@@ -30,9 +30,13 @@ def doConnect : EIO LeanPq.Error Unit := do
   let resStatus ← PqResultStatus result
   (IO.println s!"Result status: {resStatus}").toEIO (fun e => LeanPq.Error.otherError (toString e))
 
-  -- Fetch all results as list of lists
-  let rows ← fetchAllResults result
-  (IO.println s!"Fetched {rows.length} rows").toEIO (fun e => LeanPq.Error.otherError (toString e))
+  -- Fetch all results cell by cell, then in a single bulk call, and compare
+  let t0 ← IO.monoNanosNow
+  let perCell ← fetchAllResults result
+  let t1 ← IO.monoNanosNow
+  let rows ← PqFetchAll result
+  let t2 ← IO.monoNanosNow
+  (IO.println s!"Fetched {rows.size} rows: per-cell {(t1 - t0) / 1000} µs, bulk {(t2 - t1) / 1000} µs ({perCell.size} rows)").toEIO (fun e => LeanPq.Error.otherError (toString e))
 
   -- Print each row
   let mut idx := 0
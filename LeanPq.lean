@@ -2,4 +2,24 @@
 -- Import modules here that should be built as part of the library.
 import LeanPq.DataType
 import LeanPq.Extern
+import LeanPq.Value
+import LeanPq.Param
+import LeanPq.Stream
+import LeanPq.Copy
+import LeanPq.Pipeline
+import LeanPq.Async
+import LeanPq.Pool
+import LeanPq.StatementCache
+import LeanPq.FieldView
+import LeanPq.Metrics
+import LeanPq.FromRow
+import LeanPq.TypeRegistry
+import LeanPq.SqlBuilder
+import LeanPq.Notify
+import LeanPq.Replication
+import LeanPq.LargeObject
+import LeanPq.ResultCache
+import LeanPq.ParallelScan
+import LeanPq.Arrow
+import LeanPq.Router
 import LeanPq.DataType
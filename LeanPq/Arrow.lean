@@ -0,0 +1,383 @@
+/-
+Query results as Apache Arrow columns (`PqArrowColumns`), and Arrow IPC files that other
+tools can memory-map instead of parsing the output again.
+https://arrow.apache.org/docs/format/Columnar.html
+https://arrow.apache.org/docs/format/Columnar.html#ipc-file-format
+-/
+import LeanPq.DataType
+import LeanPq.Extern
+import LeanPq.Stream
+
+namespace LeanPq
+
+open Extern
+
+namespace Extern.ArrowType
+
+/-- The Arrow type `PqArrowColumns` gives a column of type `t`, as text or binary (`binary`)
+fields. Text dates and timestamps are not parsed and stay strings. -/
+def ofDataType (t : DataType) (binary : Bool) : ArrowType :=
+  match t with
+  | .boolean => .bool
+  | .smallint | .smallserial => .int16
+  | .integer | .serial => .int32
+  | .bigint | .bigserial => .int64
+  | .oid => .uint32
+  | .real => .float32
+  | .double_precision => .float64
+  | .date => if binary then .date32 else .utf8
+  | .timestamp _ false => if binary then .timestamp else .utf8
+  | .timestamp _ true => if binary then .timestampTz else .utf8
+  | .character _ | .character_varying _ | .text | .json | .xml | .numeric _ _ | .jsonb => .utf8
+  | _ => if binary then .binary else .utf8
+
+end Extern.ArrowType
+
+namespace Arrow
+
+/-- Little-endian bytes of `v`, on `n` bytes. -/
+def le (n : Nat) (v : Nat) : ByteArray :=
+  (List.range n).foldl (init := ByteArray.empty) fun b i => b.push (v / 256 ^ i % 256).toUInt8
+
+private def zeros (n : Nat) : ByteArray :=
+  ⟨Array.replicate n 0⟩
+
+/-- `n` rounded up to a multiple of `align`. -/
+private def alignUp (n align : Nat) : Nat :=
+  (n + align - 1) / align * align
+
+/-- A FlatBuffers value, the serialization of Arrow IPC metadata.
+https://flatbuffers.dev/internals/ -/
+inductive Flatbuffer where
+  /-- A little-endian scalar stored inline in its table, aligned to its size. -/
+  | scalar (bytes : ByteArray)
+  /-- A table; `none` fields are absent and read as their default. -/
+  | table (fields : Array (Option Flatbuffer))
+  | string (s : String)
+  /-- A vector of tables or strings. -/
+  | vector (elems : Array Flatbuffer)
+  /-- A vector of `count` structs packed in `data`, aligned to 8 bytes. -/
+  | structs (count : Nat) (data : ByteArray)
+  deriving Inhabited
+
+namespace Flatbuffer
+
+def u8 (v : Nat) : Flatbuffer := .scalar (le 1 v)
+def u16 (v : Nat) : Flatbuffer := .scalar (le 2 v)
+def u32 (v : Nat) : Flatbuffer := .scalar (le 4 v)
+def u64 (v : Nat) : Flatbuffer := .scalar (le 8 v)
+def bool (v : Bool) : Flatbuffer := u8 (if v then 1 else 0)
+
+private abbrev Enc := StateM ByteArray
+
+private def put (bytes : ByteArray) : Enc Unit :=
+  modify (· ++ bytes)
+
+/-- Pads with zeros until the size plus `after` is a multiple of `align`. -/
+private def pad (align : Nat) (after : Nat := 0) : Enc Unit :=
+  modify fun b => b ++ zeros (alignUp (b.size + after) align - (b.size + after))
+
+private def patch (pos : Nat) (bytes : ByteArray) : Enc Unit :=
+  modify fun b => bytes.foldl (init := (b, pos)) (fun (b, i) v => (b.set! i v, i + 1)) |>.1
+
+/-- Appends `fb` and returns the position that offsets to it refer to. Buffers are built
+front to back: children follow their parent, so every offset points forward. -/
+private partial def encodeAt : Flatbuffer → Enc Nat
+  | .scalar bytes => do
+    pad bytes.size
+    let pos := (← get).size
+    put bytes
+    return pos
+  | .string s => do
+    pad 4
+    let pos := (← get).size
+    put (le 4 s.utf8ByteSize ++ s.toUTF8 ++ zeros 1)
+    return pos
+  | .structs count data => do
+    -- The elements follow the 4-byte length.
+    pad 8 (after := 4)
+    let pos := (← get).size
+    put (le 4 count ++ data)
+    return pos
+  | .vector elems => do
+    pad 4
+    let pos := (← get).size
+    put (le 4 elems.size ++ zeros (4 * elems.size))
+    for e in elems, i in [0:elems.size] do
+      let slot := pos + 4 + 4 * i
+      let target ← encodeAt e
+      patch slot (le 4 (target - slot))
+    return pos
+  | .table fields => do
+    -- Inline layout: the offset to the vtable, then each field aligned to its size.
+    let mut offsets : Array Nat := #[]
+    let mut size := 4
+    for f in fields do
+      let width := match f with
+        | none => 0
+        | some (.scalar bytes) => bytes.size
+        | some _ => 4
+      if width == 0 then
+        offsets := offsets.push 0
+      else
+        size := alignUp size width
+        offsets := offsets.push size
+        size := size + width
+    pad 2
+    let vtable := (← get).size
+    put (le 2 (4 + 2 * fields.size) ++ le 2 size)
+    for o in offsets do
+      put (le 2 o)
+    -- The table start is 8-byte aligned, so aligned fields are aligned in the buffer.
+    pad 8
+    let pos := (← get).size
+    put (le 4 (pos - vtable) ++ zeros (size - 4))
+    for f in fields, o in offsets do
+      match f with
+      | none => pure ()
+      | some (.scalar bytes) => patch (pos + o) bytes
+      | some child =>
+        let target ← encodeAt child
+        patch (pos + o) (le 4 (target - (pos + o)))
+    return pos
+
+/-- Serializes the table `root` into a buffer padded to 8 bytes. -/
+def encode (root : Flatbuffer) : ByteArray :=
+  let enc : Enc Unit := do
+    put (zeros 4)
+    let pos ← encodeAt root
+    patch 0 (le 4 pos)
+    pad 8
+  (Id.run (enc.run ByteArray.empty)).2
+
+end Flatbuffer
+
+open Flatbuffer
+
+/-- `MetadataVersion.V5`. -/
+private def metadataVersion : Nat := 4
+
+/-- Tag and table of the `Type` union (Schema.fbs). -/
+private def typeUnion : ArrowType → Nat × Flatbuffer
+  | .bool => (6, .table #[])
+  | .int16 => (2, .table #[some (u32 16), some (bool true)])
+  | .int32 => (2, .table #[some (u32 32), some (bool true)])
+  | .int64 => (2, .table #[some (u32 64), some (bool true)])
+  | .uint32 => (2, .table #[some (u32 32), some (bool false)])
+  | .float32 => (3, .table #[some (u16 1)])
+  | .float64 => (3, .table #[some (u16 2)])
+  | .utf8 => (5, .table #[])
+  | .binary => (4, .table #[])
+  | .date32 => (8, .table #[some (u16 0)])
+  | .timestamp => (10, .table #[some (u16 2)])
+  | .timestampTz => (10, .table #[some (u16 2), some (.string "UTC")])
+
+/-- A `Schema` table with one nullable field per column. -/
+def schemaTable (schema : Array (String × ArrowType)) : Flatbuffer :=
+  let fields := schema.map fun (name, type) =>
+    let (tag, table) := typeUnion type
+    -- name, nullable, type_type, type, dictionary, children
+    Flatbuffer.table #[some (.string name), some (bool true), some (u8 tag), some table, none,
+      some (.vector #[])]
+  -- endianness (little), fields
+  .table #[some (u16 0), some (.vector fields)]
+
+/-- A `Message` table: version, header type, header and body length. -/
+private def message (headerType : Nat) (header : Flatbuffer) (bodyLength : Nat) : ByteArray :=
+  encode (.table #[some (u16 metadataVersion), some (u8 headerType), some header, some (u64 bodyLength)])
+
+/-- The body buffers of a column; the validity bitmap is left out when nothing is null. -/
+private def columnBuffers (c : ArrowColumn) : Array ByteArray :=
+  let validity := if c.nullCount == 0 then ByteArray.empty else c.validity
+  match c.type with
+  | .utf8 | .binary => #[validity, c.offsets, c.values]
+  | _ => #[validity, c.values]
+
+/-- Concatenates LSB-first bitmaps, each given with its length in bits. -/
+def concatBitmaps (parts : Array (ByteArray × Nat)) : ByteArray := Id.run do
+  let total := parts.foldl (· + ·.2) 0
+  let mut out := zeros ((total + 7) / 8)
+  let mut pos := 0
+  for (bits, length) in parts do
+    for i in [0:length] do
+      if bits.get! (i / 8) >>> (i % 8).toUInt8 &&& 1 == 1 then
+        let j := pos + i
+        out := out.set! (j / 8) (out.get! (j / 8) ||| 1 <<< (j % 8).toUInt8)
+    pos := pos + length
+  return out
+
+/-- The little-endian 32-bit value at `i`. -/
+private def readLe32 (b : ByteArray) (i : Nat) : Nat :=
+  (List.range 4).foldl (init := 0) fun v k => v + (b.get! (i + k)).toNat * 256 ^ k
+
+/-- Body buffers start 64-byte aligned, as recommended for memory-mapped reads. -/
+private def bufferAlignment : Nat := 64
+
+private def magic : ByteArray := "ARROW1".toUTF8
+
+end Arrow
+
+open Arrow
+
+/-- Names and types of exported columns. -/
+def arrowSchema (columns : Array ArrowColumn) : Array (String × ArrowType) :=
+  columns.map fun c => (c.name, c.type)
+
+/-- Concatenates record batches of the same schema into one batch: bitmaps are shifted and
+the offsets of variable-width columns rebased. Fails when such a column would exceed the 2 GB
+addressed by 32-bit offsets. -/
+def concatArrowBatches (batches : Array (Array ArrowColumn)) : Except String (Array ArrowColumn) := do
+  let some first := batches[0]?
+    | return #[]
+  unless batches.all (arrowSchema · == arrowSchema first) do
+    throw "Record batches do not have the same schema"
+  (List.range first.size).toArray.mapM fun col => do
+    let parts := batches.map (·[col]!)
+    let c := first[col]!
+    let length := parts.foldl (· + ·.length.toNat) 0
+    let nullCount := parts.foldl (· + ·.nullCount.toNat) 0
+    let validity := concatBitmaps (parts.map fun p => (p.validity, p.length.toNat))
+    let mut offsets := ByteArray.empty
+    let mut values := ByteArray.empty
+    match c.type with
+    | .utf8 | .binary =>
+      offsets := le 4 0
+      for p in parts do
+        for i in [1:p.length.toNat + 1] do
+          offsets := offsets ++ le 4 (values.size + readLe32 p.offsets (4 * i))
+        values := values ++ p.values
+      if values.size > 0x7FFFFFFF then
+        throw s!"Column {c.name} exceeds the 2 GB addressed by 32-bit Arrow offsets"
+    | .bool => values := concatBitmaps (parts.map fun p => (p.values, p.length.toNat))
+    | _ => values := parts.foldl (· ++ ·.values) ByteArray.empty
+    return { c with length := length.toUInt64, nullCount := nullCount.toUInt64, validity, offsets, values }
+
+/--
+An Arrow IPC file being written: a schema, then record batches appended one at a time.
+
+Buffers are written as they are, little-endian and 64-byte aligned, so readers can
+memory-map the file and use the columns in place. The file is only valid once `finish`
+wrote its footer.
+-/
+structure ArrowFile where
+  handle : IO.FS.Handle
+  schema : Array (String × ArrowType)
+  /-- Bytes written so far. -/
+  position : IO.Ref Nat
+  /-- Offset, metadata length and body length of each record batch, for the footer. -/
+  blocks : IO.Ref (Array (Nat × Nat × Nat))
+
+namespace ArrowFile
+
+private def io (act : IO α) : EIO LeanPq.Error α :=
+  act.toEIO fun e => .otherError (toString e)
+
+/-- Writes an encapsulated message: continuation marker, metadata length, the metadata padded
+so the body starts aligned, then the body. Returns the message's footer block. -/
+private def writeMessage (f : ArrowFile) (metadata : ByteArray) (body : Array ByteArray) :
+    EIO LeanPq.Error (Nat × Nat × Nat) := do
+  let start ← f.position.get
+  let metaLength := alignUp (start + 8 + metadata.size) bufferAlignment - (start + 8)
+  io (f.handle.write (le 4 0xFFFFFFFF ++ le 4 metaLength ++ metadata ++ zeros (metaLength - metadata.size)))
+  let mut bodyLength := 0
+  for buffer in body do
+    let padded := alignUp buffer.size bufferAlignment
+    io (f.handle.write buffer)
+    io (f.handle.write (zeros (padded - buffer.size)))
+    bodyLength := bodyLength + padded
+  f.position.set (start + 8 + metaLength + bodyLength)
+  return (start, 8 + metaLength, bodyLength)
+
+/-- Creates (or truncates) `path` and writes the schema. -/
+def create (path : System.FilePath) (schema : Array (String × ArrowType)) : EIO LeanPq.Error ArrowFile := do
+  let handle ← io (IO.FS.Handle.mk path .write)
+  -- The magic is padded to 8 bytes.
+  io (handle.write (magic ++ zeros 2))
+  let f : ArrowFile := { handle, schema, position := ← IO.mkRef 8, blocks := ← IO.mkRef #[] }
+  discard <| f.writeMessage (message 1 (schemaTable schema) 0) #[]
+  return f
+
+/-- Appends the columns as one record batch; they must match the schema and have the same
+length. -/
+def writeBatch (f : ArrowFile) (columns : Array ArrowColumn) : EIO LeanPq.Error Unit := do
+  unless arrowSchema columns == f.schema do
+    throw (.otherError "Record batch does not match the schema of the Arrow file")
+  let length := (columns[0]?.map (·.length)).getD 0
+  unless columns.all (·.length == length) do
+    throw (.otherError "Columns of a record batch must have the same length")
+  let body := columns.flatMap columnBuffers
+  let (_, layout) := body.foldl (init := (0, ByteArray.empty)) fun (offset, acc) buffer =>
+    (offset + alignUp buffer.size bufferAlignment, acc ++ le 8 offset ++ le 8 buffer.size)
+  let nodes := columns.foldl (init := ByteArray.empty) fun acc c =>
+    acc ++ le 8 c.length.toNat ++ le 8 c.nullCount.toNat
+  let bodyLength := body.foldl (init := 0) fun n b => n + alignUp b.size bufferAlignment
+  -- RecordBatch: length, nodes, buffers
+  let batch := Flatbuffer.table #[some (u64 length.toNat), some (.structs columns.size nodes),
+    some (.structs body.size layout)]
+  let block ← f.writeMessage (message 3 batch bodyLength) body
+  f.blocks.modify (·.push block)
+
+/-- Writes the end-of-stream marker and the footer, and flushes the file. -/
+def finish (f : ArrowFile) : EIO LeanPq.Error Unit := do
+  let blocks := (← f.blocks.get).foldl (init := ByteArray.empty) fun acc (offset, metaLength, bodyLength) =>
+    acc ++ le 8 offset ++ le 4 metaLength ++ zeros 4 ++ le 8 bodyLength
+  -- Footer: version, schema, dictionaries, recordBatches
+  let footer := encode (.table #[some (u16 metadataVersion), some (schemaTable f.schema),
+    some (.structs 0 ByteArray.empty), some (.structs (← f.blocks.get).size blocks)])
+  io (f.handle.write (le 4 0xFFFFFFFF ++ zeros 4 ++ footer ++ le 4 footer.size ++ magic))
+  io f.handle.flush
+
+end ArrowFile
+
+/-- Writes `columns` to `path` as an Arrow IPC file with a single record batch. -/
+def writeArrowFile (path : System.FilePath) (columns : Array ArrowColumn) : EIO LeanPq.Error Unit := do
+  let f ← ArrowFile.create path (arrowSchema columns)
+  f.writeBatch columns
+  f.finish
+
+/-- Writes `columns` as a record batch of `file`, creating it with their schema first. -/
+private def writeExported (path : System.FilePath) (file : Option ArrowFile) (columns : Array ArrowColumn) :
+    EIO LeanPq.Error ArrowFile := do
+  let f ← match file with
+    | some f => pure f
+    | none => ArrowFile.create path (arrowSchema columns)
+  f.writeBatch columns
+  return f
+
+/-- Runs `query` in chunked-rows mode (binary results) and writes each batch to `path` as a
+record batch, so memory stays bounded by one batch. When libpq only offers single rows, they
+are gathered into record batches of `chunkSize` rows. An empty result gives a file without
+columns, its types being only known from the rows. Returns the number of rows. -/
+def exportArrow (conn : Handle) (query : String) (path : System.FilePath) (params : Array Param := #[])
+    (chunkSize : Nat := 65536) : EIO LeanPq.Error Nat := do
+  let stream ← RowStream.start conn query params { chunkSize, resultFormat := 1 }
+  let mut file : Option ArrowFile := none
+  let mut rows := 0
+  let mut pending : Array (Array ArrowColumn) := #[]
+  let mut pendingRows := 0
+  for batch in stream do
+    let columns ← PqArrowColumns batch
+    let n := (← PqNtuples batch).toNat
+    rows := rows + n
+    if stream.chunked then
+      file := some (← writeExported path file columns)
+    else
+      pending := pending.push columns
+      pendingRows := pendingRows + n
+      if pendingRows ≥ chunkSize then
+        match concatArrowBatches pending with
+        | .ok columns => file := some (← writeExported path file columns)
+        | .error msg => throw (.otherError msg)
+        pending := #[]
+        pendingRows := 0
+  unless pending.isEmpty do
+    match concatArrowBatches pending with
+    | .ok columns => file := some (← writeExported path file columns)
+    | .error msg => throw (.otherError msg)
+  let f ← match file with
+    | some f => pure f
+    | none => ArrowFile.create path #[]
+  f.finish
+  return rows
+
+end LeanPq
@@ -0,0 +1,173 @@
+/-
+Non-blocking query execution: one reactor thread multiplexes the sockets of many
+connections and completes a `Task` per query.
+https://www.postgresql.org/docs/current/libpq-async.html
+-/
+import Std.Data.HashMap
+import LeanPq.Extern
+
+namespace LeanPq
+
+open Extern
+
+/-- A query in flight on one connection. -/
+structure AsyncOp where
+  conn : Handle
+  promise : IO.Promise (Except LeanPq.Error PGresult)
+  /-- The last result received so far. -/
+  last : IO.Ref (Option PGresult)
+  /-- Whether the query is still being sent. -/
+  flushing : IO.Ref Bool
+  /-- Whether `acquire` switched the connection to nonblocking mode, to be undone on completion. -/
+  restoreBlocking : Bool
+
+/--
+Drives queries sent in nonblocking mode.
+
+A dedicated thread waits on the sockets of every connection with a query in flight and
+reads results as they arrive, so no thread is blocked per query. Each connection runs at
+most one query at a time. A connection is switched to nonblocking mode while its query is in
+flight and back when it completes, so synchronous calls (COPY, pipelines, large objects)
+keep working on it afterwards.
+-/
+structure Reactor where
+  poller : Poller
+  /-- Queries in flight, by socket. -/
+  ops : IO.Ref (Std.HashMap UInt32 AsyncOp)
+  running : IO.Ref Bool
+  loop : IO.Ref (Option (Task (Except LeanPq.Error Unit)))
+
+namespace Reactor
+
+/-- Reads every result that is available without blocking; true once the query is complete.
+A COPY completes the query with its COPY result, as `PqExec` does: `PqGetResult` would return
+that result again until the copy is over. -/
+private partial def readResults (op : AsyncOp) : EIO LeanPq.Error Bool := do
+  if (← PqIsBusy op.conn) then return false
+  match ← PqGetResult op.conn with
+  | none => return true
+  | some res =>
+    op.last.set (some res)
+    match ← PqResultStatus res with
+    | .copyIn | .copyOut | .copyBoth => return true
+    | _ => readResults op
+
+/-- Switches `conn` back to blocking mode if `acquire` changed it. -/
+private def release (conn : Handle) (restoreBlocking : Bool) : EIO LeanPq.Error Unit := do
+  if restoreBlocking then
+    try PqSetnonblocking conn false catch _ => pure ()
+
+private def complete (r : Reactor) (fd : UInt32) (op : AsyncOp) (result : Except LeanPq.Error PGresult) :
+    EIO LeanPq.Error Unit := do
+  r.ops.modify (·.erase fd)
+  try PqPollerUnwatch r.poller fd catch _ => pure ()
+  release op.conn op.restoreBlocking
+  op.promise.resolve result
+
+/-- Makes progress on the query of a socket reported ready. -/
+private def service (r : Reactor) (fd : UInt32) : EIO LeanPq.Error Unit := do
+  let some op := (← r.ops.get)[fd]? | return
+  try
+    PqConsumeInput op.conn
+    if (← op.flushing.get) then
+      let pending ← PqFlush op.conn
+      op.flushing.set pending
+      if pending then
+        PqPollerWatch r.poller fd true
+        return
+    if (← readResults op) then
+      match ← op.last.get with
+      | some res => r.complete fd op (.ok res)
+      | none => r.complete fd op (.error (.otherError "Query returned no result"))
+    else
+      PqPollerWatch r.poller fd false
+  catch e =>
+    r.complete fd op (.error e)
+
+private partial def run (r : Reactor) : EIO LeanPq.Error Unit := do
+  unless (← r.running.get) do return
+  -- `stop` wakes the poller, so there is no need for a timeout.
+  for fd in ← PqPollerWait r.poller UInt32.max do
+    r.service fd
+  r.run
+
+/-- Starts a reactor and its thread. -/
+def start : EIO LeanPq.Error Reactor := do
+  let poller ← PqPollerNew
+  let ops ← IO.mkRef {}
+  let running ← IO.mkRef true
+  let loop ← IO.mkRef none
+  let r : Reactor := { poller, ops, running, loop }
+  let task ← EIO.asTask r.run .dedicated
+  loop.set (some task)
+  return r
+
+/-- Registers a query that has just been sent on `conn`. -/
+private def track (r : Reactor) (conn : Handle) (fd : UInt32) (restoreBlocking : Bool) :
+    EIO LeanPq.Error (Task (Except LeanPq.Error PGresult)) := do
+  let pending ← PqFlush conn
+  let promise ← IO.Promise.new
+  let last ← IO.mkRef none
+  let flushing ← IO.mkRef pending
+  r.ops.modify (·.insert fd { conn, promise, last, flushing, restoreBlocking })
+  PqPollerWatch r.poller fd pending
+  return promise.result!
+
+/-- Checks that `conn` can take a query and switches it to nonblocking mode. Also returns
+whether the mode was changed. -/
+private def acquire (r : Reactor) (conn : Handle) : EIO LeanPq.Error (UInt32 × Bool) := do
+  unless (← r.running.get) do
+    throw (.otherError "Reactor is stopped")
+  let socket ← PqSocket conn
+  if socket < 0 then
+    throw (.otherError "Connection has no open socket")
+  let fd := socket.toNat.toUInt32
+  if (← r.ops.get).contains fd then
+    throw (.otherError "Connection already has a query in flight")
+  if (← PqIsnonblocking conn) then
+    return (fd, false)
+  PqSetnonblocking conn true
+  return (fd, true)
+
+/-- Sends a query with `send` once `conn` is acquired, then tracks it. -/
+private def submit (r : Reactor) (conn : Handle) (send : EIO LeanPq.Error Unit) :
+    EIO LeanPq.Error (Task (Except LeanPq.Error PGresult)) := do
+  let (fd, restoreBlocking) ← r.acquire conn
+  try
+    send
+    r.track conn fd restoreBlocking
+  catch e =>
+    release conn restoreBlocking
+    throw e
+
+/-- Sends `command` and returns a task completed with its last result. For a COPY, that is
+the `copyIn` or `copyOut` result, and the copy itself is then run synchronously on `conn`. -/
+def exec (r : Reactor) (conn : Handle) (command : String) (params : Array Param := #[])
+    (resultFormat : Int := 0) : EIO LeanPq.Error (Task (Except LeanPq.Error PGresult)) := do
+  r.submit conn (PqSendQueryParams conn command params resultFormat)
+
+/-- Executes the prepared statement `stmtName` and returns a task completed with its result. -/
+def execPrepared (r : Reactor) (conn : Handle) (stmtName : String) (params : Array Param := #[])
+    (resultFormat : Int := 0) : EIO LeanPq.Error (Task (Except LeanPq.Error PGresult)) := do
+  r.submit conn (PqSendQueryPrepared conn stmtName params resultFormat)
+
+/-- Stops the reactor thread; queries still in flight fail. -/
+def stop (r : Reactor) : EIO LeanPq.Error Unit := do
+  r.running.set false
+  PqPollerWake r.poller
+  match ← r.loop.get with
+  | some task =>
+    let _ ← IO.wait task
+  | none => pure ()
+  for (fd, op) in ← r.ops.get do
+    r.complete fd op (.error (.otherError "Reactor stopped"))
+
+end Reactor
+
+/-- Waits for an asynchronous query. -/
+def await (task : Task (Except LeanPq.Error PGresult)) : EIO LeanPq.Error PGresult := do
+  match ← IO.wait task with
+  | .ok res => return res
+  | .error e => throw e
+
+end LeanPq
@@ -0,0 +1,247 @@
+/-
+Bulk loading with COPY ... FROM STDIN and bulk export with COPY ... TO STDOUT,
+in text or binary format.
+https://www.postgresql.org/docs/current/sql-copy.html
+-/
+import LeanPq.DataType
+import LeanPq.Extern
+
+namespace LeanPq
+
+open Extern
+
+/-- Column encodings of binary COPY, as passed to `PqCopyEncodeBinary`. -/
+namespace CopyKind
+
+def text : UInt8 := 0
+def bool : UInt8 := 1
+def int2 : UInt8 := 2
+def int4 : UInt8 := 3
+def int8 : UInt8 := 4
+def float4 : UInt8 := 5
+def float8 : UInt8 := 6
+def date : UInt8 := 7
+def timestamp : UInt8 := 8
+def uuid : UInt8 := 9
+def bytea : UInt8 := 10
+def numeric : UInt8 := 11
+def jsonb : UInt8 := 12
+
+/-- The binary encoding of a column type, `none` when the column must be loaded with text COPY.
+Each kind expects the matching `Value` constructor (`numeric` also takes `int` and `text`). -/
+def ofDataType? : DataType → Option UInt8
+  | .boolean => some bool
+  | .smallint | .smallserial => some int2
+  | .integer | .serial => some int4
+  | .bigint | .bigserial => some int8
+  | .real => some float4
+  | .double_precision => some float8
+  | .numeric _ _ => some numeric
+  | .date => some date
+  | .timestamp _ _ => some timestamp
+  | .uuid => some uuid
+  | .bytea => some bytea
+  | .jsonb => some jsonb
+  | .text | .character _ | .character_varying _ | .json | .xml | .enum _ => some text
+  | _ => none
+
+end CopyKind
+
+/-- Data format of a COPY operation. -/
+inductive CopyFormat where
+  /-- Tab-separated text, values given as `Option String`. -/
+  | text
+  /-- PostgreSQL binary COPY, values given as `Value`. -/
+  | binary
+  deriving BEq, DecidableEq, Repr, Inhabited
+
+/-- Collects the results that follow the end of the COPY data and returns the row count. -/
+private def collectCopy (conn : Handle) : EIO LeanPq.Error Nat := do
+  let mut count := 0
+  let mut error : Option String := none
+  repeat
+    match ← PqGetResult conn with
+    | none => break
+    | some res =>
+      match ← PqResultStatus res with
+      | .commandOk => count := (← PqCmdTuples res).toNat?.getD 0
+      | status =>
+        let msg ← PqResultErrorMessage res
+        error := some s!"{status}: {msg}"
+  if let some msg := error then
+    throw (.otherError msg)
+  return count
+
+/--
+An open `COPY ... FROM STDIN`.
+
+Every batch is encoded natively into one send buffer which is reused from batch to batch,
+then handed to libpq in a single `PQputCopyData` call.
+-/
+structure CopyIn where
+  conn : Handle
+  format : CopyFormat
+  /-- One `CopyKind` per column (binary format only). -/
+  kinds : ByteArray
+  buffer : IO.Ref ByteArray
+  headerSent : IO.Ref Bool
+
+namespace CopyIn
+
+/-- Starts `COPY table (columns) FROM STDIN`. `table` is inserted as is, so it must already be a
+valid (quoted if needed) table name; column names are escaped. -/
+def start (conn : Handle) (table : String) (columns : Array (String × DataType))
+    (format : CopyFormat := .binary) : EIO LeanPq.Error CopyIn := do
+  let kinds ← match format with
+    | .text => pure ByteArray.empty
+    | .binary => columns.foldlM (init := ByteArray.empty) fun acc (name, type) =>
+      match CopyKind.ofDataType? type with
+      | some kind => pure (acc.push kind)
+      | none => throw (.otherError s!"Column {name} has no binary COPY encoding, use the text format")
+  let names ← columns.mapM fun (name, _) => PqEscapeIdentifier conn name
+  let columnList := if names.isEmpty then "" else s!" ({", ".intercalate names.toList})"
+  let options := if format == .binary then " (FORMAT binary)" else ""
+  let res ← PqExec conn s!"COPY {table}{columnList} FROM STDIN{options}"
+  let status ← PqResultStatus res
+  unless status == .copyIn do
+    let msg ← PqResultErrorMessage res
+    throw (.otherError s!"{status}: {msg}")
+  let buffer ← IO.mkRef ByteArray.empty
+  let headerSent ← IO.mkRef false
+  return { conn, format, kinds, buffer, headerSent }
+
+/-- Encodes and sends a batch of rows in text format (`none` is SQL NULL). -/
+def sendText (c : CopyIn) (rows : Array (Array (Option String))) : EIO LeanPq.Error Unit := do
+  unless c.format == .text do
+    throw (.otherError "COPY was started in binary format")
+  let buf ← c.buffer.modifyGet fun b => (b, ByteArray.empty)
+  let buf ← PqCopyEncodeText buf rows
+  -- Kept for the next batch even when the send fails.
+  try
+    PqPutCopyData c.conn buf
+  finally
+    c.buffer.set buf
+
+/-- Encodes and sends a batch of rows in binary format, one `Value` per column. -/
+def sendBinary (c : CopyIn) (rows : Array (Array Value)) : EIO LeanPq.Error Unit := do
+  unless c.format == .binary do
+    throw (.otherError "COPY was started in text format")
+  let header := !(← c.headerSent.get)
+  let buf ← c.buffer.modifyGet fun b => (b, ByteArray.empty)
+  let buf ← PqCopyEncodeBinary buf c.kinds rows header
+  try
+    PqPutCopyData c.conn buf
+    c.headerSent.set true
+  finally
+    c.buffer.set buf
+
+/-- Ends the COPY and returns the number of rows loaded. -/
+def finish (c : CopyIn) : EIO LeanPq.Error Nat := do
+  if c.format == .binary then
+    let buf ← if (← c.headerSent.get) then pure ByteArray.empty
+      else PqCopyEncodeBinary ByteArray.empty c.kinds #[] true
+    -- File trailer: a tuple field count of -1.
+    PqPutCopyData c.conn ((buf.push 0xFF).push 0xFF)
+  PqPutCopyEnd c.conn
+  collectCopy c.conn
+
+/-- Makes the COPY fail with `reason`; no row of it is loaded. -/
+def abort (c : CopyIn) (reason : String := "aborted by client") : EIO LeanPq.Error Unit := do
+  PqPutCopyEnd c.conn (some reason)
+  try
+    let _ ← collectCopy c.conn
+  catch _ =>
+    pure ()
+
+end CopyIn
+
+
+/--
+An open `COPY ... TO STDOUT`.
+
+Data arrives as the raw chunks libpq receives (one row per chunk in text format). Binary
+exports can be decoded into typed columns with `forColumnBatches`, or written to a file
+descriptor without ever being materialized with `toFd`.
+-/
+structure CopyOut where
+  conn : Handle
+  format : CopyFormat
+
+namespace CopyOut
+
+/-- Starts `COPY source TO STDOUT`. `source` is inserted as is: a table name with an optional
+column list, or a parenthesized query. -/
+def start (conn : Handle) (source : String) (format : CopyFormat := .binary) : EIO LeanPq.Error CopyOut := do
+  let options := if format == .binary then " (FORMAT binary)" else ""
+  let res ← PqExec conn s!"COPY {source} TO STDOUT{options}"
+  let status ← PqResultStatus res
+  unless status == .copyOut do
+    let msg ← PqResultErrorMessage res
+    throw (.otherError s!"{status}: {msg}")
+  return { conn, format }
+
+/-- Returns the next chunk of COPY data, or `none` once the COPY has completed successfully. -/
+def next? (c : CopyOut) : EIO LeanPq.Error (Option ByteArray) := do
+  match ← PqGetCopyData c.conn with
+  | some chunk => return some chunk
+  | none =>
+    let _ ← collectCopy c.conn
+    return none
+
+/-- Discards the rest of the export so the connection can be reused. -/
+def drain (c : CopyOut) : EIO LeanPq.Error Unit := do
+  repeat
+    if (← PqGetCopyData c.conn).isNone then break
+  try
+    let _ ← collectCopy c.conn
+  catch _ =>
+    pure ()
+
+/-- Folds over the data chunks. Breaking out early reads the rest of the COPY to keep the
+connection usable. -/
+partial def forIn {β : Type} (c : CopyOut) (init : β) (f : ByteArray → β → EIO LeanPq.Error (ForInStep β)) :
+    EIO LeanPq.Error β := do
+  match ← c.next? with
+  | none => return init
+  | some chunk =>
+    match ← f chunk init with
+    | .done b =>
+      c.drain
+      return b
+    | .yield b => forIn c b f
+
+instance : ForIn (EIO LeanPq.Error) CopyOut ByteArray where
+  forIn c b f := c.forIn b f
+
+/-- Writes the whole export to the file descriptor `fd` and returns the number of rows.
+The data is copied from libpq's buffer straight to the descriptor. -/
+def toFd (c : CopyOut) (fd : UInt32) : EIO LeanPq.Error Nat := do
+  let _ ← PqCopyOutToFd c.conn fd
+  collectCopy c.conn
+
+/-- Decodes a binary export into batches of typed columns, `oids` giving the type of each
+exported column. `f` receives every `batchRows` rows (and the remainder at the end) as one
+`Column` per exported column; the row count is returned. -/
+def forColumnBatches (c : CopyOut) (oids : Array UInt32) (f : Array Column → EIO LeanPq.Error Unit)
+    (batchRows : Nat := 65536) : EIO LeanPq.Error Nat := do
+  unless c.format == .binary do
+    throw (.otherError "COPY was started in text format")
+  let parser ← PqCopyParserNew oids
+  try
+    repeat
+      match ← PqGetCopyData c.conn with
+      | none => break
+      | some chunk =>
+        let _ ← PqCopyParserFeed parser chunk
+        if (← PqCopyParserRows parser) >= batchRows then
+          f (← PqCopyParserTake parser)
+  catch e =>
+    c.drain
+    throw e
+  if (← PqCopyParserRows parser) > 0 then
+    f (← PqCopyParserTake parser)
+  collectCopy c.conn
+
+end CopyOut
+
+end LeanPq
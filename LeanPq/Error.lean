@@ -3,6 +3,10 @@ namespace LeanPq
 inductive Error where
   | connectionError (code : UInt32)
   | otherError (msg: String)
+  /-- The query ran longer than the timeout given to a `...Timeout` exec, and was canceled. -/
+  | queryTimeout (timeoutMs : UInt32)
+  /-- The query was canceled by `PqCancel` (or by the server, e.g. `pg_cancel_backend`). -/
+  | queryCanceled (msg : String)
   deriving BEq, DecidableEq, Repr, Inhabited
 
 
@@ -10,5 +14,7 @@ instance : ToString Error where
   toString := fun
   | .connectionError code => s!"Connection error: {code}."
   | .otherError msg => s!"Other error: {msg}."
+  | .queryTimeout timeoutMs => s!"Query timeout: canceled after {timeoutMs} ms."
+  | .queryCanceled msg => s!"Query canceled: {msg}."
 
 end LeanPq
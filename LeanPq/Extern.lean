@@ -2,6 +2,9 @@
 https://gist.github.com/ydewit/7ab62be1bd0fea5bd53b48d23914dd6b#4-scalar-values-in-lean-s-ffi
 -/
 import LeanPq.Error
+import LeanPq.Value
+import LeanPq.Param
+import LeanPq.Metrics
 
 namespace LeanPq
 
@@ -12,59 +15,59 @@ namespace Extern
 /-- Makes a new connection to the database server using parameter arrays.
 Documentation: https://www.postgresql.org/docs/current/libpq-connect.html#LIBPQ-PQCONNECTDBPARAMS -/
 @[extern "lean_pq_connect_db_params"]
-opaque PqConnectDbParams (keywords : Array String) (values : Array String) (expand_dbname : Int := 0): EIO LeanPq.Error Handle
+opaque PqConnectDbParams (keywords : @& Array String) (values : @& Array String) (expand_dbname : Int := 0): EIO LeanPq.Error Handle
 
 /-- Makes a new connection to the database server using a connection string.
 Documentation: https://www.postgresql.org/docs/current/libpq-connect.html#LIBPQ-PQCONNECTDB -/
 @[extern "lean_pq_connect_db"]
-opaque PqConnectDb (conninfo : String): EIO LeanPq.Error Handle
+opaque PqConnectDb (conninfo : @& String): EIO LeanPq.Error Handle
 
 /-- Resets the communication channel with the server.
 Documentation: https://www.postgresql.org/docs/current/libpq-connect.html#LIBPQ-PQRESET -/
 @[extern "lean_pq_reset"]
-opaque PqReset (conn : Handle): EIO LeanPq.Error  Unit
+opaque PqReset (conn : @& Handle): EIO LeanPq.Error  Unit
 
 -- [Connection Status Functions](https://www.postgresql.org/docs/current/libpq-status.html)
 
 /-- Returns the database name of the connection.
 Documentation: https://www.postgresql.org/docs/current/libpq-status.html#LIBPQ-PQDB -/
 @[extern "lean_pq_db"]
-opaque PqDb (conn : Handle): EIO LeanPq.Error String
+opaque PqDb (conn : @& Handle): EIO LeanPq.Error String
 
 /-- Returns the user name of the connection.
 Documentation: https://www.postgresql.org/docs/current/libpq-status.html#LIBPQ-PQUSER -/
 @[extern "lean_pq_user"]
-opaque PqUser (conn : Handle): EIO LeanPq.Error String
+opaque PqUser (conn : @& Handle): EIO LeanPq.Error String
 
 /-- Returns the password of the connection.
 Documentation: https://www.postgresql.org/docs/current/libpq-status.html#LIBPQ-PQPASS -/
 @[extern "lean_pq_pass"]
-opaque PqPass (conn : Handle): EIO LeanPq.Error String
+opaque PqPass (conn : @& Handle): EIO LeanPq.Error String
 
 /-- Returns the server host name of the connection.
 Documentation: https://www.postgresql.org/docs/current/libpq-status.html#LIBPQ-PQHOST -/
 @[extern "lean_pq_host"]
-opaque PqHost (conn : Handle): EIO LeanPq.Error String
+opaque PqHost (conn : @& Handle): EIO LeanPq.Error String
 
 /-- Returns the server IP address of the connection.
 Documentation: https://www.postgresql.org/docs/current/libpq-status.html#LIBPQ-PQHOSTADDR -/
 @[extern "lean_pq_host_addr"]
-opaque PqHostAddr (conn : Handle): EIO LeanPq.Error String
+opaque PqHostAddr (conn : @& Handle): EIO LeanPq.Error String
 
 /-- Returns the port of the connection.
 Documentation: https://www.postgresql.org/docs/current/libpq-status.html#LIBPQ-PQPORT -/
 @[extern "lean_pq_port"]
-opaque PqPort (conn : Handle): EIO LeanPq.Error String
+opaque PqPort (conn : @& Handle): EIO LeanPq.Error String
 
 /-- Returns the debug tty of the connection.
 Documentation: https://www.postgresql.org/docs/current/libpq-status.html#LIBPQ-PQTTY -/
 @[extern "lean_pq_tty"]
-opaque PqTty (conn : Handle): EIO LeanPq.Error String
+opaque PqTty (conn : @& Handle): EIO LeanPq.Error String
 
 /-- Returns the command-line options passed in the connection request.
 Documentation: https://www.postgresql.org/docs/current/libpq-status.html#LIBPQ-PQOPTIONS -/
 @[extern "lean_pq_options"]
-opaque PqOptions (conn : Handle): EIO LeanPq.Error String
+opaque PqOptions (conn : @& Handle): EIO LeanPq.Error String
 
 /--
 PostgreSQL connection status values returned by `PQstatus()`.
@@ -126,7 +129,7 @@ instance : ToString ConnStatus where
 /-- Returns the status of the connection.
 Documentation: https://www.postgresql.org/docs/current/libpq-status.html#LIBPQ-PQSTATUS -/
 @[extern "lean_pq_status"]
-opaque PqStatus (conn : Handle): EIO LeanPq.Error ConnStatus
+opaque PqStatus (conn : @& Handle): EIO LeanPq.Error ConnStatus
 
 /--
 PostgreSQL transaction status values returned by `PQtransactionStatus()`.
@@ -158,32 +161,37 @@ instance : ToString PGTransactionStatus where
 /-- Returns the current in-transaction status of the server.
 Documentation: https://www.postgresql.org/docs/current/libpq-status.html#LIBPQ-PQTRANSACTIONSTATUS -/
 @[extern "lean_pq_transaction_status"]
-opaque PqTransactionStatus (conn : Handle): EIO LeanPq.Error PGTransactionStatus
+opaque PqTransactionStatus (conn : @& Handle): EIO LeanPq.Error PGTransactionStatus
 
 /-- Looks up a current parameter setting of the server.
 Documentation: https://www.postgresql.org/docs/current/libpq-status.html#LIBPQ-PQPARAMETERSTATUS -/
 @[extern "lean_pq_parameter_status"]
-opaque PqParameterStatus (conn : Handle) (param_name : String): EIO LeanPq.Error String
+opaque PqParameterStatus (conn : @& Handle) (param_name : @& String): EIO LeanPq.Error String
 
 /-- Returns the version of the protocol used to communicate with the server.
 Documentation: https://www.postgresql.org/docs/current/libpq-status.html#LIBPQ-PQPROTOCOLVERSION -/
 @[extern "lean_pq_protocol_version"]
-opaque PqProtocolVersion (conn : Handle): EIO LeanPq.Error Int
+opaque PqProtocolVersion (conn : @& Handle): EIO LeanPq.Error Int
 
 /-- Returns the server version number.
 Documentation: https://www.postgresql.org/docs/current/libpq-status.html#LIBPQ-PQSERVERVERSION -/
 @[extern "lean_pq_server_version"]
-opaque PqServerVersion (conn : Handle): EIO LeanPq.Error Int
+opaque PqServerVersion (conn : @& Handle): EIO LeanPq.Error Int
 
 /-- Returns the error message most recently generated by an operation on the connection.
 Documentation: https://www.postgresql.org/docs/current/libpq-status.html#LIBPQ-PQERRORMESSAGE -/
 @[extern "lean_pq_error_message"]
-opaque PqErrorMessage (conn : Handle): EIO LeanPq.Error String
+opaque PqErrorMessage (conn : @& Handle): EIO LeanPq.Error String
 
 /-- Returns the file descriptor number of the connection socket to the server.
 Documentation: https://www.postgresql.org/docs/current/libpq-status.html#LIBPQ-PQSOCKET -/
 @[extern "lean_pq_socket"]
-opaque PqSocket (conn : Handle): EIO LeanPq.Error Int
+opaque PqSocket (conn : @& Handle): EIO LeanPq.Error Int
+
+/-- Returns the process ID of the backend process handling this connection.
+Documentation: https://www.postgresql.org/docs/current/libpq-status.html#LIBPQ-PQBACKENDPID -/
+@[extern "lean_pq_backend_pid"]
+opaque PqBackendPID (conn : @& Handle): EIO LeanPq.Error Int
 
 /--
 PostgreSQL result object returned by `PQexec()`.
@@ -195,27 +203,197 @@ opaque PGresult: Type
 /-- Submits a command to the server and waits for the result.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQEXEC -/
 @[extern "lean_pq_exec"]
-opaque PqExec (conn : Handle) (command : String): EIO LeanPq.Error PGresult
+opaque PqExec (conn : @& Handle) (command : @& String): EIO LeanPq.Error PGresult
 
 /-- Submits a command to the server and waits for the result, with the ability to pass parameters separately.
+Parameter types, lengths and formats are derived from each `Param`; `resultFormat = 1` requests binary results.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQEXECPARAMS -/
 @[extern "lean_pq_exec_params"]
-opaque PqExecParams (conn : Handle) (command : String) (nParams : Int) (paramTypes : Array USize) (paramValues : Array String) (paramLengths : Array Int) (paramFormats : Array Int) (resultFormat : Int): EIO LeanPq.Error PGresult
+opaque PqExecParams (conn : @& Handle) (command : @& String) (params : @& Array Param) (resultFormat : Int := 0): EIO LeanPq.Error PGresult
 
 /-- Submits a request to create a prepared statement with the given parameters.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQPREPARE -/
 @[extern "lean_pq_prepare"]
-opaque PqPrepare (conn : Handle) (stmtName : String) (query : String) (nParams : Int) (paramTypes : Array USize): EIO LeanPq.Error PGresult
+opaque PqPrepare (conn : @& Handle) (stmtName : @& String) (query : @& String) (paramTypes : @& Array UInt32 := #[]): EIO LeanPq.Error PGresult
 
 /-- Sends a request to execute a prepared statement with given parameters.
+Lengths and formats are derived from each `Param`; `resultFormat = 1` requests binary results.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQEXECPREPARED -/
 @[extern "lean_pq_exec_prepared"]
-opaque PqExecPrepared (conn : Handle) (stmtName : String) (nParams : Int) (paramValues : Array String) (paramLengths : Array Int) (paramFormats : Array Int) (resultFormat : Int): EIO LeanPq.Error PGresult
+opaque PqExecPrepared (conn : @& Handle) (stmtName : @& String) (params : @& Array Param) (resultFormat : Int := 0): EIO LeanPq.Error PGresult
+
+/-- Obtains information about a prepared statement: its parameters (`PqNparams`, `PqParamtype`)
+and result columns (`PqNfields`, `PqFtype`).
+Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQDESCRIBEPREPARED -/
+@[extern "lean_pq_describe_prepared"]
+opaque PqDescribePrepared (conn : @& Handle) (stmtName : @& String): EIO LeanPq.Error PGresult
+
+-- [Asynchronous Command Processing](https://www.postgresql.org/docs/current/libpq-async.html)
+
+/-- Submits a command to the server without waiting for the result(s); collect them with `PqGetResult`.
+Documentation: https://www.postgresql.org/docs/current/libpq-async.html#LIBPQ-PQSENDQUERY -/
+@[extern "lean_pq_send_query"]
+opaque PqSendQuery (conn : @& Handle) (command : @& String): EIO LeanPq.Error Unit
+
+/-- Submits a command and separate parameters to the server without waiting for the result(s).
+Documentation: https://www.postgresql.org/docs/current/libpq-async.html#LIBPQ-PQSENDQUERYPARAMS -/
+@[extern "lean_pq_send_query_params"]
+opaque PqSendQueryParams (conn : @& Handle) (command : @& String) (params : @& Array Param) (resultFormat : Int := 0): EIO LeanPq.Error Unit
+
+/-- Sends a request to create a prepared statement without waiting for its completion.
+Documentation: https://www.postgresql.org/docs/current/libpq-async.html#LIBPQ-PQSENDPREPARE -/
+@[extern "lean_pq_send_prepare"]
+opaque PqSendPrepare (conn : @& Handle) (stmtName : @& String) (query : @& String) (paramTypes : @& Array UInt32 := #[]): EIO LeanPq.Error Unit
+
+/-- Sends a request to execute a prepared statement without waiting for the result(s).
+Documentation: https://www.postgresql.org/docs/current/libpq-async.html#LIBPQ-PQSENDQUERYPREPARED -/
+@[extern "lean_pq_send_query_prepared"]
+opaque PqSendQueryPrepared (conn : @& Handle) (stmtName : @& String) (params : @& Array Param) (resultFormat : Int := 0): EIO LeanPq.Error Unit
+
+/-- Calls `PqSendQueryPrepared` once per parameter set, in a single foreign call. Stops at the
+first failure and returns how many executions were queued; `PqErrorMessage` tells why when
+that is fewer than the parameter sets. -/
+@[extern "lean_pq_send_query_prepared_batch"]
+opaque PqSendQueryPreparedBatch (conn : @& Handle) (stmtName : @& String) (paramSets : @& Array (Array Param)) (resultFormat : Int := 0): EIO LeanPq.Error Nat
+
+/-- Waits for the next result from a prior send call; `none` once the command is complete.
+Documentation: https://www.postgresql.org/docs/current/libpq-async.html#LIBPQ-PQGETRESULT -/
+@[extern "lean_pq_get_result"]
+opaque PqGetResult (conn : @& Handle): EIO LeanPq.Error (Option PGresult)
+
+/-- Sets the nonblocking status of the connection.
+Documentation: https://www.postgresql.org/docs/current/libpq-async.html#LIBPQ-PQSETNONBLOCKING -/
+@[extern "lean_pq_set_nonblocking"]
+opaque PqSetnonblocking (conn : @& Handle) (nonblocking : Bool): EIO LeanPq.Error Unit
+
+/-- Returns the blocking status of the database connection.
+Documentation: https://www.postgresql.org/docs/current/libpq-async.html#LIBPQ-PQISNONBLOCKING -/
+@[extern "lean_pq_is_nonblocking"]
+opaque PqIsnonblocking (conn : @& Handle): EIO LeanPq.Error Bool
+
+/-- Reads whatever input is available from the server, without blocking.
+Documentation: https://www.postgresql.org/docs/current/libpq-async.html#LIBPQ-PQCONSUMEINPUT -/
+@[extern "lean_pq_consume_input"]
+opaque PqConsumeInput (conn : @& Handle): EIO LeanPq.Error Unit
+
+/-- Returns true if `PqGetResult` would block waiting for input.
+Documentation: https://www.postgresql.org/docs/current/libpq-async.html#LIBPQ-PQISBUSY -/
+@[extern "lean_pq_is_busy"]
+opaque PqIsBusy (conn : @& Handle): EIO LeanPq.Error Bool
+
+/-- Attempts to flush queued output data; returns true while data remains queued (nonblocking mode).
+Documentation: https://www.postgresql.org/docs/current/libpq-async.html#LIBPQ-PQFLUSH -/
+@[extern "lean_pq_flush"]
+opaque PqFlush (conn : @& Handle): EIO LeanPq.Error Bool
+
+/-- Waits for readiness of many connection sockets at once (epoll on Linux, `poll()` elsewhere). -/
+opaque Poller: Type
+
+/-- Creates a socket readiness poller. -/
+@[extern "lean_pq_poller_new"]
+opaque PqPollerNew : EIO LeanPq.Error Poller
+
+/-- Reports `fd` once from `PqPollerWait` when it becomes readable (writable if `writable` is set).
+The watch must be renewed after each report. -/
+@[extern "lean_pq_poller_watch"]
+opaque PqPollerWatch (poller : @& Poller) (fd : UInt32) (writable : Bool): EIO LeanPq.Error Unit
+
+/-- Stops watching `fd`. -/
+@[extern "lean_pq_poller_unwatch"]
+opaque PqPollerUnwatch (poller : @& Poller) (fd : UInt32): EIO LeanPq.Error Unit
+
+/-- Blocks for up to `timeoutMs` milliseconds (with no timeout when it is `UInt32.max`) and
+returns the watched sockets that became ready. -/
+@[extern "lean_pq_poller_wait"]
+opaque PqPollerWait (poller : @& Poller) (timeoutMs : UInt32): EIO LeanPq.Error (Array UInt32)
+
+/-- Interrupts a pending `PqPollerWait` (or the next one). -/
+@[extern "lean_pq_poller_wake"]
+opaque PqPollerWake (poller : @& Poller): EIO LeanPq.Error Unit
+
+-- [Canceling Queries in Progress](https://www.postgresql.org/docs/current/libpq-cancel.html)
+
+/-- Asks the server to cancel the query running on `conn`; safe to call from another task while
+that query runs. Uses the non-blocking `PQcancelStart`/`PQcancelPoll` on libpq 17 and
+`PQcancel` before. The query may still complete if the request arrives too late.
+Documentation: https://www.postgresql.org/docs/current/libpq-cancel.html -/
+@[extern "lean_pq_cancel"]
+opaque PqCancel (conn : @& Handle): EIO LeanPq.Error Unit
+
+/-- `PqExec` that cancels the command once it has run for `timeoutMs`, as `PqExecParamsTimeout`
+does. Like `PqExec`, `command` may hold several statements; the last result is returned, and a
+`COPY` ends the command with its `copyIn` or `copyOut` result. -/
+@[extern "lean_pq_exec_timeout"]
+opaque PqExecTimeout (conn : @& Handle) (command : @& String) (timeoutMs : UInt32): EIO LeanPq.Error PGresult
+
+/-- `PqExecParams` that cancels the query once it has run for `timeoutMs` and then fails with
+`Error.queryTimeout`; a query canceled by `PqCancel` fails with `Error.queryCanceled`. The
+connection is usable afterwards, unless the canceled query did not end within 5 s of the cancel:
+the call then gives up with `Error.queryTimeout`, and the connection must be reset (`PqReset`). -/
+@[extern "lean_pq_exec_params_timeout"]
+opaque PqExecParamsTimeout (conn : @& Handle) (command : @& String) (params : @& Array Param) (timeoutMs : UInt32) (resultFormat : Int := 0): EIO LeanPq.Error PGresult
+
+/-- `PqExecPrepared` that cancels the statement once it has run for `timeoutMs`, as
+`PqExecParamsTimeout` does. -/
+@[extern "lean_pq_exec_prepared_timeout"]
+opaque PqExecPreparedTimeout (conn : @& Handle) (stmtName : @& String) (params : @& Array Param) (timeoutMs : UInt32) (resultFormat : Int := 0): EIO LeanPq.Error PGresult
+
+-- [Retrieving Query Results in Chunks](https://www.postgresql.org/docs/current/libpq-single-row-mode.html)
+
+/-- Selects single-row mode for the currently-executing query; `false` if it is too late to do so.
+Documentation: https://www.postgresql.org/docs/current/libpq-single-row-mode.html#LIBPQ-PQSETSINGLEROWMODE -/
+@[extern "lean_pq_set_single_row_mode"]
+opaque PqSetSingleRowMode (conn : @& Handle): EIO LeanPq.Error Bool
+
+/-- Selects chunked mode (up to `chunkSize` rows per result) for the currently-executing query.
+Returns `false` if it is too late to do so or if libpq is older than 17.
+Documentation: https://www.postgresql.org/docs/current/libpq-single-row-mode.html#LIBPQ-PQSETCHUNKEDROWSMODE -/
+@[extern "lean_pq_set_chunked_rows_mode"]
+opaque PqSetChunkedRowsMode (conn : @& Handle) (chunkSize : UInt32): EIO LeanPq.Error Bool
+
+-- [Pipeline Mode](https://www.postgresql.org/docs/current/libpq-pipeline-mode.html)
+
+/-- Pipeline mode status of a connection, as returned by `PQpipelineStatus()`. -/
+inductive PipelineStatus where
+  /-- The connection is not in pipeline mode. -/
+  | off
+  /-- The connection is in pipeline mode. -/
+  | on
+  /-- The connection is in pipeline mode and an error occurred; commands up to the next
+  synchronization point are skipped. -/
+  | aborted
+  deriving BEq, DecidableEq, Repr, Inhabited
+
+/-- Returns the current pipeline mode status of the connection.
+Documentation: https://www.postgresql.org/docs/current/libpq-pipeline-mode.html#LIBPQ-PQPIPELINESTATUS -/
+@[extern "lean_pq_pipeline_status"]
+opaque PqPipelineStatus (conn : @& Handle): EIO LeanPq.Error PipelineStatus
+
+/-- Causes a connection to enter pipeline mode if it is currently idle or already in pipeline mode.
+Documentation: https://www.postgresql.org/docs/current/libpq-pipeline-mode.html#LIBPQ-PQENTERPIPELINEMODE -/
+@[extern "lean_pq_enter_pipeline_mode"]
+opaque PqEnterPipelineMode (conn : @& Handle): EIO LeanPq.Error Unit
+
+/-- Causes a connection to exit pipeline mode; fails while results are still pending.
+Documentation: https://www.postgresql.org/docs/current/libpq-pipeline-mode.html#LIBPQ-PQEXITPIPELINEMODE -/
+@[extern "lean_pq_exit_pipeline_mode"]
+opaque PqExitPipelineMode (conn : @& Handle): EIO LeanPq.Error Unit
+
+/-- Marks a synchronization point in a pipeline and flushes the send buffer.
+Documentation: https://www.postgresql.org/docs/current/libpq-pipeline-mode.html#LIBPQ-PQPIPELINESYNC -/
+@[extern "lean_pq_pipeline_sync"]
+opaque PqPipelineSync (conn : @& Handle): EIO LeanPq.Error Unit
+
+/-- Asks the server to flush its output buffer, without a synchronization point.
+Documentation: https://www.postgresql.org/docs/current/libpq-pipeline-mode.html#LIBPQ-PQSENDFLUSHREQUEST -/
+@[extern "lean_pq_send_flush_request"]
+opaque PqSendFlushRequest (conn : @& Handle): EIO LeanPq.Error Unit
 
 /--
 PostgreSQL execution status values returned by `PQresultStatus()`.
 
 These values indicate the result status of a database command.
+The constructors follow the order of libpq's `ExecStatusType`.
 -/
 inductive ExecStatus where
   /-- The string sent to the server was empty. -/
@@ -224,22 +402,26 @@ inductive ExecStatus where
   | commandOk
   /-- Successful completion of a command returning data. -/
   | tuplesOk
-  /-- Copy In (to server) data transfer started. -/
-  | copyIn
   /-- Copy Out (from server) data transfer started. -/
   | copyOut
-  /-- The server sent us a Copy In/Out data transfer. -/
-  | copyBoth
-  /-- A response to a Describe command. -/
+  /-- Copy In (to server) data transfer started. -/
+  | copyIn
+  /-- The server's response was not understood. -/
   | badResponse
-  /-- A nonfatal error occurred. -/
+  /-- A nonfatal error (a notice or warning) occurred. -/
   | nonfatalError
   /-- A fatal error occurred. -/
   | fatalError
-  /-- A response to a Ping command. -/
-  | pingResponse
-  /-- A response to a Pipelined Query command. -/
+  /-- Copy In/Out (to and from server) data transfer started, used for streaming replication. -/
+  | copyBoth
+  /-- A single tuple from a larger result set, in single-row mode. -/
+  | singleTuple
+  /-- A synchronization point in pipeline mode. -/
+  | pipelineSync
+  /-- The command did not run because an earlier command of the pipeline failed. -/
   | pipelineAborted
+  /-- A chunk of tuples from a larger result set, in chunked-rows mode (libpq 17+). -/
+  | tuplesChunk
   deriving BEq, DecidableEq, Repr, Inhabited
 
 instance : ToString ExecStatus where
@@ -247,163 +429,607 @@ instance : ToString ExecStatus where
   | .emptyQuery => s!"Empty Query"
   | .commandOk => s!"Command OK"
   | .tuplesOk => s!"Tuples OK"
-  | .copyIn => s!"Copy In"
   | .copyOut => s!"Copy Out"
-  | .copyBoth => s!"Copy Both"
+  | .copyIn => s!"Copy In"
   | .badResponse => s!"Bad Response"
   | .nonfatalError => s!"Nonfatal Error"
   | .fatalError => s!"Fatal Error"
-  | .pingResponse => s!"Ping Response"
+  | .copyBoth => s!"Copy Both"
+  | .singleTuple => s!"Single Tuple"
+  | .pipelineSync => s!"Pipeline Sync"
   | .pipelineAborted => s!"Pipeline Aborted"
+  | .tuplesChunk => s!"Tuples Chunk"
 
 -- Result Status Functions
 /-- Returns the result status of the command.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQRESULTSTATUS -/
 @[extern "lean_pq_result_status"]
-opaque PqResultStatus (result : PGresult): EIO LeanPq.Error ExecStatus
+opaque PqResultStatus (result : @& PGresult): EIO LeanPq.Error ExecStatus
 
 /-- Converts the enumerated type returned by PQresultStatus into a string constant.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQRESSTATUS -/
 @[extern "lean_pq_res_status"]
-opaque PqResStatus (result : PGresult): EIO LeanPq.Error ExecStatus
+opaque PqResStatus (result : @& PGresult): EIO LeanPq.Error ExecStatus
 
 /-- Returns the error message associated with the command.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQRESULTERRORMESSAGE -/
 @[extern "lean_pq_result_error_message"]
-opaque PqResultErrorMessage (result : PGresult): EIO LeanPq.Error String
+opaque PqResultErrorMessage (result : @& PGresult): EIO LeanPq.Error String
 
 /-- Returns an individual field of an error report.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQRESULTERRORFIELD -/
 @[extern "lean_pq_result_error_field"]
-opaque PqResultErrorField (result : PGresult) (fieldcode : Int): EIO LeanPq.Error String
+opaque PqResultErrorField (result : @& PGresult) (fieldcode : Int): EIO LeanPq.Error String
+
+/-- Field codes of `PqResultErrorField`; an absent field reads as the empty string.
+Source: `PG_DIAG_*` in `postgres_ext.h`. -/
+namespace DiagField
+
+def severity : Int := 83 -- 'S'
+def sqlstate : Int := 67 -- 'C'
+def messagePrimary : Int := 77 -- 'M'
+def messageDetail : Int := 68 -- 'D'
+def messageHint : Int := 72 -- 'H'
+
+end DiagField
 
 -- Retrieving Query Result Information
 /-- Returns the number of rows (tuples) in the query result.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQNTUPLES -/
 @[extern "lean_pq_ntuples"]
-opaque PqNtuples (result : PGresult): EIO LeanPq.Error Int
+opaque PqNtuples (result : @& PGresult): EIO LeanPq.Error Int
 
 /-- Returns the number of columns (fields) in each row of the query result.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQNFIELDS -/
 @[extern "lean_pq_nfields"]
-opaque PqNfields (result : PGresult): EIO LeanPq.Error Int
+opaque PqNfields (result : @& PGresult): EIO LeanPq.Error Int
 
 /-- Returns the column name associated with the given column number.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQFNAME -/
 @[extern "lean_pq_fname"]
-opaque PqFname (result : PGresult) (fieldNum : Int): EIO LeanPq.Error String
+opaque PqFname (result : @& PGresult) (fieldNum : Int): EIO LeanPq.Error String
 
 /-- Returns the column number associated with the given column name.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQFNUMBER -/
 @[extern "lean_pq_fnumber"]
-opaque PqFnumber (result : PGresult) (fieldName : String): EIO LeanPq.Error Int
+opaque PqFnumber (result : @& PGresult) (fieldName : @& String): EIO LeanPq.Error Int
 
 /-- Returns the OID of the table from which the given column was fetched.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQFTABLE -/
 @[extern "lean_pq_ftable"]
-opaque PqFtable (result : PGresult) (fieldNum : Int): EIO LeanPq.Error USize
+opaque PqFtable (result : @& PGresult) (fieldNum : Int): EIO LeanPq.Error USize
 
 /-- Returns the column number (within its table) of the column making up the specified query result column.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQFTABLECOL -/
 @[extern "lean_pq_ftablecol"]
-opaque PqFtablecol (result : PGresult) (fieldNum : Int): EIO LeanPq.Error Int
+opaque PqFtablecol (result : @& PGresult) (fieldNum : Int): EIO LeanPq.Error Int
 
 /-- Returns the format code indicating the format of the given column.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQFFORMAT -/
 @[extern "lean_pq_fformat"]
-opaque PqFformat (result : PGresult) (fieldNum : Int): EIO LeanPq.Error Int
+opaque PqFformat (result : @& PGresult) (fieldNum : Int): EIO LeanPq.Error Int
 
 /-- Returns the data type associated with the given column number.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQFTYPE -/
 @[extern "lean_pq_ftype"]
-opaque PqFtype (result : PGresult) (fieldNum : Int): EIO LeanPq.Error USize
+opaque PqFtype (result : @& PGresult) (fieldNum : Int): EIO LeanPq.Error USize
 
 /-- Returns the size in bytes of the type associated with the given column number.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQFSIZE -/
 @[extern "lean_pq_fsize"]
-opaque PqFsize (result : PGresult) (fieldNum : Int): EIO LeanPq.Error Int
+opaque PqFsize (result : @& PGresult) (fieldNum : Int): EIO LeanPq.Error Int
 
 /-- Returns the type modifier of the type associated with the given column number.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQFMOD -/
 @[extern "lean_pq_fmod"]
-opaque PqFmod (result : PGresult) (fieldNum : Int): EIO LeanPq.Error Int
+opaque PqFmod (result : @& PGresult) (fieldNum : Int): EIO LeanPq.Error Int
 
 /-- Returns 1 if the PGresult contains binary tuple data, 0 if it contains text data.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQBINARYTUPLES -/
 @[extern "lean_pq_binary_tuples"]
-opaque PqBinaryTuples (result : PGresult): EIO LeanPq.Error Int
+opaque PqBinaryTuples (result : @& PGresult): EIO LeanPq.Error Int
 
 -- Retrieving Other Result Information
 /-- Returns the command status tag from the last SQL command executed.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQCMDSTATUS -/
 @[extern "lean_pq_cmd_status"]
-opaque PqCmdStatus (result : PGresult): EIO LeanPq.Error String
+opaque PqCmdStatus (result : @& PGresult): EIO LeanPq.Error String
 
 /-- Returns the number of rows affected by the SQL command.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQCMDTUPLES -/
 @[extern "lean_pq_cmd_tuples"]
-opaque PqCmdTuples (result : PGresult): EIO LeanPq.Error String
+opaque PqCmdTuples (result : @& PGresult): EIO LeanPq.Error String
 
 /-- Returns the OID of the inserted row, if the SQL command was an INSERT that inserted exactly one row into a table that has OIDs.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQOIDVALUE -/
 @[extern "lean_pq_oid_value"]
-opaque PqOidValue (result : PGresult): EIO LeanPq.Error USize
+opaque PqOidValue (result : @& PGresult): EIO LeanPq.Error USize
 
 /-- Returns a string with the OID of the inserted row, if the SQL command was an INSERT that inserted exactly one row into a table that has OIDs.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQOIDSTATUS -/
 @[extern "lean_pq_oid_status"]
-opaque PqOidStatus (result : PGresult): EIO LeanPq.Error String
+opaque PqOidStatus (result : @& PGresult): EIO LeanPq.Error String
+
+/-- Returns the number of bytes allocated for the result.
+Documentation: https://www.postgresql.org/docs/current/libpq-misc.html#LIBPQ-PQRESULTMEMORYSIZE -/
+@[extern "lean_pq_result_memory_size"]
+opaque PqResultMemorySize (result : @& PGresult): EIO LeanPq.Error UInt64
 
 -- Retrieving Row Values
-/-- Returns a single field value of one row of a PGresult.
+/-- Returns a single field value of one row of a PGresult, copied with its explicit length.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQGETVALUE -/
 @[extern "lean_pq_getvalue"]
-opaque PqGetvalue (result : PGresult) (rowNum : Int) (fieldNum : Int): EIO LeanPq.Error String
+opaque PqGetvalue (result : @& PGresult) (rowNum : Int) (fieldNum : Int): EIO LeanPq.Error String
 
 /-- Tests a field for a null value.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQGETISNULL -/
 @[extern "lean_pq_getisnull"]
-opaque PqGetisnull (result : PGresult) (rowNum : Int) (fieldNum : Int): EIO LeanPq.Error Int
+opaque PqGetisnull (result : @& PGresult) (rowNum : Int) (fieldNum : Int): EIO LeanPq.Error Int
 
 /-- Returns the actual length of a field value in bytes.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQGETLENGTH -/
 @[extern "lean_pq_getlength"]
-opaque PqGetlength (result : PGresult) (rowNum : Int) (fieldNum : Int): EIO LeanPq.Error Int
+opaque PqGetlength (result : @& PGresult) (rowNum : Int) (fieldNum : Int): EIO LeanPq.Error Int
+
+-- Field Views
+/--
+A field of a `PGresult`, read in place instead of being copied.
+
+The view holds its result, so the bytes stay valid for as long as the view is alive.
+Results never change once received, which lets the view functions be pure. Views are only
+made by `PqFieldView`, which checks the coordinates against the result.
+-/
+structure FieldView where
+  private mk ::
+  result : PGresult
+  row : UInt32
+  col : UInt32
+  /-- Length of the field in bytes, from `PqGetlength`. -/
+  length : UInt32
+  isNull : Bool
+
+/-- Returns a view of one field, without copying its value. -/
+@[extern "lean_pq_field_view"]
+opaque PqFieldView (result : @& PGresult) (rowNum : Int) (fieldNum : Int): EIO LeanPq.Error FieldView
+
+/-- Compares the bytes of two fields (shorter prefix first). -/
+@[extern "lean_pq_field_view_compare"]
+opaque PqFieldViewCompare (a : @& FieldView) (b : @& FieldView): Ordering
+
+/-- Tests whether a field holds exactly the UTF-8 bytes of `str`. -/
+@[extern "lean_pq_field_view_eq_string"]
+opaque PqFieldViewEqString (view : @& FieldView) (str : @& String): Bool
+
+/-- Tests whether a field holds exactly `bytes`. -/
+@[extern "lean_pq_field_view_eq_bytes"]
+opaque PqFieldViewEqBytes (view : @& FieldView) (bytes : @& ByteArray): Bool
+
+/-- 64-bit FNV-1a hash of the field bytes. -/
+@[extern "lean_pq_field_view_hash"]
+opaque PqFieldViewHash (view : @& FieldView): UInt64
+
+/-- Copies a field into a `String`; invalid UTF-8 sequences are replaced. -/
+@[extern "lean_pq_field_view_to_string"]
+opaque PqFieldViewToString (view : @& FieldView): String
+
+/-- Copies a field into a `ByteArray`. -/
+@[extern "lean_pq_field_view_to_byte_array"]
+opaque PqFieldViewToByteArray (view : @& FieldView): ByteArray
+
+/-- Parses a text-format integer field; `none` for NULL or anything else than an integer. -/
+@[extern "lean_pq_field_view_to_int64"]
+opaque PqFieldViewToInt64? (view : @& FieldView): Option Int64
+
+/-- Parses a text-format floating-point field; `none` for NULL or anything else than a number. -/
+@[extern "lean_pq_field_view_to_float"]
+opaque PqFieldViewToFloat? (view : @& FieldView): Option Float
+
+-- Bulk Retrieval of Row Values
+/-- Returns every field of the result in a single native pass, row-major (`rows[row][field]`).
+SQL NULLs are `none`. Much cheaper than calling `PqGetvalue` once per cell. -/
+@[extern "lean_pq_fetch_all"]
+opaque PqFetchAll (result : @& PGresult): EIO LeanPq.Error (Array (Array (Option String)))
+
+/-- Returns every field of the result in a single native pass, column-major (`columns[field][row]`).
+SQL NULLs are `none`. -/
+@[extern "lean_pq_fetch_columns"]
+opaque PqFetchColumns (result : @& PGresult): EIO LeanPq.Error (Array (Array (Option String)))
+
+-- Typed Decoding of Row Values
+/-- Decodes a single field according to its type OID (`PqFtype`) and format (`PqFformat`).
+Binary fields (`resultFormat = 1`) are decoded straight from network byte order, see `Value`. -/
+@[extern "lean_pq_get_typed_value"]
+opaque PqGetTypedValue (result : @& PGresult) (rowNum : Int) (fieldNum : Int): EIO LeanPq.Error Value
+
+/-- Decodes a whole column in a single native pass.
+Fixed-width types are packed into `ByteArray`/`FloatArray` buffers, see `ColumnData`. -/
+@[extern "lean_pq_decode_column"]
+opaque PqDecodeColumn (result : @& PGresult) (fieldNum : Int): EIO LeanPq.Error Column
+
+/-- Decodes a binary array field (`resultFormat = 1`) of any element type and dimensions,
+`none` when the field is NULL. Fixed-width elements are packed, see `PackedArray`. -/
+@[extern "lean_pq_get_array"]
+opaque PqGetArray (result : @& PGresult) (rowNum : Int) (fieldNum : Int): EIO LeanPq.Error (Option PackedArray)
+
+/-- Decodes a binary composite field (`resultFormat = 1`) as `Value.record`, or `Value.null`.
+Unlike `PqGetTypedValue`, this also works for named composite types, whose OIDs are not built in. -/
+@[extern "lean_pq_get_record"]
+opaque PqGetRecord (result : @& PGresult) (rowNum : Int) (fieldNum : Int): EIO LeanPq.Error Value
 
 /-- Returns the number of parameters of a prepared statement.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQNPARAMS -/
 @[extern "lean_pq_nparams"]
-opaque PqNparams (result : PGresult): EIO LeanPq.Error Int
+opaque PqNparams (result : @& PGresult): EIO LeanPq.Error Int
 
 /-- Returns the data type of the indicated statement parameter.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQPARAMTYPE -/
 @[extern "lean_pq_paramtype"]
-opaque PqParamtype (result : PGresult) (paramNum : Int): EIO LeanPq.Error USize
+opaque PqParamtype (result : @& PGresult) (paramNum : Int): EIO LeanPq.Error USize
 
 -- Escaping Strings for Inclusion in SQL Commands
 /-- Escapes a string for use as an SQL string literal on the given connection.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQESCAPELITERAL -/
 @[extern "lean_pq_escape_literal"]
-opaque PqEscapeLiteral (conn : Handle) (str : String): EIO LeanPq.Error String
+opaque PqEscapeLiteral (conn : @& Handle) (str : @& String): EIO LeanPq.Error String
 
 /-- Escapes a string for use as an SQL identifier on the given connection.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQESCAPEIDENTIFIER -/
 @[extern "lean_pq_escape_identifier"]
-opaque PqEscapeIdentifier (conn : Handle) (str : String): EIO LeanPq.Error String
+opaque PqEscapeIdentifier (conn : @& Handle) (str : @& String): EIO LeanPq.Error String
 
 /-- Escapes string literals, much like PQescapeLiteral, but the caller is responsible for providing an appropriately sized buffer.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQESCAPESTRINGCONN -/
 @[extern "lean_pq_escape_string_conn"]
-opaque PqEscapeStringConn (conn : Handle) (input : String): EIO LeanPq.Error String
+opaque PqEscapeStringConn (conn : @& Handle) (input : @& String): EIO LeanPq.Error String
 
 /-- Escapes binary data for use within an SQL command with the type bytea.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQESCAPEBYTEACONN -/
 @[extern "lean_pq_escape_bytea_conn"]
-opaque PqEscapeByteaConn (conn : Handle) (input : String): EIO LeanPq.Error String
+opaque PqEscapeByteaConn (conn : @& Handle) (input : @& ByteArray): EIO LeanPq.Error String
 
 /-- Converts a string representation of binary data into binary data — the reverse of PQescapeBytea.
 Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQUNESCAPEBYTEA -/
 @[extern "lean_pq_unescape_bytea"]
-opaque PqUnescapeBytea (str : String): EIO LeanPq.Error String
+opaque PqUnescapeBytea (str : @& String): EIO LeanPq.Error ByteArray
+
+/-- A reusable buffer that SQL text and escaped values are appended to.
+Values are escaped straight into the buffer, without an intermediate string per value;
+`PqSqlBuilderClear` keeps the buffer for the next statement. Not safe to share between tasks. -/
+opaque SqlBuilder: Type
+
+/-- Creates an empty builder for statements sent on `conn`, whose encoding settings it follows. -/
+@[extern "lean_pq_sql_builder_new"]
+opaque PqSqlBuilderNew (conn : @& Handle): EIO LeanPq.Error SqlBuilder
+
+/-- Appends raw SQL. -/
+@[extern "lean_pq_sql_builder_append"]
+opaque PqSqlBuilderAppend (builder : @& SqlBuilder) (sql : @& String): EIO LeanPq.Error Unit
+
+/-- Appends a quoted string literal, or `NULL` for `none`. -/
+@[extern "lean_pq_sql_builder_append_literal"]
+opaque PqSqlBuilderAppendLiteral (builder : @& SqlBuilder) (value : @& Option String): EIO LeanPq.Error Unit
+
+/-- Appends a quoted identifier. -/
+@[extern "lean_pq_sql_builder_append_identifier"]
+opaque PqSqlBuilderAppendIdentifier (builder : @& SqlBuilder) (name : @& String): EIO LeanPq.Error Unit
+
+/-- Appends quoted identifiers separated by commas. -/
+@[extern "lean_pq_sql_builder_append_identifiers"]
+opaque PqSqlBuilderAppendIdentifiers (builder : @& SqlBuilder) (names : @& Array String): EIO LeanPq.Error Unit
+
+/-- Appends a `bytea` literal in hex format. -/
+@[extern "lean_pq_sql_builder_append_bytea"]
+opaque PqSqlBuilderAppendBytea (builder : @& SqlBuilder) (bytes : @& ByteArray): EIO LeanPq.Error Unit
+
+/-- Appends `(v, ...), (v, ...)`, one tuple per row, every value as a literal (`none` is `NULL`). -/
+@[extern "lean_pq_sql_builder_append_rows"]
+opaque PqSqlBuilderAppendRows (builder : @& SqlBuilder) (rows : @& Array (Array (Option String))): EIO LeanPq.Error Unit
+
+/-- Returns the SQL built so far. -/
+@[extern "lean_pq_sql_builder_to_string"]
+opaque PqSqlBuilderToString (builder : @& SqlBuilder): EIO LeanPq.Error String
+
+/-- Size in bytes of the SQL built so far. -/
+@[extern "lean_pq_sql_builder_size"]
+opaque PqSqlBuilderSize (builder : @& SqlBuilder): EIO LeanPq.Error Nat
+
+/-- Empties the builder, keeping its buffer. -/
+@[extern "lean_pq_sql_builder_clear"]
+opaque PqSqlBuilderClear (builder : @& SqlBuilder): EIO LeanPq.Error Unit
+
+-- [Asynchronous Notification](https://www.postgresql.org/docs/current/libpq-notify.html)
+
+/-- A notification sent by `NOTIFY` or `pg_notify` on a channel the connection listens to. -/
+structure Notification where
+  channel : String
+  payload : String
+  /-- Process ID of the notifying backend. -/
+  bePid : UInt32
+  deriving Repr, Inhabited
+
+/-- Returns the next notification already received, without reading from the server.
+Documentation: https://www.postgresql.org/docs/current/libpq-notify.html -/
+@[extern "lean_pq_notifies"]
+opaque PqNotifies (conn : @& Handle): EIO LeanPq.Error (Option Notification)
+
+/-- Waits up to `timeoutMs` for data from the server, then returns every notification received
+(empty when the timeout expired). Blocks the calling thread without spinning. -/
+@[extern "lean_pq_wait_notifications"]
+opaque PqWaitNotifications (conn : @& Handle) (timeoutMs : UInt32): EIO LeanPq.Error (Array Notification)
+
+-- [Functions Associated with the COPY Command](https://www.postgresql.org/docs/current/libpq-copy.html)
+
+/-- Encodes rows in COPY text format (`\N` for `none`), overwriting `buffer` and reusing its storage.
+Documentation: https://www.postgresql.org/docs/current/sql-copy.html -/
+@[extern "lean_pq_copy_encode_text"]
+opaque PqCopyEncodeText (buffer : ByteArray) (rows : @& Array (Array (Option String))): EIO LeanPq.Error ByteArray
+
+/-- Encodes rows in COPY binary format, overwriting `buffer` and reusing its storage.
+`kinds` holds one `CopyKind` code per column; the file header is written first when `header` is set.
+Documentation: https://www.postgresql.org/docs/current/sql-copy.html -/
+@[extern "lean_pq_copy_encode_binary"]
+opaque PqCopyEncodeBinary (buffer : ByteArray) (kinds : @& ByteArray) (rows : @& Array (Array Value)) (header : Bool): EIO LeanPq.Error ByteArray
+
+/-- Sends data to the server during COPY_IN state.
+Documentation: https://www.postgresql.org/docs/current/libpq-copy.html#LIBPQ-PQPUTCOPYDATA -/
+@[extern "lean_pq_put_copy_data"]
+opaque PqPutCopyData (conn : @& Handle) (data : @& ByteArray): EIO LeanPq.Error Unit
+
+/-- Sends end-of-data indication to the server during COPY_IN state; a message makes the COPY fail.
+Documentation: https://www.postgresql.org/docs/current/libpq-copy.html#LIBPQ-PQPUTCOPYEND -/
+@[extern "lean_pq_put_copy_end"]
+opaque PqPutCopyEnd (conn : @& Handle) (errormsg : @& Option String := none): EIO LeanPq.Error Unit
+
+
+/-- Receives a chunk of data from the server during COPY_OUT state, `none` once the COPY is done.
+Documentation: https://www.postgresql.org/docs/current/libpq-copy.html#LIBPQ-PQGETCOPYDATA -/
+@[extern "lean_pq_get_copy_data"]
+opaque PqGetCopyData (conn : @& Handle): EIO LeanPq.Error (Option ByteArray)
+
+/-- Writes all remaining COPY_OUT data to the file descriptor `fd` without materializing it,
+returning the number of bytes written. -/
+@[extern "lean_pq_copy_out_to_fd"]
+opaque PqCopyOutToFd (conn : @& Handle) (fd : UInt32): EIO LeanPq.Error UInt64
+
+/-- An incremental parser of binary COPY data. -/
+opaque CopyParser: Type
+
+/-- Creates a binary COPY parser for columns of the given type OIDs.
+Documentation: https://www.postgresql.org/docs/current/sql-copy.html -/
+@[extern "lean_pq_copy_parser_new"]
+opaque PqCopyParserNew (oids : @& Array UInt32): EIO LeanPq.Error CopyParser
+
+/-- Decodes a chunk of binary COPY data into the parser's columns; chunks may split tuples anywhere.
+Returns true once the file trailer has been read. -/
+@[extern "lean_pq_copy_parser_feed"]
+opaque PqCopyParserFeed (parser : @& CopyParser) (chunk : @& ByteArray): EIO LeanPq.Error Bool
+
+/-- Number of tuples decoded since the last `PqCopyParserTake`. -/
+@[extern "lean_pq_copy_parser_rows"]
+opaque PqCopyParserRows (parser : @& CopyParser): EIO LeanPq.Error Nat
+
+/-- Returns the decoded columns and restarts the parser with empty ones. -/
+@[extern "lean_pq_copy_parser_take"]
+opaque PqCopyParserTake (parser : @& CopyParser): EIO LeanPq.Error (Array Column)
+
+-- [Arrow Columnar Format](https://arrow.apache.org/docs/format/Columnar.html)
+
+/-- Arrow type of an exported column, picked from the type OID and format of the field
+(see `ArrowType.ofDataType`). -/
+inductive ArrowType where
+  | bool
+  | int16
+  | int32
+  | int64
+  /-- `oid` columns. -/
+  | uint32
+  | float32
+  | float64
+  /-- Text types, `numeric`, `jsonb`, and every field of a text-format result that is not
+  a number or a boolean. -/
+  | utf8
+  /-- `bytea`, `uuid` and other binary fields, as sent by the server. -/
+  | binary
+  /-- Days since 1970-01-01. -/
+  | date32
+  /-- Microseconds since 1970-01-01, without a time zone. -/
+  | timestamp
+  /-- Microseconds since 1970-01-01 UTC. -/
+  | timestampTz
+  deriving BEq, Repr, Inhabited
+
+/--
+One column in the Arrow columnar layout, with little-endian buffers:
+* `validity`: one bit per row, least significant bit first, set for non-null values;
+* `offsets`: for `utf8` and `binary`, `length + 1` int32 offsets into `values`, empty
+  otherwise;
+* `values`: packed fixed-width values (a bitmap for `bool`; NULL rows hold zeros), or the
+  concatenated bytes of variable-width values.
+-/
+structure ArrowColumn where
+  name : String
+  type : ArrowType
+  length : UInt64
+  nullCount : UInt64
+  validity : ByteArray
+  offsets : ByteArray
+  values : ByteArray
+  deriving Inhabited
+
+/-- Converts every column of a result (text or binary) into Arrow buffers in a single native
+pass. Fails on malformed binary values, and on variable-width columns over 2 GB. -/
+@[extern "lean_pq_arrow_columns"]
+opaque PqArrowColumns (result : @& PGresult): EIO LeanPq.Error (Array ArrowColumn)
+
+-- [Large Objects](https://www.postgresql.org/docs/current/lo-interfaces.html)
+
+/-- Reference point of `PqLoLseek64`. -/
+inductive SeekOrigin where
+  | fromStart
+  | fromCurrent
+  | fromEnd
+  deriving BEq, Repr, Inhabited
+
+/-- Creates a new, empty large object and returns its OID.
+Documentation: https://www.postgresql.org/docs/current/lo-interfaces.html#LO-CREATE -/
+@[extern "lean_pq_lo_creat"]
+opaque PqLoCreat (conn : @& Handle): EIO LeanPq.Error UInt32
+
+/-- Removes a large object from the database.
+Documentation: https://www.postgresql.org/docs/current/lo-interfaces.html#LO-UNLINK -/
+@[extern "lean_pq_lo_unlink"]
+opaque PqLoUnlink (conn : @& Handle) (oid : UInt32): EIO LeanPq.Error Unit
+
+/-- Opens a large object and returns a descriptor, valid until the end of the transaction.
+`mode` combines `LoMode.read` and `LoMode.write`.
+Documentation: https://www.postgresql.org/docs/current/lo-interfaces.html#LO-OPEN -/
+@[extern "lean_pq_lo_open"]
+opaque PqLoOpen (conn : @& Handle) (oid : UInt32) (mode : UInt32): EIO LeanPq.Error UInt32
+
+/-- Closes a large object descriptor.
+Documentation: https://www.postgresql.org/docs/current/lo-interfaces.html#LO-CLOSE -/
+@[extern "lean_pq_lo_close"]
+opaque PqLoClose (conn : @& Handle) (fd : UInt32): EIO LeanPq.Error Unit
+
+/-- Reads up to `length` bytes, overwriting `buffer` and reusing its storage; an empty result
+means the end of the object.
+Documentation: https://www.postgresql.org/docs/current/lo-interfaces.html#LO-READ -/
+@[extern "lean_pq_lo_read"]
+opaque PqLoRead (conn : @& Handle) (fd : UInt32) (buffer : ByteArray) (length : UInt32): EIO LeanPq.Error ByteArray
+
+/-- Writes all of `data` at the current position.
+Documentation: https://www.postgresql.org/docs/current/lo-interfaces.html#LO-WRITE -/
+@[extern "lean_pq_lo_write"]
+opaque PqLoWrite (conn : @& Handle) (fd : UInt32) (data : @& ByteArray): EIO LeanPq.Error Unit
+
+/-- Moves the position of a descriptor and returns the new position.
+Documentation: https://www.postgresql.org/docs/current/lo-interfaces.html#LO-SEEK -/
+@[extern "lean_pq_lo_lseek64"]
+opaque PqLoLseek64 (conn : @& Handle) (fd : UInt32) (offset : Int64) (origin : SeekOrigin := .fromStart): EIO LeanPq.Error UInt64
+
+/-- Returns the current position of a descriptor.
+Documentation: https://www.postgresql.org/docs/current/lo-interfaces.html#LO-TELL -/
+@[extern "lean_pq_lo_tell64"]
+opaque PqLoTell64 (conn : @& Handle) (fd : UInt32): EIO LeanPq.Error UInt64
+
+/-- Truncates (or extends with zeros) a large object to `length` bytes.
+Documentation: https://www.postgresql.org/docs/current/lo-interfaces.html#LO-TRUNCATE -/
+@[extern "lean_pq_lo_truncate64"]
+opaque PqLoTruncate64 (conn : @& Handle) (fd : UInt32) (length : UInt64): EIO LeanPq.Error Unit
+
+/-- Copies a large object from the current position to its end into the file descriptor `out`,
+through one fixed buffer; returns the number of bytes copied. -/
+@[extern "lean_pq_lo_read_to_fd"]
+opaque PqLoReadToFd (conn : @& Handle) (fd : UInt32) (out : UInt32): EIO LeanPq.Error UInt64
+
+/-- Writes everything read from the file descriptor `input` until end of file to a large
+object, through one fixed buffer; returns the number of bytes copied. -/
+@[extern "lean_pq_lo_write_from_fd"]
+opaque PqLoWriteFromFd (conn : @& Handle) (fd : UInt32) (input : UInt32): EIO LeanPq.Error UInt64
+
+-- [Streaming Replication Protocol](https://www.postgresql.org/docs/current/protocol-replication.html)
+
+/-- A column value of a replicated row. -/
+inductive TupleField where
+  | null
+  /-- An unchanged TOASTed value, not sent by the server. -/
+  | unchanged
+  | text (value : String)
+  | binary (value : ByteArray)
+  deriving Inhabited
+
+/-- A column of a replicated table, as described by a Relation message. -/
+structure RelationColumn where
+  name : String
+  typeOid : UInt32
+  typmod : Int32
+  /-- Whether the column is part of the replica identity (usually the primary key). -/
+  key : Bool
+  deriving Inhabited
+
+/-- A change decoded from the `pgoutput` plugin (protocol version 1). Timestamps are
+microseconds since the Unix epoch, positions are LSNs.
+Documentation: https://www.postgresql.org/docs/current/protocol-logicalrep-message-formats.html -/
+inductive ReplicationEvent where
+  | begin (finalLsn : UInt64) (commitTime : Int64) (xid : UInt32)
+  | commit (commitLsn : UInt64) (endLsn : UInt64) (commitTime : Int64)
+  /-- Sent before the first change of a table in the stream, and again after it is altered. -/
+  | relation (relid : UInt32) (schema : String) (name : String) (replicaIdentity : UInt8)
+      (columns : Array RelationColumn)
+  | insert (relid : UInt32) (newTuple : Array TupleField)
+  /-- `oldTuple` holds the key columns, or the whole row with `REPLICA IDENTITY FULL`, when
+  the server sends them. -/
+  | update (relid : UInt32) (oldTuple : Option (Array TupleField)) (newTuple : Array TupleField)
+  | delete (relid : UInt32) (oldTuple : Array TupleField)
+  /-- `options`: bit 0 is `CASCADE`, bit 1 is `RESTART IDENTITY`. -/
+  | truncate (relids : Array UInt32) (options : UInt8)
+  /-- The server's liveness check; answer with `PqSendStandbyStatus` when `replyRequested`. -/
+  | keepalive (walEnd : UInt64) (replyRequested : Bool)
+  /-- Origin, Type and Message messages, undecoded; `kind` is the message byte. -/
+  | other (kind : UInt8) (data : ByteArray)
+  deriving Inhabited
+
+/-- One message of a replication stream. -/
+structure ReplicationMessage where
+  event : ReplicationEvent
+  /-- Position of the decoded data, 0 for keepalives. -/
+  walStart : UInt64
+  /-- Current end of WAL on the server. -/
+  walEnd : UInt64
+  sendTime : Int64
+  deriving Inhabited
+
+/-- Waits up to `timeoutMs` for the next message of a `START_REPLICATION` stream (`copyBoth`)
+and decodes it natively; `none` when the timeout expired. Fails once the stream has ended.
+Documentation: https://www.postgresql.org/docs/current/protocol-replication.html#PROTOCOL-REPLICATION-XLOGDATA -/
+@[extern "lean_pq_replication_receive"]
+opaque PqReplicationReceive (conn : @& Handle) (timeoutMs : UInt32): EIO LeanPq.Error (Option ReplicationMessage)
+
+/-- Decodes one CopyData message of a replication stream (XLogData carrying `pgoutput`, or a
+keepalive), as `PqReplicationReceive` does. Fails on a truncated or unknown message. -/
+@[extern "lean_pq_decode_replication_message"]
+opaque PqDecodeReplicationMessage (data : @& ByteArray): EIO LeanPq.Error ReplicationMessage
+
+/-- Sends a Standby status update; the slot's confirmed position advances to `flushLsn`.
+Documentation: https://www.postgresql.org/docs/current/protocol-replication.html#PROTOCOL-REPLICATION-STANDBY-STATUS-UPDATE -/
+@[extern "lean_pq_send_standby_status"]
+opaque PqSendStandbyStatus (conn : @& Handle) (writeLsn flushLsn applyLsn : UInt64) (replyRequested : Bool := false): EIO LeanPq.Error Unit
+
+-- Instrumentation
+
+/-- Statistics of every connection of the process. -/
+@[extern "lean_pq_global_stats"]
+opaque PqGlobalStats : EIO LeanPq.Error QueryStats
+
+/-- Statistics of one connection. -/
+@[extern "lean_pq_connection_stats"]
+opaque PqConnectionStats (conn : @& Handle): EIO LeanPq.Error QueryStats
+
+/-- Statistics of each statement run on the connection (at most 64 statements are tracked). -/
+@[extern "lean_pq_statement_stats"]
+opaque PqStatementStats (conn : @& Handle): EIO LeanPq.Error (Array StatementStats)
+
+/-- Zeroes the statistics of the connection and of its statements. -/
+@[extern "lean_pq_reset_stats"]
+opaque PqResetStats (conn : @& Handle): EIO LeanPq.Error Unit
+
+/-- Calls `callback` with the statement and its latency (µs) after every execution taking at least
+`thresholdMicros`. The callback runs on the thread that executed the query. -/
+@[extern "lean_pq_set_slow_query_callback"]
+opaque PqSetSlowQueryCallback (conn : @& Handle) (thresholdMicros : UInt64) (callback : String → UInt64 → BaseIO Unit): EIO LeanPq.Error Unit
+
+/-- Removes the slow-query callback. -/
+@[extern "lean_pq_clear_slow_query_callback"]
+opaque PqClearSlowQueryCallback (conn : @& Handle): EIO LeanPq.Error Unit
+
+/-- Enables tracing of the client/server communication, appended to the file at `path`.
+Documentation: https://www.postgresql.org/docs/current/libpq-control.html#LIBPQ-PQTRACE -/
+@[extern "lean_pq_trace"]
+opaque PqTrace (conn : @& Handle) (path : @& String) (suppressTimestamps : Bool := false): EIO LeanPq.Error Unit
+
+/-- Disables tracing started by `PqTrace`.
+Documentation: https://www.postgresql.org/docs/current/libpq-control.html#LIBPQ-PQUNTRACE -/
+@[extern "lean_pq_untrace"]
+opaque PqUntrace (conn : @& Handle): EIO LeanPq.Error Unit
 
 end Extern
@@ -0,0 +1,55 @@
+/-
+Instances for `FieldView`, so fields can be filtered, sorted and grouped without being copied.
+-/
+import LeanPq.Extern
+
+namespace LeanPq
+
+open Extern
+
+namespace Extern.FieldView
+
+/-- Order of two fields from their NULL flags, SQL NULL last as in an ascending `ORDER BY`;
+`bytes` compares two non-NULL fields. -/
+def orderNullsLast (aNull bNull : Bool) (bytes : Unit → Ordering) : Ordering :=
+  match aNull, bNull with
+  | true, true => .eq
+  | true, false => .gt
+  | false, true => .lt
+  | false, false => bytes ()
+
+/-- Byte-wise order, SQL NULL after every value. -/
+instance : Ord FieldView := ⟨fun a b => orderNullsLast a.isNull b.isNull fun _ => PqFieldViewCompare a b⟩
+
+/-- Byte-wise equality. SQL NULL equals NULL (as in `IS NOT DISTINCT FROM`), not `''`. -/
+instance : BEq FieldView := ⟨fun a b =>
+  a.isNull == b.isNull && (a.isNull || (a.length == b.length && PqFieldViewCompare a b == .eq))⟩
+
+instance : Hashable FieldView := ⟨PqFieldViewHash⟩
+
+/-- Copies the field into a `String`, `none` for SQL NULL. -/
+def toString? (v : FieldView) : Option String :=
+  if v.isNull then none else some (PqFieldViewToString v)
+
+/-- Copies the field into a `ByteArray`, `none` for SQL NULL. -/
+def toByteArray? (v : FieldView) : Option ByteArray :=
+  if v.isNull then none else some (PqFieldViewToByteArray v)
+
+/-- Tests whether the field holds exactly `s`; SQL NULL equals nothing. -/
+def eqString (v : FieldView) (s : String) : Bool :=
+  !v.isNull && PqFieldViewEqString v s
+
+/-- Parses a text-format integer. -/
+def toInt64? (v : FieldView) : Option Int64 := PqFieldViewToInt64? v
+
+/-- Parses a text-format floating-point number. -/
+def toFloat? (v : FieldView) : Option Float := PqFieldViewToFloat? v
+
+end Extern.FieldView
+
+/-- Views of every field of column `fieldNum`, one per row. -/
+def columnViews (result : PGresult) (fieldNum : Int) : EIO LeanPq.Error (Array FieldView) := do
+  let rows ← PqNtuples result
+  (List.range rows.toNat).toArray.mapM fun row => PqFieldView result row fieldNum
+
+end LeanPq
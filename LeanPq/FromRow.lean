@@ -0,0 +1,222 @@
+/-
+Typed rows: results decoded into Lean structures.
+
+  structure User where
+    id : Int64
+    name : String
+    email : Option String
+    deriving FromRow
+
+  let users : Array User ← decodeRows (← PqExec conn "SELECT id, name, email FROM users")
+
+Columns are looked up by field name and type checked once per result, then decoded
+column by column with `PqDecodeColumn`; the per-row work is only reading the decoded
+columns at a fixed position.
+-/
+import Lean.Elab.Deriving.Basic
+import LeanPq.Extern
+
+namespace LeanPq
+
+open Extern
+
+/-- A Lean type that can be read from a single result column. -/
+class FromField (α : Type) where
+  /-- Name of the expected SQL type(s), for error messages. -/
+  typeName : String
+  /-- Whether a column of the given type OID (`PqFtype`) can be read as `α`. -/
+  accepts : UInt32 → Bool
+  /-- Reads the field at `row` of a column whose type was accepted. -/
+  decode : Column → Nat → Except String α
+
+namespace FromField
+
+private def isInteger (oid : UInt32) : Bool :=
+  oid == Oid.int2 || oid == Oid.int4 || oid == Oid.int8 || oid == Oid.oid
+
+private def isText (oid : UInt32) : Bool :=
+  oid == Oid.text || oid == Oid.varchar || oid == Oid.bpchar || oid == Oid.name ||
+  oid == Oid.char || oid == Oid.json || oid == Oid.jsonb || oid == Oid.xml || oid == Oid.numeric
+
+/-- Reads a non-NULL field as a `Value`. -/
+private def value (c : Column) (row : Nat) : Except String Value :=
+  if c.isNull row then .error "unexpected NULL" else .ok (c.get row)
+
+instance : FromField Value where
+  typeName := "any type"
+  accepts _ := true
+  decode c row := .ok (c.get row)
+
+instance : FromField Bool where
+  typeName := "bool"
+  accepts oid := oid == Oid.bool
+  decode c row := do
+    match ← value c row with
+    | .bool v => return v
+    | _ => throw "expected a bool"
+
+instance : FromField Int64 where
+  typeName := "int2, int4, int8 or oid"
+  accepts := isInteger
+  decode c row := do
+    if c.isNull row then throw "unexpected NULL"
+    match c.data with
+    | .int64 _ => return c.getInt64! row
+    | _ =>
+      match c.get row with
+      | .int v => return v
+      | _ => throw "expected an integer"
+
+instance : FromField Int where
+  typeName := "int2, int4, int8 or oid"
+  accepts := isInteger
+  decode c row := return (← FromField.decode (α := Int64) c row).toInt
+
+instance : FromField Float where
+  typeName := "float4 or float8"
+  accepts oid := oid == Oid.float4 || oid == Oid.float8
+  decode c row := do
+    match ← value c row with
+    | .float v => return v
+    | _ => throw "expected a float"
+
+instance : FromField String where
+  typeName := "text, varchar, bpchar, name, json, jsonb, xml or numeric"
+  accepts := isText
+  decode c row := do
+    match ← value c row with
+    | .text v | .numeric v => return v
+    | _ => throw "expected text"
+
+instance : FromField ByteArray where
+  typeName := "bytea or uuid"
+  accepts oid := oid == Oid.bytea || oid == Oid.uuid
+  decode c row := do
+    match ← value c row with
+    | .bytea v | .uuid v => return v
+    | .text v => return v.toUTF8
+    | _ => throw "expected bytes"
+
+/-- Nullable columns: SQL NULL is `none`. -/
+instance [FromField α] : FromField (Option α) where
+  typeName := FromField.typeName (α := α)
+  accepts := FromField.accepts (α := α)
+  decode c row := if c.isNull row then .ok none else some <$> FromField.decode c row
+
+end FromField
+
+/-- The type check of one column, as read from a structure field. -/
+structure FieldCheck where
+  typeName : String
+  accepts : UInt32 → Bool
+
+/-- The check of the type read by the projection `_proj`. -/
+def FieldCheck.of [FromField β] (_proj : α → β) : FieldCheck :=
+  { typeName := FromField.typeName (α := β), accepts := FromField.accepts (α := β) }
+
+/--
+A Lean type that can be read from a result row.
+
+`columns[i]` is read by `fields[i]`; `decodeRow` receives the decoded columns in the same
+order. Instances for structures are derived with `deriving FromRow`, reading each field
+from the column of the same name.
+-/
+class FromRow (α : Type) where
+  columns : Array String
+  fields : Array FieldCheck
+  decodeRow : Array Column → Nat → Except String α
+
+namespace FromRow
+
+/-- Reads the `i`-th column, named `name`, of a row; used by derived instances. -/
+def field [FromField β] (columns : Array Column) (i : Nat) (name : String) (row : Nat) : Except String β :=
+  match columns[i]? with
+  | some c => (FromField.decode c row).mapError fun msg => s!"column {name}: {msg}"
+  | none => .error s!"column {name} was not decoded"
+
+end FromRow
+
+/--
+The columns of one result, resolved and decoded for `α`.
+
+Building the plan costs one `PqFnumber`, `PqFtype` and `PqDecodeColumn` per column;
+decoding a row then only indexes into the decoded columns.
+-/
+structure RowPlan (α : Type) where
+  columns : Array Column
+  rows : Nat
+
+namespace RowPlan
+
+/-- Resolves the columns of `α` in `result` by name, checks their types and decodes them. -/
+def build [FromRow α] (result : PGresult) : EIO LeanPq.Error (RowPlan α) := do
+  let names := FromRow.columns (α := α)
+  let checks := FromRow.fields (α := α)
+  let mut columns : Array Column := Array.mkEmpty names.size
+  for name in names, check in checks do
+    let index ← PqFnumber result name
+    if index < 0 then
+      throw (.otherError s!"Result has no column {name}")
+    let oid := (← PqFtype result index).toUInt32
+    unless check.accepts oid do
+      throw (.otherError s!"Column {name} has type OID {oid}, expected {check.typeName}")
+    columns := columns.push (← PqDecodeColumn result index)
+  return { columns, rows := (← PqNtuples result).toNat }
+
+/-- Decodes the row at `row`. -/
+def get [FromRow α] (plan : RowPlan α) (row : Nat) : EIO LeanPq.Error α :=
+  match FromRow.decodeRow plan.columns row with
+  | .ok v => return v
+  | .error msg => throw (.otherError s!"Row {row}, {msg}")
+
+/-- Decodes every row. -/
+def toArray [FromRow α] (plan : RowPlan α) : EIO LeanPq.Error (Array α) := do
+  let mut out := Array.mkEmpty plan.rows
+  for row in [0:plan.rows] do
+    out := out.push (← plan.get row)
+  return out
+
+end RowPlan
+
+/-- Decodes every row of `result` as an `α`. -/
+def decodeRows (α : Type) [FromRow α] (result : PGresult) : EIO LeanPq.Error (Array α) := do
+  let plan : RowPlan α ← RowPlan.build result
+  plan.toArray
+
+namespace FromRow
+
+open Lean Elab Command
+
+/-- Derives `FromRow` for a structure whose fields all have a `FromField` instance. -/
+def mkInstance (declName : Name) : CommandElabM Bool := do
+  let env ← getEnv
+  unless isStructure env declName do return false
+  let fields := getStructureFieldsFlattened env declName (includeSubobjectFields := false)
+  let names : Array Term := fields.map fun f => quote f.toString
+  let s := mkIdent `s
+  let checks ← fields.mapM fun f =>
+    `(LeanPq.FieldCheck.of fun ($s : $(mkIdent declName)) => $(mkIdent (`s ++ f)))
+  let columns := mkIdent `columns
+  let row := mkIdent `row
+  let getters ← (List.range fields.size).toArray.mapM fun i =>
+    `(LeanPq.FromRow.field $columns $(quote i) $(quote fields[i]!.toString) $row)
+  let fieldIds := fields.map mkIdent
+  let cmd ← `(instance : LeanPq.FromRow $(mkIdent declName) where
+      columns := #[$names,*]
+      fields := #[$checks,*]
+      decodeRow := fun $columns $row => do
+        return { $[$fieldIds:ident := (← $getters)],* })
+  elabCommand cmd
+  return true
+
+def mkInstanceHandler (declNames : Array Name) : CommandElabM Bool := do
+  if _ : declNames.size = 1 then
+    mkInstance declNames[0]
+  else
+    return false
+
+initialize registerDerivingHandler ``FromRow mkInstanceHandler
+
+end FromRow
+
+end LeanPq
@@ -0,0 +1,119 @@
+/-
+Large objects: binary values of up to 4 TB stored in `pg_largeobject`, read and written in
+chunks instead of as one `bytea` value.
+https://www.postgresql.org/docs/current/largeobjects.html
+-/
+import LeanPq.Extern
+
+namespace LeanPq
+
+open Extern
+
+/-- Modes of `PqLoOpen`, combined with `|||`. -/
+namespace LoMode
+
+def write : UInt32 := 0x00020000
+def read : UInt32 := 0x00040000
+
+end LoMode
+
+/-- Default chunk size of `LargeObject.forChunks`, a multiple of the server's 2 kB pages. -/
+def defaultLoChunkSize : UInt32 := 256 * 1024
+
+/--
+An open large object descriptor.
+
+Descriptors are only valid inside the transaction that opened them: run the work in
+`withLoTransaction`, or in a transaction of your own.
+-/
+structure LargeObject where
+  conn : Handle
+  oid : UInt32
+  fd : UInt32
+
+namespace LargeObject
+
+/-- Opens the large object `oid`, for reading and writing by default. -/
+def openObject (conn : Handle) (oid : UInt32) (mode : UInt32 := LoMode.read ||| LoMode.write) :
+    EIO LeanPq.Error LargeObject := do
+  return { conn, oid, fd := ← PqLoOpen conn oid mode }
+
+/-- Creates an empty large object and opens it for reading and writing. -/
+def create (conn : Handle) : EIO LeanPq.Error LargeObject := do
+  LargeObject.openObject conn (← PqLoCreat conn)
+
+/-- Reads up to `length` bytes into `buffer`, reusing its storage; empty at the end. -/
+def read (lo : LargeObject) (buffer : ByteArray) (length : UInt32 := defaultLoChunkSize) :
+    EIO LeanPq.Error ByteArray :=
+  PqLoRead lo.conn lo.fd buffer length
+
+def write (lo : LargeObject) (data : ByteArray) : EIO LeanPq.Error Unit :=
+  PqLoWrite lo.conn lo.fd data
+
+def seek (lo : LargeObject) (offset : Int64) (origin : SeekOrigin := .fromStart) : EIO LeanPq.Error UInt64 :=
+  PqLoLseek64 lo.conn lo.fd offset origin
+
+def tell (lo : LargeObject) : EIO LeanPq.Error UInt64 :=
+  PqLoTell64 lo.conn lo.fd
+
+def truncate (lo : LargeObject) (length : UInt64) : EIO LeanPq.Error Unit :=
+  PqLoTruncate64 lo.conn lo.fd length
+
+def close (lo : LargeObject) : EIO LeanPq.Error Unit :=
+  PqLoClose lo.conn lo.fd
+
+/-- Folds over the rest of the object in chunks of `chunkSize` bytes. The chunk passed to `f`
+is read into again afterwards, so memory stays at one chunk unless `f` keeps it. -/
+partial def forChunks {β : Type} (lo : LargeObject) (init : β) (f : ByteArray → β → EIO LeanPq.Error β)
+    (chunkSize : UInt32 := defaultLoChunkSize) : EIO LeanPq.Error β :=
+  let rec loop (buffer : ByteArray) (acc : β) : EIO LeanPq.Error β := do
+    let chunk ← lo.read buffer chunkSize
+    if chunk.isEmpty then return acc
+    let acc ← f chunk acc
+    loop chunk acc
+  loop ByteArray.empty init
+
+/-- Copies the rest of the object to the file descriptor `out` at constant memory. -/
+def readToFd (lo : LargeObject) (out : UInt32) : EIO LeanPq.Error UInt64 :=
+  PqLoReadToFd lo.conn lo.fd out
+
+/-- Appends everything read from the file descriptor `input` at constant memory. -/
+def writeFromFd (lo : LargeObject) (input : UInt32) : EIO LeanPq.Error UInt64 :=
+  PqLoWriteFromFd lo.conn lo.fd input
+
+end LargeObject
+
+/-- Runs `f` in a transaction of its own when `conn` has none open, committing on success. -/
+def withLoTransaction (conn : Handle) (f : EIO LeanPq.Error α) : EIO LeanPq.Error α := do
+  if (← PqTransactionStatus conn) != .idle then return (← f)
+  let res ← PqExec conn "BEGIN"
+  unless (← PqResultStatus res) == .commandOk do
+    throw (.otherError (← PqResultErrorMessage res))
+  try
+    let result ← f
+    let commit ← PqExec conn "COMMIT"
+    unless (← PqResultStatus commit) == .commandOk do
+      throw (.otherError (← PqResultErrorMessage commit))
+    return result
+  catch e =>
+    let _ ← PqExec conn "ROLLBACK"
+    throw e
+
+/-- Writes the large object `oid` to the file descriptor `out`; returns its size. -/
+def exportLargeObject (conn : Handle) (oid : UInt32) (out : UInt32) : EIO LeanPq.Error UInt64 :=
+  withLoTransaction conn do
+    let lo ← LargeObject.openObject conn oid LoMode.read
+    let n ← lo.readToFd out
+    lo.close
+    return n
+
+/-- Stores everything read from the file descriptor `input` as a new large object and returns
+its OID. -/
+def importLargeObject (conn : Handle) (input : UInt32) : EIO LeanPq.Error UInt32 :=
+  withLoTransaction conn do
+    let lo ← LargeObject.create conn
+    discard <| lo.writeFromFd input
+    lo.close
+    return lo.oid
+
+end LeanPq
@@ -0,0 +1,61 @@
+/-
+Query statistics collected by the native layer: counters per process, per connection and
+per statement, with a latency histogram.
+-/
+namespace LeanPq
+
+/--
+Counters of executed queries.
+
+`latency` is a histogram with power-of-two buckets: bucket `i` counts the queries that took
+less than `2^i` µs (and at least `2^(i-1)` µs); the last bucket also counts every slower one.
+Latency is measured around synchronous execution (`PqExec`, `PqExecParams`, `PqPrepare`,
+`PqExecPrepared`); rows and bytes received are counted for every result, including those
+read with `PqGetResult`.
+-/
+structure QueryStats where
+  queries : UInt64 := 0
+  /-- Failed executions and error results. -/
+  errors : UInt64 := 0
+  rows : UInt64 := 0
+  /-- Query text and parameter values sent. -/
+  bytesSent : UInt64 := 0
+  /-- Memory held by the results received (`PQresultMemorySize`). -/
+  bytesReceived : UInt64 := 0
+  resultsAllocated : UInt64 := 0
+  /-- Results released by their finalizer; only tracked process-wide. -/
+  resultsFreed : UInt64 := 0
+  totalMicros : UInt64 := 0
+  latency : Array UInt64 := #[]
+  deriving Repr, Inhabited
+
+namespace QueryStats
+
+/-- Mean latency in microseconds. -/
+def meanMicros (s : QueryStats) : Float :=
+  if s.queries == 0 then 0 else s.totalMicros.toFloat / s.queries.toFloat
+
+/-- Upper bound (µs) of the histogram bucket holding the `p`-th percentile, `0 ≤ p ≤ 1`. -/
+def percentileMicros (s : QueryStats) (p : Float) : UInt64 := Id.run do
+  let target := (p * s.queries.toFloat).ceil.toUInt64
+  let mut seen : UInt64 := 0
+  for i in [0:s.latency.size] do
+    seen := seen + s.latency[i]!
+    if seen >= target && seen > 0 then
+      return (1 : UInt64) <<< i.toUInt64
+  return 0
+
+/-- Results allocated and not freed yet. -/
+def resultsLive (s : QueryStats) : UInt64 :=
+  s.resultsAllocated - s.resultsFreed
+
+end QueryStats
+
+/-- Statistics of one statement: `key` is the prepared statement name, or the SQL text of an
+unnamed one. Statements are told apart by their full text; `key` keeps its first 64 bytes. -/
+structure StatementStats where
+  key : String
+  stats : QueryStats
+  deriving Repr, Inhabited
+
+end LeanPq
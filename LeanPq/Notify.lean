@@ -0,0 +1,75 @@
+/-
+LISTEN/NOTIFY: a connection dedicated to receiving notifications, drained in batches.
+https://www.postgresql.org/docs/current/sql-notify.html
+-/
+import LeanPq.Extern
+
+namespace LeanPq
+
+open Extern
+
+/--
+A connection listening to notification channels.
+
+The connection should not run other queries while `run` is active: notifications are read
+by `PqWaitNotifications`, which sleeps on the socket and drains every notification of a
+wakeup at once.
+-/
+structure Listener where
+  conn : Handle
+  running : IO.Ref Bool
+
+namespace Listener
+
+private def command (conn : Handle) (sql : String) : EIO LeanPq.Error Unit := do
+  let res ← PqExec conn sql
+  let status ← PqResultStatus res
+  unless status == .commandOk do
+    let msg ← PqResultErrorMessage res
+    throw (.otherError s!"{status}: {msg}")
+
+/-- Wraps `conn`; channels are added with `listen`. -/
+def new (conn : Handle) : BaseIO Listener := do
+  let running ← IO.mkRef false
+  return { conn, running }
+
+/-- Starts listening to `channel`. -/
+def listen (l : Listener) (channel : String) : EIO LeanPq.Error Unit := do
+  command l.conn s!"LISTEN {← PqEscapeIdentifier l.conn channel}"
+
+/-- Stops listening to `channel`. -/
+def unlisten (l : Listener) (channel : String) : EIO LeanPq.Error Unit := do
+  command l.conn s!"UNLISTEN {← PqEscapeIdentifier l.conn channel}"
+
+/-- Waits up to `timeoutMs` and returns the notifications received, empty on timeout. -/
+def poll (l : Listener) (timeoutMs : UInt32 := 1000) : EIO LeanPq.Error (Array Notification) :=
+  PqWaitNotifications l.conn timeoutMs
+
+/-- Calls `handler` with each batch of notifications until `stop`. `stop` is noticed within
+`checkMs`. Run it in a dedicated task: `EIO.asTask (l.run handler) .dedicated`. -/
+partial def run (l : Listener) (handler : Array Notification → EIO LeanPq.Error Unit)
+    (checkMs : UInt32 := 500) : EIO LeanPq.Error Unit := do
+  l.running.set true
+  let rec loop : EIO LeanPq.Error Unit := do
+    unless (← l.running.get) do return
+    let batch ← PqWaitNotifications l.conn checkMs
+    unless batch.isEmpty do
+      handler batch
+    loop
+  loop
+
+/-- Makes `run` return after its current wait. -/
+def stop (l : Listener) : BaseIO Unit :=
+  l.running.set false
+
+end Listener
+
+/-- Sends a notification on `channel` (`pg_notify`), delivered when the transaction commits. -/
+def notify (conn : Handle) (channel : String) (payload : String := "") : EIO LeanPq.Error Unit := do
+  let res ← PqExecParams conn "SELECT pg_notify($1, $2)" #[.text channel, .text payload]
+  let status ← PqResultStatus res
+  unless status == .tuplesOk do
+    let msg ← PqResultErrorMessage res
+    throw (.otherError s!"{status}: {msg}")
+
+end LeanPq
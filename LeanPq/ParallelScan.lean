@@ -0,0 +1,151 @@
+/-
+Parallel table scans: one query split into ranges read by several connections at once, all
+in the same exported snapshot so that together they see exactly one consistent table.
+https://www.postgresql.org/docs/current/functions-admin.html#FUNCTIONS-SNAPSHOT-SYNCHRONIZATION
+-/
+import LeanPq.Extern
+import LeanPq.Stream
+
+namespace LeanPq
+
+open Extern
+
+/-- How a scan is split into ranges. -/
+inductive ScanPartitioning where
+  /-- Ranges of heap blocks (`ctid`), read with TID range scans (PostgreSQL 14+). Works on
+  any table and splits it evenly by size. -/
+  | blocks
+  /-- Ranges of an integer column, split evenly between its minimum and maximum; best with an
+  index on the column and evenly distributed keys. -/
+  | keyRange (column : String)
+  deriving Repr, Inhabited
+
+/-- A scan of one table. -/
+structure ScanSpec where
+  /-- Inserted as is, so it must already be a valid (quoted if needed) table name. -/
+  table : String
+  /-- Select list. -/
+  columns : String := "*"
+  /-- Additional `WHERE` condition. -/
+  filter : Option String := none
+  partitioning : ScanPartitioning := .blocks
+  /-- Maximum number of rows per batch (chunked-rows mode). -/
+  chunkSize : Nat := 10000
+  /-- `1` requests binary results. -/
+  resultFormat : Int := 1
+  deriving Repr, Inhabited
+
+namespace ParallelScan
+
+/-- `n` predicates covering the `blocks` heap blocks of a table. The last range is open, so
+rows in blocks added since the size was read are not missed. -/
+def blockPredicates (blocks n : Nat) : Array String :=
+  let n := max n 1
+  (List.range n).toArray.map fun i =>
+    let lo := blocks * i / n
+    let hi := blocks * (i + 1) / n
+    let lower := if i == 0 then none else some s!"ctid >= '({lo},0)'::tid"
+    let upper := if i + 1 == n then none else some s!"ctid < '({hi},0)'::tid"
+    match [lower, upper].filterMap id with
+    | [] => "TRUE"
+    | conds => " AND ".intercalate conds
+
+/-- `n` predicates covering the values `lo` to `hi` of `column` (an escaped identifier). The
+first range also takes the NULL keys and the outer ranges are open. -/
+def keyPredicates (column : String) (lo hi : Int) (n : Nat) : Array String :=
+  let n := max n 1
+  let span := hi - lo + 1
+  let bound (i : Nat) : Int := lo + span * i / n
+  (List.range n).toArray.map fun i =>
+    if n == 1 then "TRUE"
+    else if i == 0 then s!"({column} < {bound 1} OR {column} IS NULL)"
+    else if i + 1 == n then s!"{column} >= {bound i}"
+    else s!"{column} >= {bound i} AND {column} < {bound (i + 1)}"
+
+private def command (conn : Handle) (sql : String) : EIO LeanPq.Error PGresult := do
+  let res ← PqExec conn sql
+  let status ← PqResultStatus res
+  unless status == .commandOk || status == .tuplesOk do
+    let msg ← PqResultErrorMessage res
+    throw (.otherError s!"{status}: {msg}")
+  return res
+
+/-- The partition predicates of `spec`, computed on `conn` inside the exported snapshot. -/
+private def predicates (conn : Handle) (spec : ScanSpec) (n : Nat) : EIO LeanPq.Error (Array String) := do
+  match spec.partitioning with
+  | .blocks =>
+    let res ← command conn
+      s!"SELECT pg_relation_size({← PqEscapeLiteral conn spec.table}::regclass) / \
+        current_setting('block_size')::int8"
+    return blockPredicates (← PqGetvalue res 0 0).toNat! n
+  | .keyRange column =>
+    let column ← PqEscapeIdentifier conn column
+    let res ← command conn s!"SELECT min({column})::int8, max({column})::int8 FROM {spec.table}"
+    match (← PqGetvalue res 0 0).toInt?, (← PqGetvalue res 0 1).toInt? with
+    | some lo, some hi => return keyPredicates column lo hi n
+    -- An empty table (or only NULL keys): a single partition reads it.
+    | _, _ => return #["TRUE"] ++ (List.replicate (n - 1) "FALSE").toArray
+
+/-- Reads one partition in batches, calling `f` with each. -/
+private def scanPartition (conn : Handle) (sql : String) (spec : ScanSpec)
+    (f : PGresult → EIO LeanPq.Error Unit) : EIO LeanPq.Error Unit := do
+  let stream ← RowStream.start conn sql #[] { chunkSize := spec.chunkSize, resultFormat := spec.resultFormat }
+  for batch in stream do
+    f batch
+
+end ParallelScan
+
+open ParallelScan in
+/--
+Scans `spec.table` with one partition per connection, each read by a dedicated task.
+
+The first connection exports its snapshot (`pg_export_snapshot`) and the others import it
+(`SET TRANSACTION SNAPSHOT`), so every partition sees the same committed state. `f` receives
+the partition index and each batch as it arrives; it is called concurrently from the worker
+tasks. When a partition fails, the others are canceled and the first error is raised. The
+connections must be idle, and are idle again on return.
+-/
+def parallelScan (conns : Array Handle) (spec : ScanSpec) (f : Nat → PGresult → EIO LeanPq.Error Unit) :
+    EIO LeanPq.Error Unit := do
+  let some coordinator := conns[0]? | throw (.otherError "parallelScan needs at least one connection")
+  let scan : EIO LeanPq.Error (Option LeanPq.Error) := do
+    discard <| command coordinator "BEGIN ISOLATION LEVEL REPEATABLE READ READ ONLY"
+    let snapshot ← PqGetvalue (← command coordinator "SELECT pg_export_snapshot()") 0 0
+    for conn in conns[1:] do
+      discard <| command conn "BEGIN ISOLATION LEVEL REPEATABLE READ READ ONLY"
+      discard <| command conn s!"SET TRANSACTION SNAPSHOT {← PqEscapeLiteral conn snapshot}"
+    let preds ← predicates coordinator spec conns.size
+    let filter := match spec.filter with
+      | some cond => s!"({cond}) AND "
+      | none => ""
+    let mut tasks : Array (Task (Except LeanPq.Error Unit)) := #[]
+    for i in [0:conns.size] do
+      let sql := s!"SELECT {spec.columns} FROM {spec.table} WHERE {filter}{preds[i]!}"
+      tasks := tasks.push (← EIO.asTask (scanPartition conns[i]! sql spec (f i)) .dedicated)
+    let mut error : Option LeanPq.Error := none
+    for i in [0:tasks.size] do
+      match ← IO.wait tasks[i]! with
+      | .ok () => pure ()
+      | .error e =>
+        if error.isNone then
+          error := some e
+          for conn in conns[i+1:] do
+            try PqCancel conn catch _ => pure ()
+    return error
+  let error ← tryCatch scan (fun e => pure (some e))
+  -- Ends the snapshot transactions, including those of failed partitions.
+  for conn in conns do
+    let _ ← PqExec conn "COMMIT"
+  if let some e := error then throw e
+
+/-- Scans `spec.table` like `parallelScan` and returns every batch, in partition order. -/
+def parallelScanCollect (conns : Array Handle) (spec : ScanSpec) : EIO LeanPq.Error (Array PGresult) := do
+  let mut parts : Array (IO.Ref (Array PGresult)) := #[]
+  for _ in conns do
+    parts := parts.push (← IO.mkRef #[])
+  parallelScan conns spec fun i batch => do
+    if let some part := parts[i]? then
+      part.modify (·.push batch)
+  parts.foldlM (init := #[]) fun acc part => return acc ++ (← part.get)
+
+end LeanPq
@@ -0,0 +1,62 @@
+/-
+Statement parameters for `PqExecParams` / `PqExecPrepared`.
+Binary layouts: https://www.postgresql.org/docs/current/protocol-overview.html#PROTOCOL-FORMAT-CODES
+-/
+import LeanPq.Value
+
+namespace LeanPq
+
+/--
+A statement parameter (`$1`, `$2`, ...).
+
+Lengths and format codes are derived from the constructor when the parameters are
+marshaled, so callers never build the parallel arrays libpq expects.
+An `oid` of `0` lets the server infer the parameter type.
+-/
+inductive Param where
+  /-- SQL NULL. -/
+  | null (oid : UInt32 := 0)
+  /-- A value in text format, as it would be written in SQL (without quotes). -/
+  | text (value : String) (oid : UInt32 := 0)
+  /-- A value in binary format (network byte order), as produced by the type's `*send` function. -/
+  | binary (value : ByteArray) (oid : UInt32 := 0)
+  deriving Inhabited
+
+namespace Param
+
+/-- Big-endian encoding of the low `n` bytes of `v`. -/
+private def beBytes (v : UInt64) (n : Nat) : ByteArray := Id.run do
+  let mut out := ByteArray.empty
+  for i in [0:n] do
+    out := out.push (v >>> (8 * (n - 1 - i)).toUInt64).toUInt8
+  return out
+
+/-- A binary `bool` parameter. -/
+def ofBool (v : Bool) : Param := .binary (ByteArray.mk #[if v then 1 else 0]) Oid.bool
+
+/-- A binary `int2` parameter. -/
+def ofInt16 (v : Int16) : Param := .binary (beBytes v.toUInt16.toUInt64 2) Oid.int2
+
+/-- A binary `int4` parameter. -/
+def ofInt32 (v : Int32) : Param := .binary (beBytes v.toUInt32.toUInt64 4) Oid.int4
+
+/-- A binary `int8` parameter. -/
+def ofInt64 (v : Int64) : Param := .binary (beBytes v.toUInt64 8) Oid.int8
+
+/-- A binary `float8` parameter. -/
+def ofFloat (v : Float) : Param := .binary (beBytes v.toBits 8) Oid.float8
+
+/-- A binary `bytea` parameter. -/
+def ofBytes (v : ByteArray) : Param := .binary v Oid.bytea
+
+/-- A text parameter whose type is inferred by the server. -/
+def ofString (v : String) : Param := .text v
+
+/-- `none` becomes SQL NULL. -/
+def ofOption (f : α → Param) : Option α → Param
+  | some v => f v
+  | none => .null
+
+end Param
+
+end LeanPq
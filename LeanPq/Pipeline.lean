@@ -0,0 +1,153 @@
+/-
+Pipelined execution: many statements are queued before their results are read, so a
+batch costs one network round trip instead of one per statement.
+https://www.postgresql.org/docs/current/libpq-pipeline-mode.html
+-/
+import LeanPq.Extern
+
+namespace LeanPq
+
+open Extern
+
+/--
+A connection in pipeline mode.
+
+Statements are queued with `send`/`sendBatch` and a synchronization point is issued every
+`syncEvery` statements, at which point their results are read. Bounding the number of
+statements in flight keeps the server from blocking on a full output buffer while the
+client is itself blocked sending, which would deadlock a blocking connection.
+
+Results are returned in queue order by `finish`. When a statement fails, the following
+statements up to the next synchronization point come back as `.pipelineAborted`.
+-/
+structure Pipeline where
+  conn : Handle
+  syncEvery : Nat
+  /-- Statements queued since the last synchronization point. -/
+  pending : IO.Ref Nat
+  results : IO.Ref (Array PGresult)
+
+namespace Pipeline
+
+/-- Switches `conn` to pipeline mode. The connection must be idle. -/
+def enter (conn : Handle) (syncEvery : Nat := 1000) : EIO LeanPq.Error Pipeline := do
+  PqEnterPipelineMode conn
+  let pending ← IO.mkRef 0
+  let results ← IO.mkRef #[]
+  return { conn, syncEvery := max syncEvery 1, pending, results }
+
+/-- Reads results up to the next synchronization point. Each statement's results end with
+`none`; two in a row mean the server has nothing left to send. -/
+private partial def readUntilSync (conn : Handle) (acc : Array PGresult) (afterNone : Bool := false) :
+    EIO LeanPq.Error (Array PGresult) := do
+  match ← PqGetResult conn with
+  | none =>
+    if afterNone then
+      throw (.otherError "Pipeline ended before its synchronization point")
+    readUntilSync conn acc true
+  | some res =>
+    match ← PqResultStatus res with
+    | .pipelineSync => return acc
+    | _ => readUntilSync conn (acc.push res)
+
+/-- Issues a synchronization point and reads the results of every queued statement. -/
+def sync (p : Pipeline) : EIO LeanPq.Error Unit := do
+  if (← p.pending.get) == 0 then return
+  PqPipelineSync p.conn
+  p.pending.set 0
+  let acc ← p.results.modifyGet fun r => (r, #[])
+  p.results.set (← readUntilSync p.conn acc)
+
+/-- Records `n` newly queued statements, synchronizing when the batch is full. -/
+private def added (p : Pipeline) (n : Nat) : EIO LeanPq.Error Unit := do
+  let pending ← p.pending.modifyGet fun k => (k + n, k + n)
+  if pending >= p.syncEvery then p.sync
+
+/-- Queues an execution of the prepared statement `stmtName`. -/
+def send (p : Pipeline) (stmtName : String) (params : Array Param) (resultFormat : Int := 0) :
+    EIO LeanPq.Error Unit := do
+  PqSendQueryPrepared p.conn stmtName params resultFormat
+  p.added 1
+
+/-- Queues an unnamed statement with its parameters (simple `PqSendQuery` is not allowed in pipeline mode). -/
+def sendParams (p : Pipeline) (command : String) (params : Array Param := #[]) (resultFormat : Int := 0) :
+    EIO LeanPq.Error Unit := do
+  PqSendQueryParams p.conn command params resultFormat
+  p.added 1
+
+/-- Queues a statement preparation; its result takes one slot in the results. -/
+def prepare (p : Pipeline) (stmtName : String) (query : String) (paramTypes : Array UInt32 := #[]) :
+    EIO LeanPq.Error Unit := do
+  PqSendPrepare p.conn stmtName query paramTypes
+  p.added 1
+
+/-- Sizes of the runs `sendBatch` splits `count` executions into, `pending` statements being
+queued already: every run but the last fills the pipeline up to a synchronization point. -/
+def batchSizes (syncEvery pending count : Nat) : Array Nat := Id.run do
+  let mut sizes := #[]
+  let mut left := count
+  let mut room := syncEvery - pending
+  while left > 0 do
+    let n := min left (max room 1)
+    sizes := sizes.push n
+    left := left - n
+    room := syncEvery
+  return sizes
+
+/-- Queues one execution of `stmtName` per parameter set, crossing into libpq once per run
+(see `batchSizes`). When libpq stops partway, the executions it queued are still counted,
+so that later synchronization points line up with the server's. -/
+def sendBatch (p : Pipeline) (stmtName : String) (paramSets : Array (Array Param))
+    (resultFormat : Int := 0) : EIO LeanPq.Error Unit := do
+  let mut start := 0
+  for n in batchSizes p.syncEvery (← p.pending.get) paramSets.size do
+    let queued ← PqSendQueryPreparedBatch p.conn stmtName (paramSets.extract start (start + n)) resultFormat
+    if queued < n then
+      p.pending.modify (· + queued)
+      let msg ← PqErrorMessage p.conn
+      throw (.otherError s!"Pipeline queued {queued} of {n} statements: {msg}")
+    p.added n
+    start := start + n
+
+/-- Collects the remaining results, leaves pipeline mode and returns every result in queue order. -/
+def finish (p : Pipeline) : EIO LeanPq.Error (Array PGresult) := do
+  p.sync
+  PqExitPipelineMode p.conn
+  p.results.modifyGet fun r => (r, #[])
+
+/-- Discards whatever is still in flight and leaves pipeline mode, ignoring errors. -/
+def abort (p : Pipeline) : EIO LeanPq.Error Unit := do
+  try
+    PqPipelineSync p.conn
+    let _ ← readUntilSync p.conn #[]
+  catch _ =>
+    pure ()
+  try PqExitPipelineMode p.conn catch _ => pure ()
+  p.pending.set 0
+  p.results.set #[]
+
+/-- Throws the first failure among pipelined results, naming the statement's position. -/
+def check (results : Array PGresult) : EIO LeanPq.Error Unit := do
+  let mut i := 0
+  for res in results do
+    let status ← PqResultStatus res
+    if status == .fatalError || status == .badResponse || status == .pipelineAborted then
+      let msg ← PqResultErrorMessage res
+      throw (.otherError s!"Pipelined statement {i} failed: {status}: {msg}")
+    i := i + 1
+
+end Pipeline
+
+/-- Executes the prepared statement `stmtName` once per parameter set in pipeline mode,
+returning one result per execution. -/
+def execPipelined (conn : Handle) (stmtName : String) (paramSets : Array (Array Param))
+    (resultFormat : Int := 0) (syncEvery : Nat := 1000) : EIO LeanPq.Error (Array PGresult) := do
+  let p ← Pipeline.enter conn syncEvery
+  try
+    p.sendBatch stmtName paramSets resultFormat
+    p.finish
+  catch e =>
+    p.abort
+    throw e
+
+end LeanPq
@@ -0,0 +1,332 @@
+/-
+A connection pool: `Handle`s are reused across units of work instead of paying
+connection setup (TLS, authentication) for every one of them.
+-/
+import LeanPq.Extern
+
+namespace LeanPq
+
+open Extern
+
+/-- Settings of a `Pool`. -/
+structure PoolConfig where
+  /-- Connection string passed to `PqConnectDb`. -/
+  conninfo : String
+  /-- Connections opened up front and kept open even when idle. -/
+  minSize : Nat := 1
+  /-- Upper bound on open connections, idle or checked out. -/
+  maxSize : Nat := 10
+  /-- Idle connections above `minSize` are closed after this long (ms). -/
+  idleTimeoutMs : Nat := 300000
+  /-- `checkout` fails when no connection frees up within this delay (ms). -/
+  checkoutTimeoutMs : Nat := 5000
+  /-- Number of independent idle lists; more shards mean less contention between tasks. -/
+  shards : Nat := 8
+  /-- Period of the maintenance task that expires waiters and idle connections (ms). -/
+  maintenanceIntervalMs : Nat := 50
+  deriving Repr, Inhabited
+
+/-- Counters of a `Pool`, as returned by `Pool.stats`. -/
+structure PoolStats where
+  /-- Checkouts served by an idle connection that passed its health check. -/
+  hits : Nat := 0
+  /-- Checkouts that had to wait for a connection to be returned. -/
+  waits : Nat := 0
+  /-- Checkouts that failed after `checkoutTimeoutMs`. -/
+  timeouts : Nat := 0
+  /-- Connections opened. -/
+  creations : Nat := 0
+  /-- Broken connections recovered with `PqReset`. -/
+  resets : Nat := 0
+  /-- Connections closed because they were broken or idle for too long. -/
+  discards : Nat := 0
+  /-- Connections returned inside a transaction and rolled back. -/
+  rollbacks : Nat := 0
+  /-- Open connections, idle or checked out. -/
+  size : Nat := 0
+  /-- Idle connections. -/
+  idle : Nat := 0
+  deriving Repr, Inhabited
+
+namespace PoolStats
+
+def add (a b : PoolStats) : PoolStats :=
+  { hits := a.hits + b.hits, waits := a.waits + b.waits, timeouts := a.timeouts + b.timeouts,
+    creations := a.creations + b.creations, resets := a.resets + b.resets,
+    discards := a.discards + b.discards, rollbacks := a.rollbacks + b.rollbacks,
+    size := a.size + b.size, idle := a.idle + b.idle }
+
+end PoolStats
+
+/-- An idle connection and the time it was returned (`IO.monoMsNow`). -/
+structure IdleConn where
+  conn : Handle
+  since : Nat
+
+/-- One idle list together with the counters of the checkouts that went through it, so
+that a checkout touches a single shared reference in the common case. -/
+structure PoolShard where
+  idle : Array IdleConn := #[]
+  stats : PoolStats := {}
+  /-- Set by `close` as it empties `idle`, so that no connection is added afterwards. -/
+  closed : Bool := false
+
+/-- A task blocked in `checkout`. Whoever sets `claimed` first (a returned connection or
+the timeout) resolves the promise. -/
+structure PoolWaiter where
+  promise : IO.Promise (Except LeanPq.Error Handle)
+  claimed : IO.Ref Bool
+  deadline : Nat
+
+/--
+A pool of connections to one database.
+
+Idle connections are spread over `config.shards` lists; a checkout starts at a shard picked
+from the clock and scans the others only when that one is empty. Connections are checked
+with `PqStatus` when they are handed out and returned, reset with `PqReset` when broken,
+and rolled back when returned inside a transaction. A single maintenance task expires
+checkout waits and idle connections and keeps `minSize` connections open.
+-/
+structure Pool where
+  config : PoolConfig
+  shards : Array (IO.Ref PoolShard)
+  /-- Open connections, idle or checked out. -/
+  size : IO.Ref Nat
+  waiters : IO.Ref (Array PoolWaiter)
+  /-- Counters not tied to a shard. -/
+  stats' : IO.Ref PoolStats
+  closed : IO.Ref Bool
+
+namespace Pool
+
+private def claim (w : PoolWaiter) : BaseIO Bool :=
+  w.claimed.modifyGet fun c => (!c, true)
+
+/-- Index of the shard a task starts with. The clock spreads concurrent checkouts without a
+shared counter. -/
+private def shardIndex (p : Pool) : BaseIO Nat := do
+  return (← IO.monoNanosNow) / 1000 % p.shards.size
+
+/-- Takes a slot out of `n` open connections: whether one is free below `maxSize`, and the
+new count. -/
+def reserveStep (maxSize n : Nat) : Bool × Nat :=
+  if n < maxSize then (true, n + 1) else (false, n)
+
+/-- Gives the slot of an idle connection back: whether more than `minSize` are open, and the
+new count. -/
+def shrinkStep (minSize n : Nat) : Bool × Nat :=
+  if n > minSize then (true, n - 1) else (false, n)
+
+/-- Reserves room for one more connection, `false` at `maxSize`. -/
+private def reserve (p : Pool) : BaseIO Bool :=
+  p.size.modifyGet (reserveStep p.config.maxSize)
+
+private def unreserve (p : Pool) : BaseIO Unit :=
+  p.size.modify (· - 1)
+
+/-- Opens a connection in a slot obtained from `reserve`. -/
+private def connect (p : Pool) : EIO LeanPq.Error Handle := do
+  try
+    let conn ← PqConnectDb p.config.conninfo
+    p.stats'.modify fun s => { s with creations := s.creations + 1 }
+    return conn
+  catch e =>
+    p.unreserve
+    throw e
+
+/-- Closes a connection by dropping it (the handle finalizer calls `PQfinish`). -/
+private def discard (p : Pool) (_conn : Handle) : BaseIO Unit := do
+  p.unreserve
+  p.stats'.modify fun s => { s with discards := s.discards + 1 }
+
+/-- Checks a connection with `PqStatus`, resetting it when broken. -/
+private def healthy (p : Pool) (conn : Handle) : EIO LeanPq.Error Bool := do
+  if (← PqStatus conn) == .connectionOk then return true
+  PqReset conn
+  p.stats'.modify fun s => { s with resets := s.resets + 1 }
+  return (← PqStatus conn) == .connectionOk
+
+/-- Pops an idle connection, starting with the caller's shard, which is returned with it. -/
+private def popIdle (p : Pool) : BaseIO (Option (Handle × IO.Ref PoolShard)) := do
+  let start ← p.shardIndex
+  for k in [0:p.shards.size] do
+    let some shard := p.shards[(start + k) % p.shards.size]? | continue
+    let found ← shard.modifyGet fun s =>
+      match s.idle.back? with
+      | some c => (some c.conn, { s with idle := s.idle.pop })
+      | none => (none, s)
+    if let some conn := found then return some (conn, shard)
+  return none
+
+/-- Checks a connection taken from `shard`, counting a hit when it can be handed out. -/
+private def served (p : Pool) (conn : Handle) (shard : IO.Ref PoolShard) : EIO LeanPq.Error Bool := do
+  if (← p.healthy conn) then
+    shard.modify fun s => { s with stats := { s.stats with hits := s.stats.hits + 1 } }
+    return true
+  p.discard conn
+  return false
+
+/-- Hands `conn` to the oldest waiter that has not timed out, or back to the idle lists. -/
+private partial def hand (p : Pool) (conn : Handle) : BaseIO Unit := do
+  match ← p.waiters.modifyGet fun ws => (ws[0]?, ws.extract 1 ws.size) with
+  | some w =>
+    if (← claim w) then
+      w.promise.resolve (.ok conn)
+    else
+      p.hand conn
+  | none =>
+    let since ← IO.monoMsNow
+    match p.shards[← p.shardIndex]? with
+    | some shard =>
+      -- `closed` is checked in the same update as the push: a connection returned while
+      -- `close` runs is either drained by it or discarded here.
+      let kept ← shard.modifyGet fun s =>
+        if s.closed then (false, s) else (true, { s with idle := s.idle.push { conn, since } })
+      unless kept do p.discard conn
+    | none => p.discard conn
+
+/-- Borrows a connection, opening one when none is idle and `maxSize` is not reached,
+otherwise waiting up to `checkoutTimeoutMs` for one to be returned. -/
+partial def checkout (p : Pool) : EIO LeanPq.Error Handle := do
+  if (← p.closed.get) then
+    throw (.otherError "Pool is closed")
+  match ← p.popIdle with
+  | some (conn, shard) =>
+    if (← p.served conn shard) then return conn
+    return (← p.checkout)
+  | none => pure ()
+  if (← p.reserve) then
+    return (← p.connect)
+  let promise ← IO.Promise.new
+  let claimed ← IO.mkRef false
+  let deadline := (← IO.monoMsNow) + p.config.checkoutTimeoutMs
+  let w : PoolWaiter := { promise, claimed, deadline }
+  p.waiters.modify (·.push w)
+  p.stats'.modify fun s => { s with waits := s.waits + 1 }
+  -- A connection may have been returned between the scan above and the registration.
+  match ← p.popIdle with
+  | some (conn, shard) =>
+    if (← claim w) then
+      if (← p.served conn shard) then return conn
+      return (← p.checkout)
+    p.hand conn
+  | none => pure ()
+  match ← IO.wait promise.result! with
+  | .ok conn =>
+    if (← p.healthy conn) then return conn
+    p.discard conn
+    p.checkout
+  | .error e => throw e
+
+/-- Ends an open transaction; `false` when the connection cannot be reused as is. -/
+private def rollback (p : Pool) (conn : Handle) : EIO LeanPq.Error Bool := do
+  match ← PqTransactionStatus conn with
+  | .idle => return true
+  | .inTransaction | .inError =>
+    let _ ← PqExec conn "ROLLBACK"
+    p.stats'.modify fun s => { s with rollbacks := s.rollbacks + 1 }
+    return (← PqTransactionStatus conn) == .idle
+  -- A command still running or a lost connection: start over.
+  | .active | .unknown => return false
+
+/-- Returns a connection to the pool, rolling back an open transaction first. It does not
+fail, so it can run in a `finally` without replacing the error being propagated: when no
+replacement can be opened for a waiter, the waiter keeps waiting. -/
+def release (p : Pool) (conn : Handle) : EIO LeanPq.Error Unit := do
+  let usable ← tryCatch (p.rollback conn) fun _ => pure false
+  -- Nested actions run before the condition, whatever `||` and `&&` short-circuit, so the
+  -- health check and the reservation get statements of their own.
+  let reusable ← if (← p.closed.get) || !usable then pure false
+    else tryCatch (p.healthy conn) fun _ => pure false
+  unless reusable do
+    p.discard conn
+    -- Let a waiter use the freed slot; `connect` gives it back when it fails.
+    if !(← p.closed.get) && !(← p.waiters.get).isEmpty then
+      if (← p.reserve) then
+        tryCatch (do p.hand (← p.connect)) fun _ => pure ()
+    return
+  p.hand conn
+
+/-- Runs `f` with a borrowed connection, returning it even when `f` throws. -/
+def withConnection (p : Pool) (f : Handle → EIO LeanPq.Error α) : EIO LeanPq.Error α := do
+  let conn ← p.checkout
+  try
+    f conn
+  finally
+    p.release conn
+
+/-- Fails the waiters past their deadline. -/
+private def expireWaiters (p : Pool) (now : Nat) : BaseIO Unit := do
+  let expired ← p.waiters.modifyGet fun ws => ws.partition (·.deadline ≤ now)
+  for w in expired do
+    if (← claim w) then
+      p.stats'.modify fun s => { s with timeouts := s.timeouts + 1 }
+      w.promise.resolve (.error (.otherError "Timed out waiting for a pooled connection"))
+
+/-- Closes connections idle for longer than `idleTimeoutMs`, keeping `minSize` open. -/
+private def evictIdle (p : Pool) (now : Nat) : BaseIO Unit := do
+  for shard in p.shards do
+    let evicted ← shard.modifyGet fun s =>
+      let (old, fresh) := s.idle.partition (·.since + p.config.idleTimeoutMs ≤ now)
+      (old, { s with idle := fresh })
+    for c in evicted do
+      -- The check and the decrement are one step, so that concurrent discards cannot take
+      -- the pool below `minSize`.
+      if (← p.size.modifyGet (shrinkStep p.config.minSize)) then
+        p.stats'.modify fun s => { s with discards := s.discards + 1 }
+      else
+        shard.modify fun s => { s with idle := s.idle.push c }
+
+/-- Opens connections until `minSize` are open. -/
+private partial def fill (p : Pool) : EIO LeanPq.Error Unit := do
+  if (← p.size.get) < p.config.minSize then
+    if (← p.reserve) then
+      p.hand (← p.connect)
+      p.fill
+
+private partial def maintain (p : Pool) : EIO LeanPq.Error Unit := do
+  if (← p.closed.get) then return
+  IO.sleep p.config.maintenanceIntervalMs.toUInt32
+  let now ← IO.monoMsNow
+  p.expireWaiters now
+  p.evictIdle now
+  try p.fill catch _ => pure ()
+  p.maintain
+
+/-- Creates a pool, opens `minSize` connections and starts its maintenance task. -/
+def create (config : PoolConfig) : EIO LeanPq.Error Pool := do
+  let config := { config with shards := max config.shards 1, maxSize := max config.maxSize 1 }
+  let shards ← (List.range config.shards).toArray.mapM fun _ => IO.mkRef ({} : PoolShard)
+  let size ← IO.mkRef 0
+  let waiters ← IO.mkRef #[]
+  let stats' ← IO.mkRef {}
+  let closed ← IO.mkRef false
+  let p : Pool := { config, shards, size, waiters, stats', closed }
+  p.fill
+  let _ ← EIO.asTask p.maintain .dedicated
+  return p
+
+/-- Current counters, summed over the shards. -/
+def stats (p : Pool) : BaseIO PoolStats := do
+  let mut total ← p.stats'.get
+  for shard in p.shards do
+    let s ← shard.get
+    total := total.add { s.stats with idle := s.idle.size }
+  return { total with size := ← p.size.get }
+
+/-- Closes the idle connections and fails pending checkouts. Connections still checked out
+are closed when they are returned. -/
+def close (p : Pool) : BaseIO Unit := do
+  p.closed.set true
+  for shard in p.shards do
+    let idle ← shard.modifyGet fun s => (s.idle, { s with idle := #[], closed := true })
+    for c in idle do
+      p.discard c.conn
+  let waiters ← p.waiters.modifyGet fun ws => (ws, #[])
+  for w in waiters do
+    if (← claim w) then
+      w.promise.resolve (.error (.otherError "Pool is closed"))
+
+end Pool
+
+end LeanPq
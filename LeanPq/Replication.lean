@@ -0,0 +1,194 @@
+/-
+Change data capture with logical replication: a `replication=database` connection streams
+the changes of publications, decoded natively from the `pgoutput` plugin.
+https://www.postgresql.org/docs/current/logical-replication.html
+https://www.postgresql.org/docs/current/protocol-replication.html
+-/
+import Std.Data.HashMap
+import LeanPq.Extern
+
+namespace LeanPq
+
+open Extern
+
+/-- Log sequence numbers, written `X/Y` by the server (high and low 32 bits, in hex). -/
+namespace Lsn
+
+private def hex (n : Nat) : String :=
+  String.mk ((Nat.toDigits 16 n).map Char.toUpper)
+
+private def parseHex? (s : String) : Option Nat :=
+  if s.isEmpty then none else
+  s.foldl (init := some 0) fun acc c => do
+    let n ← acc
+    let d ← if c.isDigit then some (c.toNat - '0'.toNat)
+      else if 'a' ≤ c.toLower && c.toLower ≤ 'f' then some (c.toLower.toNat - 'a'.toNat + 10)
+      else none
+    return n * 16 + d
+
+def toString (lsn : UInt64) : String :=
+  hex (lsn >>> 32).toNat ++ "/" ++ hex (lsn &&& 0xFFFFFFFF).toNat
+
+def ofString? (s : String) : Option UInt64 := do
+  let [hi, lo] := s.splitOn "/" | none
+  let hi ← parseHex? hi
+  let lo ← parseHex? lo
+  if hi < 2 ^ 32 && lo < 2 ^ 32 then some (hi * 2 ^ 32 + lo).toUInt64 else none
+
+end Lsn
+
+/-- Opens a `replication=database` connection, which accepts replication commands as well as
+SQL. `conninfo` is a connection string or URI. -/
+def connectReplication (conninfo : String) : EIO LeanPq.Error Handle :=
+  PqConnectDbParams #["dbname", "replication"] #[conninfo, "database"] 1
+
+/-- A logical replication slot, as returned by `createSlot`. -/
+structure ReplicationSlot where
+  name : String
+  /-- Position from which the slot streams changes. -/
+  consistentPoint : UInt64
+  /-- Snapshot exported at `consistentPoint`, to copy the initial data consistently. -/
+  snapshotName : Option String
+
+private def replicationCommand (conn : Handle) (sql : String) (expected : ExecStatus) :
+    EIO LeanPq.Error PGresult := do
+  let res ← PqExec conn sql
+  let status ← PqResultStatus res
+  unless status == expected do
+    let msg ← PqResultErrorMessage res
+    throw (.otherError s!"{status}: {msg}")
+  return res
+
+/-- Creates a logical slot using `pgoutput`; a temporary slot is dropped when the connection
+closes. -/
+def createSlot (conn : Handle) (name : String) (temporary : Bool := false) :
+    EIO LeanPq.Error ReplicationSlot := do
+  let kind := if temporary then " TEMPORARY" else ""
+  let res ← replicationCommand conn
+    s!"CREATE_REPLICATION_SLOT {← PqEscapeIdentifier conn name}{kind} LOGICAL pgoutput" .tuplesOk
+  let point ← PqGetvalue res 0 1
+  let some consistentPoint := Lsn.ofString? point
+    | throw (.otherError s!"Invalid consistent point {point}")
+  let snapshotName ← if (← PqGetisnull res 0 2) != 0 then pure none else some <$> PqGetvalue res 0 2
+  return { name, consistentPoint, snapshotName }
+
+/-- Drops a slot; the server then releases the WAL it retained. -/
+def dropSlot (conn : Handle) (name : String) : EIO LeanPq.Error Unit := do
+  discard <| replicationCommand conn s!"DROP_REPLICATION_SLOT {← PqEscapeIdentifier conn name}" .commandOk
+
+/-- A table described by a Relation message. -/
+structure Relation where
+  schema : String
+  name : String
+  columns : Array RelationColumn
+  deriving Inhabited
+
+/--
+A running `START_REPLICATION ... LOGICAL` stream.
+
+The slot only advances past changes the consumer acknowledged with `ack` (`run` acknowledges
+each transaction once its handler returned), so changes survive a crash of the consumer.
+Positions are reported to the server every `statusIntervalMs`, and immediately when a
+keepalive asks for it; the default stays well below the server's `wal_sender_timeout`.
+-/
+structure ReplicationStream where
+  conn : Handle
+  statusIntervalMs : Nat
+  /-- Highest position received, reported as written. -/
+  received : IO.Ref UInt64
+  /-- Highest position acknowledged, reported as flushed and applied. -/
+  flushed : IO.Ref UInt64
+  /-- `IO.monoMsNow` at the last status update. -/
+  lastStatus : IO.Ref Nat
+  /-- Tables seen in the stream, by OID. -/
+  relations : IO.Ref (Std.HashMap UInt32 Relation)
+  running : IO.Ref Bool
+
+namespace ReplicationStream
+
+/-- Starts streaming the changes of `publications` from `slot`, at `startLsn` or, for 0, where
+the slot was last confirmed. `conn` must come from `connectReplication`. -/
+def start (conn : Handle) (slot : String) (publications : Array String) (startLsn : UInt64 := 0)
+    (statusIntervalMs : Nat := 10000) : EIO LeanPq.Error ReplicationStream := do
+  let names ← publications.mapM (PqEscapeIdentifier conn)
+  let pubs ← PqEscapeLiteral conn (",".intercalate names.toList)
+  discard <| replicationCommand conn
+    s!"START_REPLICATION SLOT {← PqEscapeIdentifier conn slot} LOGICAL {Lsn.toString startLsn} \
+      (proto_version '1', publication_names {pubs})" .copyBoth
+  let received ← IO.mkRef startLsn
+  let flushed ← IO.mkRef startLsn
+  let lastStatus ← IO.mkRef (← IO.monoMsNow)
+  let relations ← IO.mkRef {}
+  let running ← IO.mkRef false
+  return { conn, statusIntervalMs, received, flushed, lastStatus, relations, running }
+
+/-- Reports the received and acknowledged positions to the server. -/
+def sendStatus (s : ReplicationStream) (replyRequested : Bool := false) : EIO LeanPq.Error Unit := do
+  let flushed ← s.flushed.get
+  PqSendStandbyStatus s.conn (← s.received.get) flushed flushed replyRequested
+  s.lastStatus.set (← IO.monoMsNow)
+
+/-- Marks every change up to `lsn` (usually the `endLsn` of a commit) as durably processed. -/
+def ack (s : ReplicationStream) (lsn : UInt64) : BaseIO Unit := do
+  s.flushed.modify (max · lsn)
+  s.received.modify (max · lsn)
+
+/-- The table of a Relation message received earlier in the stream. -/
+def relation? (s : ReplicationStream) (relid : UInt32) : BaseIO (Option Relation) :=
+  return (← s.relations.get)[relid]?
+
+/-- Waits up to `timeoutMs` for the next message; `none` when the timeout expired. Status
+updates are sent as they fall due, and keepalives are answered here. -/
+def next? (s : ReplicationStream) (timeoutMs : UInt32 := 1000) : EIO LeanPq.Error (Option ReplicationMessage) := do
+  if (← IO.monoMsNow) - (← s.lastStatus.get) >= s.statusIntervalMs then
+    s.sendStatus
+  let some msg ← PqReplicationReceive s.conn timeoutMs | return none
+  match msg.event with
+  | .keepalive walEnd replyRequested =>
+    -- `walEnd` is how far the server has sent. With every received change acknowledged,
+    -- nothing before it is pending, so the slot may advance over WAL without changes of
+    -- the publications.
+    if (← s.received.get) == (← s.flushed.get) then
+      s.ack walEnd
+    if replyRequested then
+      s.sendStatus
+  | .relation relid schema name _ columns =>
+    s.relations.modify (·.insert relid { schema, name, columns })
+    s.received.modify (max · msg.walStart)
+  | _ =>
+    s.received.modify (max · msg.walStart)
+  return some msg
+
+/-- Calls `handler` with every change until `stop`, acknowledging each transaction after
+`handler` returned for its commit. `stop` is noticed within `checkMs`. -/
+partial def run (s : ReplicationStream) (handler : ReplicationEvent → EIO LeanPq.Error Unit)
+    (checkMs : UInt32 := 500) : EIO LeanPq.Error Unit := do
+  s.running.set true
+  let rec loop : EIO LeanPq.Error Unit := do
+    unless (← s.running.get) do return
+    match ← s.next? checkMs with
+    | none | some { event := .keepalive .., .. } => pure ()
+    | some { event := event@(.commit _ endLsn _), .. } =>
+      handler event
+      s.ack endLsn
+    | some msg => handler msg.event
+    loop
+  loop
+
+/-- Makes `run` return after its current wait. -/
+def stop (s : ReplicationStream) : BaseIO Unit :=
+  s.running.set false
+
+/-- Reports the final positions and ends the stream; the connection can then run commands
+again. -/
+def close (s : ReplicationStream) : EIO LeanPq.Error Unit := do
+  s.sendStatus
+  PqPutCopyEnd s.conn
+  repeat
+    if (← PqGetCopyData s.conn).isNone then break
+  repeat
+    if (← PqGetResult s.conn).isNone then break
+
+end ReplicationStream
+
+end LeanPq
@@ -0,0 +1,338 @@
+/-
+Client-side cache of decoded query results, invalidated by NOTIFY.
+
+  -- Writers announce changes, e.g. from a trigger:
+  --   PERFORM pg_notify('lean_pq_cache', TG_TABLE_NAME);
+  let cache ← ResultCache.create listenConn
+  let users ← cache.exec conn "SELECT * FROM users WHERE id = $1" #[Param.ofInt64 42] (tags := #["users"])
+
+A notification invalidates the entries tagged with its payload (several tags may be given,
+separated by commas), and every untagged entry; an empty payload invalidates everything.
+-/
+import Std.Data.HashMap
+import LeanPq.Extern
+import LeanPq.FromRow
+import LeanPq.Notify
+import LeanPq.StatementCache
+
+namespace LeanPq
+
+open Extern
+
+/-- Settings of a `ResultCache`. -/
+structure ResultCacheConfig where
+  /-- Channel the invalidations are notified on. -/
+  channel : String := "lean_pq_cache"
+  /-- Lifetime of an entry, whether or not it was invalidated. -/
+  ttlMs : Nat := 60000
+  /-- Bound on the cached results, as estimated by `CachedResult.retainedBytes`; the least
+  recently used entries are evicted beyond it. -/
+  maxBytes : Nat := 64 * 1024 * 1024
+  deriving Repr, Inhabited
+
+/-- A result held by the cache: its columns, decoded once. -/
+structure CachedResult where
+  names : Array String
+  columns : Array Column
+  rows : Nat
+  deriving Inhabited
+
+namespace CachedResult
+
+/-- The value at `row` of the column `col`. -/
+def get (r : CachedResult) (row col : Nat) : Value :=
+  match r.columns[col]? with
+  | some c => c.get row
+  | none => .null
+
+/-- Decodes every row as an `α`, resolving its columns by name as `decodeRows` does. -/
+def decodeRows (α : Type) [FromRow α] (r : CachedResult) : EIO LeanPq.Error (Array α) := do
+  let mut columns : Array Column := #[]
+  for name in FromRow.columns (α := α), check in FromRow.fields (α := α) do
+    let some i := r.names.findIdx? (· == name)
+      | throw (.otherError s!"Result has no column {name}")
+    let c := r.columns[i]!
+    unless check.accepts c.oid do
+      throw (.otherError s!"Column {name} has type OID {c.oid}, expected {check.typeName}")
+    columns := columns.push c
+  let mut out := Array.mkEmpty r.rows
+  for row in [0:r.rows] do
+    match FromRow.decodeRow columns row with
+    | .ok v => out := out.push v
+    | .error msg => throw (.otherError s!"Row {row}, {msg}")
+  return out
+
+/-- Approximate heap bytes of a decoded value: an 8 byte header per object, plus its fields
+and payload. `null` is a scalar and takes nothing. -/
+partial def valueBytes : Value → Nat
+  | .null => 0
+  | .bool _ | .int _ | .float _ | .date _ | .timestamp _ | .timestamptz _ => 16
+  | .numeric s | .text s => 16 + 32 + s.utf8ByteSize
+  | .uuid b | .bytea b => 16 + 24 + b.size
+  | .array _ dims elements =>
+    24 + (24 + 8 * dims.size) + (24 + 8 * elements.size) + elements.foldl (· + valueBytes ·) 0
+  | .record types fields =>
+    24 + (24 + 8 * types.size) + (24 + 8 * fields.size) + fields.foldl (· + valueBytes ·) 0
+
+/-- Approximate heap bytes the cache keeps alive for a result: column names, null flags and
+values. This is what an entry costs once its `PGresult` is freed. -/
+def retainedBytes (r : CachedResult) : Nat :=
+  let names := r.names.foldl (fun n s => n + 32 + s.utf8ByteSize) (24 + 8 * r.names.size)
+  r.columns.foldl (init := names) fun n c =>
+    n + 24 + c.nulls.size + match c.data with
+      | .int64 values => 24 + values.size
+      | .float64 values => 24 + 8 * values.size
+      | .boxed values => 24 + 8 * values.size + values.foldl (· + valueBytes ·) 0
+
+end CachedResult
+
+/-- Key of a cached result: the database queried, the SQL text, its parameters as marshaled,
+and the result format. Statement names are not used, since the same name may stand for
+different SQL on different connections. -/
+structure CacheKey where
+  /-- Identity of the database, see `CacheKey.database`. -/
+  database : String
+  sql : String
+  params : ByteArray
+  /-- 0 for text results, 1 for binary ones: their columns decode differently. -/
+  format : Int
+
+instance : BEq CacheKey where
+  beq a b := a.database == b.database && a.sql == b.sql && a.params.data == b.params.data &&
+    a.format == b.format
+
+instance : Hashable CacheKey where
+  hash k :=
+    mixHash (mixHash (hash k.database) (hash k.sql)) (mixHash (hash k.params.data) (hash k.format))
+
+namespace CacheKey
+
+/-- Encodes the parameters unambiguously: kind, type OID, length, then the value. -/
+def paramBytes (params : Array Param) : ByteArray :=
+  let u32 (b : ByteArray) (v : UInt32) : ByteArray :=
+    ((((b.push (v >>> 24).toUInt8).push (v >>> 16).toUInt8).push (v >>> 8).toUInt8).push v.toUInt8)
+  params.foldl (init := ByteArray.empty) fun acc p =>
+    match p with
+    | .null oid => u32 (acc.push 0) oid
+    | .text v oid => u32 (u32 (acc.push 1) oid) v.utf8ByteSize.toUInt32 ++ v.toUTF8
+    | .binary v oid => u32 (u32 (acc.push 2) oid) v.size.toUInt32 ++ v
+
+def ofQuery (database sql : String) (params : Array Param) (format : Int) : CacheKey :=
+  { database, sql, params := paramBytes params, format }
+
+/-- Identifies the database `conn` is connected to, as user, server and database name. -/
+def database (conn : Handle) : EIO LeanPq.Error String := do
+  return s!"{← PqUser conn}@{← PqHost conn}:{← PqPort conn}/{← PqDb conn}"
+
+end CacheKey
+
+/-- A cached result and what invalidates it. -/
+structure CacheEntry where
+  result : CachedResult
+  tags : Array String
+  bytes : Nat
+  /-- `IO.monoMsNow` after which the entry is stale. -/
+  expires : Nat
+  /-- Value of the use counter at the last hit, for LRU eviction. -/
+  lastUse : Nat
+
+/-- Entries of a `ResultCache` and the invalidations seen so far. -/
+structure CacheState where
+  entries : Std.HashMap CacheKey CacheEntry := {}
+  bytes : Nat := 0
+  uses : Nat := 0
+  /-- Incremented by every invalidation of a tag. -/
+  generations : Std.HashMap String Nat := {}
+  /-- Incremented by every invalidation of all entries. -/
+  epoch : Nat := 0
+  /-- Incremented by every invalidation, which drops the untagged entries. -/
+  serial : Nat := 0
+
+namespace CacheState
+
+/-- Drops the entries tagged with any of `tags` and the untagged ones, or every entry when
+`tags` is empty. -/
+def invalidate (s : CacheState) (tags : Array String) : CacheState :=
+  if tags.isEmpty then
+    { s with entries := {}, bytes := 0, epoch := s.epoch + 1, serial := s.serial + 1 }
+  else
+    let generations := tags.foldl (init := s.generations) fun g t => g.insert t (g.getD t 0 + 1)
+    let (entries, bytes) := s.entries.fold (init := (s.entries, s.bytes)) fun (es, b) k e =>
+      if e.tags.isEmpty || e.tags.any tags.contains then (es.erase k, b - e.bytes) else (es, b)
+    { s with entries, bytes, generations, serial := s.serial + 1 }
+
+/-- Whether an invalidation that applies to a result tagged with `tags` happened since
+`before`, while the result was being queried. -/
+def invalidatedSince (s before : CacheState) (tags : Array String) : Bool :=
+  s.epoch != before.epoch ||
+    (tags.isEmpty && s.serial != before.serial) ||
+    tags.any fun t => s.generations.getD t 0 != before.generations.getD t 0
+
+/-- Evicts the least recently used entries until `extra` more bytes fit. -/
+def evict (s : CacheState) (maxBytes extra : Nat) : CacheState := Id.run do
+  if s.bytes + extra ≤ maxBytes then return s
+  let byUse := s.entries.toArray.qsort (fun a b => a.2.lastUse < b.2.lastUse)
+  let mut s := s
+  for (k, e) in byUse do
+    if s.bytes + extra ≤ maxBytes then break
+    s := { s with entries := s.entries.erase k, bytes := s.bytes - e.bytes }
+  return s
+
+end CacheState
+
+/-- Counters of a `ResultCache`. -/
+structure ResultCacheStats where
+  hits : Nat := 0
+  misses : Nat := 0
+  entries : Nat := 0
+  bytes : Nat := 0
+  invalidations : Nat := 0
+  deriving Repr, Inhabited
+
+/--
+Query results, keyed by database, SQL text, parameter bytes and result format.
+
+One cache may serve connections to several databases. Connections to the same database
+share its entries, so they must also agree on the settings that change what a query returns,
+such as `search_path`: use a cache per setting otherwise.
+
+Invalidations arrive on a dedicated listening connection, read by a task of its own.
+A result is only stored when no invalidation of its tags arrived while it was queried, so a
+write notified during the query is never hidden by an older result. If the listening
+connection fails, the cache is emptied and bypassed: without notifications it could serve
+stale results.
+-/
+structure ResultCache where
+  config : ResultCacheConfig
+  listener : Listener
+  state : IO.Ref CacheState
+  stats' : IO.Ref ResultCacheStats
+  /-- False once the listener has stopped. -/
+  healthy : IO.Ref Bool
+  task : IO.Ref (Option (Task (Except LeanPq.Error Unit)))
+
+namespace ResultCache
+
+private def now : BaseIO Nat := IO.monoMsNow
+
+/-- Drops the entries tagged with any of `tags` and the untagged ones, or every entry when
+`tags` is empty. -/
+private def invalidateTags (c : ResultCache) (tags : Array String) : BaseIO Unit := do
+  c.state.modify (·.invalidate tags)
+  c.stats'.modify fun st => { st with invalidations := st.invalidations + 1 }
+
+private def onNotifications (c : ResultCache) (batch : Array Notification) : EIO LeanPq.Error Unit := do
+  let mut tags : Array String := #[]
+  for n in batch do
+    if n.payload.isEmpty then
+      c.invalidateTags #[]
+      return
+    tags := tags ++ (n.payload.splitOn ",").toArray.map String.trim
+  c.invalidateTags tags
+
+/-- Creates a cache invalidated through `listenConn`, which it uses exclusively. -/
+def create (listenConn : Handle) (config : ResultCacheConfig := {}) : EIO LeanPq.Error ResultCache := do
+  let listener ← Listener.new listenConn
+  listener.listen config.channel
+  let c : ResultCache := {
+    config, listener,
+    state := ← IO.mkRef {}, stats' := ← IO.mkRef {},
+    healthy := ← IO.mkRef true, task := ← IO.mkRef none
+  }
+  let watch : EIO LeanPq.Error Unit := do
+    try
+      listener.run c.onNotifications
+    finally
+      c.healthy.set false
+      c.invalidateTags #[]
+  let task ← EIO.asTask watch .dedicated
+  c.task.set (some task)
+  return c
+
+private def lookup (c : ResultCache) (key : CacheKey) : BaseIO (Option CachedResult) := do
+  let t ← now
+  c.state.modifyGet fun s =>
+    match s.entries[key]? with
+    | some e =>
+      if t < e.expires then
+        let uses := s.uses + 1
+        (some e.result, { s with entries := s.entries.insert key { e with lastUse := uses }, uses })
+      else
+        (none, { s with entries := s.entries.erase key, bytes := s.bytes - e.bytes })
+    | none => (none, s)
+
+/-- Answers `key` from the cache, or runs `query` and caches its result. -/
+private def fetch (c : ResultCache) (key : CacheKey) (tags : Array String)
+    (query : EIO LeanPq.Error PGresult) : EIO LeanPq.Error CachedResult := do
+  let healthy ← c.healthy.get
+  if healthy then
+    match ← c.lookup key with
+    | some result =>
+      c.stats'.modify fun st => { st with hits := st.hits + 1 }
+      return result
+    | none => pure ()
+  c.stats'.modify fun st => { st with misses := st.misses + 1 }
+  let before ← c.state.get
+  let res ← query
+  let status ← PqResultStatus res
+  unless status == .tuplesOk do
+    let msg ← PqResultErrorMessage res
+    throw (.otherError s!"{status}: {msg}")
+  let n ← PqNfields res
+  let names ← (List.range n.toNat).toArray.mapM fun i => PqFname res i
+  let columns ← (List.range n.toNat).toArray.mapM fun i => PqDecodeColumn res i
+  let result : CachedResult := { names, columns, rows := (← PqNtuples res).toNat }
+  let bytes := result.retainedBytes
+  if healthy && bytes ≤ c.config.maxBytes then
+    let expires := (← now) + c.config.ttlMs
+    c.state.modify fun s =>
+      if s.invalidatedSince before tags then s else
+        let s := s.evict c.config.maxBytes bytes
+        let bytes' := match s.entries[key]? with
+          | some old => s.bytes - old.bytes
+          | none => s.bytes
+        let uses := s.uses + 1
+        { s with
+          entries := s.entries.insert key { result, tags, bytes, expires, lastUse := uses },
+          bytes := bytes' + bytes, uses }
+  return result
+
+/-- Executes `sql` with `PqExecParams`, or answers from the cache. `tags` name what the
+result depends on (typically its tables), as notified by writers; an untagged result is
+dropped by every notification. -/
+def exec (c : ResultCache) (conn : Handle) (sql : String) (params : Array Param := #[])
+    (tags : Array String := #[]) (resultFormat : Int := 1) : EIO LeanPq.Error CachedResult := do
+  c.fetch (.ofQuery (← CacheKey.database conn) sql params resultFormat) tags
+    (PqExecParams conn sql params resultFormat)
+
+/-- `exec` through a `StatementCache`, so that cache misses run as prepared statements on
+its connection. -/
+def execPrepared (c : ResultCache) (statements : StatementCache) (sql : String)
+    (params : Array Param := #[]) (tags : Array String := #[]) (resultFormat : Int := 1) :
+    EIO LeanPq.Error CachedResult := do
+  c.fetch (.ofQuery (← CacheKey.database statements.conn) sql params resultFormat) tags
+    (statements.exec sql params resultFormat)
+
+/-- Drops the entries tagged with `tag`, as a notification would. -/
+def invalidate (c : ResultCache) (tag : String) : BaseIO Unit :=
+  c.invalidateTags #[tag]
+
+/-- Drops every entry. -/
+def clear (c : ResultCache) : BaseIO Unit :=
+  c.invalidateTags #[]
+
+/-- Current counters. -/
+def stats (c : ResultCache) : BaseIO ResultCacheStats := do
+  let s ← c.state.get
+  return { (← c.stats'.get) with entries := s.entries.size, bytes := s.bytes }
+
+/-- Stops listening and empties the cache; later `exec` calls go to the server. -/
+def close (c : ResultCache) : BaseIO Unit := do
+  c.listener.stop
+  match ← c.task.get with
+  | some task => discard <| IO.wait task
+  | none => pure ()
+
+end ResultCache
+
+end LeanPq
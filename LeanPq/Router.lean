@@ -0,0 +1,274 @@
+/-
+Read/write routing over a primary and its streaming replicas: writes go to the primary,
+reads are spread over the replicas, and hosts are reclassified as they fail or are promoted.
+https://www.postgresql.org/docs/current/hot-standby.html
+-/
+import LeanPq.Extern
+import LeanPq.Pool
+
+namespace LeanPq
+
+open Extern
+
+/-- Role of a host, from `pg_is_in_recovery()`. -/
+inductive HostRole where
+  | primary
+  | replica
+  /-- Not classified yet. -/
+  | unknown
+  deriving BEq, Repr, Inhabited
+
+/-- How reads are spread over the replicas. -/
+inductive Balancing where
+  /-- The replica with the fewest queries in flight. -/
+  | leastOutstanding
+  /-- Among the replicas at most `toleranceMs` behind the least lagging one, the one with the
+  fewest queries in flight. -/
+  | lagAware (toleranceMs : Nat := 100)
+  deriving Repr, Inhabited
+
+/-- Settings of a `Router`. -/
+structure RouterConfig where
+  /-- Connection strings, one host each. Include a `connect_timeout` so that a host that
+  went away is detected quickly. -/
+  hosts : Array String
+  /-- Settings of each host's pool; its `conninfo` is replaced by the host's. -/
+  pool : PoolConfig := { conninfo := "" }
+  balancing : Balancing := .leastOutstanding
+  /-- Replicas further behind (replay delay, ms) are not read from. -/
+  maxLagMs : Nat := 10000
+  /-- Reads go to the primary when no replica is usable. -/
+  readFromPrimary : Bool := true
+  /-- Period of the classification of the hosts (ms). -/
+  checkIntervalMs : Nat := 1000
+  deriving Repr, Inhabited
+
+/-- What the last check (or failure) found about a host. -/
+structure HostState where
+  role : HostRole := .unknown
+  up : Bool := false
+  /-- Replay delay of a replica (ms), 0 when it streams from the primary and has replayed
+  everything it received. -/
+  lagMs : Nat := 0
+  /-- Whether a replica's WAL receiver is connected to the primary. A replica that is not may
+  have replayed all it received and still be arbitrarily behind, so it is not read from. -/
+  streaming : Bool := false
+  deriving Repr, Inhabited
+
+/-- A host of a `Router`, with its own pool. -/
+structure RouterHost where
+  conninfo : String
+  pool : Pool
+  state : IO.Ref HostState
+  /-- Queries running on the host through the router. -/
+  outstanding : IO.Ref Nat
+  /-- Connection of the periodic check, kept open between checks. -/
+  probe : IO.Ref (Option Handle)
+
+/-- State of a host, as returned by `Router.status`. -/
+structure HostStatus where
+  conninfo : String
+  state : HostState
+  outstanding : Nat
+  deriving Repr
+
+/--
+Routes work over a primary and its replicas, with a connection pool per host.
+
+A dedicated task classifies the hosts every `checkIntervalMs` with `pg_is_in_recovery()` and
+measures the replay lag of the replicas, on a connection of its own. Writes go to the host
+found primary. Reads go to a replica chosen by `config.balancing` among those streaming from
+the primary and no more than `maxLagMs` behind. When a query fails and `PqStatus` shows its
+connection broken, the host is marked down until a later check reaches it: a read is retried
+on another host, a write fails (it may have been committed). A promoted replica takes writes
+from the next check on.
+-/
+structure Router where
+  config : RouterConfig
+  hosts : Array RouterHost
+  closed : IO.Ref Bool
+
+namespace Router
+
+/-- Index of the replica to read from among `(lagMs, outstanding)` pairs, `none` when there
+is none. Ties go to the least lagging replica, then to the first one. -/
+def chooseReplica (balancing : Balancing) (replicas : Array (Nat × Nat)) : Option Nat := Id.run do
+  let some minLag := replicas.foldl (init := none) fun acc (lag, _) => some (min (acc.getD lag) lag)
+    | return none
+  let maxLag := match balancing with
+    | .leastOutstanding => none
+    | .lagAware toleranceMs => some (minLag + toleranceMs)
+  let mut best : Option (Nat × Nat × Nat) := none
+  for i in [0:replicas.size] do
+    let (lag, n) := replicas[i]!
+    if maxLag.any (lag > ·) then continue
+    match best with
+    | some (_, bestN, bestLag) =>
+      if n < bestN || (n == bestN && lag < bestLag) then
+        best := some (i, n, lag)
+    | none => best := some (i, n, lag)
+  return best.map (·.1)
+
+/-- Whether reads may go to a host found in state `s` as a replica. -/
+def readable (config : RouterConfig) (s : HostState) : Bool :=
+  s.up && s.role == .replica && s.streaming && s.lagMs ≤ config.maxLagMs
+
+/-- Classification query: recovery flag, replay delay, and whether the WAL receiver streams.
+The delay of a streaming replica that replayed everything it received is 0 (an idle primary
+sends nothing to replay); equal positions say nothing once the receiver is disconnected.
+Without `pg_read_all_stats` the receiver's status reads as NULL, and a running receiver is
+taken as streaming. -/
+private def probeQuery : String :=
+  "SELECT pg_is_in_recovery(), \
+     CASE WHEN NOT pg_is_in_recovery() THEN 0 \
+     WHEN streaming AND pg_last_wal_receive_lsn() = pg_last_wal_replay_lsn() THEN 0 \
+     ELSE COALESCE(GREATEST(0, EXTRACT(EPOCH FROM now() - pg_last_xact_replay_timestamp()) * 1000), 0) \
+     END::int8, \
+     streaming \
+   FROM (SELECT COALESCE((SELECT COALESCE(status = 'streaming', true) FROM pg_stat_wal_receiver), false) \
+     AS streaming) AS receiver"
+
+private def markDown (h : RouterHost) : BaseIO Unit :=
+  h.state.modify fun s => { s with up := false }
+
+/-- Classifies one host on its probe connection. -/
+private def probe (h : RouterHost) : EIO LeanPq.Error Unit := do
+  let conn ← match ← h.probe.get with
+    | some conn => do
+      if (← PqStatus conn) != .connectionOk then
+        PqReset conn
+      pure conn
+    | none => do
+      let conn ← PqConnectDb h.conninfo
+      h.probe.set (some conn)
+      pure conn
+  unless (← PqStatus conn) == .connectionOk do
+    throw (.otherError "Host is unreachable")
+  let res ← PqExec conn probeQuery
+  let status ← PqResultStatus res
+  unless status == .tuplesOk do
+    let msg ← PqResultErrorMessage res
+    throw (.otherError s!"{status}: {msg}")
+  let role := if (← PqGetvalue res 0 0) == "t" then HostRole.replica else .primary
+  let lagMs := (← PqGetvalue res 0 1).toNat!
+  let streaming := (← PqGetvalue res 0 2) == "t"
+  h.state.set { role, up := true, lagMs, streaming }
+
+/-- Classifies every host at once. Only the monitor task (and `create`, before starting it)
+calls this, so a probe connection is never used concurrently. -/
+private def check (r : Router) : BaseIO Unit := do
+  let tasks ← r.hosts.mapM fun h =>
+    EIO.asTask (tryCatch (probe h) fun _ => markDown h) .dedicated
+  for task in tasks do
+    discard <| IO.wait task
+
+private partial def monitor (r : Router) : BaseIO Unit := do
+  if (← r.closed.get) then return
+  IO.sleep r.config.checkIntervalMs.toUInt32
+  r.check
+  r.monitor
+
+/-- Creates a pool per host, classifies the hosts and starts the monitor task. Hosts that
+cannot be reached are marked down rather than failing the router. -/
+def create (config : RouterConfig) : EIO LeanPq.Error Router := do
+  if config.hosts.isEmpty then
+    throw (.otherError "Router needs at least one host")
+  let hosts ← config.hosts.mapM fun conninfo => do
+    let poolConfig := { config.pool with conninfo }
+    -- A host that is down at startup gets an empty pool, filled on demand.
+    let pool ← tryCatch (Pool.create poolConfig) fun _ => Pool.create { poolConfig with minSize := 0 }
+    return {
+      conninfo, pool,
+      state := ← IO.mkRef {}, outstanding := ← IO.mkRef 0, probe := ← IO.mkRef none
+    : RouterHost }
+  let r : Router := { config, hosts, closed := ← IO.mkRef false }
+  r.check
+  discard <| BaseIO.asTask r.monitor .dedicated
+  return r
+
+/-- The host to read from and its index, skipping the indices in `excluded`. -/
+private def pickRead (r : Router) (excluded : Array Nat) : BaseIO (Option (Nat × RouterHost)) := do
+  let mut replicas : Array (Nat × Nat × Nat) := #[]
+  let mut primary : Option Nat := none
+  for h in r.hosts, i in [0:r.hosts.size] do
+    if excluded.contains i then continue
+    let s ← h.state.get
+    unless s.up do continue
+    match s.role with
+    | .replica =>
+      if readable r.config s then
+        replicas := replicas.push (i, s.lagMs, ← h.outstanding.get)
+    | .primary => primary := some i
+    | .unknown => pure ()
+  let chosen := match chooseReplica r.config.balancing (replicas.map (·.2)) with
+    | some k => replicas[k]?.map (·.1)
+    | none => if r.config.readFromPrimary then primary else none
+  return chosen.bind fun i => r.hosts[i]?.map (i, ·)
+
+/-- The host found primary. -/
+private def pickPrimary (r : Router) : BaseIO (Option RouterHost) := do
+  for h in r.hosts do
+    let s ← h.state.get
+    if s.up && s.role == .primary then return some h
+  return none
+
+/-- Runs `f` on a connection of `h`. A connection failure (the host could not be reached, or
+`PqStatus` shows the connection broken after an error) marks the host down and is returned
+as `.error`; any other error is thrown. -/
+private def attempt (h : RouterHost) (f : Handle → EIO LeanPq.Error α) :
+    EIO LeanPq.Error (Except LeanPq.Error α) := do
+  h.outstanding.modify (· + 1)
+  try
+    match ← tryCatch (Except.ok (ε := LeanPq.Error) <$> h.pool.checkout) (pure ∘ .error) with
+    | .error e@(.connectionError _) =>
+      markDown h
+      return .error e
+    | .error e => throw e
+    | .ok conn =>
+      try
+        return .ok (← f conn)
+      catch e =>
+        if (← PqStatus conn) != .connectionOk then
+          markDown h
+          return .error e
+        throw e
+      finally
+        -- `release` does not throw, so it cannot replace the `.error` that fails over.
+        h.pool.release conn
+  finally
+    h.outstanding.modify (· - 1)
+
+/-- Runs the read-only work `f` on a replica (or the primary, see `readFromPrimary`), moving
+on to another host when the chosen one fails. -/
+partial def withRead (r : Router) (f : Handle → EIO LeanPq.Error α) : EIO LeanPq.Error α :=
+  let rec go (excluded : Array Nat) : EIO LeanPq.Error α := do
+    let some (i, h) ← r.pickRead excluded
+      | throw (.otherError "No host available for reads")
+    match ← attempt h f with
+    | .ok v => return v
+    | .error _ => go (excluded.push i)
+  go #[]
+
+/-- Runs `f` on the primary. It is not retried when the primary fails, since the work may
+already have been committed. -/
+def withWrite (r : Router) (f : Handle → EIO LeanPq.Error α) : EIO LeanPq.Error α := do
+  let some h ← r.pickPrimary
+    | throw (.otherError "No primary available")
+  match ← attempt h f with
+  | .ok v => return v
+  | .error e => throw e
+
+/-- State of every host, in configuration order. -/
+def status (r : Router) : BaseIO (Array HostStatus) :=
+  r.hosts.mapM fun h => do
+    return { conninfo := h.conninfo, state := ← h.state.get, outstanding := ← h.outstanding.get }
+
+/-- Stops the monitor task and closes the pools. -/
+def close (r : Router) : BaseIO Unit := do
+  r.closed.set true
+  for h in r.hosts do
+    h.pool.close
+
+end Router
+
+end LeanPq
@@ -0,0 +1,83 @@
+/-
+Multi-row INSERT and UPSERT statements, escaped in one pass into a reusable `SqlBuilder`.
+https://www.postgresql.org/docs/current/sql-insert.html
+-/
+import LeanPq.Extern
+
+namespace LeanPq
+
+open Extern
+
+/-- What an INSERT does when a row violates a unique constraint. -/
+inductive OnConflict where
+  /-- The statement fails. -/
+  | error
+  /-- The row is skipped. -/
+  | doNothing
+  /-- On a conflict on the `target` columns, `columns` are set from the proposed row. With no
+  `columns` there is nothing to set, and the row is skipped as with `doNothing`. -/
+  | update (target : Array String) (columns : Array String)
+  deriving Inhabited
+
+namespace Extern.SqlBuilder
+
+/-- Appends `INSERT INTO table (columns) VALUES ...` for `rows` (`none` is NULL). `table` is
+inserted as is, so it must already be a valid (quoted if needed) table name. Fails, before
+appending anything, on an `OnConflict.update` with columns to set but no conflict target. -/
+def appendInsert (b : SqlBuilder) (table : String) (columns : Array String)
+    (rows : Array (Array (Option String))) (onConflict : OnConflict := .error) : EIO LeanPq.Error Unit := do
+  if let .update target updated := onConflict then
+    if target.isEmpty && !updated.isEmpty then
+      throw (.otherError "ON CONFLICT DO UPDATE needs conflict target columns")
+  PqSqlBuilderAppend b s!"INSERT INTO {table} ("
+  PqSqlBuilderAppendIdentifiers b columns
+  PqSqlBuilderAppend b ") VALUES "
+  PqSqlBuilderAppendRows b rows
+  match onConflict with
+  | .error => pure ()
+  | .doNothing => PqSqlBuilderAppend b " ON CONFLICT DO NOTHING"
+  | .update target updated =>
+    if target.isEmpty then
+      PqSqlBuilderAppend b " ON CONFLICT DO NOTHING"
+      return
+    PqSqlBuilderAppend b " ON CONFLICT ("
+    PqSqlBuilderAppendIdentifiers b target
+    if updated.isEmpty then
+      PqSqlBuilderAppend b ") DO NOTHING"
+      return
+    PqSqlBuilderAppend b ") DO UPDATE SET "
+    let mut first := true
+    for column in updated do
+      unless first do PqSqlBuilderAppend b ", "
+      first := false
+      PqSqlBuilderAppendIdentifier b column
+      PqSqlBuilderAppend b " = EXCLUDED."
+      PqSqlBuilderAppendIdentifier b column
+
+/-- Returns the SQL built so far and empties the builder for the next statement. -/
+def take (b : SqlBuilder) : EIO LeanPq.Error String := do
+  let sql ← PqSqlBuilderToString b
+  PqSqlBuilderClear b
+  return sql
+
+end Extern.SqlBuilder
+
+/-- Inserts `rows` with multi-row INSERT statements of at most `batchSize` rows, reusing one
+builder for every statement. Returns the number of rows inserted or updated. -/
+def insertRows (conn : Handle) (table : String) (columns : Array String)
+    (rows : Array (Array (Option String))) (onConflict : OnConflict := .error) (batchSize : Nat := 1000) :
+    EIO LeanPq.Error Nat := do
+  let b ← PqSqlBuilderNew conn
+  let batchSize := max batchSize 1
+  let mut total := 0
+  for start in [0:rows.size:batchSize] do
+    b.appendInsert table columns (rows.extract start (start + batchSize)) onConflict
+    let res ← PqExec conn (← b.take)
+    let status ← PqResultStatus res
+    unless status == .commandOk do
+      let msg ← PqResultErrorMessage res
+      throw (.otherError s!"{status}: {msg}")
+    total := total + ((← PqCmdTuples res).toNat?.getD 0)
+  return total
+
+end LeanPq
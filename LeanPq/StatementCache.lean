@@ -0,0 +1,153 @@
+/-
+Automatic statement preparation: SQL text is prepared on first use and executed as a
+prepared statement afterwards, skipping parse and plan on every later call.
+https://www.postgresql.org/docs/current/sql-prepare.html
+-/
+import Std.Data.HashMap
+import LeanPq.Extern
+
+namespace LeanPq
+
+open Extern
+
+/-- A statement prepared by a `StatementCache`. -/
+structure CachedStatement where
+  /-- Server-side statement name. -/
+  name : String
+  /-- Parameter type OIDs, as reported by `PqDescribePrepared`. -/
+  paramTypes : Array UInt32
+  /-- Value of the cache's use counter at the last use, for LRU eviction. -/
+  lastUse : Nat
+
+/--
+Prepared statements of one connection, keyed by SQL text.
+
+At most `capacity` statements are kept; the least recently used one is deallocated to make
+room. The cache follows the backend process (`PqBackendPID`): after `PqReset`, or when the
+server reports an unknown statement (SQLSTATE 26000, e.g. after `DEALLOCATE`), statements
+are prepared again.
+-/
+structure StatementCache where
+  conn : Handle
+  capacity : Nat
+  entries : IO.Ref (Std.HashMap String CachedStatement)
+  /-- Incremented on every lookup. -/
+  uses : IO.Ref Nat
+  /-- Backend the cached statements were prepared on. -/
+  backendPid : IO.Ref Int
+
+namespace StatementCache
+
+/-- SQLSTATE `invalid_sql_statement_name`. -/
+private def unknownStatement : String := "26000"
+
+/-- Source of statement names, shared by every cache so that two caches on one connection
+never pick the same name. -/
+private initialize nextId : IO.Ref Nat ← IO.mkRef 0
+
+/-- Creates an empty cache for `conn`. -/
+def new (conn : Handle) (capacity : Nat := 256) : EIO LeanPq.Error StatementCache := do
+  let entries ← IO.mkRef {}
+  let uses ← IO.mkRef 0
+  let backendPid ← IO.mkRef (← PqBackendPID conn)
+  return { conn, capacity := max capacity 1, entries, uses, backendPid }
+
+private def check (res : PGresult) : EIO LeanPq.Error Unit := do
+  let status ← PqResultStatus res
+  unless status == .commandOk do
+    let msg ← PqResultErrorMessage res
+    throw (.otherError s!"{status}: {msg}")
+
+/-- Forgets every statement when the connection now talks to another backend. -/
+private def followBackend (c : StatementCache) : EIO LeanPq.Error Unit := do
+  let pid ← PqBackendPID c.conn
+  if pid != (← c.backendPid.get) then
+    c.entries.set {}
+    c.backendPid.set pid
+
+/-- Deallocates the statement `name`. One the server no longer knows is already gone. -/
+private def deallocate (c : StatementCache) (name : String) : EIO LeanPq.Error Unit := do
+  let res ← PqExec c.conn s!"DEALLOCATE {name}"
+  if (← PqResultStatus res) == .commandOk then return
+  if (← PqResultErrorField res DiagField.sqlstate) == unknownStatement then return
+  let msg ← PqResultErrorMessage res
+  throw (.otherError s!"DEALLOCATE {name} failed: {msg}")
+
+/-- Deallocates the least recently used statement. -/
+private def evict (c : StatementCache) : EIO LeanPq.Error Unit := do
+  let entries ← c.entries.get
+  let victim : Option (String × CachedStatement) := entries.fold (init := none) fun acc sql s =>
+    match acc with
+    | some (_, best) => if s.lastUse < best.lastUse then some (sql, s) else acc
+    | none => some (sql, s)
+  let some (sql, s) := victim | return
+  c.deallocate s.name
+  c.entries.modify (·.erase sql)
+
+/-- Prepares `sql` under a fresh name and records its parameter types. -/
+private def prepare (c : StatementCache) (sql : String) (use : Nat) : EIO LeanPq.Error CachedStatement := do
+  if (← c.entries.get).size >= c.capacity then
+    c.evict
+  let id ← nextId.modifyGet fun n => (n, n + 1)
+  let name := s!"lean_pq_{id}"
+  check (← PqPrepare c.conn name sql)
+  let desc ← PqDescribePrepared c.conn name
+  -- The statement exists on the server but is not cached: do not leave it behind.
+  try
+    check desc
+  catch e =>
+    try c.deallocate name catch _ => pure ()
+    throw e
+  let n ← PqNparams desc
+  let paramTypes ← (List.range n.toNat).toArray.mapM fun i => do
+    return (← PqParamtype desc i).toUInt32
+  let stmt : CachedStatement := { name, paramTypes, lastUse := use }
+  c.entries.modify (·.insert sql stmt)
+  return stmt
+
+/-- Returns the prepared statement for `sql`, preparing it on first use. -/
+def lookup (c : StatementCache) (sql : String) : EIO LeanPq.Error CachedStatement := do
+  c.followBackend
+  let use ← c.uses.modifyGet fun n => (n + 1, n + 1)
+  match (← c.entries.get)[sql]? with
+  | some stmt =>
+    c.entries.modify (·.insert sql { stmt with lastUse := use })
+    return stmt
+  | none => c.prepare sql use
+
+/-- Parameter type OIDs of `sql`, as inferred by the server. -/
+def paramTypes (c : StatementCache) (sql : String) : EIO LeanPq.Error (Array UInt32) :=
+  return (← c.lookup sql).paramTypes
+
+/-- Executes `sql` as a cached prepared statement. When the server no longer knows the
+statement, it is prepared again and executed once more (outside of a transaction only,
+since the failure has aborted any open one). With `timeoutMs`, a statement still running
+after that long is canceled and fails with `Error.queryTimeout`. -/
+def exec (c : StatementCache) (sql : String) (params : Array Param := #[]) (resultFormat : Int := 0)
+    (timeoutMs : Option UInt32 := none) : EIO LeanPq.Error PGresult := do
+  let run (name : String) := match timeoutMs with
+    | some ms => PqExecPreparedTimeout c.conn name params ms resultFormat
+    | none => PqExecPrepared c.conn name params resultFormat
+  let stmt ← c.lookup sql
+  let res ← run stmt.name
+  if (← PqResultStatus res) != .fatalError then return res
+  if (← PqResultErrorField res DiagField.sqlstate) != unknownStatement then return res
+  if (← PqTransactionStatus c.conn) != .idle then return res
+  c.entries.modify (·.erase sql)
+  let stmt ← c.lookup sql
+  run stmt.name
+
+/-- Deallocates every cached statement. -/
+def clear (c : StatementCache) : EIO LeanPq.Error Unit := do
+  c.followBackend
+  for (sql, s) in ← c.entries.get do
+    c.deallocate s.name
+    c.entries.modify (·.erase sql)
+
+/-- Number of cached statements. -/
+def size (c : StatementCache) : BaseIO Nat :=
+  return (← c.entries.get).size
+
+end StatementCache
+
+end LeanPq
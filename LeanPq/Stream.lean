@@ -0,0 +1,113 @@
+/-
+Streaming row iteration in single-row or chunked-rows mode.
+https://www.postgresql.org/docs/current/libpq-single-row-mode.html
+-/
+import LeanPq.Extern
+
+namespace LeanPq
+
+open Extern
+
+/-- Options of a streamed query. -/
+structure StreamConfig where
+  /-- Maximum number of rows per batch. `1` selects single-row mode; larger values use
+  chunked-rows mode, which needs libpq 17 (older versions fall back to single rows). -/
+  chunkSize : Nat := 1000
+  /-- `1` requests binary results. -/
+  resultFormat : Int := 0
+  deriving Repr, Inhabited
+
+/--
+A query whose rows are received in batches instead of one buffered `PGresult`.
+
+Each batch is a `PGresult` holding at most `chunkSize` rows; it is freed as soon as the
+caller drops it, so memory stays bounded by one batch. The connection cannot run other
+commands until the stream is exhausted or closed.
+-/
+structure RowStream where
+  conn : Handle
+  /-- Whether chunked-rows mode was accepted (otherwise batches hold a single row). -/
+  chunked : Bool
+
+namespace RowStream
+
+/-- Sends `query` and switches the connection to single-row or chunked-rows mode. -/
+def start (conn : Handle) (query : String) (params : Array Param := #[]) (config : StreamConfig := {}) :
+    EIO LeanPq.Error RowStream := do
+  PqSendQueryParams conn query params config.resultFormat
+  let chunked ← if config.chunkSize > 1 then PqSetChunkedRowsMode conn config.chunkSize.toUInt32 else pure false
+  unless chunked do
+    unless (← PqSetSingleRowMode conn) do
+      throw (.otherError "Could not select single-row mode")
+  return { conn, chunked }
+
+/-- Asks the server to stop the query; the batches already sent are still delivered until
+the canceled result, which `close` discards. -/
+def cancel (s : RowStream) : EIO LeanPq.Error Unit :=
+  PqCancel s.conn
+
+/-- Discards every remaining result so the connection can be reused. -/
+partial def close (s : RowStream) : EIO LeanPq.Error Unit := do
+  match ← PqGetResult s.conn with
+  | some _ => close s
+  | none => return ()
+
+/-- How `next?` treats a result of the stream. -/
+inductive ResultKind where
+  /-- A batch of rows. -/
+  | batch
+  /-- The zero-row result that terminates the set. -/
+  | terminator
+  | failure
+  deriving BEq, Repr
+
+def resultKind : ExecStatus → ResultKind
+  | .singleTuple | .tuplesChunk => .batch
+  | .tuplesOk | .commandOk => .terminator
+  | _ => .failure
+
+/-- The error a failed result is reported as: `queryCanceled` when the query was canceled
+(SQLSTATE `query_canceled`, e.g. by `PqCancel`), `otherError` otherwise. -/
+def failureError (status : ExecStatus) (sqlstate msg : String) : LeanPq.Error :=
+  if sqlstate == "57014" then .queryCanceled msg else .otherError s!"{status}: {msg}"
+
+/-- Returns the next non-empty batch, or `none` once the query is complete. -/
+partial def next? (s : RowStream) : EIO LeanPq.Error (Option PGresult) := do
+  match ← PqGetResult s.conn with
+  | none => return none
+  | some res =>
+    let status ← PqResultStatus res
+    match resultKind status with
+    | .batch => return some res
+    | .terminator => next? s
+    | .failure =>
+      let msg ← PqResultErrorMessage res
+      let sqlstate ← PqResultErrorField res DiagField.sqlstate
+      close s
+      throw (failureError status sqlstate msg)
+
+/-- Folds over the batches; breaking out early, or an error thrown by `f`, cancels the query
+and drains what was already sent, instead of receiving every remaining row. -/
+partial def forIn {β : Type} (s : RowStream) (init : β) (f : PGresult → β → EIO LeanPq.Error (ForInStep β)) :
+    EIO LeanPq.Error β := do
+  match ← s.next? with
+  | none => return init
+  | some batch =>
+    -- A throwing `f` must not leave the connection in the middle of the query.
+    let step ← tryCatch (f batch init) fun e => do
+      try s.cancel catch _ => pure ()
+      try s.close catch _ => pure ()
+      throw e
+    match step with
+    | .done b =>
+      try s.cancel catch _ => pure ()
+      close s
+      return b
+    | .yield b => forIn s b f
+
+instance : ForIn (EIO LeanPq.Error) RowStream PGresult where
+  forIn s b f := s.forIn b f
+
+end RowStream
+
+end LeanPq
@@ -0,0 +1,216 @@
+/-
+Maps type OIDs (`PqFtype`, `PqParamtype`) back to `DataType`.
+Catalogs: https://www.postgresql.org/docs/current/catalog-pg-type.html
+-/
+import Std.Data.HashMap
+import Std.Data.HashSet
+import LeanPq.DataType
+import LeanPq.Extern
+
+namespace LeanPq
+
+open Extern
+
+/-- Built-in types, whose OIDs are fixed across servers.
+Source: `src/include/catalog/pg_type.dat` in the PostgreSQL tree. -/
+private def builtinScalars : List (UInt32 × DataType) := [
+  (16, .boolean), (17, .bytea), (20, .bigint), (21, .smallint), (23, .integer), (25, .text),
+  (26, .oid), (114, .json), (142, .xml), (600, .point), (601, .lseg), (602, .path), (603, .box),
+  (604, .polygon), (628, .line), (650, .cidr), (700, .real), (701, .double_precision),
+  (718, .circle), (790, .money), (829, .macaddr), (869, .inet), (1042, .character none),
+  (1043, .character_varying none), (1082, .date), (1083, .time none false),
+  (1114, .timestamp none false), (1184, .timestamp none true), (1186, .interval none none),
+  (1266, .time none true), (1560, .bit none), (1562, .bit_varying none),
+  (1700, .numeric none none), (2950, .uuid), (3220, .pg_lsn), (3614, .tsvector),
+  (3615, .tsquery), (3802, .jsonb), (2970, .txid_snapshot), (5038, .pg_snapshot),
+  -- Object identifier types
+  (24, .regproc), (2202, .regprocedure), (2203, .regoper), (2204, .regoperator),
+  (2205, .regclass), (2206, .regtype), (3734, .regconfig), (3769, .regdictionary),
+  (4089, .regnamespace), (4096, .regrole), (4191, .regcollation),
+  -- Ranges and multiranges
+  (3904, .int4range), (3926, .int8range), (3906, .numrange), (3908, .tsrange),
+  (3910, .tstzrange), (3912, .daterange), (4451, .int4multirange), (4536, .int8multirange),
+  (4532, .nummultirange), (4533, .tsmultirange), (4534, .tstzmultirange),
+  (4535, .datemultirange),
+  -- Pseudo-types
+  (2249, .record), (2275, .cstring), (2276, .any), (2277, .anyarray), (2278, .void),
+  (2279, .trigger), (3838, .event_trigger), (2280, .language_handler), (2281, .internal),
+  (2283, .anyelement), (2776, .anynonarray), (3500, .anyenum), (3831, .anyrange),
+  (4537, .anymultirange), (5077, .anycompatible), (5078, .anycompatiblearray),
+  (5079, .anycompatiblenonarray), (5080, .anycompatiblerange),
+  (4538, .anycompatiblemultirange), (3115, .fdw_handler), (269, .table_am_handler),
+  (325, .index_am_handler), (3310, .tsm_handler), (32, .pg_ddl_command), (705, .unknown)
+]
+
+/-- Array types of the built-in scalars, as (array OID, element OID). -/
+private def builtinArrays : List (UInt32 × UInt32) := [
+  (1000, 16), (1001, 17), (1016, 20), (1005, 21), (1007, 23), (1009, 25), (1028, 26),
+  (199, 114), (143, 142), (651, 650), (1021, 700), (1022, 701), (791, 790), (1040, 829),
+  (1041, 869), (1014, 1042), (1015, 1043), (1182, 1082), (1183, 1083), (1115, 1114),
+  (1185, 1184), (1187, 1186), (1270, 1266), (1561, 1560), (1563, 1562), (1231, 1700),
+  (2951, 2950), (3807, 3802)
+]
+
+/-- Built-in types by OID. -/
+def builtinTypes : Std.HashMap UInt32 DataType :=
+  let scalars := Std.HashMap.ofList builtinScalars
+  builtinArrays.foldl (init := scalars) fun acc (oid, elem) =>
+    match scalars[elem]? with
+    | some t => acc.insert oid (.array t none)
+    | none => acc
+
+/-- A type loaded from the catalogs. -/
+structure TypeInfo where
+  oid : UInt32
+  /-- Name as returned by `format_type`, schema-qualified when not on the search path. -/
+  name : String
+  dataType : DataType
+  /-- Labels of an enum, in sort order. -/
+  enumLabels : Array String := #[]
+  /-- Element type OID of an array, 0 otherwise. -/
+  elem : UInt32 := 0
+
+/-- A `pg_type` row, before resolution. -/
+structure RawType where
+  name : String
+  /-- `typtype`: `b`ase, `c`omposite, `d`omain, `e`num, `p`seudo, `r`ange, `m`ultirange. -/
+  kind : String
+  elem : UInt32
+  /-- Attributes of a composite, as (name, type OID). -/
+  attributes : Array (String × UInt32) := #[]
+  enumLabels : Array String := #[]
+
+/--
+Types of one database, by OID.
+
+Built-in types are answered from `builtinTypes`. Other types (enums, domains, composites
+made with `CREATE TYPE`, arrays of them) are loaded from `pg_type`, `pg_enum` and
+`pg_attribute` in three queries, once. The row types of tables, views and sequences are not
+loaded: every relation has one, and they would make up most of a large schema. An unknown
+OID reloads the catalogs, but only once until the next load so that a type missing from
+`DataType` does not cause a round trip on every lookup.
+
+A registry holds no connection, so one registry can serve every connection of a `Pool`
+to the same database.
+-/
+structure TypeRegistry where
+  types : IO.Ref (Std.HashMap UInt32 TypeInfo)
+  /-- OIDs looked up and not found since the last load. -/
+  missing : IO.Ref (Std.HashSet UInt32)
+
+namespace TypeRegistry
+
+/-- Creates an empty registry; catalogs are loaded on the first unknown OID. -/
+def new : BaseIO TypeRegistry := do
+  let types ← IO.mkRef {}
+  let missing ← IO.mkRef {}
+  return { types, missing }
+
+private def query (conn : Handle) (sql : String) : EIO LeanPq.Error (Array (Array String)) := do
+  let res ← PqExec conn sql
+  let status ← PqResultStatus res
+  unless status == .tuplesOk do
+    let msg ← PqResultErrorMessage res
+    throw (.otherError s!"{status}: {msg}")
+  let rows ← PqFetchAll res
+  return rows.map (·.map (·.getD ""))
+
+private def toOid (s : String) : UInt32 := s.toNat!.toUInt32
+
+/-- Resolves `oid` against the built-in types and the loaded rows; `fuel` bounds the
+nesting of arrays and composites. -/
+def resolve (raw : Std.HashMap UInt32 RawType) : Nat → UInt32 → Option DataType
+  | 0, _ => none
+  | fuel + 1, oid =>
+    match builtinTypes[oid]? with
+    | some t => some t
+    | none => do
+      let r ← raw[oid]?
+      match r.kind with
+      | "e" => some (.enum r.name)
+      | "d" => some (.domain r.name)
+      | "c" =>
+        let fields := r.attributes.toList.map fun (name, type) =>
+          (name, (resolve raw fuel type).getD .unknown)
+        some (.composite r.name fields)
+      | _ =>
+        if r.elem != 0 then
+          return .array (← resolve raw fuel r.elem) none
+        none
+
+/-- Loads every non built-in type of the database `conn` is connected to. -/
+def load (r : TypeRegistry) (conn : Handle) : EIO LeanPq.Error Unit := do
+  let types ← query conn
+    "SELECT t.oid, format_type(t.oid, NULL), t.typtype, t.typelem FROM pg_type t \
+     WHERE (t.oid >= 16384 OR (t.typcategory = 'A' AND t.typelem <> 0)) \
+       AND (t.typrelid = 0 OR EXISTS \
+         (SELECT 1 FROM pg_class c WHERE c.oid = t.typrelid AND c.relkind = 'c'))"
+  let mut raw : Std.HashMap UInt32 RawType := {}
+  for row in types do
+    if let #[oid, name, kind, elem] := row then
+      raw := raw.insert (toOid oid) { name, kind, elem := toOid elem }
+  let labels ← query conn
+    "SELECT enumtypid, enumlabel FROM pg_enum ORDER BY enumtypid, enumsortorder"
+  for row in labels do
+    if let #[oid, label] := row then
+      raw := raw.modify (toOid oid) fun t => { t with enumLabels := t.enumLabels.push label }
+  let attributes ← query conn
+    "SELECT t.oid, a.attname, a.atttypid FROM pg_type t \
+     JOIN pg_class c ON c.oid = t.typrelid AND c.relkind = 'c' \
+     JOIN pg_attribute a ON a.attrelid = t.typrelid \
+     WHERE t.typtype = 'c' AND t.oid >= 16384 AND a.attnum > 0 AND NOT a.attisdropped \
+     ORDER BY t.oid, a.attnum"
+  for row in attributes do
+    if let #[oid, name, type] := row then
+      raw := raw.modify (toOid oid) fun t => { t with attributes := t.attributes.push (name, toOid type) }
+  let resolved := raw.fold (init := {}) fun acc oid t =>
+    match resolve raw 16 oid with
+    | some dataType => acc.insert oid { oid, name := t.name, dataType, enumLabels := t.enumLabels, elem := t.elem }
+    | none => acc
+  r.types.set resolved
+  r.missing.set {}
+
+/-- Looks `oid` up without querying the server. -/
+def find? (r : TypeRegistry) (oid : UInt32) : BaseIO (Option DataType) := do
+  match builtinTypes[oid]? with
+  | some t => return some t
+  | none => return ((← r.types.get)[oid]?).map (·.dataType)
+
+/-- The catalog entry of a non built-in type, loading the catalogs if `oid` is unknown. -/
+def info? (r : TypeRegistry) (conn : Handle) (oid : UInt32) : EIO LeanPq.Error (Option TypeInfo) := do
+  if let some t := (← r.types.get)[oid]? then return some t
+  if builtinTypes.contains oid || (← r.missing.get).contains oid then return none
+  r.load conn
+  let found := (← r.types.get)[oid]?
+  if found.isNone then
+    r.missing.modify (·.insert oid)
+  return found
+
+/-- The `DataType` of `oid`, loading the catalogs if it is unknown. -/
+def lookup (r : TypeRegistry) (conn : Handle) (oid : UInt32) : EIO LeanPq.Error (Option DataType) := do
+  match ← r.find? oid with
+  | some t => return some t
+  | none => return (← r.info? conn oid).map (·.dataType)
+
+/-- The `DataType` of every column of `result`. -/
+def resultTypes (r : TypeRegistry) (conn : Handle) (result : PGresult) :
+    EIO LeanPq.Error (Array (Option DataType)) := do
+  let n ← PqNfields result
+  (List.range n.toNat).toArray.mapM fun i => do
+    r.lookup conn (← PqFtype result i).toUInt32
+
+/-- The `DataType` of every parameter of a described statement (`PqDescribePrepared`). -/
+def paramTypes (r : TypeRegistry) (conn : Handle) (description : PGresult) :
+    EIO LeanPq.Error (Array (Option DataType)) := do
+  let n ← PqNparams description
+  (List.range n.toNat).toArray.mapM fun i => do
+    r.lookup conn (← PqParamtype description i).toUInt32
+
+/-- Forgets the loaded types, e.g. after DDL; they are reloaded on the next unknown OID. -/
+def invalidate (r : TypeRegistry) : BaseIO Unit := do
+  r.types.set {}
+  r.missing.set {}
+
+end TypeRegistry
+
+end LeanPq
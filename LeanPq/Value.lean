@@ -0,0 +1,165 @@
+/-
+Typed field values decoded natively from result tuples.
+Binary layouts: https://www.postgresql.org/docs/current/protocol-overview.html#PROTOCOL-FORMAT-CODES
+-/
+
+namespace LeanPq
+
+/-- Built-in type OIDs, as returned by `PqFtype` / `PqParamtype`.
+Source: `src/include/catalog/pg_type.dat` in the PostgreSQL tree. -/
+namespace Oid
+
+def bool : UInt32 := 16
+def bytea : UInt32 := 17
+def char : UInt32 := 18
+def name : UInt32 := 19
+def int8 : UInt32 := 20
+def int2 : UInt32 := 21
+def int4 : UInt32 := 23
+def text : UInt32 := 25
+def oid : UInt32 := 26
+def json : UInt32 := 114
+def xml : UInt32 := 142
+def float4 : UInt32 := 700
+def float8 : UInt32 := 701
+def bpchar : UInt32 := 1042
+def varchar : UInt32 := 1043
+def date : UInt32 := 1082
+def time : UInt32 := 1083
+def timestamp : UInt32 := 1114
+def timestamptz : UInt32 := 1184
+def numeric : UInt32 := 1700
+def uuid : UInt32 := 2950
+def jsonb : UInt32 := 3802
+def record : UInt32 := 2249
+
+end Oid
+
+/--
+A single field value decoded from a `PGresult`.
+
+The variant is chosen from the column type OID (`PqFtype`). With binary results
+(`resultFormat = 1`) every listed type is decoded straight from network byte order;
+with text results only `bool`, integers and floats are parsed, everything else is `text`.
+Binary arrays of the built-in types and anonymous records (`ROW(...)`) are decoded
+recursively; arrays and composites of other types are decoded by `PqGetArray` and
+`PqGetRecord`, which take the field's shape from the caller.
+-/
+inductive Value where
+  /-- SQL NULL. -/
+  | null
+  /-- `bool`. -/
+  | bool (value : Bool)
+  /-- `int2`, `int4`, `int8` and `oid`, widened to 64 bits. -/
+  | int (value : Int64)
+  /-- `float4` and `float8`, widened to double precision. -/
+  | float (value : Float)
+  /-- `numeric`, as its exact decimal representation (`NaN`, `Infinity` and `-Infinity` included). -/
+  | numeric (value : String)
+  /-- `date`, in days since 1970-01-01. -/
+  | date (days : Int32)
+  /-- `timestamp`, in microseconds since 1970-01-01 00:00:00. -/
+  | timestamp (micros : Int64)
+  /-- `timestamptz`, in microseconds since 1970-01-01 00:00:00 UTC. -/
+  | timestamptz (micros : Int64)
+  /-- `uuid`, as its 16 raw bytes. -/
+  | uuid (bytes : ByteArray)
+  /-- `bytea`, as raw bytes. In binary results, also any type without a decoder of its own
+  (`interval`, `inet`, ranges, ...), as its wire bytes. -/
+  | bytea (bytes : ByteArray)
+  /-- Text types (`text`, `varchar`, `json`, `jsonb`, ...). In text results, also every type
+  that is not a boolean or a number, as its text. -/
+  | text (value : String)
+  /-- An array: element type OID, size of each dimension and the elements in row-major
+  order. Lower bounds are not kept. -/
+  | array (elemOid : UInt32) (dims : Array Nat) (elements : Array Value)
+  /-- A composite value: the type OID and value of each field. -/
+  | record (types : Array UInt32) (fields : Array Value)
+  deriving Inhabited
+
+/--
+Storage of a column decoded in one native pass.
+
+Fixed-width types land in packed buffers without any per-value allocation.
+-/
+inductive ColumnData where
+  /-- Packed little-endian 64-bit integers, 8 bytes per row: integers, `bool` (0/1),
+  `date` (days) and timestamps (µs), with the same epochs as `Value`. -/
+  | int64 (values : ByteArray)
+  /-- `float4` and `float8` values. -/
+  | float64 (values : FloatArray)
+  /-- Every other type, one `Value` per row. -/
+  | boxed (values : Array Value)
+  deriving Inhabited
+
+/-- A whole result column decoded by `PqDecodeColumn`. -/
+structure Column where
+  /-- Type OID of the column. -/
+  oid : UInt32
+  /-- One byte per row, non-zero when the field is SQL NULL. -/
+  nulls : ByteArray
+  /-- The decoded values; NULL rows hold `0` in packed buffers. -/
+  data : ColumnData
+  deriving Inhabited
+
+/-- An array field decoded by `PqGetArray`. Elements are stored like a `Column`: fixed-width
+types packed (`int64`/`float64`, NULL elements hold `0`), every other type `boxed`. -/
+structure PackedArray where
+  elemOid : UInt32
+  /-- Size of each dimension; elements are in row-major order. -/
+  dims : Array Nat
+  /-- One byte per element, non-zero when it is SQL NULL. -/
+  nulls : ByteArray
+  data : ColumnData
+  deriving Inhabited
+
+namespace PackedArray
+
+/-- Views the elements as a column, to read them with `Column.get`. -/
+def toColumn (a : PackedArray) : Column :=
+  { oid := a.elemOid, nulls := a.nulls, data := a.data }
+
+/-- Number of elements. -/
+def size (a : PackedArray) : Nat := a.nulls.size
+
+end PackedArray
+
+namespace Column
+
+/-- Number of rows in the column. -/
+def size (c : Column) : Nat := c.nulls.size
+
+/-- Tests whether the field at `row` is SQL NULL. -/
+def isNull (c : Column) (row : Nat) : Bool := c.nulls.get! row != 0
+
+/-- Reads the packed 64-bit integer at `row` (only meaningful for `ColumnData.int64`). -/
+def getInt64! (c : Column) (row : Nat) : Int64 :=
+  match c.data with
+  | .int64 values =>
+    let off := row * 8
+    -- One bounds check for the 8 bytes, then unchecked reads.
+    if h : off + 8 ≤ values.size then
+      let b (k : Nat) (hk : k < 8) : UInt64 := (values[off + k]'(by omega)).toUInt64 <<< (8 * k).toUInt64
+      (b 0 (by decide) ||| b 1 (by decide) ||| b 2 (by decide) ||| b 3 (by decide) |||
+        b 4 (by decide) ||| b 5 (by decide) ||| b 6 (by decide) ||| b 7 (by decide)).toInt64
+    else
+      panic! "Column.getInt64!: row out of range"
+  | _ => panic! "Column.getInt64!: column is not packed as int64"
+
+/-- Returns the field at `row` as a `Value`. -/
+def get (c : Column) (row : Nat) : Value :=
+  if c.isNull row then .null else
+  match c.data with
+  | .float64 values => .float (values.get! row)
+  | .boxed values => values[row]!
+  | .int64 _ =>
+    let v := c.getInt64! row
+    if c.oid == Oid.bool then .bool (v != 0)
+    else if c.oid == Oid.date then .date v.toInt32
+    else if c.oid == Oid.timestamp then .timestamp v
+    else if c.oid == Oid.timestamptz then .timestamptz v
+    else .int v
+
+end Column
+
+end LeanPq
@@ -1,8 +1,29 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // pipe2
+#endif
 #include <lean/lean.h>
 #include <libpq-fe.h>
+#include <libpq/libpq-fs.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#define LEAN_PQ_USE_EPOLL 1
+#else
+#define LEAN_PQ_USE_EPOLL 0
+#endif
 
 /*
 LibPQ documentation:
@@ -12,21 +33,146 @@ https://gist.github.com/ydewit/7ab62be1bd0fea5bd53b48d23914dd6b#4-scalar-values-
 */
 
 
-#define DEBUG 1
+// Build with -DDEBUG=1 to log every connection and result allocation to stderr.
+#ifndef DEBUG
+#define DEBUG 0
+#endif
+
+// Instrumentation
+// Counters are updated with relaxed atomics, so reading a snapshot never blocks a query.
+
+// Bucket i counts latencies below 2^i microseconds; the last bucket is open-ended.
+#define LEAN_PQ_LATENCY_BUCKETS 32
+// Size of the per-connection statement table and of the keys it stores.
+#define LEAN_PQ_STMT_SLOTS 64
+#define LEAN_PQ_STMT_KEY_MAX 64
+
+struct stats {
+  _Atomic uint64_t queries;
+  _Atomic uint64_t errors;
+  _Atomic uint64_t rows;
+  _Atomic uint64_t bytes_sent;
+  _Atomic uint64_t bytes_received;
+  _Atomic uint64_t results_allocated;
+  _Atomic uint64_t results_freed;
+  _Atomic uint64_t total_micros;
+  _Atomic uint64_t latency[LEAN_PQ_LATENCY_BUCKETS];
+};
+
+typedef struct stats Stats;
+
+// Statistics of one statement, keyed by the hash and length of the statement name or the
+// full SQL text. Only the first LEAN_PQ_STMT_KEY_MAX bytes are kept, for display.
+struct stmt_stats {
+  _Atomic uint64_t hash; // 0 while the slot is free
+  _Atomic int ready;     // set once `key` is written
+  size_t full_length;
+  size_t key_length;
+  char key[LEAN_PQ_STMT_KEY_MAX];
+  Stats stats;
+};
+
+typedef struct stmt_stats StmtStats;
+
+static Stats pq_global_stats;
+
+static inline void pq_stat_add(_Atomic uint64_t *counter, uint64_t v) {
+  atomic_fetch_add_explicit(counter, v, memory_order_relaxed);
+}
+
+static inline uint64_t pq_now_micros(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+// 64-bit FNV-1a
+static inline uint64_t pq_hash_bytes(const void *data, size_t length) {
+  const unsigned char *p = (const unsigned char *)data;
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; i++) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+static void pq_stats_add_query(Stats *stats, uint64_t micros, uint64_t bytes_sent) {
+  unsigned bucket = 0;
+  while (bucket < LEAN_PQ_LATENCY_BUCKETS - 1 && micros >= ((uint64_t)1 << bucket))
+    bucket++;
+  pq_stat_add(&stats->queries, 1);
+  pq_stat_add(&stats->bytes_sent, bytes_sent);
+  pq_stat_add(&stats->total_micros, micros);
+  pq_stat_add(&stats->latency[bucket], 1);
+}
+
+static void pq_stats_add_result(Stats *stats, const PGresult *pg_result) {
+  pq_stat_add(&stats->results_allocated, 1);
+  pq_stat_add(&stats->rows, (uint64_t)PQntuples(pg_result));
+  pq_stat_add(&stats->bytes_received, (uint64_t)PQresultMemorySize(pg_result));
+  ExecStatusType status = PQresultStatus(pg_result);
+  if (status == PGRES_BAD_RESPONSE || status == PGRES_FATAL_ERROR)
+    pq_stat_add(&stats->errors, 1);
+}
 
-#define LEAN_PQ_CONNECTION_FAILED_INIT 100
+static void pq_stats_reset(Stats *stats) {
+  _Atomic uint64_t *counters = &stats->queries;
+  size_t n = sizeof(Stats) / sizeof(_Atomic uint64_t);
+  for (size_t i = 0; i < n; i++)
+    atomic_store_explicit(&counters[i], 0, memory_order_relaxed);
+}
 
 // [Database Connection Control Functions](https://www.postgresql.org/docs/current/libpq-connect.html)
 
+// Cancel requests go through PGcancelConn (non-blocking, libpq 17) or PGcancel before that.
+#ifdef LIBPQ_HAS_ASYNC_CANCEL
+typedef PGcancelConn CancelHandle;
+#else
+typedef PGcancel CancelHandle;
+#endif
+
 struct connection {
   // The libpq connection handle.
   PGconn *pg_conn;
+  Stats stats;
+  // Per-statement statistics, allocated on first use.
+  _Atomic(StmtStats *) stmts;
+  // Slow-query callback (`String → UInt64 → BaseIO Unit`), or NULL, and its threshold.
+  // Both are only accessed under `slow_lock`, since queries may run on other threads.
+  pthread_mutex_t slow_lock;
+  lean_object *slow_callback;
+  uint64_t slow_threshold_micros;
+  // Destination of PQtrace, or NULL.
+  FILE *trace;
+  // Created on the thread owning the connection (at connect and reset) and only used under
+  // `cancel_lock` afterwards, so that a query can be canceled from any thread.
+  pthread_mutex_t cancel_lock;
+  CancelHandle *cancel;
 };
 
 typedef struct connection Connection;
 
 static lean_external_class *pq_connection_external_class = NULL;
 
+static CancelHandle* pq_cancel_create(PGconn *pg_conn) {
+#ifdef LIBPQ_HAS_ASYNC_CANCEL
+  return PQcancelCreate(pg_conn);
+#else
+  return PQgetCancel(pg_conn);
+#endif
+}
+
+static void pq_cancel_free(CancelHandle *cancel) {
+  if (cancel == NULL)
+    return;
+#ifdef LIBPQ_HAS_ASYNC_CANCEL
+  PQcancelFinish(cancel);
+#else
+  PQfreeCancel(cancel);
+#endif
+}
+
 static void pq_connection_finalizer(void *h) {
   Connection *connection = (Connection *)h;
 #if DEBUG
@@ -35,10 +181,29 @@ static void pq_connection_finalizer(void *h) {
   // Closes the connection to the server. Also frees memory used by the PGconn
   // object.
   PQfinish(connection->pg_conn);
+  if (connection->trace)
+    fclose(connection->trace);
+  if (connection->slow_callback)
+    lean_dec(connection->slow_callback);
+  free(atomic_load(&connection->stmts));
+  pq_cancel_free(connection->cancel);
+  pthread_mutex_destroy(&connection->cancel_lock);
+  pthread_mutex_destroy(&connection->slow_lock);
   free(connection);
 }
 
-static void pq_connection_foreach(void *mod, b_lean_obj_arg fn) {}
+static void pq_connection_foreach(void *h, b_lean_obj_arg fn) {
+  Connection *connection = (Connection *)h;
+  pthread_mutex_lock(&connection->slow_lock);
+  lean_object *callback = connection->slow_callback;
+  if (callback)
+    lean_inc(callback);
+  pthread_mutex_unlock(&connection->slow_lock);
+  if (callback) {
+    lean_inc(fn);
+    lean_dec(lean_apply_1(fn, callback));
+  }
+}
 
 lean_obj_res pq_connection_wrap_handle(Connection *hconn) {
   return lean_alloc_external(pq_connection_external_class, hconn);
@@ -57,25 +222,65 @@ static void initialize_pq_connection_external_class() {
 
 // Error management
 
+// Constructor tags of `LeanPq.Error`.
+#define LEAN_PQ_ERROR_CONNECTION 0
+#define LEAN_PQ_ERROR_OTHER 1
+#define LEAN_PQ_ERROR_QUERY_TIMEOUT 2
+#define LEAN_PQ_ERROR_QUERY_CANCELED 3
+
+// `connectionError` has a single UInt32 field, stored unboxed.
 static lean_object* pq_connection_error(const uint32_t code) {
-  lean_object* code_obj = lean_box_uint32(code);
-  lean_object* connect_err = lean_alloc_ctor(0, 1, 0); // IOError constructor
-  lean_ctor_set(connect_err, 0, code_obj);
+  lean_object* connect_err = lean_alloc_ctor(LEAN_PQ_ERROR_CONNECTION, 0, sizeof(uint32_t));
+  lean_ctor_set_uint32(connect_err, 0, code);
   return connect_err;
 }
 
 static lean_object* pq_other_error(const char* msg) {
   lean_object* msg_obj = lean_mk_string(msg);
-  lean_object* other_err = lean_alloc_ctor(1, 1, 0); // IOError constructor
+  lean_object* other_err = lean_alloc_ctor(LEAN_PQ_ERROR_OTHER, 1, 0);
   lean_ctor_set(other_err, 0, msg_obj);
   return other_err;
 }
 
+static lean_object* pq_query_timeout_error(uint32_t timeout_ms) {
+  lean_object* timeout_err = lean_alloc_ctor(LEAN_PQ_ERROR_QUERY_TIMEOUT, 0, sizeof(uint32_t));
+  lean_ctor_set_uint32(timeout_err, 0, timeout_ms);
+  return timeout_err;
+}
+
+static lean_object* pq_query_canceled_error(const char* msg) {
+  lean_object* canceled_err = lean_alloc_ctor(LEAN_PQ_ERROR_QUERY_CANCELED, 1, 0);
+  lean_ctor_set(canceled_err, 0, lean_mk_string(msg));
+  return canceled_err;
+}
+
+// Wraps a freshly created PGconn into its external object. A connection that
+// failed is closed and reported with its status.
+static lean_obj_res pq_connection_io(PGconn *pg_conn) {
+  initialize_pq_connection_external_class();
+  ConnStatusType status = PQstatus(pg_conn);
+  if (status != CONNECTION_OK) {
+    PQfinish(pg_conn);
+    return lean_io_result_mk_error(pq_connection_error((uint32_t)status));
+  }
+  Connection *connection = (Connection *)calloc(1, sizeof *connection); // Allocate our wrapper
+  if (!connection) {
+    PQfinish(pg_conn);
+    return lean_io_result_mk_error(pq_other_error("Memory allocation for connection failed"));
+  }
+  connection->pg_conn = pg_conn;
+  pthread_mutex_init(&connection->cancel_lock, NULL);
+  pthread_mutex_init(&connection->slow_lock, NULL);
+  connection->cancel = pq_cancel_create(pg_conn);
+#if DEBUG
+  fprintf(stderr, "Connection %p\n", pg_conn);
+#endif
+  return lean_io_result_mk_ok(pq_connection_wrap_handle(connection));
+}
+
 // PQconnectdbParams - Makes a new connection to the database server using parameter arrays
 // Documentation: https://www.postgresql.org/docs/current/libpq-connect.html#LIBPQ-PQCONNECTDBPARAMS
 LEAN_EXPORT lean_obj_res lean_pq_connect_db_params(b_lean_obj_arg keywords, b_lean_obj_arg values, b_lean_obj_arg expand_dbname) {
-  // Initialize the external class for connections
-  initialize_pq_connection_external_class();
   size_t size = lean_array_size(keywords);
   const char **keywords_cstr = (const char **)malloc(size * sizeof(const char *));
   const char **values_cstr = (const char **)malloc(size * sizeof(const char *));
@@ -89,41 +294,15 @@ LEAN_EXPORT lean_obj_res lean_pq_connect_db_params(b_lean_obj_arg keywords, b_le
   PGconn *pg_conn = PQconnectdbParams(keywords_cstr, values_cstr, expand_dbname_int); // Create the libpq handle
   free(keywords_cstr);
   free(values_cstr);
-  ConnStatusType status = PQstatus(pg_conn);
-  // If the connection is not successful, return an error
-  if (status != CONNECTION_OK)
-    return lean_io_result_mk_error(pq_connection_error((uint32_t)status));
-  Connection *connection = (Connection *)malloc(sizeof *connection); // Allocate our wrapper
-  if (!connection)
-    return lean_io_result_mk_error(pq_other_error("Memory allocation for connection failed"));
-  // Initialize all fields to safe defaults
-  connection->pg_conn = pg_conn;
-#if DEBUG
-  fprintf(stderr, "Connection %p\n", pg_conn);
-#endif
-  return lean_io_result_mk_ok(pq_connection_wrap_handle(connection));
+  return pq_connection_io(pg_conn);
 }
 
 // PQconnectdb - Makes a new connection to the database server using a connection string
 // Documentation: https://www.postgresql.org/docs/current/libpq-connect.html#LIBPQ-PQCONNECTDB
 LEAN_EXPORT lean_obj_res lean_pq_connect_db(b_lean_obj_arg conninfo) {
-  // Initialize the external class for connections
-  initialize_pq_connection_external_class();
   const char *conninfo_cstr = lean_string_cstr(conninfo); // Convert Lean string to C string
   PGconn *pg_conn = PQconnectdb(conninfo_cstr); // Create the libpq handle
-  ConnStatusType status = PQstatus(pg_conn);
-  // If the connection is not successful, return an error
-  if (status != CONNECTION_OK)
-    return lean_io_result_mk_error(pq_connection_error((uint32_t)status));
-  Connection *connection = (Connection *)malloc(sizeof *connection); // Allocate our wrapper
-  if (!connection)
-    return lean_io_result_mk_error(lean_box(LEAN_PQ_CONNECTION_FAILED_INIT));
-  // Initialize all fields to safe defaults
-  connection->pg_conn = pg_conn;
-#if DEBUG
-  fprintf(stderr, "Connection %p\n", pg_conn);
-#endif
-  return lean_io_result_mk_ok(pq_connection_wrap_handle(connection));
+  return pq_connection_io(pg_conn);
 }
 
 // PQreset - Resets the communication channel with the server
@@ -131,6 +310,11 @@ LEAN_EXPORT lean_obj_res lean_pq_connect_db(b_lean_obj_arg conninfo) {
 LEAN_EXPORT lean_obj_res lean_pq_reset(b_lean_obj_arg conn) {
   Connection *connection = pq_connection_get_handle(conn);
   PQreset(connection->pg_conn);
+  // The new backend has a new cancel key.
+  pthread_mutex_lock(&connection->cancel_lock);
+  pq_cancel_free(connection->cancel);
+  connection->cancel = pq_cancel_create(connection->pg_conn);
+  pthread_mutex_unlock(&connection->cancel_lock);
   return lean_io_result_mk_ok(lean_box(0));
 }
 
@@ -258,8 +442,16 @@ LEAN_EXPORT lean_obj_res lean_pq_error_message(b_lean_obj_arg conn) {
 LEAN_EXPORT lean_obj_res lean_pq_socket(b_lean_obj_arg conn) {
   Connection *connection = pq_connection_get_handle(conn);
   int socket = PQsocket(connection->pg_conn);
-  lean_object * socket_boxed = lean_box_uint32((uint32_t)socket);
-  return lean_io_result_mk_ok(socket_boxed);
+  // -1 when there is no open connection
+  return lean_io_result_mk_ok(lean_int_to_int(socket));
+}
+
+// PQbackendPID - Returns the process ID of the backend process handling this connection
+// Documentation: https://www.postgresql.org/docs/current/libpq-status.html#LIBPQ-PQBACKENDPID
+LEAN_EXPORT lean_obj_res lean_pq_backend_pid(b_lean_obj_arg conn) {
+  Connection *connection = pq_connection_get_handle(conn);
+  int pid = PQbackendPID(connection->pg_conn);
+  return lean_io_result_mk_ok(lean_int_to_int(pid));
 }
 
 // [Command Execution Functions](https://www.postgresql.org/docs/current/libpq-exec.html)
@@ -282,6 +474,7 @@ static void pq_result_finalizer(void *h) {
 #endif
   PQclear(result->pg_result);
   free(result);
+  pq_stat_add(&pq_global_stats.results_freed, 1);
 }
 
 static void pq_result_foreach(void *mod, b_lean_obj_arg fn) {}
@@ -301,26 +494,206 @@ static void initialize_pq_result_external_class() {
   }
 }
 
+// Wraps a freshly returned PGresult into its external object. A NULL result
+// (out of memory, lost connection) is reported with the connection error message.
+static lean_obj_res pq_result_io(Connection *connection, PGresult *pg_result) {
+  initialize_pq_result_external_class();
+  if (pg_result == NULL) {
+    pq_stat_add(&pq_global_stats.errors, 1);
+    pq_stat_add(&connection->stats.errors, 1);
+    return lean_io_result_mk_error(pq_other_error(PQerrorMessage(connection->pg_conn)));
+  }
+  pq_stats_add_result(&pq_global_stats, pg_result);
+  pq_stats_add_result(&connection->stats, pg_result);
+  Result *result = (Result *)malloc(sizeof *result);
+  if (!result) {
+    PQclear(pg_result);
+    pq_stat_add(&pq_global_stats.results_freed, 1);
+    return lean_io_result_mk_error(pq_other_error("Memory allocation for result failed"));
+  }
+  result->pg_result = pg_result;
+#if DEBUG
+  fprintf(stderr, "Result %p\n", pg_result);
+#endif
+  return lean_io_result_mk_ok(pq_result_wrap_handle(result));
+}
+
+// Returns the statistics slot of a statement, claiming a free one for a new key.
+// NULL when the table is full: the query then only counts in the totals.
+static StmtStats* pq_stmt_stats(Connection *connection, const char *key, size_t key_length) {
+  StmtStats *table = atomic_load_explicit(&connection->stmts, memory_order_acquire);
+  if (!table) {
+    StmtStats *fresh = (StmtStats *)calloc(LEAN_PQ_STMT_SLOTS, sizeof *fresh);
+    if (!fresh)
+      return NULL;
+    StmtStats *expected = NULL;
+    if (atomic_compare_exchange_strong(&connection->stmts, &expected, fresh)) {
+      table = fresh;
+    } else {
+      free(fresh);
+      table = expected;
+    }
+  }
+  // Statements that only differ after the displayed prefix still get their own slots.
+  uint64_t h = pq_hash_bytes(key, key_length) | 1;
+  size_t full_length = key_length;
+  if (key_length > LEAN_PQ_STMT_KEY_MAX)
+    key_length = LEAN_PQ_STMT_KEY_MAX;
+  for (size_t probe = 0; probe < LEAN_PQ_STMT_SLOTS; probe++) {
+    StmtStats *slot = &table[(h + probe) % LEAN_PQ_STMT_SLOTS];
+    uint64_t current = atomic_load_explicit(&slot->hash, memory_order_acquire);
+    if (current == 0) {
+      uint64_t expected = 0;
+      if (atomic_compare_exchange_strong(&slot->hash, &expected, h)) {
+        memcpy(slot->key, key, key_length);
+        slot->full_length = full_length;
+        slot->key_length = key_length;
+        atomic_store_explicit(&slot->ready, 1, memory_order_release);
+        return slot;
+      }
+      current = expected;
+    }
+    if (current == h && atomic_load_explicit(&slot->ready, memory_order_acquire) &&
+        slot->full_length == full_length && memcmp(slot->key, key, key_length) == 0)
+      return slot;
+  }
+  return NULL;
+}
+
+// Records a completed round trip: latency and bytes sent in the global, connection and
+// statement statistics, then the slow-query callback when the threshold is reached.
+// `key` is the statement name, or the SQL text for unnamed statements.
+static void pq_record_query(Connection *connection, const char *key, size_t key_length,
+                            size_t bytes_sent, uint64_t started, const PGresult *pg_result) {
+  uint64_t micros = pq_now_micros() - started;
+  pq_stats_add_query(&pq_global_stats, micros, bytes_sent);
+  pq_stats_add_query(&connection->stats, micros, bytes_sent);
+  StmtStats *slot = pq_stmt_stats(connection, key, key_length);
+  if (slot) {
+    pq_stats_add_query(&slot->stats, micros, bytes_sent);
+    if (pg_result)
+      pq_stats_add_result(&slot->stats, pg_result);
+    else
+      pq_stat_add(&slot->stats.errors, 1);
+  }
+  // The callback is referenced under the lock and called outside of it, so that it may
+  // replace itself.
+  pthread_mutex_lock(&connection->slow_lock);
+  lean_object *callback = connection->slow_callback;
+  if (callback && micros >= connection->slow_threshold_micros)
+    lean_inc(callback);
+  else
+    callback = NULL;
+  pthread_mutex_unlock(&connection->slow_lock);
+  if (callback)
+    lean_dec(lean_apply_3(callback, lean_mk_string_from_bytes(key, key_length),
+                          lean_box_uint64(micros), lean_io_mk_world()));
+}
+
+// Parameter marshaling
+
+// Statements with up to this many parameters are marshaled without any heap allocation.
+#define LEAN_PQ_PARAMS_STACK 16
+
+// Constructor tags of `LeanPq.Param`.
+#define LEAN_PQ_PARAM_NULL 0
+#define LEAN_PQ_PARAM_TEXT 1
+#define LEAN_PQ_PARAM_BINARY 2
+
+// The parallel arrays libpq expects, pointing into the Lean parameter objects.
+struct params {
+  int n;
+  Oid *types;
+  const char **values;
+  int *lengths;
+  int *formats;
+  // Total size of the parameter values, for instrumentation.
+  size_t bytes;
+  void *heap;
+  Oid types_buf[LEAN_PQ_PARAMS_STACK];
+  const char *values_buf[LEAN_PQ_PARAMS_STACK];
+  int lengths_buf[LEAN_PQ_PARAMS_STACK];
+  int formats_buf[LEAN_PQ_PARAMS_STACK];
+};
+
+typedef struct params Params;
+
+// Fills `params` from an `Array Param`. The pointers borrow from `param_array`,
+// which must stay alive until the statement has been sent.
+static int pq_params_init(Params *params, b_lean_obj_arg param_array) {
+  size_t n = lean_array_size(param_array);
+  if (n > INT_MAX)
+    return 0;
+  params->n = (int)n;
+  params->bytes = 0;
+  params->heap = NULL;
+  if (n <= LEAN_PQ_PARAMS_STACK) {
+    params->types = params->types_buf;
+    params->values = params->values_buf;
+    params->lengths = params->lengths_buf;
+    params->formats = params->formats_buf;
+  } else {
+    // A single block for the four arrays.
+    size_t stride = sizeof(const char *) + sizeof(Oid) + 2 * sizeof(int);
+    char *heap = (char *)malloc(n * stride);
+    if (!heap)
+      return 0;
+    params->heap = heap;
+    params->values = (const char **)heap;
+    params->types = (Oid *)(heap + n * sizeof(const char *));
+    params->lengths = (int *)(heap + n * (sizeof(const char *) + sizeof(Oid)));
+    params->formats = (int *)(heap + n * (sizeof(const char *) + sizeof(Oid) + sizeof(int)));
+  }
+  for (size_t i = 0; i < n; i++) {
+    lean_object *param = lean_array_get_core(param_array, i);
+    switch (lean_ptr_tag(param)) {
+      case LEAN_PQ_PARAM_TEXT: {
+        lean_object *value = lean_ctor_get(param, 0);
+        params->types[i] = (Oid)lean_ctor_get_uint32(param, sizeof(void *));
+        params->values[i] = lean_string_cstr(value);
+        params->lengths[i] = (int)(lean_string_size(value) - 1);
+        params->formats[i] = 0;
+        params->bytes += (size_t)params->lengths[i];
+        break;
+      }
+      case LEAN_PQ_PARAM_BINARY: {
+        lean_object *value = lean_ctor_get(param, 0);
+        params->types[i] = (Oid)lean_ctor_get_uint32(param, sizeof(void *));
+        params->values[i] = (const char *)lean_sarray_cptr(value);
+        params->lengths[i] = (int)lean_sarray_size(value);
+        params->formats[i] = 1;
+        params->bytes += (size_t)params->lengths[i];
+        break;
+      }
+      default:
+        params->types[i] = (Oid)lean_ctor_get_uint32(param, 0);
+        params->values[i] = NULL;
+        params->lengths[i] = 0;
+        params->formats[i] = 0;
+        break;
+    }
+  }
+  return 1;
+}
+
+static void pq_params_free(Params *params) {
+  free(params->heap);
+}
+
 // PQexec - Submits a command to the server and waits for the result
 // Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQEXEC
 LEAN_EXPORT lean_obj_res lean_pq_exec(b_lean_obj_arg conn, b_lean_obj_arg cmd) {
-  // Initialize the external class for results
-  initialize_pq_result_external_class();
   // Get the connection handle
   Connection *connection = pq_connection_get_handle(conn);
   // Convert the command to a C string
   const char * cmd_cstr = lean_string_cstr(cmd);
+  size_t cmd_length = lean_string_size(cmd) - 1;
   // Execute the command
+  uint64_t started = pq_now_micros();
   PGresult * pg_result = PQexec(connection->pg_conn, cmd_cstr);
-  Result *result = (Result *)malloc(sizeof *result);
-  if (!result)
-    return lean_io_result_mk_error(pq_other_error("Memory allocation for result failed"));
-  result->pg_result = pg_result;
-#if DEBUG
-  fprintf(stderr, "Result %p\n", pg_result);
-#endif
+  pq_record_query(connection, cmd_cstr, cmd_length, cmd_length, started, pg_result);
   // Return the result
-  return lean_io_result_mk_ok(pq_result_wrap_handle(result));
+  return pq_result_io(connection, pg_result);
 }
 
 // PQexecParams - Submits a command to the server and waits for the result, with the ability to pass parameters separately
@@ -328,186 +701,865 @@ LEAN_EXPORT lean_obj_res lean_pq_exec(b_lean_obj_arg conn, b_lean_obj_arg cmd) {
 LEAN_EXPORT lean_obj_res lean_pq_exec_params(
   b_lean_obj_arg conn,
   b_lean_obj_arg cmd,
-  b_lean_obj_arg nParams,
-  b_lean_obj_arg paramTypes,
-  b_lean_obj_arg paramValues,
-  b_lean_obj_arg paramLengths,
-  b_lean_obj_arg paramFormats,
+  b_lean_obj_arg param_array,
   b_lean_obj_arg resultFormat) {
-  // Initialize the external class for results
-  initialize_pq_result_external_class();
   // Get the connection handle
   Connection *connection = pq_connection_get_handle(conn);
   const char * cmd_cstr = lean_string_cstr(cmd);
-  int nParams_int = lean_unbox(nParams);
-  const Oid * paramTypes_oid = (const Oid *)lean_unbox(paramTypes);
-  const char * const * paramValues_cstr_array = (const char **)lean_unbox(paramValues);
-  const int * paramLengths_int = (const int *)lean_unbox(paramLengths);
-  const int * paramFormats_int = (const int *)lean_unbox(paramFormats);
   int resultFormat_int = lean_unbox(resultFormat);
-  PGresult * pg_result = PQexecParams(connection->pg_conn, cmd_cstr, nParams_int, paramTypes_oid, paramValues_cstr_array, paramLengths_int, paramFormats_int, resultFormat_int);
-  Result *result = (Result *)malloc(sizeof *result);
-  if (!result)
-    return lean_io_result_mk_error(pq_other_error("Memory allocation for result failed"));
-  result->pg_result = pg_result;
-#if DEBUG
-  fprintf(stderr, "Result %p\n", pg_result);
-#endif
+  Params params;
+  if (!pq_params_init(&params, param_array))
+    return lean_io_result_mk_error(pq_other_error("Memory allocation for parameters failed"));
+  size_t cmd_length = lean_string_size(cmd) - 1;
+  uint64_t started = pq_now_micros();
+  PGresult * pg_result = PQexecParams(connection->pg_conn, cmd_cstr, params.n, params.types, params.values, params.lengths, params.formats, resultFormat_int);
+  pq_record_query(connection, cmd_cstr, cmd_length, cmd_length + params.bytes, started, pg_result);
+  pq_params_free(&params);
   // Return the result
-  return lean_io_result_mk_ok(pq_result_wrap_handle(result));
+  return pq_result_io(connection, pg_result);
 }
 
 // PQprepare - Submits a request to create a prepared statement with the given parameters
 // Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQPREPARE
-LEAN_EXPORT lean_obj_res lean_pq_prepare(b_lean_obj_arg conn, b_lean_obj_arg stmtName, b_lean_obj_arg query, b_lean_obj_arg nParams, b_lean_obj_arg paramTypes) {
+LEAN_EXPORT lean_obj_res lean_pq_prepare(b_lean_obj_arg conn, b_lean_obj_arg stmtName, b_lean_obj_arg query, b_lean_obj_arg paramTypes) {
   Connection *connection = pq_connection_get_handle(conn);
   const char * stmtName_cstr = lean_string_cstr(stmtName);
   const char * query_cstr = lean_string_cstr(query);
-  const int nParams_int = lean_unbox(nParams);
-  const Oid * paramTypes_oid = (const Oid *)lean_unbox(paramTypes);
-  PGresult * pg_result = PQprepare(connection->pg_conn, stmtName_cstr, query_cstr, nParams_int, paramTypes_oid);
-  Result *result = (Result *)malloc(sizeof *result);
-  if (!result)
-    return lean_io_result_mk_error(pq_other_error("Memory allocation for result failed"));
-  result->pg_result = pg_result;
-#if DEBUG
-  fprintf(stderr, "Result %p\n", pg_result);
-#endif
+  size_t nParams = lean_array_size(paramTypes);
+  Oid types_buf[LEAN_PQ_PARAMS_STACK];
+  Oid * types = nParams <= LEAN_PQ_PARAMS_STACK ? types_buf : (Oid *)malloc(nParams * sizeof(Oid));
+  if (!types)
+    return lean_io_result_mk_error(pq_other_error("Memory allocation for parameter types failed"));
+  for (size_t i = 0; i < nParams; i++) {
+    types[i] = (Oid)lean_unbox_uint32(lean_array_get_core(paramTypes, i));
+  }
+  uint64_t started = pq_now_micros();
+  PGresult * pg_result = PQprepare(connection->pg_conn, stmtName_cstr, query_cstr, (int)nParams, types);
+  pq_record_query(connection, query_cstr, lean_string_size(query) - 1, lean_string_size(query) - 1, started, pg_result);
+  if (types != types_buf)
+    free(types);
   // Return the result
-  return lean_io_result_mk_ok(pq_result_wrap_handle(result));
+  return pq_result_io(connection, pg_result);
 }
 
 // PQexecPrepared - Sends a request to execute a prepared statement with given parameters
 // Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQEXECPREPARED
-LEAN_EXPORT lean_obj_res lean_pq_exec_prepared(b_lean_obj_arg conn, b_lean_obj_arg stmtName, b_lean_obj_arg nParams, b_lean_obj_arg paramValues, b_lean_obj_arg paramLengths, b_lean_obj_arg paramFormats, b_lean_obj_arg resultFormat) {
+LEAN_EXPORT lean_obj_res lean_pq_exec_prepared(b_lean_obj_arg conn, b_lean_obj_arg stmtName, b_lean_obj_arg param_array, b_lean_obj_arg resultFormat) {
   Connection *connection = pq_connection_get_handle(conn);
   const char * stmtName_cstr = lean_string_cstr(stmtName);
-  const int nParams_int = lean_unbox(nParams);
-  const char * const * paramValues_cstr_array = (const char **)lean_unbox(paramValues);
-  const int * paramLengths_int = (const int *)lean_unbox(paramLengths);
-  const int * paramFormats_int = (const int *)lean_unbox(paramFormats);
   int resultFormat_int = lean_unbox(resultFormat);
-  PGresult * pg_result = PQexecPrepared(connection->pg_conn, stmtName_cstr, nParams_int, paramValues_cstr_array, paramLengths_int, paramFormats_int, resultFormat_int);
-  Result *result = (Result *)malloc(sizeof *result);
-  if (!result)
-    return lean_io_result_mk_error(pq_other_error("Memory allocation for result failed"));
-  result->pg_result = pg_result;
-#if DEBUG
-  fprintf(stderr, "Result %p\n", pg_result);
-#endif
+  Params params;
+  if (!pq_params_init(&params, param_array))
+    return lean_io_result_mk_error(pq_other_error("Memory allocation for parameters failed"));
+  uint64_t started = pq_now_micros();
+  PGresult * pg_result = PQexecPrepared(connection->pg_conn, stmtName_cstr, params.n, params.values, params.lengths, params.formats, resultFormat_int);
+  pq_record_query(connection, stmtName_cstr, lean_string_size(stmtName) - 1, params.bytes, started, pg_result);
+  pq_params_free(&params);
   // Return the result
-  return lean_io_result_mk_ok(pq_result_wrap_handle(result));
+  return pq_result_io(connection, pg_result);
 }
 
-// [Result Functions](https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-EXEC-SELECT-INFO)
-
-// Result Status Functions
-// PQresultStatus - Returns the result status of the command
-// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQRESULTSTATUS
-LEAN_EXPORT lean_obj_res lean_pq_result_status(b_lean_obj_arg res) {
-  Result *result = pq_result_get_handle(res);
-  ExecStatusType status = PQresultStatus(result->pg_result);
-  lean_object * status_boxed = lean_box_uint32((uint32_t)status);
-  return lean_io_result_mk_ok(status_boxed);
+// PQdescribePrepared - Obtains information about the prepared statement `stmtName`
+// Use PqNparams/PqParamtype and PqNfields/PqFtype on the result.
+// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQDESCRIBEPREPARED
+LEAN_EXPORT lean_obj_res lean_pq_describe_prepared(b_lean_obj_arg conn, b_lean_obj_arg stmtName) {
+  Connection *connection = pq_connection_get_handle(conn);
+  const char * stmtName_cstr = lean_string_cstr(stmtName);
+  PGresult * pg_result = PQdescribePrepared(connection->pg_conn, stmtName_cstr);
+  return pq_result_io(connection, pg_result);
 }
 
-// PQresStatus - Converts the enumerated type returned by PQresultStatus into a string constant
-// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQRESSTATUS
-LEAN_EXPORT lean_obj_res lean_pq_res_status(b_lean_obj_arg res) {
-  Result *result = pq_result_get_handle(res);
-  ExecStatusType status = PQresultStatus(result->pg_result);
-  lean_object * status_boxed = lean_box_uint32((uint32_t)status);
-  return lean_io_result_mk_ok(status_boxed);
+// [Asynchronous Command Processing](https://www.postgresql.org/docs/current/libpq-async.html)
+
+// PQsendQuery - Submits a command to the server without waiting for the result(s)
+// Documentation: https://www.postgresql.org/docs/current/libpq-async.html#LIBPQ-PQSENDQUERY
+LEAN_EXPORT lean_obj_res lean_pq_send_query(b_lean_obj_arg conn, b_lean_obj_arg cmd) {
+  Connection *connection = pq_connection_get_handle(conn);
+  const char * cmd_cstr = lean_string_cstr(cmd);
+  if (!PQsendQuery(connection->pg_conn, cmd_cstr))
+    return lean_io_result_mk_error(pq_other_error(PQerrorMessage(connection->pg_conn)));
+  return lean_io_result_mk_ok(lean_box(0));
 }
 
-// PQresultErrorMessage - Returns the error message associated with the command
-// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQRESULTERRORMESSAGE
-LEAN_EXPORT lean_obj_res lean_pq_result_error_message(b_lean_obj_arg res) {
-  Result *result = pq_result_get_handle(res);
-  const char * error_message = PQresultErrorMessage(result->pg_result);
-  return lean_io_result_mk_ok(lean_mk_string(error_message));
+// PQsendQueryParams - Submits a command and separate parameters to the server without waiting for the result(s)
+// Documentation: https://www.postgresql.org/docs/current/libpq-async.html#LIBPQ-PQSENDQUERYPARAMS
+LEAN_EXPORT lean_obj_res lean_pq_send_query_params(b_lean_obj_arg conn, b_lean_obj_arg cmd, b_lean_obj_arg param_array, b_lean_obj_arg resultFormat) {
+  Connection *connection = pq_connection_get_handle(conn);
+  const char * cmd_cstr = lean_string_cstr(cmd);
+  int resultFormat_int = lean_unbox(resultFormat);
+  Params params;
+  if (!pq_params_init(&params, param_array))
+    return lean_io_result_mk_error(pq_other_error("Memory allocation for parameters failed"));
+  int sent = PQsendQueryParams(connection->pg_conn, cmd_cstr, params.n, params.types, params.values, params.lengths, params.formats, resultFormat_int);
+  pq_params_free(&params);
+  if (!sent)
+    return lean_io_result_mk_error(pq_other_error(PQerrorMessage(connection->pg_conn)));
+  return lean_io_result_mk_ok(lean_box(0));
 }
 
-// PQresultErrorField - Returns an individual field of an error report
-// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQRESULTERRORFIELD
-LEAN_EXPORT lean_obj_res lean_pq_result_error_field(b_lean_obj_arg res, b_lean_obj_arg fieldcode) {
-  Result *result = pq_result_get_handle(res);
-  int fieldcode_int = lean_unbox(fieldcode);
-  const char * error_field = PQresultErrorField(result->pg_result, fieldcode_int);
-  return lean_io_result_mk_ok(lean_mk_string(error_field));
+// PQgetResult - Waits for the next result from a prior send call, NULL once the command is complete
+// Documentation: https://www.postgresql.org/docs/current/libpq-async.html#LIBPQ-PQGETRESULT
+LEAN_EXPORT lean_obj_res lean_pq_get_result(b_lean_obj_arg conn) {
+  initialize_pq_result_external_class();
+  Connection *connection = pq_connection_get_handle(conn);
+  PGresult * pg_result = PQgetResult(connection->pg_conn);
+  if (pg_result == NULL)
+    return lean_io_result_mk_ok(lean_box(0)); // Option.none
+  lean_object * wrapped = pq_result_io(connection, pg_result);
+  if (lean_io_result_is_error(wrapped))
+    return wrapped;
+  lean_object * result_obj = lean_io_result_get_value(wrapped);
+  lean_inc(result_obj);
+  lean_dec(wrapped);
+  lean_object * some = lean_alloc_ctor(1, 1, 0); // Option.some
+  lean_ctor_set(some, 0, result_obj);
+  return lean_io_result_mk_ok(some);
 }
 
-// Retrieving Query Result Information
-// PQntuples - Returns the number of rows (tuples) in the query result
-// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQNTUPLES
-LEAN_EXPORT lean_obj_res lean_pq_ntuples(b_lean_obj_arg res) {
-  Result *result = pq_result_get_handle(res);
-  int ntuples = PQntuples(result->pg_result);
-  return lean_io_result_mk_ok(lean_box(ntuples));
+// PQsetnonblocking - Sets the nonblocking status of the connection
+// Documentation: https://www.postgresql.org/docs/current/libpq-async.html#LIBPQ-PQSETNONBLOCKING
+LEAN_EXPORT lean_obj_res lean_pq_set_nonblocking(b_lean_obj_arg conn, uint8_t nonblocking) {
+  Connection *connection = pq_connection_get_handle(conn);
+  if (PQsetnonblocking(connection->pg_conn, nonblocking ? 1 : 0) != 0)
+    return lean_io_result_mk_error(pq_other_error(PQerrorMessage(connection->pg_conn)));
+  return lean_io_result_mk_ok(lean_box(0));
 }
 
-// PQnfields - Returns the number of columns (fields) in each row of the query result
-// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQNFIELDS
-LEAN_EXPORT lean_obj_res lean_pq_nfields(b_lean_obj_arg res) {
-  Result *result = pq_result_get_handle(res);
-  int nfields = PQnfields(result->pg_result);
-  return lean_io_result_mk_ok(lean_box(nfields));
+// PQisnonblocking - Returns the blocking status of the database connection
+// Documentation: https://www.postgresql.org/docs/current/libpq-async.html#LIBPQ-PQISNONBLOCKING
+LEAN_EXPORT lean_obj_res lean_pq_is_nonblocking(b_lean_obj_arg conn) {
+  Connection *connection = pq_connection_get_handle(conn);
+  return lean_io_result_mk_ok(lean_box(PQisnonblocking(connection->pg_conn) ? 1 : 0));
 }
 
-// PQfname - Returns the column name associated with the given column number
-// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQFNAME
-LEAN_EXPORT lean_obj_res lean_pq_fname(b_lean_obj_arg res, b_lean_obj_arg field_num) {
-  Result *result = pq_result_get_handle(res);
-  int field_num_int = lean_unbox(field_num);
-  const char * fname = PQfname(result->pg_result, field_num_int);
-  return lean_io_result_mk_ok(lean_mk_string(fname));
+// PQconsumeInput - Reads whatever input is available from the server without blocking
+// Documentation: https://www.postgresql.org/docs/current/libpq-async.html#LIBPQ-PQCONSUMEINPUT
+LEAN_EXPORT lean_obj_res lean_pq_consume_input(b_lean_obj_arg conn) {
+  Connection *connection = pq_connection_get_handle(conn);
+  if (!PQconsumeInput(connection->pg_conn))
+    return lean_io_result_mk_error(pq_other_error(PQerrorMessage(connection->pg_conn)));
+  return lean_io_result_mk_ok(lean_box(0));
 }
 
-// PQfnumber - Returns the column number associated with the given column name
-// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQFNUMBER
-LEAN_EXPORT lean_obj_res lean_pq_fnumber(b_lean_obj_arg res, b_lean_obj_arg field_name) {
-  Result *result = pq_result_get_handle(res);
-  const char * field_name_cstr = lean_string_cstr(field_name);
-  int fnumber = PQfnumber(result->pg_result, field_name_cstr);
-  return lean_io_result_mk_ok(lean_box(fnumber));
+// PQisBusy - Returns true if a command is busy, that is, PQgetResult would block waiting for input
+// Documentation: https://www.postgresql.org/docs/current/libpq-async.html#LIBPQ-PQISBUSY
+LEAN_EXPORT lean_obj_res lean_pq_is_busy(b_lean_obj_arg conn) {
+  Connection *connection = pq_connection_get_handle(conn);
+  return lean_io_result_mk_ok(lean_box(PQisBusy(connection->pg_conn) ? 1 : 0));
 }
 
-// PQftable - Returns the OID of the table from which the given column was fetched
-// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQFTABLE
-LEAN_EXPORT lean_obj_res lean_pq_ftable(b_lean_obj_arg res, b_lean_obj_arg field_num) {
-  Result *result = pq_result_get_handle(res);
-  int field_num_int = lean_unbox(field_num);
-  Oid ftable = PQftable(result->pg_result, field_num_int);
-  lean_object * ftable_obj = lean_box_usize((size_t)ftable);
-  return lean_io_result_mk_ok(ftable_obj);
+// PQflush - Attempts to flush any queued output data to the server
+// Returns true while data remains queued (nonblocking mode only).
+// Documentation: https://www.postgresql.org/docs/current/libpq-async.html#LIBPQ-PQFLUSH
+LEAN_EXPORT lean_obj_res lean_pq_flush(b_lean_obj_arg conn) {
+  Connection *connection = pq_connection_get_handle(conn);
+  int status = PQflush(connection->pg_conn);
+  if (status < 0)
+    return lean_io_result_mk_error(pq_other_error(PQerrorMessage(connection->pg_conn)));
+  return lean_io_result_mk_ok(lean_box(status == 1 ? 1 : 0));
 }
 
-// PQftablecol - Returns the column number (within its table) of the column making up the specified query result column
-// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQFTABLECOL
-LEAN_EXPORT lean_obj_res lean_pq_ftablecol(b_lean_obj_arg res, b_lean_obj_arg field_num) {
-  Result *result = pq_result_get_handle(res);
-  int field_num_int = lean_unbox(field_num);
-  int ftablecol = PQftablecol(result->pg_result, field_num_int);
-  return lean_io_result_mk_ok(lean_box(ftablecol));
+// Socket readiness poller
+// Waits on the sockets of many connections at once: epoll on Linux, poll() elsewhere.
+// A watch is one-shot; it must be renewed after the socket has been reported ready.
+
+#define LEAN_PQ_POLLER_MAX_EVENTS 256
+
+struct poller {
+  // Pipe used to interrupt a wait.
+  int wake[2];
+#if LEAN_PQ_USE_EPOLL
+  int epfd;
+#else
+  pthread_mutex_t lock;
+  struct pollfd *fds;
+  size_t nfds;
+  size_t cap;
+#endif
+};
+
+typedef struct poller Poller;
+
+static lean_external_class *pq_poller_external_class = NULL;
+
+static void pq_poller_finalizer(void *h) {
+  Poller *poller = (Poller *)h;
+  close(poller->wake[0]);
+  close(poller->wake[1]);
+#if LEAN_PQ_USE_EPOLL
+  close(poller->epfd);
+#else
+  pthread_mutex_destroy(&poller->lock);
+  free(poller->fds);
+#endif
+  free(poller);
 }
 
-// PQfformat - Returns the format code indicating the format of the given column
-// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQFFORMAT
-LEAN_EXPORT lean_obj_res lean_pq_fformat(b_lean_obj_arg res, b_lean_obj_arg field_num) {
-  Result *result = pq_result_get_handle(res);
-  int field_num_int = lean_unbox(field_num);
-  int fformat = PQfformat(result->pg_result, field_num_int);
-  return lean_io_result_mk_ok(lean_box(fformat));
+static void pq_poller_foreach(void *mod, b_lean_obj_arg fn) {}
+
+static Poller *pq_poller_get_handle(lean_object *poller) {
+  return (Poller *)lean_get_external_data(poller);
 }
 
-// PQftype - Returns the data type associated with the given column number
-// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQFTYPE
-LEAN_EXPORT lean_obj_res lean_pq_ftype(b_lean_obj_arg res, b_lean_obj_arg field_num) {
-  Result *result = pq_result_get_handle(res);
-  int field_num_int = lean_unbox(field_num);
-  Oid ftype = PQftype(result->pg_result, field_num_int);
-  lean_object * ftype_obj = lean_box_usize((size_t)ftype);
-  return lean_io_result_mk_ok(ftype_obj);
+// PqPollerNew - Creates a socket readiness poller
+LEAN_EXPORT lean_obj_res lean_pq_poller_new() {
+  if (pq_poller_external_class == NULL) {
+    pq_poller_external_class = lean_register_external_class(
+        pq_poller_finalizer, pq_poller_foreach);
+  }
+  Poller *poller = (Poller *)calloc(1, sizeof *poller);
+  if (!poller)
+    return lean_io_result_mk_error(pq_other_error("Memory allocation for poller failed"));
+  // Close-on-exec, so that child processes do not inherit the pipe.
+#ifdef __linux__
+  int piped = pipe2(poller->wake, O_CLOEXEC | O_NONBLOCK) == 0;
+#else
+  int piped = pipe(poller->wake) == 0;
+  for (int i = 0; piped && i < 2; i++) {
+    fcntl(poller->wake[i], F_SETFD, FD_CLOEXEC);
+    fcntl(poller->wake[i], F_SETFL, O_NONBLOCK);
+  }
+#endif
+  if (!piped) {
+    free(poller);
+    return lean_io_result_mk_error(pq_other_error(strerror(errno)));
+  }
+#if LEAN_PQ_USE_EPOLL
+  poller->epfd = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event ev = { .events = EPOLLIN, .data = { .fd = poller->wake[0] } };
+  if (poller->epfd < 0 || epoll_ctl(poller->epfd, EPOLL_CTL_ADD, poller->wake[0], &ev) != 0) {
+    lean_object *err = pq_other_error(strerror(errno));
+    if (poller->epfd >= 0)
+      close(poller->epfd);
+    close(poller->wake[0]);
+    close(poller->wake[1]);
+    free(poller);
+    return lean_io_result_mk_error(err);
+  }
+#else
+  pthread_mutex_init(&poller->lock, NULL);
+#endif
+  return lean_io_result_mk_ok(lean_alloc_external(pq_poller_external_class, poller));
+}
+
+// PqPollerWake - Makes a pending or the next PqPollerWait return immediately
+LEAN_EXPORT lean_obj_res lean_pq_poller_wake(b_lean_obj_arg poller_obj) {
+  Poller *poller = pq_poller_get_handle(poller_obj);
+  char byte = 1;
+  // A full pipe already guarantees a wake-up.
+  ssize_t ignored = write(poller->wake[1], &byte, 1);
+  (void)ignored;
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// PqPollerWatch - Reports `fd` once it becomes readable (or writable when `writable` is set)
+LEAN_EXPORT lean_obj_res lean_pq_poller_watch(b_lean_obj_arg poller_obj, uint32_t fd, uint8_t writable) {
+  Poller *poller = pq_poller_get_handle(poller_obj);
+#if LEAN_PQ_USE_EPOLL
+  struct epoll_event ev = { .events = (writable ? EPOLLOUT : EPOLLIN) | EPOLLONESHOT, .data = { .fd = (int)fd } };
+  if (epoll_ctl(poller->epfd, EPOLL_CTL_MOD, (int)fd, &ev) != 0) {
+    if (errno != ENOENT || epoll_ctl(poller->epfd, EPOLL_CTL_ADD, (int)fd, &ev) != 0)
+      return lean_io_result_mk_error(pq_other_error(strerror(errno)));
+  }
+#else
+  short events = writable ? POLLOUT : POLLIN;
+  pthread_mutex_lock(&poller->lock);
+  size_t i = 0;
+  while (i < poller->nfds && poller->fds[i].fd != (int)fd)
+    i++;
+  if (i == poller->nfds) {
+    if (poller->nfds == poller->cap) {
+      size_t cap = poller->cap ? poller->cap * 2 : 16;
+      struct pollfd *grown = (struct pollfd *)realloc(poller->fds, cap * sizeof *grown);
+      if (!grown) {
+        pthread_mutex_unlock(&poller->lock);
+        return lean_io_result_mk_error(pq_other_error("Memory allocation for poller failed"));
+      }
+      poller->fds = grown;
+      poller->cap = cap;
+    }
+    poller->fds[i].fd = (int)fd;
+    poller->nfds++;
+  }
+  poller->fds[i].events = events;
+  pthread_mutex_unlock(&poller->lock);
+  // The waiting thread must pick up the new set.
+  lean_dec(lean_pq_poller_wake(poller_obj));
+#endif
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// PqPollerUnwatch - Stops watching `fd`
+LEAN_EXPORT lean_obj_res lean_pq_poller_unwatch(b_lean_obj_arg poller_obj, uint32_t fd) {
+  Poller *poller = pq_poller_get_handle(poller_obj);
+#if LEAN_PQ_USE_EPOLL
+  epoll_ctl(poller->epfd, EPOLL_CTL_DEL, (int)fd, NULL);
+#else
+  pthread_mutex_lock(&poller->lock);
+  for (size_t i = 0; i < poller->nfds; i++) {
+    if (poller->fds[i].fd == (int)fd) {
+      poller->fds[i] = poller->fds[--poller->nfds];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&poller->lock);
+#endif
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+static void pq_poller_drain_wake(Poller *poller) {
+  char buf[64];
+  while (read(poller->wake[0], buf, sizeof buf) > 0) {}
+}
+
+// PqPollerWait - Blocks up to `timeout_ms` and returns the watched sockets that became ready
+// Each reported socket is disarmed until it is watched again. UINT32_MAX waits with no timeout.
+LEAN_EXPORT lean_obj_res lean_pq_poller_wait(b_lean_obj_arg poller_obj, uint32_t timeout_ms) {
+  Poller *poller = pq_poller_get_handle(poller_obj);
+  int timeout = timeout_ms == UINT32_MAX ? -1 : timeout_ms > INT_MAX ? INT_MAX : (int)timeout_ms;
+  lean_object *ready = lean_alloc_array(0, 0);
+#if LEAN_PQ_USE_EPOLL
+  struct epoll_event events[LEAN_PQ_POLLER_MAX_EVENTS];
+  int n = epoll_wait(poller->epfd, events, LEAN_PQ_POLLER_MAX_EVENTS, timeout);
+  if (n < 0 && errno != EINTR) {
+    lean_dec(ready);
+    return lean_io_result_mk_error(pq_other_error(strerror(errno)));
+  }
+  for (int i = 0; i < n; i++) {
+    if (events[i].data.fd == poller->wake[0])
+      pq_poller_drain_wake(poller);
+    else
+      ready = lean_array_push(ready, lean_box_uint32((uint32_t)events[i].data.fd));
+  }
+#else
+  // Snapshot the armed sockets; the wake pipe goes last.
+  pthread_mutex_lock(&poller->lock);
+  size_t nfds = 0;
+  struct pollfd *fds = (struct pollfd *)malloc((poller->nfds + 1) * sizeof *fds);
+  if (!fds) {
+    pthread_mutex_unlock(&poller->lock);
+    lean_dec(ready);
+    return lean_io_result_mk_error(pq_other_error("Memory allocation for poller failed"));
+  }
+  for (size_t i = 0; i < poller->nfds; i++) {
+    if (poller->fds[i].events != 0)
+      fds[nfds++] = poller->fds[i];
+  }
+  pthread_mutex_unlock(&poller->lock);
+  fds[nfds].fd = poller->wake[0];
+  fds[nfds].events = POLLIN;
+  int n = poll(fds, (nfds_t)(nfds + 1), timeout);
+  if (n < 0 && errno != EINTR) {
+    free(fds);
+    lean_dec(ready);
+    return lean_io_result_mk_error(pq_other_error(strerror(errno)));
+  }
+  if (n > 0) {
+    if (fds[nfds].revents)
+      pq_poller_drain_wake(poller);
+    pthread_mutex_lock(&poller->lock);
+    for (size_t i = 0; i < nfds; i++) {
+      if (fds[i].revents == 0)
+        continue;
+      ready = lean_array_push(ready, lean_box_uint32((uint32_t)fds[i].fd));
+      // Disarm, like EPOLLONESHOT.
+      for (size_t j = 0; j < poller->nfds; j++) {
+        if (poller->fds[j].fd == fds[i].fd)
+          poller->fds[j].events = 0;
+      }
+    }
+    pthread_mutex_unlock(&poller->lock);
+  }
+  free(fds);
+#endif
+  return lean_io_result_mk_ok(ready);
+}
+
+// [Canceling Queries in Progress](https://www.postgresql.org/docs/current/libpq-cancel.html)
+
+// How long a cancel request may take to reach the server.
+#define LEAN_PQ_CANCEL_TIMEOUT_MS 5000
+
+// SQLSTATE `query_canceled`.
+#define LEAN_PQ_SQLSTATE_QUERY_CANCELED "57014"
+
+// Asks the server to cancel the query running on the connection. Safe to call from any thread.
+// Returns NULL once the request was delivered, otherwise an error message (in `errbuf`).
+// Delivery does not mean the query was canceled: it may complete before the request lands.
+static const char* pq_cancel_send(Connection *connection, char *errbuf, size_t errlen) {
+  const char *error = NULL;
+  pthread_mutex_lock(&connection->cancel_lock);
+  CancelHandle *cancel = connection->cancel;
+  if (cancel == NULL) {
+    error = "Connection has no cancel handle";
+  } else {
+#ifdef LIBPQ_HAS_ASYNC_CANCEL
+    // Non-blocking cancel: the exchange with the server is bounded by the timeout.
+    PQcancelReset(cancel);
+    uint64_t deadline = pq_now_micros() + (uint64_t)LEAN_PQ_CANCEL_TIMEOUT_MS * 1000;
+    PostgresPollingStatusType status = PQcancelStart(cancel) ? PGRES_POLLING_WRITING : PGRES_POLLING_FAILED;
+    while (status != PGRES_POLLING_OK) {
+      if (status == PGRES_POLLING_FAILED) {
+        snprintf(errbuf, errlen, "%s", PQcancelErrorMessage(cancel));
+        error = errbuf;
+        break;
+      }
+      uint64_t now = pq_now_micros();
+      if (now >= deadline) {
+        error = "Cancel request timed out";
+        break;
+      }
+      struct pollfd pfd = {
+        .fd = PQcancelSocket(cancel),
+        .events = status == PGRES_POLLING_READING ? POLLIN : POLLOUT,
+        .revents = 0
+      };
+      if (poll(&pfd, 1, (int)((deadline - now + 999) / 1000)) < 0 && errno != EINTR) {
+        snprintf(errbuf, errlen, "%s", strerror(errno));
+        error = errbuf;
+        break;
+      }
+      status = PQcancelPoll(cancel);
+    }
+#else
+    if (!PQcancel(cancel, errbuf, (int)errlen))
+      error = errbuf;
+#endif
+  }
+  pthread_mutex_unlock(&connection->cancel_lock);
+  return error;
+}
+
+// PqCancel - Requests cancellation of the query the connection is running
+// Documentation: https://www.postgresql.org/docs/current/libpq-cancel.html
+LEAN_EXPORT lean_obj_res lean_pq_cancel(b_lean_obj_arg conn) {
+  Connection *connection = pq_connection_get_handle(conn);
+  char errbuf[256];
+  const char *error = pq_cancel_send(connection, errbuf, sizeof errbuf);
+  if (error != NULL)
+    return lean_io_result_mk_error(pq_other_error(error));
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// How long the results of a query canceled by its deadline are awaited once the cancel was sent.
+#define LEAN_PQ_CANCEL_GRACE_MS 5000
+
+// Outcomes of pq_exec_deadline, in `*canceled`.
+#define LEAN_PQ_DEADLINE_MET 0
+#define LEAN_PQ_DEADLINE_CANCELED 1
+#define LEAN_PQ_DEADLINE_ABANDONED 2
+
+// Reads every result of the query just sent, like PQexec, and cancels it once `timeout_ms` has
+// passed. Returns the last result, or NULL (see PQerrorMessage) when the connection failed.
+// As with PQexec, a COPY result ends the read and is returned. `*canceled` is set to
+// LEAN_PQ_DEADLINE_CANCELED when the deadline fired; the results of the canceled query are then
+// read to the end, so that the connection stays usable. When they have not all arrived within
+// LEAN_PQ_CANCEL_GRACE_MS (the cancel was lost, or the server ignores it) the read is given up:
+// NULL is returned with LEAN_PQ_DEADLINE_ABANDONED, and the connection must be reset.
+static PGresult* pq_exec_deadline(Connection *connection, uint32_t timeout_ms, int *canceled) {
+  PGconn *pg_conn = connection->pg_conn;
+  uint64_t deadline = pq_now_micros() + (uint64_t)timeout_ms * 1000;
+  PGresult *last = NULL;
+  int flushing = PQflush(pg_conn) == 1;
+  *canceled = LEAN_PQ_DEADLINE_MET;
+  for (;;) {
+    while (!flushing && !PQisBusy(pg_conn)) {
+      PGresult *pg_result = PQgetResult(pg_conn);
+      if (pg_result == NULL)
+        return last;
+      ExecStatusType status = PQresultStatus(pg_result);
+      if (status == PGRES_COPY_IN || status == PGRES_COPY_OUT || status == PGRES_COPY_BOTH) {
+        PQclear(last);
+        return pg_result;
+      }
+      // An error result is kept over the results that follow it, as PQexec does.
+      if (last != NULL && PQresultStatus(last) == PGRES_FATAL_ERROR) {
+        PQclear(pg_result);
+        continue;
+      }
+      PQclear(last);
+      last = pg_result;
+    }
+    uint64_t now = pq_now_micros();
+    if (now >= deadline) {
+      if (*canceled == LEAN_PQ_DEADLINE_CANCELED) {
+        *canceled = LEAN_PQ_DEADLINE_ABANDONED;
+        break;
+      }
+      char errbuf[256];
+      *canceled = LEAN_PQ_DEADLINE_CANCELED;
+      // A cancel that is not delivered is covered by the grace period as well.
+      pq_cancel_send(connection, errbuf, sizeof errbuf);
+      deadline = pq_now_micros() + (uint64_t)LEAN_PQ_CANCEL_GRACE_MS * 1000;
+      continue;
+    }
+    int wait_ms = (int)((deadline - now + 999) / 1000);
+    struct pollfd pfd = {
+      .fd = PQsocket(pg_conn),
+      .events = (short)(POLLIN | (flushing ? POLLOUT : 0)),
+      .revents = 0
+    };
+    if (poll(&pfd, 1, wait_ms) < 0 && errno != EINTR)
+      break;
+    if (!PQconsumeInput(pg_conn))
+      break;
+    if (flushing) {
+      int status = PQflush(pg_conn);
+      if (status < 0)
+        break;
+      flushing = status == 1;
+    }
+  }
+  PQclear(last);
+  return NULL;
+}
+
+// Turns the outcome of pq_exec_deadline into the Lean result: a canceled query fails with
+// `queryTimeout` (deadline) or `queryCanceled` (PqCancel from elsewhere).
+static lean_obj_res pq_deadline_result_io(Connection *connection, PGresult *pg_result, int canceled, uint32_t timeout_ms) {
+  if (canceled == LEAN_PQ_DEADLINE_ABANDONED) {
+    pq_stat_add(&pq_global_stats.errors, 1);
+    pq_stat_add(&connection->stats.errors, 1);
+    return lean_io_result_mk_error(pq_query_timeout_error(timeout_ms));
+  }
+  if (pg_result != NULL && PQresultStatus(pg_result) == PGRES_FATAL_ERROR) {
+    const char *sqlstate = PQresultErrorField(pg_result, PG_DIAG_SQLSTATE);
+    if (sqlstate != NULL && strcmp(sqlstate, LEAN_PQ_SQLSTATE_QUERY_CANCELED) == 0) {
+      lean_object *error = canceled != LEAN_PQ_DEADLINE_MET ? pq_query_timeout_error(timeout_ms)
+                                    : pq_query_canceled_error(PQresultErrorMessage(pg_result));
+      pq_stats_add_result(&pq_global_stats, pg_result);
+      pq_stats_add_result(&connection->stats, pg_result);
+      PQclear(pg_result);
+      pq_stat_add(&pq_global_stats.results_freed, 1);
+      return lean_io_result_mk_error(error);
+    }
+  }
+  return pq_result_io(connection, pg_result);
+}
+
+// PqExecTimeout - PQexec that cancels the command after `timeout_ms`
+LEAN_EXPORT lean_obj_res lean_pq_exec_timeout(b_lean_obj_arg conn, b_lean_obj_arg cmd, uint32_t timeout_ms) {
+  Connection *connection = pq_connection_get_handle(conn);
+  const char * cmd_cstr = lean_string_cstr(cmd);
+  size_t cmd_length = lean_string_size(cmd) - 1;
+  uint64_t started = pq_now_micros();
+  if (!PQsendQuery(connection->pg_conn, cmd_cstr))
+    return lean_io_result_mk_error(pq_other_error(PQerrorMessage(connection->pg_conn)));
+  int canceled;
+  PGresult *pg_result = pq_exec_deadline(connection, timeout_ms, &canceled);
+  pq_record_query(connection, cmd_cstr, cmd_length, cmd_length, started, pg_result);
+  return pq_deadline_result_io(connection, pg_result, canceled, timeout_ms);
+}
+
+// PqExecParamsTimeout - PQexecParams that cancels the query after `timeout_ms`
+LEAN_EXPORT lean_obj_res lean_pq_exec_params_timeout(b_lean_obj_arg conn, b_lean_obj_arg cmd, b_lean_obj_arg param_array,
+                                                     uint32_t timeout_ms, b_lean_obj_arg resultFormat) {
+  Connection *connection = pq_connection_get_handle(conn);
+  const char * cmd_cstr = lean_string_cstr(cmd);
+  Params params;
+  if (!pq_params_init(&params, param_array))
+    return lean_io_result_mk_error(pq_other_error("Memory allocation for parameters failed"));
+  size_t cmd_length = lean_string_size(cmd) - 1;
+  uint64_t started = pq_now_micros();
+  int sent = PQsendQueryParams(connection->pg_conn, cmd_cstr, params.n, params.types, params.values, params.lengths,
+                               params.formats, (int)lean_unbox(resultFormat));
+  pq_params_free(&params);
+  if (!sent)
+    return lean_io_result_mk_error(pq_other_error(PQerrorMessage(connection->pg_conn)));
+  int canceled;
+  PGresult *pg_result = pq_exec_deadline(connection, timeout_ms, &canceled);
+  pq_record_query(connection, cmd_cstr, cmd_length, cmd_length + params.bytes, started, pg_result);
+  return pq_deadline_result_io(connection, pg_result, canceled, timeout_ms);
+}
+
+// PqExecPreparedTimeout - PQexecPrepared that cancels the statement after `timeout_ms`
+LEAN_EXPORT lean_obj_res lean_pq_exec_prepared_timeout(b_lean_obj_arg conn, b_lean_obj_arg stmtName, b_lean_obj_arg param_array,
+                                                       uint32_t timeout_ms, b_lean_obj_arg resultFormat) {
+  Connection *connection = pq_connection_get_handle(conn);
+  const char * stmtName_cstr = lean_string_cstr(stmtName);
+  Params params;
+  if (!pq_params_init(&params, param_array))
+    return lean_io_result_mk_error(pq_other_error("Memory allocation for parameters failed"));
+  uint64_t started = pq_now_micros();
+  int sent = PQsendQueryPrepared(connection->pg_conn, stmtName_cstr, params.n, params.values, params.lengths,
+                                 params.formats, (int)lean_unbox(resultFormat));
+  pq_params_free(&params);
+  if (!sent)
+    return lean_io_result_mk_error(pq_other_error(PQerrorMessage(connection->pg_conn)));
+  int canceled;
+  PGresult *pg_result = pq_exec_deadline(connection, timeout_ms, &canceled);
+  pq_record_query(connection, stmtName_cstr, lean_string_size(stmtName) - 1, params.bytes, started, pg_result);
+  return pq_deadline_result_io(connection, pg_result, canceled, timeout_ms);
+}
+
+// [Retrieving Query Results in Chunks](https://www.postgresql.org/docs/current/libpq-single-row-mode.html)
+
+// PQsetSingleRowMode - Selects single-row mode for the currently-executing query
+// Documentation: https://www.postgresql.org/docs/current/libpq-single-row-mode.html#LIBPQ-PQSETSINGLEROWMODE
+LEAN_EXPORT lean_obj_res lean_pq_set_single_row_mode(b_lean_obj_arg conn) {
+  Connection *connection = pq_connection_get_handle(conn);
+  int ok = PQsetSingleRowMode(connection->pg_conn);
+  return lean_io_result_mk_ok(lean_box(ok ? 1 : 0));
+}
+
+// PQsetChunkedRowsMode - Selects chunked mode for the currently-executing query (libpq 17+)
+// Returns false when libpq was built without chunked mode.
+// Documentation: https://www.postgresql.org/docs/current/libpq-single-row-mode.html#LIBPQ-PQSETCHUNKEDROWSMODE
+LEAN_EXPORT lean_obj_res lean_pq_set_chunked_rows_mode(b_lean_obj_arg conn, uint32_t chunk_size) {
+#ifdef LIBPQ_HAS_CHUNK_MODE
+  Connection *connection = pq_connection_get_handle(conn);
+  int ok = PQsetChunkedRowsMode(connection->pg_conn, (int)chunk_size);
+  return lean_io_result_mk_ok(lean_box(ok ? 1 : 0));
+#else
+  return lean_io_result_mk_ok(lean_box(0));
+#endif
+}
+
+// [Pipeline Mode](https://www.postgresql.org/docs/current/libpq-pipeline-mode.html)
+// Pipelining needs libpq 14+; older builds report an error from every entry point.
+
+#ifndef LIBPQ_HAS_PIPELINING
+static lean_obj_res pq_pipeline_unsupported() {
+  return lean_io_result_mk_error(pq_other_error("Pipeline mode requires libpq 14 or later"));
+}
+#endif
+
+// PQpipelineStatus - Returns the current pipeline mode status of the connection
+// Documentation: https://www.postgresql.org/docs/current/libpq-pipeline-mode.html#LIBPQ-PQPIPELINESTATUS
+LEAN_EXPORT lean_obj_res lean_pq_pipeline_status(b_lean_obj_arg conn) {
+#ifdef LIBPQ_HAS_PIPELINING
+  Connection *connection = pq_connection_get_handle(conn);
+  PGpipelineStatus status = PQpipelineStatus(connection->pg_conn);
+  return lean_io_result_mk_ok(lean_box((unsigned)status));
+#else
+  return lean_io_result_mk_ok(lean_box(0)); // PipelineStatus.off
+#endif
+}
+
+// PQenterPipelineMode - Causes a connection to enter pipeline mode if it is currently idle
+// Documentation: https://www.postgresql.org/docs/current/libpq-pipeline-mode.html#LIBPQ-PQENTERPIPELINEMODE
+LEAN_EXPORT lean_obj_res lean_pq_enter_pipeline_mode(b_lean_obj_arg conn) {
+#ifdef LIBPQ_HAS_PIPELINING
+  Connection *connection = pq_connection_get_handle(conn);
+  if (!PQenterPipelineMode(connection->pg_conn))
+    return lean_io_result_mk_error(pq_other_error(PQerrorMessage(connection->pg_conn)));
+  return lean_io_result_mk_ok(lean_box(0));
+#else
+  return pq_pipeline_unsupported();
+#endif
+}
+
+// PQexitPipelineMode - Causes a connection to exit pipeline mode once all results are collected
+// Documentation: https://www.postgresql.org/docs/current/libpq-pipeline-mode.html#LIBPQ-PQEXITPIPELINEMODE
+LEAN_EXPORT lean_obj_res lean_pq_exit_pipeline_mode(b_lean_obj_arg conn) {
+#ifdef LIBPQ_HAS_PIPELINING
+  Connection *connection = pq_connection_get_handle(conn);
+  if (!PQexitPipelineMode(connection->pg_conn))
+    return lean_io_result_mk_error(pq_other_error(PQerrorMessage(connection->pg_conn)));
+  return lean_io_result_mk_ok(lean_box(0));
+#else
+  return pq_pipeline_unsupported();
+#endif
+}
+
+// PQpipelineSync - Marks a synchronization point in a pipeline and flushes the send buffer
+// Documentation: https://www.postgresql.org/docs/current/libpq-pipeline-mode.html#LIBPQ-PQPIPELINESYNC
+LEAN_EXPORT lean_obj_res lean_pq_pipeline_sync(b_lean_obj_arg conn) {
+#ifdef LIBPQ_HAS_PIPELINING
+  Connection *connection = pq_connection_get_handle(conn);
+  if (!PQpipelineSync(connection->pg_conn))
+    return lean_io_result_mk_error(pq_other_error(PQerrorMessage(connection->pg_conn)));
+  return lean_io_result_mk_ok(lean_box(0));
+#else
+  return pq_pipeline_unsupported();
+#endif
+}
+
+// PQsendFlushRequest - Asks the server to flush its output buffer without a synchronization point
+// Documentation: https://www.postgresql.org/docs/current/libpq-pipeline-mode.html#LIBPQ-PQSENDFLUSHREQUEST
+LEAN_EXPORT lean_obj_res lean_pq_send_flush_request(b_lean_obj_arg conn) {
+#ifdef LIBPQ_HAS_PIPELINING
+  Connection *connection = pq_connection_get_handle(conn);
+  if (!PQsendFlushRequest(connection->pg_conn))
+    return lean_io_result_mk_error(pq_other_error(PQerrorMessage(connection->pg_conn)));
+  return lean_io_result_mk_ok(lean_box(0));
+#else
+  return pq_pipeline_unsupported();
+#endif
+}
+
+// PQsendPrepare - Sends a request to create a prepared statement without waiting for completion
+// Documentation: https://www.postgresql.org/docs/current/libpq-async.html#LIBPQ-PQSENDPREPARE
+LEAN_EXPORT lean_obj_res lean_pq_send_prepare(b_lean_obj_arg conn, b_lean_obj_arg stmtName, b_lean_obj_arg query, b_lean_obj_arg paramTypes) {
+  Connection *connection = pq_connection_get_handle(conn);
+  const char * stmtName_cstr = lean_string_cstr(stmtName);
+  const char * query_cstr = lean_string_cstr(query);
+  size_t nParams = lean_array_size(paramTypes);
+  Oid types_buf[LEAN_PQ_PARAMS_STACK];
+  Oid * types = nParams <= LEAN_PQ_PARAMS_STACK ? types_buf : (Oid *)malloc(nParams * sizeof(Oid));
+  if (!types)
+    return lean_io_result_mk_error(pq_other_error("Memory allocation for parameter types failed"));
+  for (size_t i = 0; i < nParams; i++) {
+    types[i] = (Oid)lean_unbox_uint32(lean_array_get_core(paramTypes, i));
+  }
+  int sent = PQsendPrepare(connection->pg_conn, stmtName_cstr, query_cstr, (int)nParams, types);
+  if (types != types_buf)
+    free(types);
+  if (!sent)
+    return lean_io_result_mk_error(pq_other_error(PQerrorMessage(connection->pg_conn)));
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// PQsendQueryPrepared - Sends a request to execute a prepared statement without waiting for the result(s)
+// Documentation: https://www.postgresql.org/docs/current/libpq-async.html#LIBPQ-PQSENDQUERYPREPARED
+LEAN_EXPORT lean_obj_res lean_pq_send_query_prepared(b_lean_obj_arg conn, b_lean_obj_arg stmtName, b_lean_obj_arg param_array, b_lean_obj_arg resultFormat) {
+  Connection *connection = pq_connection_get_handle(conn);
+  const char * stmtName_cstr = lean_string_cstr(stmtName);
+  int resultFormat_int = lean_unbox(resultFormat);
+  Params params;
+  if (!pq_params_init(&params, param_array))
+    return lean_io_result_mk_error(pq_other_error("Memory allocation for parameters failed"));
+  int sent = PQsendQueryPrepared(connection->pg_conn, stmtName_cstr, params.n, params.values, params.lengths, params.formats, resultFormat_int);
+  pq_params_free(&params);
+  if (!sent)
+    return lean_io_result_mk_error(pq_other_error(PQerrorMessage(connection->pg_conn)));
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// PqSendQueryPreparedBatch - Queues one execution of a prepared statement per parameter set
+// Saves a round trip through the FFI per statement when a pipeline is filled in bulk.
+LEAN_EXPORT lean_obj_res lean_pq_send_query_prepared_batch(b_lean_obj_arg conn, b_lean_obj_arg stmtName, b_lean_obj_arg param_sets, b_lean_obj_arg resultFormat) {
+  Connection *connection = pq_connection_get_handle(conn);
+  const char * stmtName_cstr = lean_string_cstr(stmtName);
+  int resultFormat_int = lean_unbox(resultFormat);
+  size_t count = lean_array_size(param_sets);
+  // Executions already queued produce results whatever happens next, so a failure
+  // returns how many there are rather than an error.
+  for (size_t i = 0; i < count; i++) {
+    Params params;
+    if (!pq_params_init(&params, lean_array_get_core(param_sets, i))) {
+      if (i == 0)
+        return lean_io_result_mk_error(pq_other_error("Memory allocation for parameters failed"));
+      return lean_io_result_mk_ok(lean_usize_to_nat(i));
+    }
+    int sent = PQsendQueryPrepared(connection->pg_conn, stmtName_cstr, params.n, params.values, params.lengths, params.formats, resultFormat_int);
+    pq_params_free(&params);
+    if (!sent)
+      return lean_io_result_mk_ok(lean_usize_to_nat(i));
+  }
+  return lean_io_result_mk_ok(lean_usize_to_nat(count));
+}
+
+// [Result Functions](https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-EXEC-SELECT-INFO)
+
+// Result Status Functions
+// PQresultStatus - Returns the result status of the command
+// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQRESULTSTATUS
+LEAN_EXPORT lean_obj_res lean_pq_result_status(b_lean_obj_arg res) {
+  Result *result = pq_result_get_handle(res);
+  ExecStatusType status = PQresultStatus(result->pg_result);
+  lean_object * status_boxed = lean_box_uint32((uint32_t)status);
+  return lean_io_result_mk_ok(status_boxed);
+}
+
+// PQresStatus - Converts the enumerated type returned by PQresultStatus into a string constant
+// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQRESSTATUS
+LEAN_EXPORT lean_obj_res lean_pq_res_status(b_lean_obj_arg res) {
+  Result *result = pq_result_get_handle(res);
+  ExecStatusType status = PQresultStatus(result->pg_result);
+  lean_object * status_boxed = lean_box_uint32((uint32_t)status);
+  return lean_io_result_mk_ok(status_boxed);
+}
+
+// PQresultErrorMessage - Returns the error message associated with the command
+// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQRESULTERRORMESSAGE
+LEAN_EXPORT lean_obj_res lean_pq_result_error_message(b_lean_obj_arg res) {
+  Result *result = pq_result_get_handle(res);
+  const char * error_message = PQresultErrorMessage(result->pg_result);
+  return lean_io_result_mk_ok(lean_mk_string(error_message));
+}
+
+// PQresultErrorField - Returns an individual field of an error report
+// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQRESULTERRORFIELD
+LEAN_EXPORT lean_obj_res lean_pq_result_error_field(b_lean_obj_arg res, b_lean_obj_arg fieldcode) {
+  Result *result = pq_result_get_handle(res);
+  int fieldcode_int = lean_unbox(fieldcode);
+  const char * error_field = PQresultErrorField(result->pg_result, fieldcode_int);
+  // NULL when the field is not part of the report
+  return lean_io_result_mk_ok(lean_mk_string(error_field ? error_field : ""));
+}
+
+// Retrieving Query Result Information
+// PQntuples - Returns the number of rows (tuples) in the query result
+// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQNTUPLES
+LEAN_EXPORT lean_obj_res lean_pq_ntuples(b_lean_obj_arg res) {
+  Result *result = pq_result_get_handle(res);
+  int ntuples = PQntuples(result->pg_result);
+  return lean_io_result_mk_ok(lean_box(ntuples));
+}
+
+// PQnfields - Returns the number of columns (fields) in each row of the query result
+// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQNFIELDS
+LEAN_EXPORT lean_obj_res lean_pq_nfields(b_lean_obj_arg res) {
+  Result *result = pq_result_get_handle(res);
+  int nfields = PQnfields(result->pg_result);
+  return lean_io_result_mk_ok(lean_box(nfields));
+}
+
+// PQfname - Returns the column name associated with the given column number
+// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQFNAME
+LEAN_EXPORT lean_obj_res lean_pq_fname(b_lean_obj_arg res, b_lean_obj_arg field_num) {
+  Result *result = pq_result_get_handle(res);
+  int field_num_int = lean_unbox(field_num);
+  const char * fname = PQfname(result->pg_result, field_num_int);
+  return lean_io_result_mk_ok(lean_mk_string(fname));
+}
+
+// PQfnumber - Returns the column number associated with the given column name
+// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQFNUMBER
+LEAN_EXPORT lean_obj_res lean_pq_fnumber(b_lean_obj_arg res, b_lean_obj_arg field_name) {
+  Result *result = pq_result_get_handle(res);
+  const char * field_name_cstr = lean_string_cstr(field_name);
+  int fnumber = PQfnumber(result->pg_result, field_name_cstr);
+  return lean_io_result_mk_ok(lean_box(fnumber));
+}
+
+// PQftable - Returns the OID of the table from which the given column was fetched
+// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQFTABLE
+LEAN_EXPORT lean_obj_res lean_pq_ftable(b_lean_obj_arg res, b_lean_obj_arg field_num) {
+  Result *result = pq_result_get_handle(res);
+  int field_num_int = lean_unbox(field_num);
+  Oid ftable = PQftable(result->pg_result, field_num_int);
+  lean_object * ftable_obj = lean_box_usize((size_t)ftable);
+  return lean_io_result_mk_ok(ftable_obj);
+}
+
+// PQftablecol - Returns the column number (within its table) of the column making up the specified query result column
+// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQFTABLECOL
+LEAN_EXPORT lean_obj_res lean_pq_ftablecol(b_lean_obj_arg res, b_lean_obj_arg field_num) {
+  Result *result = pq_result_get_handle(res);
+  int field_num_int = lean_unbox(field_num);
+  int ftablecol = PQftablecol(result->pg_result, field_num_int);
+  return lean_io_result_mk_ok(lean_box(ftablecol));
+}
+
+// PQfformat - Returns the format code indicating the format of the given column
+// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQFFORMAT
+LEAN_EXPORT lean_obj_res lean_pq_fformat(b_lean_obj_arg res, b_lean_obj_arg field_num) {
+  Result *result = pq_result_get_handle(res);
+  int field_num_int = lean_unbox(field_num);
+  int fformat = PQfformat(result->pg_result, field_num_int);
+  return lean_io_result_mk_ok(lean_box(fformat));
+}
+
+// PQftype - Returns the data type associated with the given column number
+// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQFTYPE
+LEAN_EXPORT lean_obj_res lean_pq_ftype(b_lean_obj_arg res, b_lean_obj_arg field_num) {
+  Result *result = pq_result_get_handle(res);
+  int field_num_int = lean_unbox(field_num);
+  Oid ftype = PQftype(result->pg_result, field_num_int);
+  lean_object * ftype_obj = lean_box_usize((size_t)ftype);
+  return lean_io_result_mk_ok(ftype_obj);
 }
 
 // PQfsize - Returns the size in bytes of the type associated with the given column number
@@ -570,6 +1622,13 @@ LEAN_EXPORT lean_obj_res lean_pq_oid_status(b_lean_obj_arg res) {
   return lean_io_result_mk_ok(lean_mk_string(oid_status));
 }
 
+// PQresultMemorySize - Returns the number of bytes allocated for the result
+// Documentation: https://www.postgresql.org/docs/current/libpq-misc.html#LIBPQ-PQRESULTMEMORYSIZE
+LEAN_EXPORT lean_obj_res lean_pq_result_memory_size(b_lean_obj_arg res) {
+  Result *result = pq_result_get_handle(res);
+  return lean_io_result_mk_ok(lean_box_uint64((uint64_t)PQresultMemorySize(result->pg_result)));
+}
+
 // Retrieving Row Values
 // PQgetvalue - Returns a single field value of one row of a PGresult
 // Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQGETVALUE
@@ -578,7 +1637,11 @@ LEAN_EXPORT lean_obj_res lean_pq_getvalue(b_lean_obj_arg res, b_lean_obj_arg row
   int row_num_int = lean_unbox(row_num);
   int field_num_int = lean_unbox(field_num);
   const char * value = PQgetvalue(result->pg_result, row_num_int, field_num_int);
-  return lean_io_result_mk_ok(lean_mk_string(value));
+  if (value == NULL)
+    return lean_io_result_mk_error(pq_other_error("Row or field number out of range"));
+  // The explicit length keeps binary values with NUL bytes intact and avoids a strlen.
+  int length = PQgetlength(result->pg_result, row_num_int, field_num_int);
+  return lean_io_result_mk_ok(lean_mk_string_from_bytes(value, (size_t)length));
 }
 
 // PQgetisnull - Tests a field for a null value
@@ -601,6 +1664,60 @@ LEAN_EXPORT lean_obj_res lean_pq_getlength(b_lean_obj_arg res, b_lean_obj_arg ro
   return lean_io_result_mk_ok(lean_box(length));
 }
 
+// Bulk Retrieval of Row Values
+
+// Builds the `Option String` for one field: `none` for SQL NULL, otherwise a
+// copy of the value using the length libpq already knows (no strlen).
+static inline lean_object* pq_field_to_option_string(const PGresult *pg_result, int row, int col) {
+  if (PQgetisnull(pg_result, row, col))
+    return lean_box(0); // Option.none
+  const char * value = PQgetvalue(pg_result, row, col);
+  int length = PQgetlength(pg_result, row, col);
+  lean_object * some = lean_alloc_ctor(1, 1, 0); // Option.some
+  lean_ctor_set(some, 0, lean_mk_string_from_bytes(value, (size_t)length));
+  return some;
+}
+
+// PqFetchAll - Materializes the whole result row-major in a single pass
+// All arrays are allocated at their final size from PQntuples/PQnfields.
+LEAN_EXPORT lean_obj_res lean_pq_fetch_all(b_lean_obj_arg res) {
+  Result *result = pq_result_get_handle(res);
+  const PGresult *pg_result = result->pg_result;
+  int ntuples = PQntuples(pg_result);
+  int nfields = PQnfields(pg_result);
+  lean_object * rows = lean_alloc_array((size_t)ntuples, (size_t)ntuples);
+  lean_object ** rows_cptr = lean_array_cptr(rows);
+  for (int row = 0; row < ntuples; row++) {
+    lean_object * cols = lean_alloc_array((size_t)nfields, (size_t)nfields);
+    lean_object ** cols_cptr = lean_array_cptr(cols);
+    for (int col = 0; col < nfields; col++) {
+      cols_cptr[col] = pq_field_to_option_string(pg_result, row, col);
+    }
+    rows_cptr[row] = cols;
+  }
+  return lean_io_result_mk_ok(rows);
+}
+
+// PqFetchColumns - Materializes the whole result column-major in a single pass
+// The outer array is indexed by field number, each inner array by row number.
+LEAN_EXPORT lean_obj_res lean_pq_fetch_columns(b_lean_obj_arg res) {
+  Result *result = pq_result_get_handle(res);
+  const PGresult *pg_result = result->pg_result;
+  int ntuples = PQntuples(pg_result);
+  int nfields = PQnfields(pg_result);
+  lean_object * cols = lean_alloc_array((size_t)nfields, (size_t)nfields);
+  lean_object ** cols_cptr = lean_array_cptr(cols);
+  for (int col = 0; col < nfields; col++) {
+    lean_object * values = lean_alloc_array((size_t)ntuples, (size_t)ntuples);
+    lean_object ** values_cptr = lean_array_cptr(values);
+    for (int row = 0; row < ntuples; row++) {
+      values_cptr[row] = pq_field_to_option_string(pg_result, row, col);
+    }
+    cols_cptr[col] = values;
+  }
+  return lean_io_result_mk_ok(cols);
+}
+
 // PQnparams - Returns the number of parameters of a prepared statement
 // Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQNPARAMS
 LEAN_EXPORT lean_obj_res lean_pq_nparams(b_lean_obj_arg res) {
@@ -619,20 +1736,973 @@ LEAN_EXPORT lean_obj_res lean_pq_paramtype(b_lean_obj_arg res, b_lean_obj_arg pa
   return lean_io_result_mk_ok(param_type_obj);
 }
 
-// Escaping Strings for Inclusion in SQL Commands
-// PQescapeLiteral - Escapes a string for use as an SQL string literal on the given connection
-// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQESCAPELITERAL
-LEAN_EXPORT lean_obj_res lean_pq_escape_literal(b_lean_obj_arg conn, b_lean_obj_arg str) {
-  Connection *connection = pq_connection_get_handle(conn);
-  const char * str_cstr = lean_string_cstr(str);
-  size_t str_length = strlen(str_cstr);
-  char * escaped = PQescapeLiteral(connection->pg_conn, str_cstr, str_length);
-  if (escaped == NULL) {
-    return lean_io_result_mk_error(pq_other_error("PQescapeLiteral failed"));
-  }
-  lean_object * result = lean_mk_string(escaped);
-  PQfreemem(escaped);
-  return lean_io_result_mk_ok(result);
+// Typed Decoding of Row Values
+// Binary layouts follow the `*send`/`*recv` functions of the PostgreSQL backend.
+
+// Built-in type OIDs (src/include/catalog/pg_type.dat), mirrored in `LeanPq.Oid`.
+#define LEAN_PQ_BOOLOID 16
+#define LEAN_PQ_BYTEAOID 17
+#define LEAN_PQ_CHAROID 18
+#define LEAN_PQ_NAMEOID 19
+#define LEAN_PQ_INT8OID 20
+#define LEAN_PQ_INT2OID 21
+#define LEAN_PQ_INT4OID 23
+#define LEAN_PQ_TEXTOID 25
+#define LEAN_PQ_OIDOID 26
+#define LEAN_PQ_JSONOID 114
+#define LEAN_PQ_XMLOID 142
+#define LEAN_PQ_FLOAT4OID 700
+#define LEAN_PQ_UNKNOWNOID 705
+#define LEAN_PQ_FLOAT8OID 701
+#define LEAN_PQ_BPCHAROID 1042
+#define LEAN_PQ_VARCHAROID 1043
+#define LEAN_PQ_DATEOID 1082
+#define LEAN_PQ_TIMESTAMPOID 1114
+#define LEAN_PQ_TIMESTAMPTZOID 1184
+#define LEAN_PQ_NUMERICOID 1700
+#define LEAN_PQ_UUIDOID 2950
+#define LEAN_PQ_JSONBOID 3802
+#define LEAN_PQ_RECORDOID 2249
+
+// PostgreSQL epoch (2000-01-01) relative to the Unix epoch.
+#define LEAN_PQ_EPOCH_DIFF_DAYS 10957
+#define LEAN_PQ_EPOCH_DIFF_MICROS INT64_C(946684800000000)
+
+// Constructor tags of `LeanPq.Value`.
+#define LEAN_PQ_VALUE_NULL 0
+#define LEAN_PQ_VALUE_BOOL 1
+#define LEAN_PQ_VALUE_INT 2
+#define LEAN_PQ_VALUE_FLOAT 3
+#define LEAN_PQ_VALUE_NUMERIC 4
+#define LEAN_PQ_VALUE_DATE 5
+#define LEAN_PQ_VALUE_TIMESTAMP 6
+#define LEAN_PQ_VALUE_TIMESTAMPTZ 7
+#define LEAN_PQ_VALUE_UUID 8
+#define LEAN_PQ_VALUE_BYTEA 9
+#define LEAN_PQ_VALUE_TEXT 10
+#define LEAN_PQ_VALUE_ARRAY 11
+#define LEAN_PQ_VALUE_RECORD 12
+
+// Constructor tags of `LeanPq.ColumnData`.
+#define LEAN_PQ_COLUMN_INT64 0
+#define LEAN_PQ_COLUMN_FLOAT64 1
+#define LEAN_PQ_COLUMN_BOXED 2
+
+static inline uint16_t pq_read_be16(const char *p) {
+  const unsigned char *u = (const unsigned char *)p;
+  return (uint16_t)((u[0] << 8) | u[1]);
+}
+
+static inline uint32_t pq_read_be32(const char *p) {
+  const unsigned char *u = (const unsigned char *)p;
+  return ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) | ((uint32_t)u[2] << 8) | (uint32_t)u[3];
+}
+
+static inline uint64_t pq_read_be64(const char *p) {
+  return ((uint64_t)pq_read_be32(p) << 32) | (uint64_t)pq_read_be32(p + 4);
+}
+
+static inline void pq_write_le64(uint8_t *p, uint64_t v) {
+  for (int i = 0; i < 8; i++) {
+    p[i] = (uint8_t)(v >> (8 * i));
+  }
+}
+
+static inline double pq_read_float4(const char *p) {
+  uint32_t bits = pq_read_be32(p);
+  float f;
+  memcpy(&f, &bits, sizeof f);
+  return (double)f;
+}
+
+static inline double pq_read_float8(const char *p) {
+  uint64_t bits = pq_read_be64(p);
+  double d;
+  memcpy(&d, &bits, sizeof d);
+  return d;
+}
+
+// Timestamps keep the +/-infinity sentinels (INT64_MAX / INT64_MIN) untouched.
+static inline int64_t pq_timestamp_to_unix(int64_t pg_micros) {
+  if (pg_micros == INT64_MAX || pg_micros == INT64_MIN)
+    return pg_micros;
+  return pg_micros + LEAN_PQ_EPOCH_DIFF_MICROS;
+}
+
+static inline int32_t pq_date_to_unix(int32_t pg_days) {
+  if (pg_days == INT32_MAX || pg_days == INT32_MIN)
+    return pg_days;
+  return pg_days + LEAN_PQ_EPOCH_DIFF_DAYS;
+}
+
+static lean_object* pq_mk_byte_array(const char *data, size_t length) {
+  lean_object * arr = lean_alloc_sarray(1, length, length);
+  if (length > 0)
+    memcpy(lean_sarray_cptr(arr), data, length);
+  return arr;
+}
+
+static lean_object* pq_value_with_object(unsigned tag, lean_object *obj) {
+  lean_object * value = lean_alloc_ctor(tag, 1, 0);
+  lean_ctor_set(value, 0, obj);
+  return value;
+}
+
+static lean_object* pq_value_with_uint64(unsigned tag, uint64_t v) {
+  lean_object * value = lean_alloc_ctor(tag, 0, sizeof(uint64_t));
+  lean_ctor_set_uint64(value, 0, v);
+  return value;
+}
+
+static lean_object* pq_value_float(double v) {
+  lean_object * value = lean_alloc_ctor(LEAN_PQ_VALUE_FLOAT, 0, sizeof(double));
+  lean_ctor_set_float(value, 0, v);
+  return value;
+}
+
+static lean_object* pq_value_bool(int v) {
+  lean_object * value = lean_alloc_ctor(LEAN_PQ_VALUE_BOOL, 0, 1);
+  lean_ctor_set_uint8(value, 0, v ? 1 : 0);
+  return value;
+}
+
+static lean_object* pq_value_date(int32_t days) {
+  lean_object * value = lean_alloc_ctor(LEAN_PQ_VALUE_DATE, 0, sizeof(uint32_t));
+  lean_ctor_set_uint32(value, 0, (uint32_t)days);
+  return value;
+}
+
+// Converts a binary `numeric` (base-10000 digits, see numeric_send) into its
+// decimal text form. Returns NULL when the value is malformed.
+#define LEAN_PQ_NUMERIC_POS 0x0000
+#define LEAN_PQ_NUMERIC_NEG 0x4000
+#define LEAN_PQ_NUMERIC_NAN 0xC000
+#define LEAN_PQ_NUMERIC_PINF 0xD000
+#define LEAN_PQ_NUMERIC_NINF 0xF000
+
+static lean_object* pq_numeric_to_string(const char *p, int length) {
+  if (length < 8)
+    return NULL;
+  int ndigits = (int16_t)pq_read_be16(p);
+  int weight = (int16_t)pq_read_be16(p + 2);
+  uint16_t sign = pq_read_be16(p + 4);
+  int dscale = (int16_t)pq_read_be16(p + 6);
+  if (sign == LEAN_PQ_NUMERIC_NAN)
+    return lean_mk_string("NaN");
+  if (sign == LEAN_PQ_NUMERIC_PINF)
+    return lean_mk_string("Infinity");
+  if (sign == LEAN_PQ_NUMERIC_NINF)
+    return lean_mk_string("-Infinity");
+  if (ndigits < 0 || dscale < 0 || length < 8 + 2 * ndigits)
+    return NULL;
+  // Sign, integer digits (at least one), point and fractional digits.
+  int int_groups = weight >= 0 ? weight + 1 : 0;
+  size_t cap = 2 + (size_t)(int_groups > 0 ? int_groups * 4 : 1) + 1 + (size_t)dscale + 1;
+  char stack_buf[128];
+  char *buf = cap <= sizeof stack_buf ? stack_buf : (char *)malloc(cap);
+  if (!buf)
+    return NULL;
+  size_t n = 0;
+  if (sign == LEAN_PQ_NUMERIC_NEG)
+    buf[n++] = '-';
+  if (int_groups == 0) {
+    buf[n++] = '0';
+  } else {
+    for (int g = 0; g < int_groups; g++) {
+      int digit = g < ndigits ? (int16_t)pq_read_be16(p + 8 + 2 * g) : 0;
+      // The leading group is printed without zero padding.
+      char tmp[5];
+      snprintf(tmp, sizeof tmp, g == 0 ? "%d" : "%04d", digit);
+      for (char *t = tmp; *t; t++)
+        buf[n++] = *t;
+    }
+  }
+  if (dscale > 0) {
+    buf[n++] = '.';
+    int written = 0;
+    // The first fractional group sits at index weight + 1 (may be negative weight).
+    for (int g = weight + 1; written < dscale; g++) {
+      int digit = (g >= 0 && g < ndigits) ? (int16_t)pq_read_be16(p + 8 + 2 * g) : 0;
+      int divisor = 1000;
+      for (int k = 0; k < 4 && written < dscale; k++, written++) {
+        buf[n++] = (char)('0' + (digit / divisor) % 10);
+        divisor /= 10;
+      }
+    }
+  }
+  lean_object * str = lean_mk_string_unchecked(buf, n, n);
+  if (buf != stack_buf)
+    free(buf);
+  return str;
+}
+
+// Array types of the built-in scalars (see `builtinTypes` in TypeRegistry.lean).
+static int pq_is_array_oid(Oid oid) {
+  switch (oid) {
+    case 1000: case 1001: case 1016: case 1005: case 1007: case 1009: case 1028:
+    case 199: case 143: case 651: case 1021: case 1022: case 791: case 1040:
+    case 1041: case 1014: case 1015: case 1182: case 1183: case 1115: case 1185:
+    case 1187: case 1270: case 1561: case 1563: case 1231: case 2951: case 3807:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static lean_object* pq_decode_binary_array(const char *p, int length, int *ok);
+static lean_object* pq_decode_binary_record(const char *p, int length, int *ok);
+
+// Decodes one binary field. `ok` is cleared when the length does not match the type.
+static lean_object* pq_decode_binary_field(Oid oid, const char *p, int length, int *ok) {
+  *ok = 1;
+  if (pq_is_array_oid(oid))
+    return pq_decode_binary_array(p, length, ok);
+  switch (oid) {
+    case LEAN_PQ_BOOLOID:
+      if (length != 1) break;
+      return pq_value_bool(p[0] != 0);
+    case LEAN_PQ_INT2OID:
+      if (length != 2) break;
+      return pq_value_with_uint64(LEAN_PQ_VALUE_INT, (uint64_t)(int64_t)(int16_t)pq_read_be16(p));
+    case LEAN_PQ_INT4OID:
+      if (length != 4) break;
+      return pq_value_with_uint64(LEAN_PQ_VALUE_INT, (uint64_t)(int64_t)(int32_t)pq_read_be32(p));
+    case LEAN_PQ_OIDOID:
+      if (length != 4) break;
+      return pq_value_with_uint64(LEAN_PQ_VALUE_INT, (uint64_t)pq_read_be32(p));
+    case LEAN_PQ_INT8OID:
+      if (length != 8) break;
+      return pq_value_with_uint64(LEAN_PQ_VALUE_INT, pq_read_be64(p));
+    case LEAN_PQ_FLOAT4OID:
+      if (length != 4) break;
+      return pq_value_float(pq_read_float4(p));
+    case LEAN_PQ_FLOAT8OID:
+      if (length != 8) break;
+      return pq_value_float(pq_read_float8(p));
+    case LEAN_PQ_DATEOID:
+      if (length != 4) break;
+      return pq_value_date(pq_date_to_unix((int32_t)pq_read_be32(p)));
+    case LEAN_PQ_TIMESTAMPOID:
+      if (length != 8) break;
+      return pq_value_with_uint64(LEAN_PQ_VALUE_TIMESTAMP, (uint64_t)pq_timestamp_to_unix((int64_t)pq_read_be64(p)));
+    case LEAN_PQ_TIMESTAMPTZOID:
+      if (length != 8) break;
+      return pq_value_with_uint64(LEAN_PQ_VALUE_TIMESTAMPTZ, (uint64_t)pq_timestamp_to_unix((int64_t)pq_read_be64(p)));
+    case LEAN_PQ_UUIDOID:
+      if (length != 16) break;
+      return pq_value_with_object(LEAN_PQ_VALUE_UUID, pq_mk_byte_array(p, 16));
+    case LEAN_PQ_BYTEAOID:
+      return pq_value_with_object(LEAN_PQ_VALUE_BYTEA, pq_mk_byte_array(p, (size_t)length));
+    case LEAN_PQ_NUMERICOID: {
+      lean_object * str = pq_numeric_to_string(p, length);
+      if (!str) break;
+      return pq_value_with_object(LEAN_PQ_VALUE_NUMERIC, str);
+    }
+    case LEAN_PQ_JSONBOID:
+      // jsonb_send prefixes the text with a one byte format version.
+      if (length < 1 || p[0] != 1) break;
+      return pq_value_with_object(LEAN_PQ_VALUE_TEXT, lean_mk_string_from_bytes(p + 1, (size_t)length - 1));
+    case LEAN_PQ_RECORDOID:
+      return pq_decode_binary_record(p, length, ok);
+    // The binary form of these is their text.
+    case LEAN_PQ_TEXTOID:
+    case LEAN_PQ_VARCHAROID:
+    case LEAN_PQ_BPCHAROID:
+    case LEAN_PQ_NAMEOID:
+    case LEAN_PQ_CHAROID:
+    case LEAN_PQ_JSONOID:
+    case LEAN_PQ_XMLOID:
+    case LEAN_PQ_UNKNOWNOID:
+      return pq_value_with_object(LEAN_PQ_VALUE_TEXT, lean_mk_string_from_bytes(p, (size_t)length));
+    default:
+      // interval, inet, ranges, named composites, ...: kept as their wire bytes, which
+      // are not text and would be mangled by UTF-8 validation.
+      return pq_value_with_object(LEAN_PQ_VALUE_BYTEA, pq_mk_byte_array(p, (size_t)length));
+  }
+  *ok = 0;
+  return NULL;
+}
+
+// Binary arrays (array_send): ndim, has-null flag, element OID, then (size, lower bound)
+// per dimension and the elements in row-major order, each as (length or -1, bytes).
+#define LEAN_PQ_ARRAY_MAX_DIMS 6
+
+struct array_header {
+  int ndim;
+  Oid elem_oid;
+  int dims[LEAN_PQ_ARRAY_MAX_DIMS];
+  size_t count;
+  const char *elements;
+  const char *end;
+};
+
+typedef struct array_header ArrayHeader;
+
+static int pq_read_array_header(const char *p, int length, ArrayHeader *header) {
+  if (length < 12)
+    return 0;
+  header->ndim = (int32_t)pq_read_be32(p);
+  header->elem_oid = pq_read_be32(p + 8);
+  if (header->ndim < 0 || header->ndim > LEAN_PQ_ARRAY_MAX_DIMS || length < 12 + 8 * header->ndim)
+    return 0;
+  header->count = header->ndim > 0 ? 1 : 0;
+  for (int d = 0; d < header->ndim; d++) {
+    int size = (int32_t)pq_read_be32(p + 12 + 8 * d);
+    if (size < 0)
+      return 0;
+    // A wrapped product could pass the size check below with huge dimensions.
+    if (size > 0 && header->count > SIZE_MAX / (size_t)size)
+      return 0;
+    header->dims[d] = size;
+    header->count *= (size_t)size;
+  }
+  header->elements = p + 12 + 8 * header->ndim;
+  header->end = p + length;
+  // Every element takes at least its 4 byte length.
+  return header->count <= (size_t)(header->end - header->elements) / 4;
+}
+
+// Reads the next element; `*element` is NULL for SQL NULL. Returns 0 past the end of the data.
+static inline int pq_next_element(const char **cursor, const char *end, const char **element, int *length) {
+  if (end - *cursor < 4)
+    return 0;
+  int32_t n = (int32_t)pq_read_be32(*cursor);
+  *cursor += 4;
+  if (n < 0) {
+    *element = NULL;
+    *length = 0;
+    return 1;
+  }
+  if (end - *cursor < n)
+    return 0;
+  *element = *cursor;
+  *length = n;
+  *cursor += n;
+  return 1;
+}
+
+static lean_object* pq_mk_dims(const ArrayHeader *header) {
+  lean_object * dims = lean_alloc_array((size_t)header->ndim, (size_t)header->ndim);
+  for (int d = 0; d < header->ndim; d++)
+    lean_array_cptr(dims)[d] = lean_box((size_t)header->dims[d]);
+  return dims;
+}
+
+// Releases the first `filled` elements of an array being built, then the array.
+static void pq_drop_partial_array(lean_object *values, size_t filled, size_t size) {
+  lean_object ** values_cptr = lean_array_cptr(values);
+  for (size_t rest = filled; rest < size; rest++)
+    values_cptr[rest] = lean_box(0);
+  lean_dec(values);
+}
+
+// Decodes a binary array into `Value.array`, elements boxed.
+static lean_object* pq_decode_binary_array(const char *p, int length, int *ok) {
+  ArrayHeader header;
+  if (!pq_read_array_header(p, length, &header)) {
+    *ok = 0;
+    return NULL;
+  }
+  lean_object * elements = lean_alloc_array(header.count, header.count);
+  lean_object ** elements_cptr = lean_array_cptr(elements);
+  const char * cursor = header.elements;
+  for (size_t i = 0; i < header.count; i++) {
+    const char * element;
+    int element_length;
+    lean_object * value = NULL;
+    if (pq_next_element(&cursor, header.end, &element, &element_length)) {
+      value = element ? pq_decode_binary_field(header.elem_oid, element, element_length, ok)
+                      : lean_box(LEAN_PQ_VALUE_NULL);
+    }
+    if (!value) {
+      pq_drop_partial_array(elements, i, header.count);
+      *ok = 0;
+      return NULL;
+    }
+    elements_cptr[i] = value;
+  }
+  *ok = 1;
+  lean_object * array = lean_alloc_ctor(LEAN_PQ_VALUE_ARRAY, 2, sizeof(uint32_t));
+  lean_ctor_set(array, 0, pq_mk_dims(&header));
+  lean_ctor_set(array, 1, elements);
+  lean_ctor_set_uint32(array, 2 * sizeof(void *), (uint32_t)header.elem_oid);
+  return array;
+}
+
+// Decodes a binary composite (record_send): field count, then (OID, length or -1, bytes) per field.
+static lean_object* pq_decode_binary_record(const char *p, int length, int *ok) {
+  if (length < 4) {
+    *ok = 0;
+    return NULL;
+  }
+  int32_t nfields = (int32_t)pq_read_be32(p);
+  const char * cursor = p + 4;
+  const char * end = p + length;
+  // Every field takes at least its OID and length.
+  if (nfields < 0 || (size_t)nfields > (size_t)(end - cursor) / 8) {
+    *ok = 0;
+    return NULL;
+  }
+  lean_object * types = lean_alloc_array((size_t)nfields, (size_t)nfields);
+  lean_object * fields = lean_alloc_array((size_t)nfields, (size_t)nfields);
+  for (int32_t i = 0; i < nfields; i++) {
+    lean_object * value = NULL;
+    Oid oid = 0;
+    if (end - cursor >= 4) {
+      oid = pq_read_be32(cursor);
+      cursor += 4;
+      const char * field;
+      int field_length;
+      if (pq_next_element(&cursor, end, &field, &field_length)) {
+        value = field ? pq_decode_binary_field(oid, field, field_length, ok)
+                      : lean_box(LEAN_PQ_VALUE_NULL);
+      }
+    }
+    if (!value) {
+      pq_drop_partial_array(types, (size_t)i, (size_t)nfields);
+      pq_drop_partial_array(fields, (size_t)i, (size_t)nfields);
+      *ok = 0;
+      return NULL;
+    }
+    lean_array_cptr(types)[i] = lean_box_uint32((uint32_t)oid);
+    lean_array_cptr(fields)[i] = value;
+  }
+  *ok = 1;
+  lean_object * record = lean_alloc_ctor(LEAN_PQ_VALUE_RECORD, 2, 0);
+  lean_ctor_set(record, 0, types);
+  lean_ctor_set(record, 1, fields);
+  return record;
+}
+
+// Parses a whole text integer field (NUL-terminated, as libpq gives it). Returns 0
+// when it is not a number or is out of range.
+static int pq_parse_text_int(const char *p, int length, int64_t *out) {
+  char *end;
+  errno = 0;
+  long long v = strtoll(p, &end, 10);
+  if (length <= 0 || end != p + length || errno != 0)
+    return 0;
+  *out = (int64_t)v;
+  return 1;
+}
+
+// Parses a whole text floating-point field (NaN and Infinity included). Returns 0 when
+// it is not a number or overflows; ERANGE on underflow is accepted, since float8 holds
+// subnormal values.
+static int pq_parse_text_float(const char *p, int length, double *out) {
+  char *end;
+  errno = 0;
+  double v = strtod(p, &end);
+  if (length <= 0 || end != p + length || (errno != 0 && isinf(v)))
+    return 0;
+  *out = v;
+  return 1;
+}
+
+// Decodes one text field: only bool, integers and floats are parsed. `ok` is cleared
+// when a number is malformed or out of range.
+static lean_object* pq_decode_text_field(Oid oid, const char *p, int length, int *ok) {
+  *ok = 1;
+  switch (oid) {
+    case LEAN_PQ_BOOLOID:
+      return pq_value_bool(length > 0 && p[0] == 't');
+    case LEAN_PQ_INT2OID:
+    case LEAN_PQ_INT4OID:
+    case LEAN_PQ_INT8OID:
+    case LEAN_PQ_OIDOID: {
+      int64_t v;
+      if (!pq_parse_text_int(p, length, &v)) break;
+      return pq_value_with_uint64(LEAN_PQ_VALUE_INT, (uint64_t)v);
+    }
+    case LEAN_PQ_FLOAT4OID:
+    case LEAN_PQ_FLOAT8OID: {
+      double v;
+      if (!pq_parse_text_float(p, length, &v)) break;
+      return pq_value_float(v);
+    }
+    default:
+      return pq_value_with_object(LEAN_PQ_VALUE_TEXT, lean_mk_string_from_bytes(p, (size_t)length));
+  }
+  *ok = 0;
+  return NULL;
+}
+
+static lean_object* pq_decode_field(const PGresult *pg_result, int row, int col, Oid oid, int binary, int *ok) {
+  *ok = 1;
+  if (PQgetisnull(pg_result, row, col))
+    return lean_box(LEAN_PQ_VALUE_NULL);
+  const char * value = PQgetvalue(pg_result, row, col);
+  int length = PQgetlength(pg_result, row, col);
+  if (binary)
+    return pq_decode_binary_field(oid, value, length, ok);
+  return pq_decode_text_field(oid, value, length, ok);
+}
+
+static lean_object* pq_decode_error(const PGresult *pg_result, int row, int col) {
+  char msg[128];
+  snprintf(msg, sizeof msg, "Malformed %s value of type %u (%d bytes) at row %d, field %d",
+           PQfformat(pg_result, col) == 1 ? "binary" : "text",
+           PQftype(pg_result, col), PQgetlength(pg_result, row, col), row, col);
+  return pq_other_error(msg);
+}
+
+// PqGetTypedValue - Decodes a single field according to its type OID and format
+LEAN_EXPORT lean_obj_res lean_pq_get_typed_value(b_lean_obj_arg res, b_lean_obj_arg row_num, b_lean_obj_arg field_num) {
+  Result *result = pq_result_get_handle(res);
+  int row_num_int = lean_unbox(row_num);
+  int field_num_int = lean_unbox(field_num);
+  const PGresult *pg_result = result->pg_result;
+  if (row_num_int < 0 || row_num_int >= PQntuples(pg_result) || field_num_int < 0 || field_num_int >= PQnfields(pg_result))
+    return lean_io_result_mk_error(pq_other_error("Row or field number out of range"));
+  int ok;
+  lean_object * value = pq_decode_field(pg_result, row_num_int, field_num_int,
+                                        PQftype(pg_result, field_num_int),
+                                        PQfformat(pg_result, field_num_int) == 1, &ok);
+  if (!ok)
+    return lean_io_result_mk_error(pq_decode_error(pg_result, row_num_int, field_num_int));
+  return lean_io_result_mk_ok(value);
+}
+
+// Width in bytes of a fixed-width binary type packed as int64, 0 otherwise.
+static int pq_packed_int_width(Oid oid) {
+  switch (oid) {
+    case LEAN_PQ_BOOLOID: return 1;
+    case LEAN_PQ_INT2OID: return 2;
+    case LEAN_PQ_INT4OID:
+    case LEAN_PQ_OIDOID:
+    case LEAN_PQ_DATEOID: return 4;
+    case LEAN_PQ_INT8OID:
+    case LEAN_PQ_TIMESTAMPOID:
+    case LEAN_PQ_TIMESTAMPTZOID: return 8;
+    default: return 0;
+  }
+}
+
+// Decodes a binary fixed-width value packed as int64 (see `ColumnData.int64`).
+// Returns 0 when the length does not match the type.
+static inline int pq_decode_packed_int(Oid oid, const char *p, int length, int64_t *out) {
+  if (length != pq_packed_int_width(oid))
+    return 0;
+  switch (oid) {
+    case LEAN_PQ_BOOLOID: *out = p[0] != 0; break;
+    case LEAN_PQ_INT2OID: *out = (int16_t)pq_read_be16(p); break;
+    case LEAN_PQ_INT4OID: *out = (int32_t)pq_read_be32(p); break;
+    case LEAN_PQ_OIDOID: *out = pq_read_be32(p); break;
+    case LEAN_PQ_DATEOID: *out = pq_date_to_unix((int32_t)pq_read_be32(p)); break;
+    case LEAN_PQ_INT8OID: *out = (int64_t)pq_read_be64(p); break;
+    default: *out = pq_timestamp_to_unix((int64_t)pq_read_be64(p)); break;
+  }
+  return 1;
+}
+
+// Decodes a binary float4/float8 value. Returns 0 when the length does not match the type.
+static inline int pq_decode_packed_float(Oid oid, const char *p, int length, double *out) {
+  if (oid == LEAN_PQ_FLOAT4OID && length == 4) {
+    *out = pq_read_float4(p);
+    return 1;
+  }
+  if (oid == LEAN_PQ_FLOAT8OID && length == 8) {
+    *out = pq_read_float8(p);
+    return 1;
+  }
+  return 0;
+}
+
+static lean_object* pq_mk_column(Oid oid, lean_object *nulls, unsigned data_tag, lean_object *values) {
+  lean_object * data = lean_alloc_ctor(data_tag, 1, 0);
+  lean_ctor_set(data, 0, values);
+  lean_object * column = lean_alloc_ctor(0, 2, sizeof(uint32_t));
+  lean_ctor_set(column, 0, nulls);
+  lean_ctor_set(column, 1, data);
+  lean_ctor_set_uint32(column, 2 * sizeof(void *), (uint32_t)oid);
+  return column;
+}
+
+// PqDecodeColumn - Decodes a whole column in one pass
+// Integers, bool, date and timestamps are packed into a ByteArray of
+// little-endian int64, floats into a FloatArray; other types are boxed.
+LEAN_EXPORT lean_obj_res lean_pq_decode_column(b_lean_obj_arg res, b_lean_obj_arg field_num) {
+  Result *result = pq_result_get_handle(res);
+  const PGresult *pg_result = result->pg_result;
+  int col = lean_unbox(field_num);
+  if (col < 0 || col >= PQnfields(pg_result))
+    return lean_io_result_mk_error(pq_other_error("Field number out of range"));
+  int ntuples = PQntuples(pg_result);
+  Oid oid = PQftype(pg_result, col);
+  int binary = PQfformat(pg_result, col) == 1;
+  lean_object * nulls = lean_alloc_sarray(1, (size_t)ntuples, (size_t)ntuples);
+  uint8_t * nulls_cptr = lean_sarray_cptr(nulls);
+  for (int row = 0; row < ntuples; row++) {
+    nulls_cptr[row] = (uint8_t)PQgetisnull(pg_result, row, col);
+  }
+
+  int width = pq_packed_int_width(oid);
+  // Text dates and timestamps are not parsed and stay boxed.
+  int text_packable = oid != LEAN_PQ_DATEOID && oid != LEAN_PQ_TIMESTAMPOID && oid != LEAN_PQ_TIMESTAMPTZOID;
+  if (width > 0 && (binary || text_packable)) {
+    lean_object * values = lean_alloc_sarray(1, (size_t)ntuples * 8, (size_t)ntuples * 8);
+    uint8_t * out = lean_sarray_cptr(values);
+    for (int row = 0; row < ntuples; row++, out += 8) {
+      int64_t v = 0;
+      if (!nulls_cptr[row]) {
+        const char * p = PQgetvalue(pg_result, row, col);
+        int length = PQgetlength(pg_result, row, col);
+        int ok = 1;
+        if (!binary && oid == LEAN_PQ_BOOLOID)
+          v = p[0] == 't';
+        else
+          ok = binary ? pq_decode_packed_int(oid, p, length, &v) : pq_parse_text_int(p, length, &v);
+        if (!ok) {
+          lean_dec(values);
+          lean_dec(nulls);
+          return lean_io_result_mk_error(pq_decode_error(pg_result, row, col));
+        }
+      }
+      pq_write_le64(out, (uint64_t)v);
+    }
+    return lean_io_result_mk_ok(pq_mk_column(oid, nulls, LEAN_PQ_COLUMN_INT64, values));
+  }
+
+  if (oid == LEAN_PQ_FLOAT4OID || oid == LEAN_PQ_FLOAT8OID) {
+    lean_object * values = lean_alloc_sarray(sizeof(double), (size_t)ntuples, (size_t)ntuples);
+    double * out = lean_float_array_cptr(values);
+    for (int row = 0; row < ntuples; row++) {
+      double v = 0.0;
+      if (!nulls_cptr[row]) {
+        const char * p = PQgetvalue(pg_result, row, col);
+        int length = PQgetlength(pg_result, row, col);
+        int ok = !binary ? pq_parse_text_float(p, length, &v) : pq_decode_packed_float(oid, p, length, &v);
+        if (!ok) {
+          lean_dec(values);
+          lean_dec(nulls);
+          return lean_io_result_mk_error(pq_decode_error(pg_result, row, col));
+        }
+      }
+      out[row] = v;
+    }
+    return lean_io_result_mk_ok(pq_mk_column(oid, nulls, LEAN_PQ_COLUMN_FLOAT64, values));
+  }
+
+  lean_object * values = lean_alloc_array((size_t)ntuples, (size_t)ntuples);
+  lean_object ** values_cptr = lean_array_cptr(values);
+  for (int row = 0; row < ntuples; row++) {
+    int ok;
+    lean_object * value = pq_decode_field(pg_result, row, col, oid, binary, &ok);
+    if (!ok) {
+      // Keep the array well-formed before releasing it.
+      for (int rest = row; rest < ntuples; rest++)
+        values_cptr[rest] = lean_box(0);
+      lean_dec(values);
+      lean_dec(nulls);
+      return lean_io_result_mk_error(pq_decode_error(pg_result, row, col));
+    }
+    values_cptr[row] = value;
+  }
+  return lean_io_result_mk_ok(pq_mk_column(oid, nulls, LEAN_PQ_COLUMN_BOXED, values));
+}
+
+// Packed arrays
+// Fixed-width elements are converted from network byte order straight into the packed
+// buffer of a ColumnData, the way PqDecodeColumn packs a column.
+
+// PackedArray layout: dims, nulls, data (objects), then elem_oid (uint32).
+static lean_object* pq_mk_packed_array(const ArrayHeader *header, lean_object *nulls, unsigned data_tag, lean_object *values) {
+  lean_object * data = lean_alloc_ctor(data_tag, 1, 0);
+  lean_ctor_set(data, 0, values);
+  lean_object * array = lean_alloc_ctor(0, 3, sizeof(uint32_t));
+  lean_ctor_set(array, 0, pq_mk_dims(header));
+  lean_ctor_set(array, 1, nulls);
+  lean_ctor_set(array, 2, data);
+  lean_ctor_set_uint32(array, 3 * sizeof(void *), (uint32_t)header->elem_oid);
+  return array;
+}
+
+// int8, timestamp and timestamptz arrays without NULLs: elements are 12 byte (length, value)
+// records. Every length is checked in a first pass, so that the swap loops have no early exit
+// and no per-element branch on the type, which lets the compiler vectorize them.
+static int pq_unpack_int64_elements(const ArrayHeader *header, uint8_t *out) {
+  const char * elements = header->elements;
+  size_t n = header->count;
+  if ((size_t)(header->end - elements) / 12 < n)
+    return 0;
+  uint32_t bad = 0;
+  for (size_t i = 0; i < n; i++)
+    bad |= pq_read_be32(elements + 12 * i) ^ 8;
+  if (bad)
+    return 0;
+  if (header->elem_oid == LEAN_PQ_INT8OID) {
+    for (size_t i = 0; i < n; i++)
+      pq_write_le64(out + 8 * i, pq_read_be64(elements + 12 * i + 4));
+  } else {
+    for (size_t i = 0; i < n; i++)
+      pq_write_le64(out + 8 * i, (uint64_t)pq_timestamp_to_unix((int64_t)pq_read_be64(elements + 12 * i + 4)));
+  }
+  return 1;
+}
+
+// PqGetArray - Decodes a binary array field with packed storage for fixed-width elements
+LEAN_EXPORT lean_obj_res lean_pq_get_array(b_lean_obj_arg res, b_lean_obj_arg row_num, b_lean_obj_arg field_num) {
+  Result *result = pq_result_get_handle(res);
+  const PGresult *pg_result = result->pg_result;
+  int row = lean_unbox(row_num);
+  int col = lean_unbox(field_num);
+  if (row < 0 || row >= PQntuples(pg_result) || col < 0 || col >= PQnfields(pg_result))
+    return lean_io_result_mk_error(pq_other_error("Row or field number out of range"));
+  if (PQfformat(pg_result, col) != 1)
+    return lean_io_result_mk_error(pq_other_error("Arrays are only decoded from binary results"));
+  if (PQgetisnull(pg_result, row, col))
+    return lean_io_result_mk_ok(lean_box(0));
+  ArrayHeader header;
+  if (!pq_read_array_header(PQgetvalue(pg_result, row, col), PQgetlength(pg_result, row, col), &header))
+    return lean_io_result_mk_error(pq_other_error("Malformed binary array"));
+  int has_nulls = pq_read_be32(PQgetvalue(pg_result, row, col) + 4) != 0;
+  size_t n = header.count;
+  Oid oid = header.elem_oid;
+  lean_object * nulls = lean_alloc_sarray(1, n, n);
+  uint8_t * nulls_cptr = lean_sarray_cptr(nulls);
+  memset(nulls_cptr, 0, n);
+  lean_object * packed = NULL;
+  unsigned data_tag = LEAN_PQ_COLUMN_BOXED;
+  int ok = 1;
+  int width = pq_packed_int_width(oid);
+  if (width == 8 && !has_nulls) {
+    packed = lean_alloc_sarray(1, n * 8, n * 8);
+    data_tag = LEAN_PQ_COLUMN_INT64;
+    ok = pq_unpack_int64_elements(&header, lean_sarray_cptr(packed));
+  } else if (width > 0 || oid == LEAN_PQ_FLOAT4OID || oid == LEAN_PQ_FLOAT8OID) {
+    int floats = width == 0;
+    packed = floats ? lean_alloc_sarray(sizeof(double), n, n) : lean_alloc_sarray(1, n * 8, n * 8);
+    data_tag = floats ? LEAN_PQ_COLUMN_FLOAT64 : LEAN_PQ_COLUMN_INT64;
+    const char * cursor = header.elements;
+    for (size_t i = 0; ok && i < n; i++) {
+      const char * element;
+      int length;
+      int64_t v = 0;
+      double d = 0.0;
+      if (!pq_next_element(&cursor, header.end, &element, &length)) {
+        ok = 0;
+      } else if (!element) {
+        nulls_cptr[i] = 1;
+      } else if (floats) {
+        ok = pq_decode_packed_float(oid, element, length, &d);
+      } else {
+        ok = pq_decode_packed_int(oid, element, length, &v);
+      }
+      if (floats)
+        lean_float_array_cptr(packed)[i] = d;
+      else
+        pq_write_le64(lean_sarray_cptr(packed) + 8 * i, (uint64_t)v);
+    }
+  } else {
+    packed = lean_alloc_array(n, n);
+    lean_object ** values_cptr = lean_array_cptr(packed);
+    const char * cursor = header.elements;
+    for (size_t i = 0; i < n; i++) {
+      const char * element;
+      int length;
+      lean_object * value = NULL;
+      if (pq_next_element(&cursor, header.end, &element, &length)) {
+        if (element) {
+          value = pq_decode_binary_field(oid, element, length, &ok);
+        } else {
+          nulls_cptr[i] = 1;
+          value = lean_box(LEAN_PQ_VALUE_NULL);
+        }
+      }
+      if (!value) {
+        pq_drop_partial_array(packed, i, n);
+        lean_dec(nulls);
+        return lean_io_result_mk_error(pq_other_error("Malformed binary array"));
+      }
+      values_cptr[i] = value;
+    }
+  }
+  if (!ok) {
+    lean_dec(packed);
+    lean_dec(nulls);
+    return lean_io_result_mk_error(pq_other_error("Malformed binary array"));
+  }
+  lean_object * some = lean_alloc_ctor(1, 1, 0);
+  lean_ctor_set(some, 0, pq_mk_packed_array(&header, nulls, data_tag, packed));
+  return lean_io_result_mk_ok(some);
+}
+
+// PqGetRecord - Decodes a binary composite field, whatever its type OID
+LEAN_EXPORT lean_obj_res lean_pq_get_record(b_lean_obj_arg res, b_lean_obj_arg row_num, b_lean_obj_arg field_num) {
+  Result *result = pq_result_get_handle(res);
+  const PGresult *pg_result = result->pg_result;
+  int row = lean_unbox(row_num);
+  int col = lean_unbox(field_num);
+  if (row < 0 || row >= PQntuples(pg_result) || col < 0 || col >= PQnfields(pg_result))
+    return lean_io_result_mk_error(pq_other_error("Row or field number out of range"));
+  if (PQfformat(pg_result, col) != 1)
+    return lean_io_result_mk_error(pq_other_error("Records are only decoded from binary results"));
+  if (PQgetisnull(pg_result, row, col))
+    return lean_io_result_mk_ok(lean_box(LEAN_PQ_VALUE_NULL));
+  int ok;
+  lean_object * value = pq_decode_binary_record(PQgetvalue(pg_result, row, col), PQgetlength(pg_result, row, col), &ok);
+  if (!ok)
+    return lean_io_result_mk_error(pq_other_error("Malformed binary record"));
+  return lean_io_result_mk_ok(value);
+}
+
+// Field views
+// A FieldView holds its PGresult, so the bytes it refers to stay valid; results are never
+// modified once received, which is why the view functions below are pure.
+// Layout: result (object), then row, col, length (uint32) and is_null (uint8).
+
+#define LEAN_PQ_VIEW_ROW (sizeof(void*))
+#define LEAN_PQ_VIEW_COL (sizeof(void*) + 4)
+#define LEAN_PQ_VIEW_LENGTH (sizeof(void*) + 8)
+#define LEAN_PQ_VIEW_IS_NULL (sizeof(void*) + 12)
+
+// Bytes and length of the field a view refers to. The coordinates are checked against the
+// result and the length clamped to the field's, so a view never reads out of bounds; one
+// that does not match its result reads as empty.
+static inline const char* pq_view_field(b_lean_obj_arg view, size_t *length) {
+  PGresult *pg_result = pq_result_get_handle(lean_ctor_get(view, 0))->pg_result;
+  uint32_t row = lean_ctor_get_uint32(view, LEAN_PQ_VIEW_ROW);
+  uint32_t col = lean_ctor_get_uint32(view, LEAN_PQ_VIEW_COL);
+  if (row >= (uint32_t)PQntuples(pg_result) || col >= (uint32_t)PQnfields(pg_result)) {
+    *length = 0;
+    return "";
+  }
+  size_t claimed = (size_t)lean_ctor_get_uint32(view, LEAN_PQ_VIEW_LENGTH);
+  size_t actual = (size_t)PQgetlength(pg_result, (int)row, (int)col);
+  *length = claimed < actual ? claimed : actual;
+  return PQgetvalue(pg_result, (int)row, (int)col);
+}
+
+// PqFieldView - Refers to a field in place, without copying it
+LEAN_EXPORT lean_obj_res lean_pq_field_view(b_lean_obj_arg res, b_lean_obj_arg row_num, b_lean_obj_arg field_num) {
+  Result *result = pq_result_get_handle(res);
+  int row = lean_unbox(row_num);
+  int col = lean_unbox(field_num);
+  if (row < 0 || row >= PQntuples(result->pg_result) || col < 0 || col >= PQnfields(result->pg_result))
+    return lean_io_result_mk_error(pq_other_error("Row or field number out of range"));
+  lean_object *view = lean_alloc_ctor(0, 1, 13);
+  lean_inc(res);
+  lean_ctor_set(view, 0, res);
+  lean_ctor_set_uint32(view, LEAN_PQ_VIEW_ROW, (uint32_t)row);
+  lean_ctor_set_uint32(view, LEAN_PQ_VIEW_COL, (uint32_t)col);
+  lean_ctor_set_uint32(view, LEAN_PQ_VIEW_LENGTH, (uint32_t)PQgetlength(result->pg_result, row, col));
+  lean_ctor_set_uint8(view, LEAN_PQ_VIEW_IS_NULL, (uint8_t)PQgetisnull(result->pg_result, row, col));
+  return lean_io_result_mk_ok(view);
+}
+
+// PqFieldViewCompare - Byte-wise comparison of two fields (Ordering: lt = 0, eq = 1, gt = 2)
+LEAN_EXPORT uint8_t lean_pq_field_view_compare(b_lean_obj_arg a, b_lean_obj_arg b) {
+  size_t a_length, b_length;
+  const char *a_bytes = pq_view_field(a, &a_length);
+  const char *b_bytes = pq_view_field(b, &b_length);
+  int c = memcmp(a_bytes, b_bytes, a_length < b_length ? a_length : b_length);
+  if (c == 0)
+    c = (a_length > b_length) - (a_length < b_length);
+  return c < 0 ? 0 : (c == 0 ? 1 : 2);
+}
+
+// PqFieldViewEqString - Compares a field with the UTF-8 bytes of a string
+LEAN_EXPORT uint8_t lean_pq_field_view_eq_string(b_lean_obj_arg view, b_lean_obj_arg str) {
+  size_t length;
+  const char *bytes = pq_view_field(view, &length);
+  return length == lean_string_size(str) - 1 && memcmp(bytes, lean_string_cstr(str), length) == 0;
+}
+
+// PqFieldViewEqBytes - Compares a field with a byte array
+LEAN_EXPORT uint8_t lean_pq_field_view_eq_bytes(b_lean_obj_arg view, b_lean_obj_arg bytes) {
+  size_t length;
+  const char *field = pq_view_field(view, &length);
+  return length == lean_sarray_size(bytes) && memcmp(field, lean_sarray_cptr(bytes), length) == 0;
+}
+
+// PqFieldViewHash - 64-bit FNV-1a hash of the field bytes
+LEAN_EXPORT uint64_t lean_pq_field_view_hash(b_lean_obj_arg view) {
+  size_t length;
+  const char *bytes = pq_view_field(view, &length);
+  return pq_hash_bytes(bytes, length);
+}
+
+// PqFieldViewToString - Copies the field into a String (invalid UTF-8 is replaced)
+LEAN_EXPORT lean_obj_res lean_pq_field_view_to_string(b_lean_obj_arg view) {
+  size_t length;
+  const char *bytes = pq_view_field(view, &length);
+  return lean_mk_string_from_bytes(bytes, length);
+}
+
+// PqFieldViewToByteArray - Copies the field into a ByteArray
+LEAN_EXPORT lean_obj_res lean_pq_field_view_to_byte_array(b_lean_obj_arg view) {
+  size_t length;
+  const char *bytes = pq_view_field(view, &length);
+  return pq_mk_byte_array(bytes, length);
+}
+
+// Longest text form parsed by the numeric view parsers, with room for the terminator.
+#define LEAN_PQ_VIEW_NUMBER_MAX 64
+
+// Copies a short text field into `buf` as a C string; 0 when it is NULL, empty or too long.
+static int pq_view_number_text(b_lean_obj_arg view, char *buf) {
+  size_t length;
+  const char *bytes = pq_view_field(view, &length);
+  if (lean_ctor_get_uint8(view, LEAN_PQ_VIEW_IS_NULL) || length == 0 || length >= LEAN_PQ_VIEW_NUMBER_MAX)
+    return 0;
+  memcpy(buf, bytes, length);
+  buf[length] = '\0';
+  return 1;
+}
+
+// PqFieldViewToInt64? - Parses a text integer field
+LEAN_EXPORT lean_obj_res lean_pq_field_view_to_int64(b_lean_obj_arg view) {
+  char buf[LEAN_PQ_VIEW_NUMBER_MAX];
+  if (!pq_view_number_text(view, buf))
+    return lean_box(0); // Option.none
+  char *end;
+  errno = 0;
+  long long v = strtoll(buf, &end, 10);
+  if (errno != 0 || *end != '\0')
+    return lean_box(0);
+  lean_object *some = lean_alloc_ctor(1, 1, 0); // Option.some
+  lean_ctor_set(some, 0, lean_box_uint64((uint64_t)(int64_t)v));
+  return some;
+}
+
+// PqFieldViewToFloat? - Parses a text floating-point field (NaN and Infinity included)
+LEAN_EXPORT lean_obj_res lean_pq_field_view_to_float(b_lean_obj_arg view) {
+  char buf[LEAN_PQ_VIEW_NUMBER_MAX];
+  if (!pq_view_number_text(view, buf))
+    return lean_box(0); // Option.none
+  char *end;
+  double v = strtod(buf, &end);
+  if (*end != '\0')
+    return lean_box(0);
+  lean_object *some = lean_alloc_ctor(1, 1, 0); // Option.some
+  lean_ctor_set(some, 0, lean_box_float(v));
+  return some;
+}
+
+// Escaping Strings for Inclusion in SQL Commands
+// Lean strings may contain NUL bytes, which libpq would silently treat as the end of the
+// input; they are rejected instead, since text values cannot hold them anyway.
+static const char *pq_nul_error = "String contains a NUL byte";
+
+static inline int pq_has_nul(const char *str, size_t length) {
+  return memchr(str, 0, length) != NULL;
+}
+
+// PQescapeLiteral - Escapes a string for use as an SQL string literal on the given connection
+// Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQESCAPELITERAL
+LEAN_EXPORT lean_obj_res lean_pq_escape_literal(b_lean_obj_arg conn, b_lean_obj_arg str) {
+  Connection *connection = pq_connection_get_handle(conn);
+  const char * str_cstr = lean_string_cstr(str);
+  size_t str_length = lean_string_size(str) - 1;
+  if (pq_has_nul(str_cstr, str_length))
+    return lean_io_result_mk_error(pq_other_error(pq_nul_error));
+  char * escaped = PQescapeLiteral(connection->pg_conn, str_cstr, str_length);
+  if (escaped == NULL) {
+    return lean_io_result_mk_error(pq_other_error("PQescapeLiteral failed"));
+  }
+  lean_object * result = lean_mk_string(escaped);
+  PQfreemem(escaped);
+  return lean_io_result_mk_ok(result);
 }
 
 // PQescapeIdentifier - Escapes a string for use as an SQL identifier on the given connection
@@ -640,7 +2710,9 @@ LEAN_EXPORT lean_obj_res lean_pq_escape_literal(b_lean_obj_arg conn, b_lean_obj_
 LEAN_EXPORT lean_obj_res lean_pq_escape_identifier(b_lean_obj_arg conn, b_lean_obj_arg str) {
   Connection *connection = pq_connection_get_handle(conn);
   const char * str_cstr = lean_string_cstr(str);
-  size_t str_length = strlen(str_cstr);
+  size_t str_length = lean_string_size(str) - 1;
+  if (pq_has_nul(str_cstr, str_length))
+    return lean_io_result_mk_error(pq_other_error(pq_nul_error));
   char * escaped = PQescapeIdentifier(connection->pg_conn, str_cstr, str_length);
   if (escaped == NULL) {
     return lean_io_result_mk_error(pq_other_error("PQescapeIdentifier failed"));
@@ -655,7 +2727,9 @@ LEAN_EXPORT lean_obj_res lean_pq_escape_identifier(b_lean_obj_arg conn, b_lean_o
 LEAN_EXPORT lean_obj_res lean_pq_escape_string_conn(b_lean_obj_arg conn, b_lean_obj_arg from) {
   Connection *connection = pq_connection_get_handle(conn);
   const char * from_cstr = lean_string_cstr(from);
-  size_t from_length = strlen(from_cstr);
+  size_t from_length = lean_string_size(from) - 1;
+  if (pq_has_nul(from_cstr, from_length))
+    return lean_io_result_mk_error(pq_other_error(pq_nul_error));
   // Allocate buffer for escaped string (worst case: 2x original length + 1)
   size_t to_length = 2 * from_length + 1;
   char * to = (char *)malloc(to_length);
@@ -668,7 +2742,7 @@ LEAN_EXPORT lean_obj_res lean_pq_escape_string_conn(b_lean_obj_arg conn, b_lean_
     free(to);
     return lean_io_result_mk_error(pq_other_error("PQescapeStringConn failed"));
   }
-  lean_object * result = lean_mk_string(to);
+  lean_object * result = lean_mk_string_from_bytes(to, escaped_length);
   free(to);
   return lean_io_result_mk_ok(result);
 }
@@ -677,14 +2751,13 @@ LEAN_EXPORT lean_obj_res lean_pq_escape_string_conn(b_lean_obj_arg conn, b_lean_
 // Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQESCAPEBYTEACONN
 LEAN_EXPORT lean_obj_res lean_pq_escape_bytea_conn(b_lean_obj_arg conn, b_lean_obj_arg from) {
   Connection *connection = pq_connection_get_handle(conn);
-  const char * from_cstr = lean_string_cstr(from);
-  size_t from_length = strlen(from_cstr);
   size_t to_length = 0;
-  unsigned char * escaped = PQescapeByteaConn(connection->pg_conn, (const unsigned char *)from_cstr, from_length, &to_length);
+  unsigned char * escaped = PQescapeByteaConn(connection->pg_conn, lean_sarray_cptr(from), lean_sarray_size(from), &to_length);
   if (escaped == NULL) {
     return lean_io_result_mk_error(pq_other_error("PQescapeByteaConn failed"));
   }
-  lean_object * result = lean_mk_string((const char *)escaped);
+  // to_length counts the terminating zero byte.
+  lean_object * result = lean_mk_string_from_bytes((const char *)escaped, to_length - 1);
   PQfreemem(escaped);
   return lean_io_result_mk_ok(result);
 }
@@ -693,13 +2766,1909 @@ LEAN_EXPORT lean_obj_res lean_pq_escape_bytea_conn(b_lean_obj_arg conn, b_lean_o
 // Documentation: https://www.postgresql.org/docs/current/libpq-exec.html#LIBPQ-PQUNESCAPEBYTEA
 LEAN_EXPORT lean_obj_res lean_pq_unescape_bytea(b_lean_obj_arg str) {
   const char * str_cstr = lean_string_cstr(str);
-  size_t str_length = strlen(str_cstr);
   size_t to_length = 0;
   unsigned char * unescaped = PQunescapeBytea((const unsigned char *)str_cstr, &to_length);
   if (unescaped == NULL) {
     return lean_io_result_mk_error(pq_other_error("PQunescapeBytea failed"));
   }
-  lean_object * result = lean_mk_string((const char *)unescaped);
+  lean_object * result = pq_mk_byte_array((const char *)unescaped, to_length);
   PQfreemem(unescaped);
   return lean_io_result_mk_ok(result);
 }
+
+// SQL builder
+// Escapes values straight into one growing buffer that is kept across statements, instead of
+// one libpq allocation and one Lean string per value. Literals go through PQescapeStringConn,
+// which writes into the caller's buffer and honours the client encoding and
+// standard_conforming_strings; identifiers and bytea (hex format) are escaped here.
+
+struct sql_builder {
+  // The connection, kept alive by the builder.
+  lean_object *conn;
+  char *buf;
+  size_t size;
+  size_t capacity;
+  // Whether the server has standard_conforming_strings on (backslashes are literal).
+  int standard_strings;
+};
+
+typedef struct sql_builder SqlBuilder;
+
+static lean_external_class *pq_sql_builder_external_class = NULL;
+
+static void pq_sql_builder_finalizer(void *h) {
+  SqlBuilder *builder = (SqlBuilder *)h;
+  lean_dec(builder->conn);
+  free(builder->buf);
+  free(builder);
+}
+
+static void pq_sql_builder_foreach(void *h, b_lean_obj_arg fn) {
+  SqlBuilder *builder = (SqlBuilder *)h;
+  lean_inc(fn);
+  lean_inc(builder->conn);
+  lean_dec(lean_apply_1(fn, builder->conn));
+}
+
+static SqlBuilder *pq_sql_builder_get_handle(lean_object *builder) {
+  return (SqlBuilder *)lean_get_external_data(builder);
+}
+
+// Returns room for `extra` more bytes, NULL when out of memory.
+static char* pq_sql_reserve(SqlBuilder *builder, size_t extra) {
+  size_t needed = builder->size + extra;
+  if (needed > builder->capacity) {
+    size_t capacity = builder->capacity * 2;
+    if (capacity < needed)
+      capacity = needed;
+    if (capacity < 4096)
+      capacity = 4096;
+    char *grown = (char *)realloc(builder->buf, capacity);
+    if (!grown)
+      return NULL;
+    builder->buf = grown;
+    builder->capacity = capacity;
+  }
+  return builder->buf + builder->size;
+}
+
+static int pq_sql_put(SqlBuilder *builder, const char *data, size_t length) {
+  char *p = pq_sql_reserve(builder, length);
+  if (!p)
+    return 0;
+  memcpy(p, data, length);
+  builder->size += length;
+  return 1;
+}
+
+// Appends a quoted string literal. Returns an error message, or NULL.
+static const char* pq_sql_put_literal(SqlBuilder *builder, const char *str, size_t length) {
+  if (pq_has_nul(str, length))
+    return pq_nul_error;
+  // Quotes, every byte doubled in the worst case, and the zero byte written by libpq.
+  char *p = pq_sql_reserve(builder, 2 * length + 3);
+  if (!p)
+    return "Memory allocation for SQL builder failed";
+  int error = 0;
+  p[0] = '\'';
+  size_t n = PQescapeStringConn(pq_connection_get_handle(builder->conn)->pg_conn, p + 1, str, length, &error);
+  if (error)
+    return "Invalid string for the client encoding";
+  p[n + 1] = '\'';
+  builder->size += n + 2;
+  return NULL;
+}
+
+static const char* pq_sql_put_identifier(SqlBuilder *builder, const char *str, size_t length) {
+  if (pq_has_nul(str, length))
+    return pq_nul_error;
+  char *p = pq_sql_reserve(builder, 2 * length + 2);
+  if (!p)
+    return "Memory allocation for SQL builder failed";
+  size_t n = 0;
+  p[n++] = '"';
+  for (size_t i = 0; i < length; i++) {
+    if (str[i] == '"')
+      p[n++] = '"';
+    p[n++] = str[i];
+  }
+  p[n++] = '"';
+  builder->size += n;
+  return NULL;
+}
+
+static const char* pq_sql_put_bytea(SqlBuilder *builder, const uint8_t *data, size_t length) {
+  static const char hex[] = "0123456789abcdef";
+  char *p = pq_sql_reserve(builder, 2 * length + 12);
+  if (!p)
+    return "Memory allocation for SQL builder failed";
+  size_t n = 0;
+  p[n++] = '\'';
+  p[n++] = '\\';
+  if (!builder->standard_strings)
+    p[n++] = '\\';
+  p[n++] = 'x';
+  for (size_t i = 0; i < length; i++) {
+    p[n++] = hex[data[i] >> 4];
+    p[n++] = hex[data[i] & 0xF];
+  }
+  memcpy(p + n, "'::bytea", 8);
+  builder->size += n + 8;
+  return NULL;
+}
+
+static lean_obj_res pq_sql_result(const char *error) {
+  if (error)
+    return lean_io_result_mk_error(pq_other_error(error));
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// PqSqlBuilderNew - Creates an empty SQL builder for statements sent on `conn`
+LEAN_EXPORT lean_obj_res lean_pq_sql_builder_new(b_lean_obj_arg conn) {
+  if (pq_sql_builder_external_class == NULL) {
+    pq_sql_builder_external_class = lean_register_external_class(
+        pq_sql_builder_finalizer, pq_sql_builder_foreach);
+  }
+  SqlBuilder *builder = (SqlBuilder *)calloc(1, sizeof *builder);
+  if (!builder)
+    return lean_io_result_mk_error(pq_other_error("Memory allocation for SQL builder failed"));
+  const char *standard = PQparameterStatus(pq_connection_get_handle(conn)->pg_conn, "standard_conforming_strings");
+  builder->standard_strings = standard == NULL || strcmp(standard, "on") == 0;
+  lean_inc(conn);
+  builder->conn = conn;
+  return lean_io_result_mk_ok(lean_alloc_external(pq_sql_builder_external_class, builder));
+}
+
+// PqSqlBuilderAppend - Appends raw SQL
+LEAN_EXPORT lean_obj_res lean_pq_sql_builder_append(b_lean_obj_arg builder_obj, b_lean_obj_arg sql) {
+  SqlBuilder *builder = pq_sql_builder_get_handle(builder_obj);
+  if (!pq_sql_put(builder, lean_string_cstr(sql), lean_string_size(sql) - 1))
+    return pq_sql_result("Memory allocation for SQL builder failed");
+  return pq_sql_result(NULL);
+}
+
+// PqSqlBuilderAppendLiteral - Appends a string literal, or NULL
+LEAN_EXPORT lean_obj_res lean_pq_sql_builder_append_literal(b_lean_obj_arg builder_obj, b_lean_obj_arg value) {
+  SqlBuilder *builder = pq_sql_builder_get_handle(builder_obj);
+  if (lean_is_scalar(value))
+    return pq_sql_result(pq_sql_put(builder, "NULL", 4) ? NULL : "Memory allocation for SQL builder failed");
+  lean_object *str = lean_ctor_get(value, 0);
+  return pq_sql_result(pq_sql_put_literal(builder, lean_string_cstr(str), lean_string_size(str) - 1));
+}
+
+// PqSqlBuilderAppendIdentifier - Appends a quoted identifier
+LEAN_EXPORT lean_obj_res lean_pq_sql_builder_append_identifier(b_lean_obj_arg builder_obj, b_lean_obj_arg name) {
+  SqlBuilder *builder = pq_sql_builder_get_handle(builder_obj);
+  return pq_sql_result(pq_sql_put_identifier(builder, lean_string_cstr(name), lean_string_size(name) - 1));
+}
+
+// PqSqlBuilderAppendIdentifiers - Appends comma separated quoted identifiers
+LEAN_EXPORT lean_obj_res lean_pq_sql_builder_append_identifiers(b_lean_obj_arg builder_obj, b_lean_obj_arg names) {
+  SqlBuilder *builder = pq_sql_builder_get_handle(builder_obj);
+  size_t n = lean_array_size(names);
+  for (size_t i = 0; i < n; i++) {
+    if (i > 0 && !pq_sql_put(builder, ", ", 2))
+      return pq_sql_result("Memory allocation for SQL builder failed");
+    lean_object *name = lean_array_get_core(names, i);
+    const char *error = pq_sql_put_identifier(builder, lean_string_cstr(name), lean_string_size(name) - 1);
+    if (error)
+      return pq_sql_result(error);
+  }
+  return pq_sql_result(NULL);
+}
+
+// PqSqlBuilderAppendBytea - Appends a bytea literal in hex format
+LEAN_EXPORT lean_obj_res lean_pq_sql_builder_append_bytea(b_lean_obj_arg builder_obj, b_lean_obj_arg bytes) {
+  SqlBuilder *builder = pq_sql_builder_get_handle(builder_obj);
+  return pq_sql_result(pq_sql_put_bytea(builder, lean_sarray_cptr(bytes), lean_sarray_size(bytes)));
+}
+
+// PqSqlBuilderAppendRows - Appends `(v, ...), (v, ...)` with every value escaped as a literal
+LEAN_EXPORT lean_obj_res lean_pq_sql_builder_append_rows(b_lean_obj_arg builder_obj, b_lean_obj_arg rows) {
+  SqlBuilder *builder = pq_sql_builder_get_handle(builder_obj);
+  size_t nrows = lean_array_size(rows);
+  for (size_t r = 0; r < nrows; r++) {
+    lean_object *row = lean_array_get_core(rows, r);
+    size_t ncols = lean_array_size(row);
+    if (!pq_sql_put(builder, r > 0 ? ", (" : "(", r > 0 ? 3 : 1))
+      return pq_sql_result("Memory allocation for SQL builder failed");
+    for (size_t c = 0; c < ncols; c++) {
+      if (c > 0 && !pq_sql_put(builder, ", ", 2))
+        return pq_sql_result("Memory allocation for SQL builder failed");
+      lean_object *value = lean_array_get_core(row, c);
+      const char *error = NULL;
+      if (lean_is_scalar(value)) {
+        if (!pq_sql_put(builder, "NULL", 4))
+          error = "Memory allocation for SQL builder failed";
+      } else {
+        lean_object *str = lean_ctor_get(value, 0);
+        error = pq_sql_put_literal(builder, lean_string_cstr(str), lean_string_size(str) - 1);
+      }
+      if (error)
+        return pq_sql_result(error);
+    }
+    if (!pq_sql_put(builder, ")", 1))
+      return pq_sql_result("Memory allocation for SQL builder failed");
+  }
+  return pq_sql_result(NULL);
+}
+
+// PqSqlBuilderToString - Returns the SQL built so far
+LEAN_EXPORT lean_obj_res lean_pq_sql_builder_to_string(b_lean_obj_arg builder_obj) {
+  SqlBuilder *builder = pq_sql_builder_get_handle(builder_obj);
+  return lean_io_result_mk_ok(lean_mk_string_from_bytes(builder->buf ? builder->buf : "", builder->size));
+}
+
+// PqSqlBuilderSize - Size in bytes of the SQL built so far
+LEAN_EXPORT lean_obj_res lean_pq_sql_builder_size(b_lean_obj_arg builder_obj) {
+  SqlBuilder *builder = pq_sql_builder_get_handle(builder_obj);
+  return lean_io_result_mk_ok(lean_usize_to_nat(builder->size));
+}
+
+// PqSqlBuilderClear - Empties the builder, keeping its buffer for the next statement
+LEAN_EXPORT lean_obj_res lean_pq_sql_builder_clear(b_lean_obj_arg builder_obj) {
+  pq_sql_builder_get_handle(builder_obj)->size = 0;
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// [Asynchronous Notification](https://www.postgresql.org/docs/current/libpq-notify.html)
+
+// Notification layout: channel, payload (objects), then be_pid (uint32).
+static lean_object* pq_mk_notification(const PGnotify *notify) {
+  lean_object * notification = lean_alloc_ctor(0, 2, sizeof(uint32_t));
+  lean_ctor_set(notification, 0, lean_mk_string(notify->relname));
+  lean_ctor_set(notification, 1, lean_mk_string(notify->extra));
+  lean_ctor_set_uint32(notification, 2 * sizeof(void *), (uint32_t)notify->be_pid);
+  return notification;
+}
+
+// Moves every notification libpq has already parsed into `out`.
+static lean_object* pq_drain_notifies(PGconn *pg_conn, lean_object *out) {
+  PGnotify *notify;
+  while ((notify = PQnotifies(pg_conn)) != NULL) {
+    out = lean_array_push(out, pq_mk_notification(notify));
+    PQfreemem(notify);
+  }
+  return out;
+}
+
+// PQnotifies - Returns the next notification already received, if any
+// Documentation: https://www.postgresql.org/docs/current/libpq-notify.html
+LEAN_EXPORT lean_obj_res lean_pq_notifies(b_lean_obj_arg conn) {
+  Connection *connection = pq_connection_get_handle(conn);
+  PGnotify *notify = PQnotifies(connection->pg_conn);
+  if (notify == NULL)
+    return lean_io_result_mk_ok(lean_box(0));
+  lean_object * some = lean_alloc_ctor(1, 1, 0);
+  lean_ctor_set(some, 0, pq_mk_notification(notify));
+  PQfreemem(notify);
+  return lean_io_result_mk_ok(some);
+}
+
+// PqWaitNotifications - Waits up to `timeout_ms` for the socket to become readable, then
+// returns every notification received. Notifications already buffered are returned without
+// waiting; an empty array means the timeout expired.
+LEAN_EXPORT lean_obj_res lean_pq_wait_notifications(b_lean_obj_arg conn, uint32_t timeout_ms) {
+  Connection *connection = pq_connection_get_handle(conn);
+  PGconn *pg_conn = connection->pg_conn;
+  lean_object * out = pq_drain_notifies(pg_conn, lean_alloc_array(0, 0));
+  if (lean_array_size(out) > 0)
+    return lean_io_result_mk_ok(out);
+  int fd = PQsocket(pg_conn);
+  if (fd < 0) {
+    lean_dec(out);
+    return lean_io_result_mk_error(pq_other_error("Connection has no open socket"));
+  }
+  struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+  int ready;
+  do {
+    ready = poll(&pfd, 1, timeout_ms > INT_MAX ? -1 : (int)timeout_ms);
+  } while (ready < 0 && errno == EINTR);
+  if (ready < 0) {
+    lean_dec(out);
+    return lean_io_result_mk_error(pq_other_error(strerror(errno)));
+  }
+  if (ready == 0)
+    return lean_io_result_mk_ok(out);
+  // Reads everything available on the socket; one wakeup may carry many notifications.
+  if (!PQconsumeInput(pg_conn)) {
+    lean_dec(out);
+    return lean_io_result_mk_error(pq_other_error(PQerrorMessage(pg_conn)));
+  }
+  return lean_io_result_mk_ok(pq_drain_notifies(pg_conn, out));
+}
+
+// [Functions Associated with the COPY Command](https://www.postgresql.org/docs/current/libpq-copy.html)
+
+// A ByteArray being filled from the start. Its storage is reused in place
+// when the Lean object is exclusive and large enough.
+struct byte_buffer {
+  lean_object *arr;
+  size_t size;
+};
+
+typedef struct byte_buffer ByteBuffer;
+
+// Takes ownership of `arr`; its previous contents are discarded.
+static void pq_buf_init(ByteBuffer *b, lean_object *arr) {
+  b->arr = arr;
+  b->size = 0;
+}
+
+static uint8_t* pq_buf_reserve(ByteBuffer *b, size_t extra) {
+  size_t needed = b->size + extra;
+  size_t capacity = lean_sarray_capacity(b->arr);
+  if (!lean_is_exclusive(b->arr) || capacity < needed) {
+    size_t grown_capacity = capacity * 2;
+    if (grown_capacity < needed)
+      grown_capacity = needed;
+    if (grown_capacity < 4096)
+      grown_capacity = 4096;
+    lean_object *grown = lean_alloc_sarray(1, b->size, grown_capacity);
+    if (b->size > 0)
+      memcpy(lean_sarray_cptr(grown), lean_sarray_cptr(b->arr), b->size);
+    lean_dec(b->arr);
+    b->arr = grown;
+  }
+  return lean_sarray_cptr(b->arr) + b->size;
+}
+
+static inline void pq_buf_put(ByteBuffer *b, const void *data, size_t length) {
+  uint8_t *p = pq_buf_reserve(b, length);
+  if (length > 0)
+    memcpy(p, data, length);
+  b->size += length;
+}
+
+static inline void pq_buf_put_be16(ByteBuffer *b, uint16_t v) {
+  uint8_t *p = pq_buf_reserve(b, 2);
+  p[0] = (uint8_t)(v >> 8);
+  p[1] = (uint8_t)v;
+  b->size += 2;
+}
+
+static inline void pq_buf_put_be32(ByteBuffer *b, uint32_t v) {
+  uint8_t *p = pq_buf_reserve(b, 4);
+  p[0] = (uint8_t)(v >> 24);
+  p[1] = (uint8_t)(v >> 16);
+  p[2] = (uint8_t)(v >> 8);
+  p[3] = (uint8_t)v;
+  b->size += 4;
+}
+
+static inline void pq_buf_put_be64(ByteBuffer *b, uint64_t v) {
+  pq_buf_put_be32(b, (uint32_t)(v >> 32));
+  pq_buf_put_be32(b, (uint32_t)v);
+}
+
+static lean_object* pq_buf_finish(ByteBuffer *b) {
+  lean_to_sarray(b->arr)->m_size = b->size;
+  return b->arr;
+}
+
+// Writes one field in COPY text format: backslash, tab, newline and carriage
+// return are escaped.
+static void pq_copy_text_field(ByteBuffer *b, const char *s, size_t length) {
+  uint8_t *p = pq_buf_reserve(b, 2 * length);
+  size_t n = 0;
+  for (size_t i = 0; i < length; i++) {
+    char c = s[i];
+    switch (c) {
+      case '\\': p[n++] = '\\'; p[n++] = '\\'; break;
+      case '\t': p[n++] = '\\'; p[n++] = 't'; break;
+      case '\n': p[n++] = '\\'; p[n++] = 'n'; break;
+      case '\r': p[n++] = '\\'; p[n++] = 'r'; break;
+      default: p[n++] = (uint8_t)c; break;
+    }
+  }
+  b->size += n;
+}
+
+// PqCopyEncodeText - Encodes rows in COPY text format into a reused buffer
+// Rows are `Array (Array (Option String))`; `none` is written as \N.
+LEAN_EXPORT lean_obj_res lean_pq_copy_encode_text(lean_obj_arg buffer, b_lean_obj_arg rows) {
+  ByteBuffer b;
+  pq_buf_init(&b, buffer);
+  size_t nrows = lean_array_size(rows);
+  for (size_t r = 0; r < nrows; r++) {
+    lean_object *row = lean_array_get_core(rows, r);
+    size_t nfields = lean_array_size(row);
+    for (size_t c = 0; c < nfields; c++) {
+      if (c > 0)
+        pq_buf_put(&b, "\t", 1);
+      lean_object *field = lean_array_get_core(row, c);
+      if (lean_is_scalar(field)) {
+        pq_buf_put(&b, "\\N", 2);
+      } else {
+        lean_object *str = lean_ctor_get(field, 0);
+        pq_copy_text_field(&b, lean_string_cstr(str), lean_string_size(str) - 1);
+      }
+    }
+    pq_buf_put(&b, "\n", 1);
+  }
+  return lean_io_result_mk_ok(pq_buf_finish(&b));
+}
+
+// Column kinds of binary COPY, mirrored in `LeanPq.CopyKind`.
+#define LEAN_PQ_KIND_TEXT 0
+#define LEAN_PQ_KIND_BOOL 1
+#define LEAN_PQ_KIND_INT2 2
+#define LEAN_PQ_KIND_INT4 3
+#define LEAN_PQ_KIND_INT8 4
+#define LEAN_PQ_KIND_FLOAT4 5
+#define LEAN_PQ_KIND_FLOAT8 6
+#define LEAN_PQ_KIND_DATE 7
+#define LEAN_PQ_KIND_TIMESTAMP 8
+#define LEAN_PQ_KIND_UUID 9
+#define LEAN_PQ_KIND_BYTEA 10
+#define LEAN_PQ_KIND_NUMERIC 11
+#define LEAN_PQ_KIND_JSONB 12
+
+// Writes a decimal string as a length-prefixed binary numeric (see numeric_recv).
+// Accepts [-+]digits[.digits], NaN, Infinity and -Infinity.
+static int pq_put_numeric(ByteBuffer *b, const char *s, size_t length) {
+  if (length == 3 && memcmp(s, "NaN", 3) == 0) {
+    pq_buf_put_be32(b, 8);
+    pq_buf_put_be16(b, 0); pq_buf_put_be16(b, 0); pq_buf_put_be16(b, LEAN_PQ_NUMERIC_NAN); pq_buf_put_be16(b, 0);
+    return 1;
+  }
+  if ((length == 8 && memcmp(s, "Infinity", 8) == 0) || (length == 9 && memcmp(s, "-Infinity", 9) == 0)) {
+    pq_buf_put_be32(b, 8);
+    pq_buf_put_be16(b, 0); pq_buf_put_be16(b, 0);
+    pq_buf_put_be16(b, s[0] == '-' ? LEAN_PQ_NUMERIC_NINF : LEAN_PQ_NUMERIC_PINF); pq_buf_put_be16(b, 0);
+    return 1;
+  }
+  uint16_t sign = LEAN_PQ_NUMERIC_POS;
+  size_t i = 0;
+  if (i < length && (s[i] == '-' || s[i] == '+')) {
+    if (s[i] == '-')
+      sign = LEAN_PQ_NUMERIC_NEG;
+    i++;
+  }
+  size_t int_start = i;
+  while (i < length && s[i] >= '0' && s[i] <= '9') i++;
+  size_t int_len = i - int_start;
+  size_t frac_start = i, frac_len = 0;
+  if (i < length && s[i] == '.') {
+    frac_start = ++i;
+    while (i < length && s[i] >= '0' && s[i] <= '9') i++;
+    frac_len = i - frac_start;
+  }
+  if (i != length || int_len + frac_len == 0 || frac_len > 0x3FFF)
+    return 0;
+  // Skip leading zeros of the integer part.
+  while (int_len > 0 && s[int_start] == '0') {
+    int_start++;
+    int_len--;
+  }
+  size_t int_groups = (int_len + 3) / 4;
+  size_t frac_groups = (frac_len + 3) / 4;
+  size_t total = int_groups + frac_groups;
+  int16_t stack_digits[64];
+  int16_t *digits = total <= 64 ? stack_digits : (int16_t *)malloc(total * sizeof(int16_t));
+  if (!digits)
+    return 0;
+  // Integer groups are aligned on the decimal point: the first one may be short.
+  size_t pos = int_start;
+  size_t first = int_len - (int_groups > 0 ? (int_groups - 1) * 4 : 0);
+  for (size_t g = 0; g < int_groups; g++) {
+    size_t width = g == 0 ? first : 4;
+    int v = 0;
+    for (size_t k = 0; k < width; k++)
+      v = v * 10 + (s[pos++] - '0');
+    digits[g] = (int16_t)v;
+  }
+  for (size_t g = 0; g < frac_groups; g++) {
+    int v = 0;
+    for (size_t k = 0; k < 4; k++) {
+      size_t idx = g * 4 + k;
+      v = v * 10 + (idx < frac_len ? s[frac_start + idx] - '0' : 0);
+    }
+    digits[int_groups + g] = (int16_t)v;
+  }
+  // Strip zero groups at both ends; the weight follows the first kept group.
+  size_t lo = 0, hi = total;
+  int weight = (int)int_groups - 1;
+  while (lo < hi && digits[lo] == 0) {
+    lo++;
+    weight--;
+  }
+  while (hi > lo && digits[hi - 1] == 0) hi--;
+  if (lo == hi) {
+    weight = 0;
+    sign = LEAN_PQ_NUMERIC_POS;
+  }
+  size_t ndigits = hi - lo;
+  pq_buf_put_be32(b, (uint32_t)(8 + 2 * ndigits));
+  pq_buf_put_be16(b, (uint16_t)ndigits);
+  pq_buf_put_be16(b, (uint16_t)(int16_t)weight);
+  pq_buf_put_be16(b, sign);
+  pq_buf_put_be16(b, (uint16_t)frac_len);
+  for (size_t g = lo; g < hi; g++)
+    pq_buf_put_be16(b, (uint16_t)digits[g]);
+  if (digits != stack_digits)
+    free(digits);
+  return 1;
+}
+
+static inline int64_t pq_unix_to_timestamp(int64_t unix_micros) {
+  if (unix_micros == INT64_MAX || unix_micros == INT64_MIN)
+    return unix_micros;
+  return unix_micros - LEAN_PQ_EPOCH_DIFF_MICROS;
+}
+
+static inline int32_t pq_unix_to_date(int32_t unix_days) {
+  if (unix_days == INT32_MAX || unix_days == INT32_MIN)
+    return unix_days;
+  return unix_days - LEAN_PQ_EPOCH_DIFF_DAYS;
+}
+
+// Writes one length-prefixed binary field of the given kind. Returns 0 when the
+// value does not fit the column.
+static int pq_copy_binary_field(ByteBuffer *b, uint8_t kind, b_lean_obj_arg value) {
+  if (lean_is_scalar(value)) { // Value.null
+    pq_buf_put_be32(b, UINT32_MAX);
+    return 1;
+  }
+  unsigned tag = lean_ptr_tag(value);
+  switch (kind) {
+    case LEAN_PQ_KIND_BOOL:
+      if (tag != LEAN_PQ_VALUE_BOOL) return 0;
+      pq_buf_put_be32(b, 1);
+      pq_buf_put(b, lean_ctor_get_uint8(value, 0) ? "\1" : "\0", 1);
+      return 1;
+    case LEAN_PQ_KIND_INT2:
+    case LEAN_PQ_KIND_INT4:
+    case LEAN_PQ_KIND_INT8: {
+      if (tag != LEAN_PQ_VALUE_INT) return 0;
+      int64_t v = (int64_t)lean_ctor_get_uint64(value, 0);
+      if (kind == LEAN_PQ_KIND_INT2) {
+        if (v < INT16_MIN || v > INT16_MAX) return 0;
+        pq_buf_put_be32(b, 2);
+        pq_buf_put_be16(b, (uint16_t)(int16_t)v);
+      } else if (kind == LEAN_PQ_KIND_INT4) {
+        if (v < INT32_MIN || v > INT32_MAX) return 0;
+        pq_buf_put_be32(b, 4);
+        pq_buf_put_be32(b, (uint32_t)(int32_t)v);
+      } else {
+        pq_buf_put_be32(b, 8);
+        pq_buf_put_be64(b, (uint64_t)v);
+      }
+      return 1;
+    }
+    case LEAN_PQ_KIND_FLOAT4:
+    case LEAN_PQ_KIND_FLOAT8: {
+      double d;
+      if (tag == LEAN_PQ_VALUE_FLOAT)
+        d = lean_ctor_get_float(value, 0);
+      else if (tag == LEAN_PQ_VALUE_INT)
+        d = (double)(int64_t)lean_ctor_get_uint64(value, 0);
+      else
+        return 0;
+      if (kind == LEAN_PQ_KIND_FLOAT4) {
+        float f = (float)d;
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof bits);
+        pq_buf_put_be32(b, 4);
+        pq_buf_put_be32(b, bits);
+      } else {
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof bits);
+        pq_buf_put_be32(b, 8);
+        pq_buf_put_be64(b, bits);
+      }
+      return 1;
+    }
+    case LEAN_PQ_KIND_DATE:
+      if (tag != LEAN_PQ_VALUE_DATE) return 0;
+      pq_buf_put_be32(b, 4);
+      pq_buf_put_be32(b, (uint32_t)pq_unix_to_date((int32_t)lean_ctor_get_uint32(value, 0)));
+      return 1;
+    case LEAN_PQ_KIND_TIMESTAMP:
+      if (tag != LEAN_PQ_VALUE_TIMESTAMP && tag != LEAN_PQ_VALUE_TIMESTAMPTZ) return 0;
+      pq_buf_put_be32(b, 8);
+      pq_buf_put_be64(b, (uint64_t)pq_unix_to_timestamp((int64_t)lean_ctor_get_uint64(value, 0)));
+      return 1;
+    case LEAN_PQ_KIND_UUID: {
+      if (tag != LEAN_PQ_VALUE_UUID) return 0;
+      lean_object *bytes = lean_ctor_get(value, 0);
+      if (lean_sarray_size(bytes) != 16) return 0;
+      pq_buf_put_be32(b, 16);
+      pq_buf_put(b, lean_sarray_cptr(bytes), 16);
+      return 1;
+    }
+    case LEAN_PQ_KIND_BYTEA: {
+      if (tag != LEAN_PQ_VALUE_BYTEA) return 0;
+      lean_object *bytes = lean_ctor_get(value, 0);
+      size_t length = lean_sarray_size(bytes);
+      if (length > INT32_MAX) return 0;
+      pq_buf_put_be32(b, (uint32_t)length);
+      pq_buf_put(b, lean_sarray_cptr(bytes), length);
+      return 1;
+    }
+    case LEAN_PQ_KIND_NUMERIC: {
+      if (tag == LEAN_PQ_VALUE_INT) {
+        char tmp[24];
+        int n = snprintf(tmp, sizeof tmp, "%lld", (long long)(int64_t)lean_ctor_get_uint64(value, 0));
+        return pq_put_numeric(b, tmp, (size_t)n);
+      }
+      if (tag != LEAN_PQ_VALUE_NUMERIC && tag != LEAN_PQ_VALUE_TEXT) return 0;
+      lean_object *str = lean_ctor_get(value, 0);
+      return pq_put_numeric(b, lean_string_cstr(str), lean_string_size(str) - 1);
+    }
+    case LEAN_PQ_KIND_JSONB:
+    case LEAN_PQ_KIND_TEXT: {
+      if (tag != LEAN_PQ_VALUE_TEXT) return 0;
+      lean_object *str = lean_ctor_get(value, 0);
+      size_t length = lean_string_size(str) - 1;
+      int jsonb = kind == LEAN_PQ_KIND_JSONB;
+      if (length + jsonb > INT32_MAX) return 0;
+      pq_buf_put_be32(b, (uint32_t)(length + jsonb));
+      if (jsonb)
+        pq_buf_put(b, "\1", 1); // jsonb format version
+      pq_buf_put(b, lean_string_cstr(str), length);
+      return 1;
+    }
+    default:
+      return 0;
+  }
+}
+
+// PqCopyEncodeBinary - Encodes rows in COPY binary format into a reused buffer
+// `kinds` holds one column kind per byte; the file header is written first when
+// `header` is set. The trailer is left to the caller.
+LEAN_EXPORT lean_obj_res lean_pq_copy_encode_binary(lean_obj_arg buffer, b_lean_obj_arg kinds, b_lean_obj_arg rows, uint8_t header) {
+  ByteBuffer b;
+  pq_buf_init(&b, buffer);
+  if (header) {
+    static const char signature[11] = {'P', 'G', 'C', 'O', 'P', 'Y', '\n', '\377', '\r', '\n', '\0'};
+    pq_buf_put(&b, signature, sizeof signature);
+    pq_buf_put_be32(&b, 0); // flags
+    pq_buf_put_be32(&b, 0); // header extension length
+  }
+  size_t ncols = lean_sarray_size(kinds);
+  const uint8_t *kinds_cptr = lean_sarray_cptr(kinds);
+  size_t nrows = lean_array_size(rows);
+  for (size_t r = 0; r < nrows; r++) {
+    lean_object *row = lean_array_get_core(rows, r);
+    if (lean_array_size(row) != ncols) {
+      lean_dec(pq_buf_finish(&b));
+      char msg[96];
+      snprintf(msg, sizeof msg, "COPY row %zu has %zu fields, expected %zu", r, lean_array_size(row), ncols);
+      return lean_io_result_mk_error(pq_other_error(msg));
+    }
+    pq_buf_put_be16(&b, (uint16_t)ncols);
+    for (size_t c = 0; c < ncols; c++) {
+      if (!pq_copy_binary_field(&b, kinds_cptr[c], lean_array_get_core(row, c))) {
+        lean_dec(pq_buf_finish(&b));
+        char msg[96];
+        snprintf(msg, sizeof msg, "COPY row %zu, field %zu does not match its column type", r, c);
+        return lean_io_result_mk_error(pq_other_error(msg));
+      }
+    }
+  }
+  return lean_io_result_mk_ok(pq_buf_finish(&b));
+}
+
+// PQputCopyData - Sends data to the server during COPY_IN state
+// Documentation: https://www.postgresql.org/docs/current/libpq-copy.html#LIBPQ-PQPUTCOPYDATA
+LEAN_EXPORT lean_obj_res lean_pq_put_copy_data(b_lean_obj_arg conn, b_lean_obj_arg data) {
+  Connection *connection = pq_connection_get_handle(conn);
+  const char *p = (const char *)lean_sarray_cptr(data);
+  size_t remaining = lean_sarray_size(data);
+  // libpq takes an int length: send very large buffers in pieces.
+  while (remaining > 0) {
+    int piece = remaining > (size_t)INT_MAX ? INT_MAX : (int)remaining;
+    if (PQputCopyData(connection->pg_conn, p, piece) != 1)
+      return lean_io_result_mk_error(pq_other_error(PQerrorMessage(connection->pg_conn)));
+    p += piece;
+    remaining -= (size_t)piece;
+  }
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// PQputCopyEnd - Sends end-of-data indication to the server during COPY_IN state
+// Documentation: https://www.postgresql.org/docs/current/libpq-copy.html#LIBPQ-PQPUTCOPYEND
+LEAN_EXPORT lean_obj_res lean_pq_put_copy_end(b_lean_obj_arg conn, b_lean_obj_arg errormsg) {
+  Connection *connection = pq_connection_get_handle(conn);
+  const char *errormsg_cstr = lean_is_scalar(errormsg) ? NULL : lean_string_cstr(lean_ctor_get(errormsg, 0));
+  if (PQputCopyEnd(connection->pg_conn, errormsg_cstr) != 1)
+    return lean_io_result_mk_error(pq_other_error(PQerrorMessage(connection->pg_conn)));
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// PQgetCopyData - Receives data from the server during COPY_OUT state
+// Returns `none` once the COPY is complete; the final status is then read with PQgetResult.
+// Documentation: https://www.postgresql.org/docs/current/libpq-copy.html#LIBPQ-PQGETCOPYDATA
+LEAN_EXPORT lean_obj_res lean_pq_get_copy_data(b_lean_obj_arg conn) {
+  Connection *connection = pq_connection_get_handle(conn);
+  char *buffer = NULL;
+  int length = PQgetCopyData(connection->pg_conn, &buffer, 0);
+  if (length == -1)
+    return lean_io_result_mk_ok(lean_box(0)); // Option.none
+  if (length < 0)
+    return lean_io_result_mk_error(pq_other_error(PQerrorMessage(connection->pg_conn)));
+  lean_object *chunk = pq_mk_byte_array(buffer, (size_t)length);
+  PQfreemem(buffer);
+  lean_object *some = lean_alloc_ctor(1, 1, 0); // Option.some
+  lean_ctor_set(some, 0, chunk);
+  return lean_io_result_mk_ok(some);
+}
+
+// PqCopyOutToFd - Writes every COPY_OUT chunk straight to a file descriptor
+// The data never becomes a Lean object. Returns the number of bytes written.
+LEAN_EXPORT lean_obj_res lean_pq_copy_out_to_fd(b_lean_obj_arg conn, uint32_t fd) {
+  Connection *connection = pq_connection_get_handle(conn);
+  uint64_t total = 0;
+  for (;;) {
+    char *buffer = NULL;
+    int length = PQgetCopyData(connection->pg_conn, &buffer, 0);
+    if (length == -1)
+      break;
+    if (length < 0)
+      return lean_io_result_mk_error(pq_other_error(PQerrorMessage(connection->pg_conn)));
+    const char *p = buffer;
+    size_t remaining = (size_t)length;
+    while (remaining > 0) {
+      ssize_t written = write((int)fd, p, remaining);
+      if (written < 0) {
+        if (errno == EINTR)
+          continue;
+        PQfreemem(buffer);
+        return lean_io_result_mk_error(pq_other_error(strerror(errno)));
+      }
+      p += written;
+      remaining -= (size_t)written;
+    }
+    total += (uint64_t)length;
+    PQfreemem(buffer);
+  }
+  return lean_io_result_mk_ok(lean_box_uint64(total));
+}
+
+// Binary COPY parser
+
+// Builds one typed column while tuples are parsed.
+struct column_builder {
+  Oid oid;
+  int data_tag; // LEAN_PQ_COLUMN_*
+  lean_object *nulls;  // ByteArray
+  ByteBuffer packed;   // int64 column
+  lean_object *floats; // FloatArray
+  lean_object *boxed;  // Array Value
+};
+
+typedef struct column_builder ColumnBuilder;
+
+// Incremental parser of the binary COPY format. Chunks may split tuples
+// anywhere: the incomplete tail is kept in `pending`.
+struct copy_parser {
+  size_t ncols;
+  ColumnBuilder *cols;
+  size_t rows;
+  char *pending;
+  size_t pending_len;
+  size_t pending_cap;
+  int header_done;
+  int done;
+};
+
+typedef struct copy_parser CopyParser;
+
+static lean_external_class *pq_copy_parser_external_class = NULL;
+
+static void pq_column_builder_reset(ColumnBuilder *col) {
+  col->nulls = lean_alloc_sarray(1, 0, 0);
+  col->packed.arr = NULL;
+  col->floats = NULL;
+  col->boxed = NULL;
+  switch (col->data_tag) {
+    case LEAN_PQ_COLUMN_INT64: pq_buf_init(&col->packed, lean_alloc_sarray(1, 0, 0)); break;
+    case LEAN_PQ_COLUMN_FLOAT64: col->floats = lean_alloc_sarray(sizeof(double), 0, 0); break;
+    default: col->boxed = lean_alloc_array(0, 0); break;
+  }
+}
+
+static void pq_column_builder_release(ColumnBuilder *col) {
+  lean_dec(col->nulls);
+  if (col->packed.arr) lean_dec(col->packed.arr);
+  if (col->floats) lean_dec(col->floats);
+  if (col->boxed) lean_dec(col->boxed);
+}
+
+static void pq_copy_parser_finalizer(void *h) {
+  CopyParser *parser = (CopyParser *)h;
+  for (size_t i = 0; i < parser->ncols; i++)
+    pq_column_builder_release(&parser->cols[i]);
+  free(parser->cols);
+  free(parser->pending);
+  free(parser);
+}
+
+static void pq_copy_parser_visit(b_lean_obj_arg fn, lean_object *obj) {
+  if (!obj)
+    return;
+  lean_inc(fn);
+  lean_inc(obj);
+  lean_dec(lean_apply_1(fn, obj));
+}
+
+static void pq_copy_parser_foreach(void *h, b_lean_obj_arg fn) {
+  CopyParser *parser = (CopyParser *)h;
+  for (size_t i = 0; i < parser->ncols; i++) {
+    ColumnBuilder *col = &parser->cols[i];
+    pq_copy_parser_visit(fn, col->nulls);
+    pq_copy_parser_visit(fn, col->packed.arr);
+    pq_copy_parser_visit(fn, col->floats);
+    pq_copy_parser_visit(fn, col->boxed);
+  }
+}
+
+static CopyParser *pq_copy_parser_get_handle(lean_object *parser) {
+  return (CopyParser *)lean_get_external_data(parser);
+}
+
+// PqCopyParserNew - Creates a binary COPY parser for columns of the given type OIDs
+LEAN_EXPORT lean_obj_res lean_pq_copy_parser_new(b_lean_obj_arg oids) {
+  if (pq_copy_parser_external_class == NULL) {
+    pq_copy_parser_external_class = lean_register_external_class(
+        pq_copy_parser_finalizer, pq_copy_parser_foreach);
+  }
+  size_t ncols = lean_array_size(oids);
+  CopyParser *parser = (CopyParser *)calloc(1, sizeof *parser);
+  ColumnBuilder *cols = (ColumnBuilder *)calloc(ncols > 0 ? ncols : 1, sizeof *cols);
+  if (!parser || !cols) {
+    free(parser);
+    free(cols);
+    return lean_io_result_mk_error(pq_other_error("Memory allocation for COPY parser failed"));
+  }
+  parser->ncols = ncols;
+  parser->cols = cols;
+  for (size_t i = 0; i < ncols; i++) {
+    Oid oid = (Oid)lean_unbox_uint32(lean_array_get_core(oids, i));
+    cols[i].oid = oid;
+    if (pq_packed_int_width(oid) > 0)
+      cols[i].data_tag = LEAN_PQ_COLUMN_INT64;
+    else if (oid == LEAN_PQ_FLOAT4OID || oid == LEAN_PQ_FLOAT8OID)
+      cols[i].data_tag = LEAN_PQ_COLUMN_FLOAT64;
+    else
+      cols[i].data_tag = LEAN_PQ_COLUMN_BOXED;
+    pq_column_builder_reset(&cols[i]);
+  }
+  return lean_io_result_mk_ok(lean_alloc_external(pq_copy_parser_external_class, parser));
+}
+
+// Drops the last field of the column: its null flag, and its value when `with_value` is set.
+// The buffers are exclusive to the builder until they are taken.
+static void pq_column_builder_pop(ColumnBuilder *col, int with_value) {
+  lean_to_sarray(col->nulls)->m_size--;
+  if (!with_value)
+    return;
+  switch (col->data_tag) {
+    case LEAN_PQ_COLUMN_INT64: col->packed.size -= 8; break;
+    case LEAN_PQ_COLUMN_FLOAT64: lean_to_sarray(col->floats)->m_size--; break;
+    default: {
+      lean_array_object *boxed = lean_to_array(col->boxed);
+      lean_dec(boxed->m_data[--boxed->m_size]);
+      break;
+    }
+  }
+}
+
+// Appends one field (NULL when `length` is -1) to its column. Returns 0 on a malformed
+// value, leaving the column as it was.
+static int pq_column_builder_push(ColumnBuilder *col, const char *p, int32_t length) {
+  int is_null = length < 0;
+  col->nulls = lean_byte_array_push(col->nulls, (uint8_t)is_null);
+  switch (col->data_tag) {
+    case LEAN_PQ_COLUMN_INT64: {
+      int64_t v = 0;
+      if (!is_null && !pq_decode_packed_int(col->oid, p, length, &v)) {
+        pq_column_builder_pop(col, 0);
+        return 0;
+      }
+      uint8_t *out = pq_buf_reserve(&col->packed, 8);
+      pq_write_le64(out, (uint64_t)v);
+      col->packed.size += 8;
+      return 1;
+    }
+    case LEAN_PQ_COLUMN_FLOAT64: {
+      double v = 0.0;
+      if (!is_null && !pq_decode_packed_float(col->oid, p, length, &v)) {
+        pq_column_builder_pop(col, 0);
+        return 0;
+      }
+      col->floats = lean_float_array_push(col->floats, v);
+      return 1;
+    }
+    default: {
+      lean_object *value;
+      if (is_null) {
+        value = lean_box(LEAN_PQ_VALUE_NULL);
+      } else {
+        int ok;
+        value = pq_decode_binary_field(col->oid, p, length, &ok);
+        if (!ok) {
+          pq_column_builder_pop(col, 0);
+          return 0;
+        }
+      }
+      col->boxed = lean_array_push(col->boxed, value);
+      return 1;
+    }
+  }
+}
+
+// Parses as many complete tuples as `data` holds. Returns the number of bytes
+// consumed, or -1 on malformed input.
+static ssize_t pq_copy_parse(CopyParser *parser, const char *data, size_t length) {
+  static const char signature[11] = {'P', 'G', 'C', 'O', 'P', 'Y', '\n', '\377', '\r', '\n', '\0'};
+  size_t pos = 0;
+  if (!parser->header_done) {
+    if (length < 19)
+      return 0;
+    if (memcmp(data, signature, sizeof signature) != 0)
+      return -1;
+    uint32_t ext_length = pq_read_be32(data + 15);
+    if (length < 19 + (size_t)ext_length)
+      return 0;
+    pos = 19 + ext_length;
+    parser->header_done = 1;
+  }
+  while (!parser->done && pos + 2 <= length) {
+    int16_t nfields = (int16_t)pq_read_be16(data + pos);
+    if (nfields == -1) {
+      parser->done = 1;
+      pos += 2;
+      break;
+    }
+    if ((size_t)nfields != parser->ncols)
+      return -1;
+    // Make sure the whole tuple is available before decoding any of it.
+    size_t end = pos + 2;
+    for (int16_t f = 0; f < nfields; f++) {
+      if (end + 4 > length)
+        return (ssize_t)pos;
+      int32_t field_length = (int32_t)pq_read_be32(data + end);
+      end += 4 + (field_length > 0 ? (size_t)field_length : 0);
+      if (end > length)
+        return (ssize_t)pos;
+    }
+    size_t cursor = pos + 2;
+    for (int16_t f = 0; f < nfields; f++) {
+      int32_t field_length = (int32_t)pq_read_be32(data + cursor);
+      cursor += 4;
+      if (!pq_column_builder_push(&parser->cols[f], data + cursor, field_length)) {
+        // Roll the tuple back so that every column keeps `rows` entries.
+        for (int16_t g = 0; g < f; g++)
+          pq_column_builder_pop(&parser->cols[g], 1);
+        return -1;
+      }
+      cursor += field_length > 0 ? (size_t)field_length : 0;
+    }
+    parser->rows++;
+    pos = end;
+  }
+  return (ssize_t)pos;
+}
+
+// PqCopyParserFeed - Parses a chunk of binary COPY data into the column buffers
+// Returns true once the trailer has been seen.
+LEAN_EXPORT lean_obj_res lean_pq_copy_parser_feed(b_lean_obj_arg parser_obj, b_lean_obj_arg chunk) {
+  CopyParser *parser = pq_copy_parser_get_handle(parser_obj);
+  const char *data = (const char *)lean_sarray_cptr(chunk);
+  size_t length = lean_sarray_size(chunk);
+  if (parser->pending_len > 0) {
+    // Complete the pending tail first.
+    if (parser->pending_len + length > parser->pending_cap) {
+      size_t cap = parser->pending_cap * 2;
+      if (cap < parser->pending_len + length)
+        cap = parser->pending_len + length;
+      char *grown = (char *)realloc(parser->pending, cap);
+      if (!grown)
+        return lean_io_result_mk_error(pq_other_error("Memory allocation for COPY parser failed"));
+      parser->pending = grown;
+      parser->pending_cap = cap;
+    }
+    memcpy(parser->pending + parser->pending_len, data, length);
+    parser->pending_len += length;
+    data = parser->pending;
+    length = parser->pending_len;
+  }
+  ssize_t consumed = pq_copy_parse(parser, data, length);
+  if (consumed < 0)
+    return lean_io_result_mk_error(pq_other_error("Malformed binary COPY data"));
+  size_t rest = length - (size_t)consumed;
+  if (rest > 0 && !parser->done) {
+    if (data == parser->pending) {
+      memmove(parser->pending, parser->pending + consumed, rest);
+    } else {
+      if (rest > parser->pending_cap) {
+        char *grown = (char *)realloc(parser->pending, rest);
+        if (!grown)
+          return lean_io_result_mk_error(pq_other_error("Memory allocation for COPY parser failed"));
+        parser->pending = grown;
+        parser->pending_cap = rest;
+      }
+      memcpy(parser->pending, data + consumed, rest);
+    }
+    parser->pending_len = rest;
+  } else {
+    parser->pending_len = 0;
+  }
+  return lean_io_result_mk_ok(lean_box(parser->done ? 1 : 0));
+}
+
+// PqCopyParserRows - Number of tuples decoded since the last take
+LEAN_EXPORT lean_obj_res lean_pq_copy_parser_rows(b_lean_obj_arg parser_obj) {
+  CopyParser *parser = pq_copy_parser_get_handle(parser_obj);
+  return lean_io_result_mk_ok(lean_usize_to_nat(parser->rows));
+}
+
+// PqCopyParserTake - Hands the decoded columns over and starts new, empty ones
+LEAN_EXPORT lean_obj_res lean_pq_copy_parser_take(b_lean_obj_arg parser_obj) {
+  CopyParser *parser = pq_copy_parser_get_handle(parser_obj);
+  lean_object *columns = lean_alloc_array(parser->ncols, parser->ncols);
+  lean_object **columns_cptr = lean_array_cptr(columns);
+  for (size_t i = 0; i < parser->ncols; i++) {
+    ColumnBuilder *col = &parser->cols[i];
+    lean_object *values;
+    switch (col->data_tag) {
+      case LEAN_PQ_COLUMN_INT64: values = pq_buf_finish(&col->packed); break;
+      case LEAN_PQ_COLUMN_FLOAT64: values = col->floats; break;
+      default: values = col->boxed; break;
+    }
+    columns_cptr[i] = pq_mk_column(col->oid, col->nulls, (unsigned)col->data_tag, values);
+    pq_column_builder_reset(col);
+  }
+  parser->rows = 0;
+  return lean_io_result_mk_ok(columns);
+}
+
+// [Arrow Columnar Format](https://arrow.apache.org/docs/format/Columnar.html)
+// Buffers are little-endian. Validity bitmaps are LSB first, with a set bit for
+// each non-null value.
+
+// Constructor tags of `LeanPq.ArrowType`.
+#define LEAN_PQ_ARROW_BOOL 0
+#define LEAN_PQ_ARROW_INT16 1
+#define LEAN_PQ_ARROW_INT32 2
+#define LEAN_PQ_ARROW_INT64 3
+#define LEAN_PQ_ARROW_UINT32 4
+#define LEAN_PQ_ARROW_FLOAT32 5
+#define LEAN_PQ_ARROW_FLOAT64 6
+#define LEAN_PQ_ARROW_UTF8 7
+#define LEAN_PQ_ARROW_BINARY 8
+#define LEAN_PQ_ARROW_DATE32 9
+#define LEAN_PQ_ARROW_TIMESTAMP 10
+#define LEAN_PQ_ARROW_TIMESTAMPTZ 11
+
+// Arrow type of a column, mirrored by `ArrowType.ofDataType`. Text dates and
+// timestamps are not parsed and stay strings, as in `PqDecodeColumn`.
+static uint8_t pq_arrow_type(Oid oid, int binary) {
+  switch (oid) {
+    case LEAN_PQ_BOOLOID: return LEAN_PQ_ARROW_BOOL;
+    case LEAN_PQ_INT2OID: return LEAN_PQ_ARROW_INT16;
+    case LEAN_PQ_INT4OID: return LEAN_PQ_ARROW_INT32;
+    case LEAN_PQ_INT8OID: return LEAN_PQ_ARROW_INT64;
+    case LEAN_PQ_OIDOID: return LEAN_PQ_ARROW_UINT32;
+    case LEAN_PQ_FLOAT4OID: return LEAN_PQ_ARROW_FLOAT32;
+    case LEAN_PQ_FLOAT8OID: return LEAN_PQ_ARROW_FLOAT64;
+    case LEAN_PQ_DATEOID: return binary ? LEAN_PQ_ARROW_DATE32 : LEAN_PQ_ARROW_UTF8;
+    case LEAN_PQ_TIMESTAMPOID: return binary ? LEAN_PQ_ARROW_TIMESTAMP : LEAN_PQ_ARROW_UTF8;
+    case LEAN_PQ_TIMESTAMPTZOID: return binary ? LEAN_PQ_ARROW_TIMESTAMPTZ : LEAN_PQ_ARROW_UTF8;
+    // Sent as text in both formats (numeric and jsonb are converted).
+    case LEAN_PQ_CHAROID:
+    case LEAN_PQ_NAMEOID:
+    case LEAN_PQ_TEXTOID:
+    case LEAN_PQ_JSONOID:
+    case LEAN_PQ_XMLOID:
+    case LEAN_PQ_BPCHAROID:
+    case LEAN_PQ_VARCHAROID:
+    case LEAN_PQ_NUMERICOID:
+    case LEAN_PQ_JSONBOID:
+      return LEAN_PQ_ARROW_UTF8;
+    // Any other binary field is kept as its wire bytes.
+    default: return binary ? LEAN_PQ_ARROW_BINARY : LEAN_PQ_ARROW_UTF8;
+  }
+}
+
+// Value width in bytes of the fixed-width types, 0 for bool (a bitmap) and the
+// variable-width utf8 and binary.
+static int pq_arrow_width(uint8_t type) {
+  switch (type) {
+    case LEAN_PQ_ARROW_INT16: return 2;
+    case LEAN_PQ_ARROW_INT32:
+    case LEAN_PQ_ARROW_UINT32:
+    case LEAN_PQ_ARROW_FLOAT32:
+    case LEAN_PQ_ARROW_DATE32: return 4;
+    case LEAN_PQ_ARROW_INT64:
+    case LEAN_PQ_ARROW_FLOAT64:
+    case LEAN_PQ_ARROW_TIMESTAMP:
+    case LEAN_PQ_ARROW_TIMESTAMPTZ: return 8;
+    default: return 0;
+  }
+}
+
+static inline void pq_write_le(uint8_t *p, uint64_t v, int width) {
+  for (int i = 0; i < width; i++) {
+    p[i] = (uint8_t)(v >> (8 * i));
+  }
+}
+
+static lean_object* pq_mk_arrow_column(const char *name, uint8_t type, size_t length, size_t null_count,
+                                       lean_object *validity, lean_object *offsets, lean_object *values) {
+  lean_object * column = lean_alloc_ctor(0, 4, 2 * sizeof(uint64_t) + 1);
+  lean_ctor_set(column, 0, lean_mk_string(name));
+  lean_ctor_set(column, 1, validity);
+  lean_ctor_set(column, 2, offsets);
+  lean_ctor_set(column, 3, values);
+  lean_ctor_set_uint64(column, 4 * sizeof(void *), (uint64_t)length);
+  lean_ctor_set_uint64(column, 4 * sizeof(void *) + sizeof(uint64_t), (uint64_t)null_count);
+  lean_ctor_set_uint8(column, 4 * sizeof(void *) + 2 * sizeof(uint64_t), type);
+  return column;
+}
+
+// Writes one non-null fixed-width (or bool) field at `row`. Returns 0 when a
+// binary value has the wrong length or a text number is malformed or out of range.
+static int pq_arrow_put_fixed(uint8_t *out, uint8_t type, int width, int row, Oid oid, int binary,
+                              const char *p, int length) {
+  if (type == LEAN_PQ_ARROW_FLOAT32 || type == LEAN_PQ_ARROW_FLOAT64) {
+    double v = 0.0;
+    if (!(binary ? pq_decode_packed_float(oid, p, length, &v) : pq_parse_text_float(p, length, &v)))
+      return 0;
+    if (type == LEAN_PQ_ARROW_FLOAT32) {
+      float f = (float)v;
+      uint32_t bits;
+      memcpy(&bits, &f, sizeof bits);
+      pq_write_le(out + 4 * (size_t)row, bits, 4);
+    } else {
+      uint64_t bits;
+      memcpy(&bits, &v, sizeof bits);
+      pq_write_le(out + 8 * (size_t)row, bits, 8);
+    }
+    return 1;
+  }
+  int64_t v = 0;
+  if (!binary && oid == LEAN_PQ_BOOLOID)
+    v = p[0] == 't';
+  else if (!(binary ? pq_decode_packed_int(oid, p, length, &v) : pq_parse_text_int(p, length, &v)))
+    return 0;
+  if (type == LEAN_PQ_ARROW_BOOL) {
+    if (v)
+      out[row >> 3] |= (uint8_t)(1 << (row & 7));
+  } else {
+    pq_write_le(out + (size_t)width * (size_t)row, (uint64_t)v, width);
+  }
+  return 1;
+}
+
+// Appends one non-null variable-width field. Returns 0 when a binary numeric or
+// jsonb value is malformed.
+static int pq_arrow_put_variable(ByteBuffer *b, Oid oid, int binary, const char *p, int length) {
+  if (binary && oid == LEAN_PQ_NUMERICOID) {
+    lean_object * str = pq_numeric_to_string(p, length);
+    if (!str)
+      return 0;
+    pq_buf_put(b, lean_string_cstr(str), lean_string_size(str) - 1);
+    lean_dec(str);
+    return 1;
+  }
+  if (binary && oid == LEAN_PQ_JSONBOID) {
+    // jsonb_send prefixes the text with a one byte format version.
+    if (length < 1 || p[0] != 1)
+      return 0;
+    pq_buf_put(b, p + 1, (size_t)length - 1);
+    return 1;
+  }
+  pq_buf_put(b, p, (size_t)length);
+  return 1;
+}
+
+// Builds the buffers of one column in a single pass over its fields. Returns
+// NULL with `*error` set when a field cannot be converted.
+static lean_object* pq_arrow_column(const PGresult *pg_result, int col, lean_object **error) {
+  int ntuples = PQntuples(pg_result);
+  Oid oid = PQftype(pg_result, col);
+  int binary = PQfformat(pg_result, col) == 1;
+  uint8_t type = pq_arrow_type(oid, binary);
+  int width = pq_arrow_width(type);
+  int variable = type == LEAN_PQ_ARROW_UTF8 || type == LEAN_PQ_ARROW_BINARY;
+
+  size_t bitmap_size = ((size_t)ntuples + 7) / 8;
+  lean_object * validity = lean_alloc_sarray(1, bitmap_size, bitmap_size);
+  uint8_t * valid = lean_sarray_cptr(validity);
+  memset(valid, 0, bitmap_size);
+
+  // Fixed-width values are written in place; NULL slots stay zeroed.
+  size_t values_size = variable ? 0 : width > 0 ? (size_t)ntuples * (size_t)width : bitmap_size;
+  lean_object * values = lean_alloc_sarray(1, values_size, values_size);
+  memset(lean_sarray_cptr(values), 0, values_size);
+  size_t offsets_size = variable ? ((size_t)ntuples + 1) * 4 : 0;
+  lean_object * offsets = lean_alloc_sarray(1, offsets_size, offsets_size);
+  uint8_t * offs = lean_sarray_cptr(offsets);
+  ByteBuffer b;
+  pq_buf_init(&b, values);
+  if (variable)
+    pq_write_le(offs, 0, 4);
+
+  size_t null_count = 0;
+  for (int row = 0; row < ntuples; row++) {
+    if (PQgetisnull(pg_result, row, col)) {
+      null_count++;
+    } else {
+      valid[row >> 3] |= (uint8_t)(1 << (row & 7));
+      const char * p = PQgetvalue(pg_result, row, col);
+      int length = PQgetlength(pg_result, row, col);
+      int ok = variable
+        ? pq_arrow_put_variable(&b, oid, binary, p, length)
+        : pq_arrow_put_fixed(lean_sarray_cptr(b.arr), type, width, row, oid, binary, p, length);
+      if (!ok || b.size > INT32_MAX) {
+        *error = ok ? pq_other_error("Column exceeds the 2 GB addressed by 32-bit Arrow offsets")
+                    : pq_decode_error(pg_result, row, col);
+        lean_dec(b.arr);
+        lean_dec(offsets);
+        lean_dec(validity);
+        return NULL;
+      }
+    }
+    if (variable)
+      pq_write_le(offs + 4 * ((size_t)row + 1), (uint64_t)b.size, 4);
+  }
+  if (variable)
+    values = pq_buf_finish(&b);
+  return pq_mk_arrow_column(PQfname(pg_result, col), type, (size_t)ntuples, null_count,
+                            validity, offsets, values);
+}
+
+// PqArrowColumns - Converts every column of a result into Arrow buffers
+LEAN_EXPORT lean_obj_res lean_pq_arrow_columns(b_lean_obj_arg res) {
+  Result *result = pq_result_get_handle(res);
+  const PGresult *pg_result = result->pg_result;
+  int nfields = PQnfields(pg_result);
+  lean_object * columns = lean_alloc_array((size_t)nfields, (size_t)nfields);
+  lean_object ** columns_cptr = lean_array_cptr(columns);
+  for (int col = 0; col < nfields; col++) {
+    lean_object * error = NULL;
+    lean_object * column = pq_arrow_column(pg_result, col, &error);
+    if (!column) {
+      // Keep the array well-formed before releasing it.
+      for (int rest = col; rest < nfields; rest++)
+        columns_cptr[rest] = lean_box(0);
+      lean_dec(columns);
+      return lean_io_result_mk_error(error);
+    }
+    columns_cptr[col] = column;
+  }
+  return lean_io_result_mk_ok(columns);
+}
+
+// [Large Objects](https://www.postgresql.org/docs/current/lo-interfaces.html)
+// Descriptors are only valid inside the transaction that opened them.
+
+// Chunk size of the file descriptor transfers, a multiple of the server's LOBLKSIZE (2 kB).
+#define LEAN_PQ_LO_CHUNK (256 * 1024)
+
+static lean_obj_res pq_lo_error(Connection *connection) {
+  return lean_io_result_mk_error(pq_other_error(PQerrorMessage(connection->pg_conn)));
+}
+
+// lo_creat - Creates a new, empty large object and returns its OID
+// Documentation: https://www.postgresql.org/docs/current/lo-interfaces.html#LO-CREATE
+LEAN_EXPORT lean_obj_res lean_pq_lo_creat(b_lean_obj_arg conn) {
+  Connection *connection = pq_connection_get_handle(conn);
+  Oid oid = lo_creat(connection->pg_conn, INV_READ | INV_WRITE);
+  if (oid == InvalidOid)
+    return pq_lo_error(connection);
+  return lean_io_result_mk_ok(lean_box_uint32(oid));
+}
+
+// lo_unlink - Removes a large object from the database
+// Documentation: https://www.postgresql.org/docs/current/lo-interfaces.html#LO-UNLINK
+LEAN_EXPORT lean_obj_res lean_pq_lo_unlink(b_lean_obj_arg conn, uint32_t oid) {
+  Connection *connection = pq_connection_get_handle(conn);
+  if (lo_unlink(connection->pg_conn, (Oid)oid) < 0)
+    return pq_lo_error(connection);
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// lo_open - Opens a large object for reading and/or writing (INV_READ, INV_WRITE)
+// Documentation: https://www.postgresql.org/docs/current/lo-interfaces.html#LO-OPEN
+LEAN_EXPORT lean_obj_res lean_pq_lo_open(b_lean_obj_arg conn, uint32_t oid, uint32_t mode) {
+  Connection *connection = pq_connection_get_handle(conn);
+  int fd = lo_open(connection->pg_conn, (Oid)oid, (int)mode);
+  if (fd < 0)
+    return pq_lo_error(connection);
+  return lean_io_result_mk_ok(lean_box_uint32((uint32_t)fd));
+}
+
+// lo_close - Closes a large object descriptor
+// Documentation: https://www.postgresql.org/docs/current/lo-interfaces.html#LO-CLOSE
+LEAN_EXPORT lean_obj_res lean_pq_lo_close(b_lean_obj_arg conn, uint32_t fd) {
+  Connection *connection = pq_connection_get_handle(conn);
+  if (lo_close(connection->pg_conn, (int)fd) < 0)
+    return pq_lo_error(connection);
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// lo_read - Reads up to `length` bytes into `buffer`, reusing its storage when it is
+// exclusive and large enough. An empty result means the end of the object.
+// Documentation: https://www.postgresql.org/docs/current/lo-interfaces.html#LO-READ
+LEAN_EXPORT lean_obj_res lean_pq_lo_read(b_lean_obj_arg conn, uint32_t fd, lean_obj_arg buffer, uint32_t length) {
+  Connection *connection = pq_connection_get_handle(conn);
+  if (length > INT_MAX)
+    length = INT_MAX;
+  ByteBuffer b;
+  pq_buf_init(&b, buffer);
+  char *dst = (char *)pq_buf_reserve(&b, length);
+  int n = lo_read(connection->pg_conn, (int)fd, dst, length);
+  if (n < 0) {
+    lean_dec(pq_buf_finish(&b));
+    return pq_lo_error(connection);
+  }
+  b.size = (size_t)n;
+  return lean_io_result_mk_ok(pq_buf_finish(&b));
+}
+
+// lo_write - Writes all of `data`, in pieces the server accepts
+// Documentation: https://www.postgresql.org/docs/current/lo-interfaces.html#LO-WRITE
+LEAN_EXPORT lean_obj_res lean_pq_lo_write(b_lean_obj_arg conn, uint32_t fd, b_lean_obj_arg data) {
+  Connection *connection = pq_connection_get_handle(conn);
+  const char *p = (const char *)lean_sarray_cptr(data);
+  size_t remaining = lean_sarray_size(data);
+  while (remaining > 0) {
+    size_t piece = remaining > (size_t)INT_MAX ? (size_t)INT_MAX : remaining;
+    int n = lo_write(connection->pg_conn, (int)fd, p, piece);
+    if (n <= 0)
+      return pq_lo_error(connection);
+    p += n;
+    remaining -= (size_t)n;
+  }
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// lo_lseek64 - Moves the position of a descriptor (`SeekOrigin`: 0 start, 1 current, 2 end)
+// Documentation: https://www.postgresql.org/docs/current/lo-interfaces.html#LO-SEEK
+LEAN_EXPORT lean_obj_res lean_pq_lo_lseek64(b_lean_obj_arg conn, uint32_t fd, uint64_t offset, uint8_t whence) {
+  Connection *connection = pq_connection_get_handle(conn);
+  static const int whences[] = { SEEK_SET, SEEK_CUR, SEEK_END };
+  pg_int64 position = lo_lseek64(connection->pg_conn, (int)fd, (pg_int64)offset, whences[whence % 3]);
+  if (position < 0)
+    return pq_lo_error(connection);
+  return lean_io_result_mk_ok(lean_box_uint64((uint64_t)position));
+}
+
+// lo_tell64 - Returns the current position of a descriptor
+// Documentation: https://www.postgresql.org/docs/current/lo-interfaces.html#LO-TELL
+LEAN_EXPORT lean_obj_res lean_pq_lo_tell64(b_lean_obj_arg conn, uint32_t fd) {
+  Connection *connection = pq_connection_get_handle(conn);
+  pg_int64 position = lo_tell64(connection->pg_conn, (int)fd);
+  if (position < 0)
+    return pq_lo_error(connection);
+  return lean_io_result_mk_ok(lean_box_uint64((uint64_t)position));
+}
+
+// lo_truncate64 - Truncates (or zero-extends) a large object to `length` bytes
+// Documentation: https://www.postgresql.org/docs/current/lo-interfaces.html#LO-TRUNCATE
+LEAN_EXPORT lean_obj_res lean_pq_lo_truncate64(b_lean_obj_arg conn, uint32_t fd, uint64_t length) {
+  Connection *connection = pq_connection_get_handle(conn);
+  if (lo_truncate64(connection->pg_conn, (int)fd, (pg_int64)length) < 0)
+    return pq_lo_error(connection);
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// PqLoReadToFd - Copies a descriptor from its current position to the end into the file
+// descriptor `out`, through one fixed buffer. Returns the number of bytes copied.
+LEAN_EXPORT lean_obj_res lean_pq_lo_read_to_fd(b_lean_obj_arg conn, uint32_t fd, uint32_t out) {
+  Connection *connection = pq_connection_get_handle(conn);
+  char *buffer = (char *)malloc(LEAN_PQ_LO_CHUNK);
+  if (!buffer)
+    return lean_io_result_mk_error(pq_other_error("Memory allocation for large object buffer failed"));
+  uint64_t total = 0;
+  for (;;) {
+    int n = lo_read(connection->pg_conn, (int)fd, buffer, LEAN_PQ_LO_CHUNK);
+    if (n < 0) {
+      free(buffer);
+      return pq_lo_error(connection);
+    }
+    if (n == 0)
+      break;
+    const char *p = buffer;
+    size_t remaining = (size_t)n;
+    while (remaining > 0) {
+      ssize_t written = write((int)out, p, remaining);
+      if (written < 0) {
+        if (errno == EINTR)
+          continue;
+        free(buffer);
+        return lean_io_result_mk_error(pq_other_error(strerror(errno)));
+      }
+      p += written;
+      remaining -= (size_t)written;
+    }
+    total += (uint64_t)n;
+  }
+  free(buffer);
+  return lean_io_result_mk_ok(lean_box_uint64(total));
+}
+
+// PqLoWriteFromFd - Appends everything read from the file descriptor `in` until end of file
+// to a descriptor, through one fixed buffer. Returns the number of bytes copied.
+LEAN_EXPORT lean_obj_res lean_pq_lo_write_from_fd(b_lean_obj_arg conn, uint32_t fd, uint32_t in) {
+  Connection *connection = pq_connection_get_handle(conn);
+  char *buffer = (char *)malloc(LEAN_PQ_LO_CHUNK);
+  if (!buffer)
+    return lean_io_result_mk_error(pq_other_error("Memory allocation for large object buffer failed"));
+  uint64_t total = 0;
+  for (;;) {
+    ssize_t n = read((int)in, buffer, LEAN_PQ_LO_CHUNK);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      free(buffer);
+      return lean_io_result_mk_error(pq_other_error(strerror(errno)));
+    }
+    if (n == 0)
+      break;
+    size_t done = 0;
+    while (done < (size_t)n) {
+      int written = lo_write(connection->pg_conn, (int)fd, buffer + done, (size_t)n - done);
+      if (written <= 0) {
+        free(buffer);
+        return pq_lo_error(connection);
+      }
+      done += (size_t)written;
+    }
+    total += (uint64_t)n;
+  }
+  free(buffer);
+  return lean_io_result_mk_ok(lean_box_uint64(total));
+}
+
+// [Streaming Replication Protocol](https://www.postgresql.org/docs/current/protocol-replication.html)
+// Logical decoding output of pgoutput: https://www.postgresql.org/docs/current/protocol-logicalrep-message-formats.html
+
+// Constructor tags of `LeanPq.ReplicationEvent`.
+#define LEAN_PQ_REPL_BEGIN 0
+#define LEAN_PQ_REPL_COMMIT 1
+#define LEAN_PQ_REPL_RELATION 2
+#define LEAN_PQ_REPL_INSERT 3
+#define LEAN_PQ_REPL_UPDATE 4
+#define LEAN_PQ_REPL_DELETE 5
+#define LEAN_PQ_REPL_TRUNCATE 6
+#define LEAN_PQ_REPL_KEEPALIVE 7
+#define LEAN_PQ_REPL_OTHER 8
+
+// Constructor tags of `LeanPq.TupleField`.
+#define LEAN_PQ_TUPLE_NULL 0
+#define LEAN_PQ_TUPLE_UNCHANGED 1
+#define LEAN_PQ_TUPLE_TEXT 2
+#define LEAN_PQ_TUPLE_BINARY 3
+
+// A bounds-checked cursor over one CopyData message; `ok` drops to 0 on the first overrun.
+typedef struct {
+  const char *p;
+  const char *end;
+  int ok;
+} ReplReader;
+
+static inline int pq_repl_has(ReplReader *r, size_t n) {
+  if (r->ok && (size_t)(r->end - r->p) >= n)
+    return 1;
+  r->ok = 0;
+  return 0;
+}
+
+static inline uint8_t pq_repl_u8(ReplReader *r) {
+  if (!pq_repl_has(r, 1)) return 0;
+  return (uint8_t)*r->p++;
+}
+
+static inline uint16_t pq_repl_u16(ReplReader *r) {
+  if (!pq_repl_has(r, 2)) return 0;
+  uint16_t v = pq_read_be16(r->p);
+  r->p += 2;
+  return v;
+}
+
+static inline uint32_t pq_repl_u32(ReplReader *r) {
+  if (!pq_repl_has(r, 4)) return 0;
+  uint32_t v = pq_read_be32(r->p);
+  r->p += 4;
+  return v;
+}
+
+static inline uint64_t pq_repl_u64(ReplReader *r) {
+  if (!pq_repl_has(r, 8)) return 0;
+  uint64_t v = pq_read_be64(r->p);
+  r->p += 8;
+  return v;
+}
+
+// A NUL-terminated string; the empty string on overrun.
+static lean_object* pq_repl_string(ReplReader *r) {
+  const char *nul = r->ok ? memchr(r->p, 0, (size_t)(r->end - r->p)) : NULL;
+  if (nul == NULL) {
+    r->ok = 0;
+    return lean_mk_string("");
+  }
+  lean_object *s = lean_mk_string_from_bytes(r->p, (size_t)(nul - r->p));
+  r->p = nul + 1;
+  return s;
+}
+
+// TupleData: Int16 column count, then one tagged value per column.
+static lean_object* pq_repl_tuple(ReplReader *r) {
+  uint16_t ncols = pq_repl_u16(r);
+  lean_object *fields = lean_alloc_array(0, ncols);
+  for (uint16_t i = 0; i < ncols && r->ok; i++) {
+    lean_object *field;
+    uint8_t tag = pq_repl_u8(r);
+    switch (tag) {
+      case 'n': field = lean_box(LEAN_PQ_TUPLE_NULL); break;
+      case 'u': field = lean_box(LEAN_PQ_TUPLE_UNCHANGED); break;
+      case 't':
+      case 'b': {
+        int binary = tag == 'b';
+        uint32_t length = pq_repl_u32(r);
+        if (!pq_repl_has(r, length)) {
+          field = lean_box(LEAN_PQ_TUPLE_NULL);
+          break;
+        }
+        field = lean_alloc_ctor(binary ? LEAN_PQ_TUPLE_BINARY : LEAN_PQ_TUPLE_TEXT, 1, 0);
+        lean_ctor_set(field, 0, binary ? pq_mk_byte_array(r->p, length)
+                                       : lean_mk_string_from_bytes(r->p, length));
+        r->p += length;
+        break;
+      }
+      default:
+        r->ok = 0;
+        field = lean_box(LEAN_PQ_TUPLE_NULL);
+        break;
+    }
+    fields = lean_array_push(fields, field);
+  }
+  return fields;
+}
+
+// RelationColumn layout: name (object), then type_oid, typmod (uint32) and key (uint8).
+static lean_object* pq_repl_relation(ReplReader *r) {
+  uint32_t relid = pq_repl_u32(r);
+  lean_object *schema = pq_repl_string(r);
+  lean_object *name = pq_repl_string(r);
+  uint8_t replica_identity = pq_repl_u8(r);
+  uint16_t ncols = pq_repl_u16(r);
+  lean_object *columns = lean_alloc_array(0, ncols);
+  for (uint16_t i = 0; i < ncols && r->ok; i++) {
+    uint8_t flags = pq_repl_u8(r);
+    lean_object *column = lean_alloc_ctor(0, 1, 2 * sizeof(uint32_t) + 1);
+    lean_ctor_set(column, 0, pq_repl_string(r));
+    lean_ctor_set_uint32(column, sizeof(void *), pq_repl_u32(r));
+    lean_ctor_set_uint32(column, sizeof(void *) + 4, pq_repl_u32(r));
+    lean_ctor_set_uint8(column, sizeof(void *) + 8, flags & 1);
+    columns = lean_array_push(columns, column);
+  }
+  lean_object *event = lean_alloc_ctor(LEAN_PQ_REPL_RELATION, 3, sizeof(uint32_t) + 1);
+  lean_ctor_set(event, 0, schema);
+  lean_ctor_set(event, 1, name);
+  lean_ctor_set(event, 2, columns);
+  lean_ctor_set_uint32(event, 3 * sizeof(void *), relid);
+  lean_ctor_set_uint8(event, 3 * sizeof(void *) + 4, replica_identity);
+  return event;
+}
+
+// Decodes one pgoutput message (protocol version 1) into a `ReplicationEvent`.
+static lean_object* pq_repl_decode_pgoutput(ReplReader *r) {
+  const char *start = r->p;
+  uint8_t kind = pq_repl_u8(r);
+  lean_object *event;
+  switch (kind) {
+    case 'B': {
+      event = lean_alloc_ctor(LEAN_PQ_REPL_BEGIN, 0, 2 * sizeof(uint64_t) + sizeof(uint32_t));
+      lean_ctor_set_uint64(event, 0, pq_repl_u64(r));
+      lean_ctor_set_uint64(event, 8, (uint64_t)pq_timestamp_to_unix((int64_t)pq_repl_u64(r)));
+      lean_ctor_set_uint32(event, 16, pq_repl_u32(r));
+      return event;
+    }
+    case 'C': {
+      pq_repl_u8(r); // flags, unused
+      event = lean_alloc_ctor(LEAN_PQ_REPL_COMMIT, 0, 3 * sizeof(uint64_t));
+      lean_ctor_set_uint64(event, 0, pq_repl_u64(r));
+      lean_ctor_set_uint64(event, 8, pq_repl_u64(r));
+      lean_ctor_set_uint64(event, 16, (uint64_t)pq_timestamp_to_unix((int64_t)pq_repl_u64(r)));
+      return event;
+    }
+    case 'R':
+      return pq_repl_relation(r);
+    case 'I': {
+      uint32_t relid = pq_repl_u32(r);
+      pq_repl_u8(r); // 'N'
+      event = lean_alloc_ctor(LEAN_PQ_REPL_INSERT, 1, sizeof(uint32_t));
+      lean_ctor_set(event, 0, pq_repl_tuple(r));
+      lean_ctor_set_uint32(event, sizeof(void *), relid);
+      return event;
+    }
+    case 'U': {
+      uint32_t relid = pq_repl_u32(r);
+      // The old tuple ('K' key columns or 'O' whole row) is only sent when the replica
+      // identity requires it.
+      lean_object *old_tuple = lean_box(0); // Option.none
+      uint8_t part = pq_repl_u8(r);
+      if (part == 'K' || part == 'O') {
+        old_tuple = lean_alloc_ctor(1, 1, 0);
+        lean_ctor_set(old_tuple, 0, pq_repl_tuple(r));
+        pq_repl_u8(r); // 'N'
+      }
+      event = lean_alloc_ctor(LEAN_PQ_REPL_UPDATE, 2, sizeof(uint32_t));
+      lean_ctor_set(event, 0, old_tuple);
+      lean_ctor_set(event, 1, pq_repl_tuple(r));
+      lean_ctor_set_uint32(event, 2 * sizeof(void *), relid);
+      return event;
+    }
+    case 'D': {
+      uint32_t relid = pq_repl_u32(r);
+      pq_repl_u8(r); // 'K' or 'O'
+      event = lean_alloc_ctor(LEAN_PQ_REPL_DELETE, 1, sizeof(uint32_t));
+      lean_ctor_set(event, 0, pq_repl_tuple(r));
+      lean_ctor_set_uint32(event, sizeof(void *), relid);
+      return event;
+    }
+    case 'T': {
+      uint32_t nrels = pq_repl_u32(r);
+      uint8_t options = pq_repl_u8(r);
+      lean_object *relids = lean_alloc_array(0, 0);
+      for (uint32_t i = 0; i < nrels && r->ok; i++)
+        relids = lean_array_push(relids, lean_box_uint32(pq_repl_u32(r)));
+      event = lean_alloc_ctor(LEAN_PQ_REPL_TRUNCATE, 1, 1);
+      lean_ctor_set(event, 0, relids);
+      lean_ctor_set_uint8(event, sizeof(void *), options);
+      return event;
+    }
+    default: {
+      // Origin, Type and logical decoding messages are passed through undecoded.
+      event = lean_alloc_ctor(LEAN_PQ_REPL_OTHER, 1, 1);
+      lean_ctor_set(event, 0, pq_mk_byte_array(start, (size_t)(r->end - start)));
+      lean_ctor_set_uint8(event, sizeof(void *), kind);
+      r->p = r->end;
+      return event;
+    }
+  }
+}
+
+// ReplicationMessage layout: event (object), then wal_start, wal_end and send_time (uint64).
+static lean_object* pq_repl_message(const char *data, size_t length, lean_object **error) {
+  ReplReader r = { data, data + length, 1 };
+  uint64_t wal_start = 0, wal_end = 0;
+  int64_t send_time = 0;
+  lean_object *event;
+  switch (pq_repl_u8(&r)) {
+    case 'w': // XLogData
+      wal_start = pq_repl_u64(&r);
+      wal_end = pq_repl_u64(&r);
+      send_time = pq_timestamp_to_unix((int64_t)pq_repl_u64(&r));
+      event = pq_repl_decode_pgoutput(&r);
+      break;
+    case 'k': // Primary keepalive
+      wal_end = pq_repl_u64(&r);
+      send_time = pq_timestamp_to_unix((int64_t)pq_repl_u64(&r));
+      event = lean_alloc_ctor(LEAN_PQ_REPL_KEEPALIVE, 0, sizeof(uint64_t) + 1);
+      lean_ctor_set_uint64(event, 0, wal_end);
+      lean_ctor_set_uint8(event, 8, pq_repl_u8(&r) != 0);
+      break;
+    default:
+      *error = pq_other_error("Unknown replication message");
+      return NULL;
+  }
+  if (!r.ok) {
+    lean_dec(event);
+    *error = pq_other_error("Truncated replication message");
+    return NULL;
+  }
+  lean_object *message = lean_alloc_ctor(0, 1, 3 * sizeof(uint64_t));
+  lean_ctor_set(message, 0, event);
+  lean_ctor_set_uint64(message, sizeof(void *), wal_start);
+  lean_ctor_set_uint64(message, sizeof(void *) + 8, wal_end);
+  lean_ctor_set_uint64(message, sizeof(void *) + 16, (uint64_t)send_time);
+  return message;
+}
+
+// PqReplicationReceive - Waits up to `timeout_ms` for the next CopyBoth message and decodes it
+// `none` on timeout. The socket is polled, so waiting costs no CPU; messages already buffered
+// by libpq are returned without a system call.
+LEAN_EXPORT lean_obj_res lean_pq_replication_receive(b_lean_obj_arg conn, uint32_t timeout_ms) {
+  Connection *connection = pq_connection_get_handle(conn);
+  PGconn *pg_conn = connection->pg_conn;
+  char *buffer = NULL;
+  int length = PQgetCopyData(pg_conn, &buffer, 1);
+  if (length == 0) {
+    int fd = PQsocket(pg_conn);
+    if (fd < 0)
+      return lean_io_result_mk_error(pq_other_error("Connection has no open socket"));
+    struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+    int ready;
+    do {
+      ready = poll(&pfd, 1, timeout_ms > INT_MAX ? -1 : (int)timeout_ms);
+    } while (ready < 0 && errno == EINTR);
+    if (ready < 0)
+      return lean_io_result_mk_error(pq_other_error(strerror(errno)));
+    if (ready == 0)
+      return lean_io_result_mk_ok(lean_box(0)); // Option.none
+    if (!PQconsumeInput(pg_conn))
+      return lean_io_result_mk_error(pq_other_error(PQerrorMessage(pg_conn)));
+    length = PQgetCopyData(pg_conn, &buffer, 1);
+    if (length == 0)
+      return lean_io_result_mk_ok(lean_box(0)); // Partial message, read on the next call
+  }
+  if (length == -1) {
+    // The server ended the stream; its final result carries the reason, if any.
+    PGresult *result = PQgetResult(pg_conn);
+    int failed = result != NULL && PQresultStatus(result) == PGRES_FATAL_ERROR;
+    lean_object *error = pq_other_error(failed ? PQresultErrorMessage(result) : "Replication stream ended");
+    PQclear(result);
+    while ((result = PQgetResult(pg_conn)) != NULL)
+      PQclear(result);
+    return lean_io_result_mk_error(error);
+  }
+  if (length < 0)
+    return lean_io_result_mk_error(pq_other_error(PQerrorMessage(pg_conn)));
+  lean_object *error = NULL;
+  lean_object *message = pq_repl_message(buffer, (size_t)length, &error);
+  PQfreemem(buffer);
+  if (message == NULL)
+    return lean_io_result_mk_error(error);
+  lean_object *some = lean_alloc_ctor(1, 1, 0); // Option.some
+  lean_ctor_set(some, 0, message);
+  return lean_io_result_mk_ok(some);
+}
+
+// PqDecodeReplicationMessage - Decodes one CopyData message of a replication stream
+LEAN_EXPORT lean_obj_res lean_pq_decode_replication_message(b_lean_obj_arg data) {
+  lean_object *error = NULL;
+  lean_object *message = pq_repl_message((const char *)lean_sarray_cptr(data), lean_sarray_size(data), &error);
+  if (message == NULL)
+    return lean_io_result_mk_error(error);
+  return lean_io_result_mk_ok(message);
+}
+
+// PqSendStandbyStatus - Reports the WAL positions written, flushed and applied by the client
+// The server advances the slot's confirmed position to `flush`, releasing older WAL.
+LEAN_EXPORT lean_obj_res lean_pq_send_standby_status(b_lean_obj_arg conn, uint64_t write_lsn, uint64_t flush_lsn,
+                                                     uint64_t apply_lsn, uint8_t reply_requested) {
+  Connection *connection = pq_connection_get_handle(conn);
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  int64_t now = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 - LEAN_PQ_EPOCH_DIFF_MICROS;
+  char message[1 + 4 * 8 + 1];
+  uint64_t fields[4] = { write_lsn, flush_lsn, apply_lsn, (uint64_t)now };
+  message[0] = 'r';
+  for (int i = 0; i < 4; i++) {
+    for (int b = 0; b < 8; b++)
+      message[1 + 8 * i + b] = (char)(fields[i] >> (56 - 8 * b));
+  }
+  message[sizeof message - 1] = (char)(reply_requested != 0);
+  if (PQputCopyData(connection->pg_conn, message, sizeof message) != 1 || PQflush(connection->pg_conn) != 0)
+    return lean_io_result_mk_error(pq_other_error(PQerrorMessage(connection->pg_conn)));
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// [Instrumentation]
+
+// QueryStats layout: latency (object), then the eight UInt64 counters in the order of `Stats`.
+static lean_object* pq_stats_snapshot(Stats *stats) {
+  lean_object *latency = lean_alloc_array(LEAN_PQ_LATENCY_BUCKETS, LEAN_PQ_LATENCY_BUCKETS);
+  lean_object **latency_cptr = lean_array_cptr(latency);
+  for (size_t i = 0; i < LEAN_PQ_LATENCY_BUCKETS; i++)
+    latency_cptr[i] = lean_box_uint64(atomic_load_explicit(&stats->latency[i], memory_order_relaxed));
+  _Atomic uint64_t *counters[] = {
+    &stats->queries, &stats->errors, &stats->rows, &stats->bytes_sent, &stats->bytes_received,
+    &stats->results_allocated, &stats->results_freed, &stats->total_micros,
+  };
+  size_t n = sizeof counters / sizeof counters[0];
+  lean_object *snapshot = lean_alloc_ctor(0, 1, n * sizeof(uint64_t));
+  lean_ctor_set(snapshot, 0, latency);
+  for (size_t i = 0; i < n; i++)
+    lean_ctor_set_uint64(snapshot, sizeof(void *) + i * sizeof(uint64_t),
+                         atomic_load_explicit(counters[i], memory_order_relaxed));
+  return snapshot;
+}
+
+// PqGlobalStats - Statistics of every connection of the process
+LEAN_EXPORT lean_obj_res lean_pq_global_stats() {
+  return lean_io_result_mk_ok(pq_stats_snapshot(&pq_global_stats));
+}
+
+// PqConnectionStats - Statistics of one connection
+LEAN_EXPORT lean_obj_res lean_pq_connection_stats(b_lean_obj_arg conn) {
+  Connection *connection = pq_connection_get_handle(conn);
+  return lean_io_result_mk_ok(pq_stats_snapshot(&connection->stats));
+}
+
+// PqStatementStats - Statistics of each statement run on the connection
+LEAN_EXPORT lean_obj_res lean_pq_statement_stats(b_lean_obj_arg conn) {
+  Connection *connection = pq_connection_get_handle(conn);
+  StmtStats *table = atomic_load_explicit(&connection->stmts, memory_order_acquire);
+  lean_object *entries = lean_alloc_array(0, 0);
+  if (!table)
+    return lean_io_result_mk_ok(entries);
+  for (size_t i = 0; i < LEAN_PQ_STMT_SLOTS; i++) {
+    StmtStats *slot = &table[i];
+    if (!atomic_load_explicit(&slot->ready, memory_order_acquire))
+      continue;
+    lean_object *entry = lean_alloc_ctor(0, 2, 0);
+    lean_ctor_set(entry, 0, lean_mk_string_from_bytes(slot->key, slot->key_length));
+    lean_ctor_set(entry, 1, pq_stats_snapshot(&slot->stats));
+    entries = lean_array_push(entries, entry);
+  }
+  return lean_io_result_mk_ok(entries);
+}
+
+// PqResetStats - Zeroes the statistics of a connection and of its statements
+LEAN_EXPORT lean_obj_res lean_pq_reset_stats(b_lean_obj_arg conn) {
+  Connection *connection = pq_connection_get_handle(conn);
+  pq_stats_reset(&connection->stats);
+  StmtStats *table = atomic_load_explicit(&connection->stmts, memory_order_acquire);
+  if (table) {
+    for (size_t i = 0; i < LEAN_PQ_STMT_SLOTS; i++)
+      pq_stats_reset(&table[i].stats);
+  }
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// PqSetSlowQueryCallback - Calls `callback` with the statement and its latency (µs) for every
+// round trip of at least `threshold_micros`; it runs on the thread that issued the query.
+LEAN_EXPORT lean_obj_res lean_pq_set_slow_query_callback(b_lean_obj_arg conn, uint64_t threshold_micros, lean_obj_arg callback) {
+  Connection *connection = pq_connection_get_handle(conn);
+  if (lean_is_mt(conn))
+    lean_mark_mt(callback);
+  pthread_mutex_lock(&connection->slow_lock);
+  lean_object *previous = connection->slow_callback;
+  connection->slow_threshold_micros = threshold_micros;
+  connection->slow_callback = callback;
+  pthread_mutex_unlock(&connection->slow_lock);
+  if (previous)
+    lean_dec(previous);
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// PqClearSlowQueryCallback - Removes the slow-query callback
+LEAN_EXPORT lean_obj_res lean_pq_clear_slow_query_callback(b_lean_obj_arg conn) {
+  Connection *connection = pq_connection_get_handle(conn);
+  pthread_mutex_lock(&connection->slow_lock);
+  lean_object *previous = connection->slow_callback;
+  connection->slow_callback = NULL;
+  pthread_mutex_unlock(&connection->slow_lock);
+  if (previous)
+    lean_dec(previous);
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// PQtrace - Enables tracing of the client/server communication to a file (appended to)
+// Documentation: https://www.postgresql.org/docs/current/libpq-control.html#LIBPQ-PQTRACE
+LEAN_EXPORT lean_obj_res lean_pq_trace(b_lean_obj_arg conn, b_lean_obj_arg path, uint8_t suppress_timestamps) {
+  Connection *connection = pq_connection_get_handle(conn);
+  FILE *file = fopen(lean_string_cstr(path), "a");
+  if (!file)
+    return lean_io_result_mk_error(pq_other_error(strerror(errno)));
+  if (connection->trace) {
+    PQuntrace(connection->pg_conn);
+    fclose(connection->trace);
+  }
+  connection->trace = file;
+  PQtrace(connection->pg_conn, file);
+#ifdef PQTRACE_SUPPRESS_TIMESTAMPS
+  PQsetTraceFlags(connection->pg_conn, suppress_timestamps ? PQTRACE_SUPPRESS_TIMESTAMPS : 0);
+#endif
+  return lean_io_result_mk_ok(lean_box(0));
+}
+
+// PQuntrace - Disables tracing started by PQtrace
+// Documentation: https://www.postgresql.org/docs/current/libpq-control.html#LIBPQ-PQUNTRACE
+LEAN_EXPORT lean_obj_res lean_pq_untrace(b_lean_obj_arg conn) {
+  Connection *connection = pq_connection_get_handle(conn);
+  if (connection->trace) {
+    PQuntrace(connection->pg_conn);
+    fclose(connection->trace);
+    connection->trace = NULL;
+  }
+  return lean_io_result_mk_ok(lean_box(0));
+}
@@ -34,6 +34,11 @@ lean_exe examples {
   root := `Examples
 }
 
+-- Run against tests/docker-compose.yml: `lake exe bench [output.json]`
+lean_exe bench {
+  root := `Bench
+}
+
 @[test_driver]
 lean_exe tests {
   root := `Tests.Test
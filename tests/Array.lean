@@ -0,0 +1,70 @@
+/-
+Test file for the binary array decoder: boxed arrays through the COPY parser, packed arrays
+from `PqGetArray`, and malformed headers.
+-/
+
+import LeanPq.Copy
+import Tests.Native
+import Tests.Copy
+open LeanPq
+open Extern
+
+namespace Tests
+
+def be32 (n : UInt32) : Array UInt8 :=
+  #[(n >>> 24).toUInt8, (n >>> 16).toUInt8, (n >>> 8).toUInt8, n.toUInt8]
+
+def be64 (n : UInt64) : Array UInt8 :=
+  be32 (n >>> 32).toUInt32 ++ be32 n.toUInt32
+
+/-- A binary array: ndim, has-null flag, element OID, (size, lower bound) per dimension,
+then the elements. -/
+def binaryArray (elemOid : UInt32) (dims : Array UInt32) (elements : Array (Array UInt8)) : Array UInt8 :=
+  be32 dims.size.toUInt32 ++ be32 0 ++ be32 elemOid ++ dims.flatMap (fun d => be32 d ++ be32 1) ++
+    elements.flatMap fun e => be32 e.size.toUInt32 ++ e
+
+/-- One tuple of a single field. -/
+def copyTuple (field : Array UInt8) : Array UInt8 :=
+  #[0, 1] ++ be32 field.size.toUInt32 ++ field
+
+#guard be32 0x01020304 == #[1, 2, 3, 4]
+#guard (binaryArray Oid.int8 #[2] #[be64 1, be64 2]).size == 20 + 2 * 12
+
+/-- Checks of the array decoder on hand-built data, run by the `tests` executable. -/
+def arrayChecks : IO Unit := do
+  let parser ← run (PqCopyParserNew #[1016])
+  let field := binaryArray Oid.int8 #[2] #[be64 1, be64 (-3 : Int64).toUInt64]
+  discard <| run (PqCopyParserFeed parser (ByteArray.mk (copyHeader ++ copyTuple field)))
+  let columns ← run (PqCopyParserTake parser)
+  check "int8[] decoded" <| match columns[0]?.map (·.get 0) with
+    | some (.array elemOid dims #[.int a, .int b]) => elemOid == Oid.int8 && dims == #[2] && a == 1 && b == -3
+    | _ => false
+
+  -- 65536^4 wraps to 0 in 64 bits: the header must be rejected, not read as an empty array.
+  let parser ← run (PqCopyParserNew #[1016])
+  let field := binaryArray Oid.int8 #[65536, 65536, 65536, 65536] #[]
+  check "array size overflow" (← fails (PqCopyParserFeed parser (ByteArray.mk (copyHeader ++ copyTuple field))))
+
+  let parser ← run (PqCopyParserNew #[1016])
+  let field := binaryArray Oid.int8 #[2] #[be64 1]
+  check "truncated array" (← fails (PqCopyParserFeed parser (ByteArray.mk (copyHeader ++ copyTuple field))))
+
+/-- Checks of `PqGetArray` on arrays sent by the server, run once a server is up. -/
+def arrayServerChecks : IO Unit := do
+  let conn ← run (PqConnectDb testConninfo)
+  let res ← run (PqExecParams conn
+    "SELECT ARRAY[1, -2, 3]::int8[], ARRAY['2000-01-01 00:00:01']::timestamp[], \
+       ARRAY[1, NULL]::int8[], '{}'::int8[], ARRAY[[1, 2], [3, 4]]::int8[]" #[] 1)
+  let some ints ← run (PqGetArray res 0 0) | check "int8[]" false
+  check "int8[] packed" (ints.size == 3 && ints.dims == #[3] &&
+    ints.toColumn.getInt64! 0 == 1 && ints.toColumn.getInt64! 1 == -2 && ints.toColumn.getInt64! 2 == 3)
+  let some stamps ← run (PqGetArray res 0 1) | check "timestamp[]" false
+  check "timestamp[] converted to the Unix epoch" (stamps.toColumn.getInt64! 0 == 946684801000000)
+  let some withNull ← run (PqGetArray res 0 2) | check "int8[] with NULL" false
+  check "int8[] with NULL" (withNull.size == 2 && !withNull.toColumn.isNull 0 && withNull.toColumn.isNull 1)
+  let some empty ← run (PqGetArray res 0 3) | check "empty int8[]" false
+  check "empty int8[]" (empty.size == 0 && empty.dims.isEmpty)
+  let some matrix ← run (PqGetArray res 0 4) | check "int8[][]" false
+  check "int8[][]" (matrix.dims == #[2, 2] && matrix.toColumn.getInt64! 3 == 4)
+
+end Tests
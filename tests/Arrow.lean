@@ -0,0 +1,67 @@
+/-
+Test file for the Arrow type mapping and the FlatBuffers encoding of IPC metadata.
+-/
+
+import LeanPq.Arrow
+open LeanPq
+open Extern
+
+namespace Tests
+
+#guard ArrowType.ofDataType .integer true == .int32
+#guard ArrowType.ofDataType .integer false == .int32
+#guard ArrowType.ofDataType .oid true == .uint32
+#guard ArrowType.ofDataType (.numeric none none) true == .utf8
+#guard ArrowType.ofDataType (.timestamp none true) true == .timestampTz
+#guard ArrowType.ofDataType (.timestamp none false) false == .utf8
+#guard ArrowType.ofDataType .date true == .date32
+#guard ArrowType.ofDataType .bytea true == .binary
+#guard ArrowType.ofDataType .bytea false == .utf8
+#guard ArrowType.ofDataType .jsonb true == .utf8
+
+#guard (Arrow.le 4 0x01020304).data == #[4, 3, 2, 1]
+
+-- Root offset, vtable (size 6, table size 8, field at 4), padding, then the table.
+#guard (Arrow.Flatbuffer.encode (.table #[some (.u32 7)])).data ==
+  #[16, 0, 0, 0, 6, 0, 8, 0, 4, 0, 0, 0, 0, 0, 0, 0, 12, 0, 0, 0, 7, 0, 0, 0]
+
+-- Children follow the table, and offsets are relative to their own position.
+#guard (Arrow.Flatbuffer.encode (.table #[some (.string "ab")])).data ==
+  #[16, 0, 0, 0, 6, 0, 8, 0, 4, 0, 0, 0, 0, 0, 0, 0, 12, 0, 0, 0, 4, 0, 0, 0,
+    2, 0, 0, 0, 97, 98, 0, 0]
+
+-- Struct vectors are 8-byte aligned after their length.
+#guard (Arrow.Flatbuffer.encode (.table #[some (.structs 1 (Arrow.le 8 5))])).data ==
+  #[16, 0, 0, 0, 6, 0, 8, 0, 4, 0, 0, 0, 0, 0, 0, 0, 12, 0, 0, 0, 8, 0, 0, 0,
+    0, 0, 0, 0, 1, 0, 0, 0, 5, 0, 0, 0, 0, 0, 0, 0]
+
+#guard (Arrow.concatBitmaps #[(⟨#[0b101]⟩, 3), (⟨#[0b11]⟩, 2), (⟨#[0xFF, 1]⟩, 9)]).data ==
+  #[0b11111101, 0b111111]
+
+-- Single-row batches, as given without chunked-rows mode, gathered into one record batch.
+private def textRow (s : Option String) : Array ArrowColumn :=
+  let bytes := (s.getD "").toUTF8
+  #[{ name := "t", type := .utf8, length := 1, nullCount := if s.isSome then 0 else 1,
+      validity := ⟨#[if s.isSome then 1 else 0]⟩, offsets := Arrow.le 4 0 ++ Arrow.le 4 bytes.size,
+      values := bytes }]
+
+#guard
+  match concatArrowBatches #[textRow (some "ab"), textRow none, textRow (some "c")] with
+  | .ok #[c] =>
+    c.length == 3 && c.nullCount == 1 && c.validity.data == #[0b101] && c.values.data == "abc".toUTF8.data &&
+      c.offsets.data == (Arrow.le 4 0 ++ Arrow.le 4 2 ++ Arrow.le 4 2 ++ Arrow.le 4 3).data
+  | _ => false
+
+#guard
+  let int (v : Nat) : Array ArrowColumn :=
+    #[{ name := "i", type := .int32, length := 1, nullCount := 0, validity := ⟨#[1]⟩,
+        offsets := .empty, values := Arrow.le 4 v }]
+  match concatArrowBatches #[int 1, int 2] with
+  | .ok #[c] => c.length == 2 && c.values.data == (Arrow.le 4 1 ++ Arrow.le 4 2).data && c.offsets.size == 0
+  | _ => false
+
+#guard match concatArrowBatches #[textRow none, #[]] with
+  | .error _ => true
+  | .ok _ => false
+
+end Tests
@@ -0,0 +1,42 @@
+/-
+Test file for the socket poller, the reactor's wake-up without a poll timeout, and COPY through
+the reactor.
+-/
+
+import LeanPq.Async
+import Tests.Native
+open LeanPq
+open Extern
+
+namespace Tests
+
+/-- Checks of the poller and reactor that need no server, run by the `tests` executable. -/
+def asyncChecks : IO Unit := do
+  let poller ← run PqPollerNew
+  check "poller times out" ((← run (PqPollerWait poller 0)).isEmpty)
+  -- A wake-up sent before the wait still ends it, even with no timeout.
+  run (PqPollerWake poller)
+  check "poller wakes" ((← run (PqPollerWait poller UInt32.max)).isEmpty)
+  check "poller drains the wake-up" ((← run (PqPollerWait poller 0)).isEmpty)
+
+  -- The reactor loop waits with no timeout; `stop` must still end it.
+  let reactor ← run Reactor.start
+  run reactor.stop
+
+/-- Checks of the reactor against a server, run by the `tests` executable once it is up. -/
+def asyncServerChecks : IO Unit := do
+  let conn ← run (PqConnectDb testConninfo)
+  let reactor ← run Reactor.start
+  -- The task completes with the COPY result instead of polling for more results forever.
+  let res ← run (await (← run (reactor.exec conn "COPY (SELECT 1 UNION ALL SELECT 2) TO STDOUT")))
+  check "COPY completes the query" ((← run (PqResultStatus res)) == .copyOut)
+  check "COPY rows" ((← run (PqGetCopyData conn)).map (·.data) == some "1\n".toUTF8.data)
+  check "COPY rows" ((← run (PqGetCopyData conn)).map (·.data) == some "2\n".toUTF8.data)
+  check "COPY end" ((← run (PqGetCopyData conn)).isNone)
+  repeat
+    if (← run (PqGetResult conn)).isNone then break
+  let res ← run (await (← run (reactor.exec conn "SELECT 1")))
+  check "usable after COPY" ((← run (PqGetvalue res 0 0)) == "1")
+  run reactor.stop
+
+end Tests
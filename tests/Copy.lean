@@ -0,0 +1,91 @@
+/-
+Test file for the native COPY encoders (text escaping, binary fields and numerics) and the
+binary COPY parser.
+-/
+
+import LeanPq.Copy
+import Tests.Native
+open LeanPq
+open Extern
+
+namespace Tests
+
+#guard CopyKind.ofDataType? .integer == some CopyKind.int4
+#guard CopyKind.ofDataType? (.numeric none none) == some CopyKind.numeric
+#guard CopyKind.ofDataType? .json == some CopyKind.text
+#guard CopyKind.ofDataType? (.interval none none) == none
+
+/-- Checks of the native encoders, run by the `tests` executable. -/
+def copyChecks : IO Unit := do
+  let text ← run (PqCopyEncodeText ByteArray.empty
+    #[#[some "a\tb", none], #[some "x\\y\r\n", some ""]])
+  check "text escaping" (text.data == "a\\tb\t\\N\nx\\\\y\\r\\n\t\n".toUTF8.data)
+
+  let encode (kind : UInt8) (v : Value) : IO ByteArray :=
+    run (PqCopyEncodeBinary ByteArray.empty (ByteArray.mk #[kind]) #[#[v]] false)
+  -- Field count, length, ndigits, weight, sign, dscale, then base-10000 digits.
+  check "numeric 12345.678" ((← encode CopyKind.numeric (.numeric "12345.678")).data ==
+    #[0, 1, 0, 0, 0, 14, 0, 3, 0, 1, 0, 0, 0, 3, 0, 1, 0x09, 0x29, 0x1A, 0x7C])
+  check "numeric 0.0001" ((← encode CopyKind.numeric (.numeric "0.0001")).data ==
+    #[0, 1, 0, 0, 0, 10, 0, 1, 0xFF, 0xFF, 0, 0, 0, 4, 0, 1])
+  check "numeric -0" ((← encode CopyKind.numeric (.numeric "-0")).data ==
+    #[0, 1, 0, 0, 0, 8, 0, 0, 0, 0, 0, 0, 0, 0])
+  check "numeric NaN" ((← encode CopyKind.numeric (.numeric "NaN")).data ==
+    #[0, 1, 0, 0, 0, 8, 0, 0, 0, 0, 0xC0, 0, 0, 0])
+  check "numeric from int" ((← encode CopyKind.numeric (.int 10000)).data ==
+    #[0, 1, 0, 0, 0, 10, 0, 1, 0, 1, 0, 0, 0, 0, 0, 1])
+  check "int4" ((← encode CopyKind.int4 (.int (-2))).data == #[0, 1, 0, 0, 0, 4, 0xFF, 0xFF, 0xFF, 0xFE])
+  check "null" ((← encode CopyKind.int4 .null).data == #[0, 1, 0xFF, 0xFF, 0xFF, 0xFF])
+  check "jsonb version byte" ((← encode CopyKind.jsonb (.text "1")).data == #[0, 1, 0, 0, 0, 2, 1, 0x31])
+  check "date epoch" ((← encode CopyKind.date (.date 10957)).data == #[0, 1, 0, 0, 0, 4, 0, 0, 0, 0])
+
+  check "int2 out of range" (← fails (encode CopyKind.int2 (.int 70000)))
+  check "malformed numeric" (← fails (encode CopyKind.numeric (.numeric "1.2.3")))
+  check "kind mismatch" (← fails (encode CopyKind.bool (.int 1)))
+  check "row width" (← fails (PqCopyEncodeBinary ByteArray.empty (ByteArray.mk #[3, 3]) #[#[.int 1]] false))
+
+  let header ← run (PqCopyEncodeBinary ByteArray.empty ByteArray.empty #[] true)
+  check "binary header" (header.data == #[0x50, 0x47, 0x43, 0x4F, 0x50, 0x59, 0x0A, 0xFF, 0x0D, 0x0A, 0,
+    0, 0, 0, 0, 0, 0, 0, 0])
+
+/-- Binary COPY header without extension. -/
+def copyHeader : Array UInt8 :=
+  #[0x50, 0x47, 0x43, 0x4F, 0x50, 0x59, 0x0A, 0xFF, 0x0D, 0x0A, 0, 0, 0, 0, 0, 0, 0, 0, 0]
+
+def isText (v : Value) (expected : String) : Bool :=
+  match v with
+  | .text s => s == expected
+  | _ => false
+
+/-- Checks of the native binary COPY parser, run by the `tests` executable. -/
+def copyParserChecks : IO Unit := do
+  let parser ← run (PqCopyParserNew #[Oid.int4, Oid.text])
+  let tuple1 : Array UInt8 := #[0, 2, 0, 0, 0, 4, 0, 0, 0, 7, 0, 0, 0, 2, 0x68, 0x69]
+  let tuple2 : Array UInt8 := #[0, 2, 0xFF, 0xFF, 0xFF, 0xFF, 0, 0, 0, 1, 0x78]
+  -- The second tuple is split across chunks.
+  let first := copyHeader ++ tuple1 ++ tuple2.extract 0 5
+  let second := tuple2.extract 5 tuple2.size ++ #[0xFF, 0xFF]
+  check "parser waits for the trailer" (!(← run (PqCopyParserFeed parser (ByteArray.mk first))))
+  check "parser keeps a split tuple" ((← run (PqCopyParserRows parser)) == 1)
+  check "parser reads the trailer" (← run (PqCopyParserFeed parser (ByteArray.mk second)))
+  check "parser rows" ((← run (PqCopyParserRows parser)) == 2)
+  let columns ← run (PqCopyParserTake parser)
+  check "parser columns" (columns.size == 2 && columns.all (·.size == 2))
+  if let #[ints, texts] := columns then
+    check "parser int4" (ints.getInt64! 0 == 7 && ints.isNull 1)
+    check "parser text" (isText (texts.get 0) "hi" && isText (texts.get 1) "x")
+  check "parser take resets" ((← run (PqCopyParserRows parser)) == 0)
+
+  -- The second field of the tuple has the wrong width for int4: the first one is rolled back.
+  let parser ← run (PqCopyParserNew #[Oid.int8, Oid.int4])
+  let bad : Array UInt8 := #[0, 2, 0, 0, 0, 8, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 2, 0, 1]
+  check "malformed tuple" (← fails (PqCopyParserFeed parser (ByteArray.mk (copyHeader ++ bad))))
+  check "malformed tuple rows" ((← run (PqCopyParserRows parser)) == 0)
+  let columns ← run (PqCopyParserTake parser)
+  check "malformed tuple rolled back" (columns.all (·.size == 0))
+
+  check "wrong field count" (← fails do
+    let parser ← PqCopyParserNew #[Oid.int4]
+    PqCopyParserFeed parser (ByteArray.mk (copyHeader ++ tuple1)))
+
+end Tests
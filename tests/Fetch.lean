@@ -0,0 +1,31 @@
+/-
+Test file for the bulk retrieval of results as strings.
+-/
+
+import LeanPq.Extern
+import Tests.Native
+open LeanPq
+open Extern
+
+namespace Tests
+
+/-- Checks of `PqFetchAll` and `PqFetchColumns`, run by the `tests` executable once a server
+is up. -/
+def fetchChecks : IO Unit := do
+  let conn ← run (PqConnectDb testConninfo)
+  let res ← run (PqExec conn
+    "SELECT * FROM (VALUES (1, 'a', NULL::text), (2, NULL, ''), (3, 'c', 'z')) AS t(n, s, e) ORDER BY n")
+  let rows ← run (PqFetchAll res)
+  check "row count" (rows.size == 3 && rows.all (·.size == 3))
+  check "row-major order" (rows[0]! == #[some "1", some "a", none] && rows[1]! == #[some "2", none, some ""])
+  check "last row" (rows[2]! == #[some "3", some "c", some "z"])
+  let columns ← run (PqFetchColumns res)
+  check "column count" (columns.size == 3 && columns.all (·.size == 3))
+  check "column-major order" (columns[0]! == #[some "1", some "2", some "3"])
+  check "NULL is not ''" (columns[2]! == #[none, some "", some "z"] && columns[1]! == #[some "a", none, some "c"])
+  let empty ← run (PqExec conn "SELECT 1 AS n, 'x' AS s WHERE false")
+  check "zero rows, row-major" ((← run (PqFetchAll empty)).isEmpty)
+  let emptyColumns ← run (PqFetchColumns empty)
+  check "zero rows, column-major" (emptyColumns.size == 2 && emptyColumns.all (·.isEmpty))
+
+end Tests
@@ -0,0 +1,34 @@
+/-
+Test file for the ordering and equality of field views, SQL NULL included.
+-/
+
+import LeanPq.FieldView
+import Tests.Native
+open LeanPq
+open Extern
+
+namespace Tests
+
+#guard FieldView.orderNullsLast true true (fun _ => .lt) == .eq
+#guard FieldView.orderNullsLast true false (fun _ => .lt) == .gt
+#guard FieldView.orderNullsLast false true (fun _ => .gt) == .lt
+#guard FieldView.orderNullsLast false false (fun _ => .lt) == .lt
+
+/-- Checks of views over a real result, run by the `tests` executable once a server is up. -/
+def fieldViewChecks : IO Unit := do
+  let conn ← run (PqConnectDb testConninfo)
+  let res ← run (PqExec conn "SELECT NULL::text, ''::text, 'b'::text, NULL::text")
+  let views ← (List.range 4).toArray.mapM fun i => run (PqFieldView res 0 i)
+  let some null := views[0]? | check "field views" false
+  let some empty := views[1]? | check "field views" false
+  let some b := views[2]? | check "field views" false
+  let some null' := views[3]? | check "field views" false
+  check "NULL is not ''" (!(null == empty) && !(empty == null))
+  check "NULL equals NULL" (null == null' && hash null == hash null')
+  check "NULL sorts last" (compare null b == .gt && compare empty null == .lt)
+  check "bytes order" (compare empty b == .lt && compare b b == .eq)
+  check "copies" (null.toString? == none && empty.toString? == some "" && b.toByteArray?.map (·.data) == some #[0x62])
+  check "out of range" (← fails (PqFieldView res 1 0))
+  check "negative field" (← fails (PqFieldView res 0 (-1)))
+
+end Tests
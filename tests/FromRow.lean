@@ -0,0 +1,43 @@
+/-
+Test file for typed rows.
+Checks derived `FromRow` instances against hand-built decoded columns.
+-/
+
+import LeanPq.FromRow
+open LeanPq
+
+namespace Tests
+
+structure Account where
+  id : Int64
+  name : String
+  balance : Option Float
+  deriving FromRow
+
+def int8Column (values : List Int64) : Column :=
+  let bytes := values.foldl (init := ByteArray.empty) fun acc v =>
+    (List.range 8).foldl (init := acc) fun acc k => acc.push (v.toUInt64 >>> (8 * k).toUInt64).toUInt8
+  { oid := Oid.int8, nulls := ByteArray.mk (values.map fun _ => 0).toArray, data := .int64 bytes }
+
+def accounts : Array Column := #[
+  int8Column [1, -2],
+  { oid := Oid.text, nulls := ByteArray.mk #[0, 0], data := .boxed #[.text "a", .text "b"] },
+  { oid := Oid.float8, nulls := ByteArray.mk #[0, 1], data := .float64 (FloatArray.mk #[1.5, 0]) }
+]
+
+def decoded (row : Nat) : Option (Int64 × String × Option Float) :=
+  match FromRow.decodeRow (α := Account) accounts row with
+  | .ok a => some (a.id, a.name, a.balance)
+  | .error _ => none
+
+#guard FromRow.columns (α := Account) == #["id", "name", "balance"]
+#guard (FromRow.fields (α := Account)).map (·.accepts Oid.int4) == #[true, false, false]
+#guard decoded 0 == some (1, "a", some 1.5)
+#guard decoded 1 == some (-2, "b", none)
+
+-- A NULL in a non-optional field is an error naming the column.
+#guard (FromRow.decodeRow (α := Account)
+  (accounts.set! 1 { oid := Oid.text, nulls := ByteArray.mk #[1, 1], data := .boxed #[.null, .null] }) 0
+  |>.toOption |>.isNone)
+
+end Tests
@@ -0,0 +1,59 @@
+/-
+Test file for large objects: chunked writes, seeks and reads, truncation, unlinking, and the
+descriptor's lifetime.
+-/
+
+import LeanPq.LargeObject
+import Tests.Native
+open LeanPq
+open Extern
+
+namespace Tests
+
+/-- Checks of large objects against a server, run by the `tests` executable once it is up. -/
+def largeObjectChecks : IO Unit := do
+  let conn ← run (PqConnectDb testConninfo)
+  let piece (b : UInt8) : ByteArray := ByteArray.mk (Array.replicate 3000 b)
+  let data := piece 1 ++ piece 2 ++ piece 3
+
+  let oid ← run <| withLoTransaction conn do
+    let lo ← LargeObject.create conn
+    lo.write (piece 1)
+    lo.write (piece 2)
+    lo.write (piece 3)
+    lo.close
+    return lo.oid
+  check "transaction committed" ((← run (PqTransactionStatus conn)) == .idle)
+
+  let (size, position, chunk, tell) ← run <| withLoTransaction conn do
+    let lo ← LargeObject.openObject conn oid LoMode.read
+    let size ← lo.seek 0 .fromEnd
+    let position ← lo.seek 2500
+    let chunk ← lo.read ByteArray.empty 1000
+    let tell ← lo.tell
+    lo.close
+    return (size, position, chunk, tell)
+  check "size" (size == 9000)
+  check "seek" (position == 2500)
+  check "read across pieces" (chunk.data == (data.extract 2500 3500).data)
+  check "tell" (tell == 3500)
+
+  let read ← run <| withLoTransaction conn do
+    let lo ← LargeObject.openObject conn oid
+    lo.truncate 4000
+    discard <| lo.seek 0
+    let read ← lo.forChunks ByteArray.empty (fun chunk acc => return acc ++ chunk) 1024
+    lo.close
+    return read
+  check "truncated" (read.data == (data.extract 0 4000).data)
+
+  -- Outside a transaction each call commits on its own, which closes the descriptor.
+  check "descriptor outside a transaction" (← fails do
+    let lo ← LargeObject.openObject conn oid LoMode.read
+    lo.read ByteArray.empty 1)
+  check "usable after descriptor error" ((← run (PqTransactionStatus conn)) == .idle)
+
+  run (PqLoUnlink conn oid)
+  check "unlinked" (← fails (withLoTransaction conn (LargeObject.openObject conn oid LoMode.read)))
+
+end Tests
@@ -0,0 +1,55 @@
+/-
+Test file for query statistics: histogram summaries, counters and the slow-query callback.
+-/
+
+import LeanPq.Extern
+import Tests.Native
+open LeanPq
+open Extern
+
+namespace Tests
+
+private def sampleStats : QueryStats :=
+  { queries := 4, totalMicros := 10, resultsAllocated := 5, resultsFreed := 3,
+    latency := #[0, 1, 2, 0, 1] }
+
+#guard sampleStats.meanMicros == 2.5
+#guard ({} : QueryStats).meanMicros == 0
+#guard sampleStats.resultsLive == 2
+-- Buckets hold the queries below 1, 2, 4, 8 and 16 µs.
+#guard sampleStats.percentileMicros 0.25 == 2
+#guard sampleStats.percentileMicros 0.5 == 4
+#guard sampleStats.percentileMicros 0.75 == 4
+#guard sampleStats.percentileMicros 1 == 16
+#guard ({} : QueryStats).percentileMicros 0.5 == 0
+
+/-- Checks of the native counters against a server, run by the `tests` executable once it is
+up. -/
+def metricsChecks : IO Unit := do
+  let conn ← run (PqConnectDb testConninfo)
+  run (PqResetStats conn)
+  discard <| run (PqExec conn "SELECT generate_series(1, 3)")
+  discard <| run (PqExec conn "SELECT * FROM lean_pq_no_such_table")
+  let stats ← run (PqConnectionStats conn)
+  check "queries" (stats.queries == 2)
+  check "rows" (stats.rows == 3)
+  check "errors" (stats.errors == 1)
+  check "results" (stats.resultsAllocated == 2)
+  check "histogram" (stats.latency.foldl (· + ·) 0 == 2)
+  let statements ← run (PqStatementStats conn)
+  check "per statement" (statements.any fun s => s.key == "SELECT generate_series(1, 3)" && s.stats.rows == 3)
+
+  -- A canceled query's result is freed right away and must not stay live.
+  let before ← run PqGlobalStats
+  check "timeout" (← fails (PqExecTimeout conn "SELECT pg_sleep(5)" 50))
+  let after ← run PqGlobalStats
+  check "canceled result freed" (after.resultsLive == before.resultsLive)
+
+  let seen ← IO.mkRef (#[] : Array String)
+  run (PqSetSlowQueryCallback conn 0 fun key _ => seen.modify (·.push key))
+  discard <| run (PqExec conn "SELECT 1")
+  run (PqClearSlowQueryCallback conn)
+  discard <| run (PqExec conn "SELECT 2")
+  check "slow-query callback" ((← seen.get) == #["SELECT 1"])
+
+end Tests
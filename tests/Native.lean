@@ -0,0 +1,28 @@
+/-
+Helpers for checks of native functions. `#guard` runs at elaboration time, where the C
+functions are not loaded, so these checks run from the `tests` executable instead.
+-/
+
+import LeanPq.Error
+
+namespace Tests
+
+/-- Server used by the checks that need one. -/
+def testConninfo : String := "host=localhost port=5432 user=postgres password=test dbname=postgres"
+
+/-- Fails the test run when `cond` does not hold. -/
+def check (name : String) (cond : Bool) : IO Unit :=
+  unless cond do
+    throw (IO.userError s!"Check failed: {name}")
+
+/-- Runs a library action, turning its error into an `IO` error. -/
+def run (act : EIO LeanPq.Error α) : IO α :=
+  act.toIO fun e => IO.userError (toString e)
+
+/-- Whether a library action fails. -/
+def fails (act : EIO LeanPq.Error α) : IO Bool := do
+  match ← act.toBaseIO with
+  | .ok _ => return false
+  | .error _ => return true
+
+end Tests
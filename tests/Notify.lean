@@ -0,0 +1,31 @@
+/-
+Test file for LISTEN/NOTIFY delivery between two connections.
+-/
+
+import LeanPq.Notify
+import Tests.Native
+open LeanPq
+open Extern
+
+namespace Tests
+
+/-- Checks of a listener against a server, run by the `tests` executable once it is up. -/
+def notifyChecks : IO Unit := do
+  let listener ← Listener.new (← run (PqConnectDb testConninfo))
+  let sender ← run (PqConnectDb testConninfo)
+  -- A channel that is only valid quoted, as `listen` escapes it.
+  let channel := "Lean Pq Test"
+  run (listener.listen channel)
+  run (notify sender channel "hello")
+  let batch ← run (listener.poll 5000)
+  check "one notification" (batch.size == 1)
+  let some n := batch[0]? | check "notification" false
+  check "channel" (n.channel == channel)
+  check "payload" (n.payload == "hello")
+  check "sender pid" (n.bePid.toNat == (← run (PqBackendPID sender)).toNat)
+
+  run (listener.unlisten channel)
+  run (notify sender channel "ignored")
+  check "no delivery after UNLISTEN" ((← run (listener.poll 500)).isEmpty)
+
+end Tests
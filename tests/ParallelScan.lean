@@ -0,0 +1,25 @@
+/-
+Test file for the partitioning of parallel scans.
+-/
+
+import LeanPq.ParallelScan
+open LeanPq
+
+namespace Tests
+
+#guard ParallelScan.blockPredicates 100 1 == #["TRUE"]
+#guard ParallelScan.blockPredicates 100 3 == #[
+  "ctid < '(33,0)'::tid",
+  "ctid >= '(33,0)'::tid AND ctid < '(66,0)'::tid",
+  "ctid >= '(66,0)'::tid"]
+#guard ParallelScan.blockPredicates 0 2 == #["ctid < '(0,0)'::tid", "ctid >= '(0,0)'::tid"]
+
+#guard ParallelScan.keyPredicates "id" 1 100 1 == #["TRUE"]
+#guard ParallelScan.keyPredicates "id" 1 100 4 == #[
+  "(id < 26 OR id IS NULL)",
+  "id >= 26 AND id < 51",
+  "id >= 51 AND id < 76",
+  "id >= 76"]
+#guard ParallelScan.keyPredicates "id" (-10) 9 2 == #["(id < 0 OR id IS NULL)", "id >= 0"]
+
+end Tests
@@ -0,0 +1,22 @@
+/-
+Test file for statement parameters.
+Checks the network byte order produced by the binary encoders.
+-/
+
+import LeanPq.Param
+open LeanPq
+
+namespace Tests
+
+def binaryBytes : Param → Option (Array UInt8 × UInt32)
+  | .binary value oid => some (value.data, oid)
+  | _ => none
+
+#guard binaryBytes (Param.ofInt32 1) == some (#[0, 0, 0, 1], Oid.int4)
+#guard binaryBytes (Param.ofInt16 (-1)) == some (#[0xFF, 0xFF], Oid.int2)
+#guard binaryBytes (Param.ofInt64 258) == some (#[0, 0, 0, 0, 0, 0, 1, 2], Oid.int8)
+#guard binaryBytes (Param.ofBool true) == some (#[1], Oid.bool)
+#guard binaryBytes (Param.ofFloat 1.0) == some (#[0x3F, 0xF0, 0, 0, 0, 0, 0, 0], Oid.float8)
+#guard binaryBytes (Param.ofOption Param.ofInt32 none) == none
+
+end Tests
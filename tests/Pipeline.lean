@@ -0,0 +1,18 @@
+/-
+Test file for the splitting of pipelined batches at synchronization points.
+-/
+
+import LeanPq.Pipeline
+open LeanPq
+
+namespace Tests
+
+#guard Pipeline.batchSizes 3 0 7 == #[3, 3, 1]
+#guard Pipeline.batchSizes 3 1 7 == #[2, 3, 2]
+#guard Pipeline.batchSizes 3 2 1 == #[1]
+#guard Pipeline.batchSizes 1000 0 0 == #[]
+#guard Pipeline.batchSizes 4 0 8 == #[4, 4]
+-- A full pipeline (which `added` does not leave behind) still makes progress.
+#guard Pipeline.batchSizes 2 2 3 == #[1, 2]
+
+end Tests
@@ -0,0 +1,45 @@
+/-
+Test file for the connection pool's slot accounting and its lifecycle without a server.
+-/
+
+import LeanPq.Pool
+import Tests.Native
+open LeanPq
+
+namespace Tests
+
+#guard Pool.reserveStep 2 1 == (true, 2)
+#guard Pool.reserveStep 2 2 == (false, 2)
+#guard Pool.shrinkStep 1 2 == (true, 1)
+#guard Pool.shrinkStep 1 1 == (false, 1)
+#guard Pool.shrinkStep 0 0 == (false, 0)
+
+-- Two evictions racing over the last connection above `minSize`: only the first one frees it.
+#guard
+  let (first, n) := Pool.shrinkStep 1 2
+  let (second, n) := Pool.shrinkStep 1 n
+  first && !second && n == 1
+
+#guard
+  let s := PoolStats.add { hits := 1, discards := 2, size := 3 } { hits := 4, idle := 5 }
+  s.hits == 5 && s.discards == 2 && s.size == 3 && s.idle == 5
+
+/-- Checks of a pool that never connects, run by the `tests` executable. -/
+def poolChecks : IO Unit := do
+  let pool ← run (Pool.create { conninfo := "", minSize := 0, maintenanceIntervalMs := 1 })
+  let stats ← pool.stats
+  check "empty pool" (stats.size == 0 && stats.idle == 0 && stats.hits == 0)
+  pool.close
+  check "closed pool refuses checkouts" (← fails pool.checkout)
+
+/-- Checks of a pool against a server, run by the `tests` executable once it is up. -/
+def poolServerChecks : IO Unit := do
+  let pool ← run (Pool.create { conninfo := testConninfo, minSize := 1 })
+  let conn ← run pool.checkout
+  pool.close
+  -- Returned after `close`: finished rather than put back on an idle list.
+  run (pool.release conn)
+  let stats ← pool.stats
+  check "released after close" (stats.idle == 0 && stats.size == 0)
+
+end Tests
@@ -0,0 +1,102 @@
+/-
+Test file for LSN formatting and parsing, and for the native `pgoutput` decoder.
+-/
+
+import LeanPq.Replication
+import Tests.Native
+open LeanPq
+open Extern
+
+namespace Tests
+
+#guard Lsn.toString 0 == "0/0"
+#guard Lsn.toString 0x16B3748 == "0/16B3748"
+#guard Lsn.toString 0x1000000FF == "1/FF"
+#guard Lsn.ofString? "0/16B3748" == some 0x16B3748
+#guard Lsn.ofString? "1/ff" == some 0x1000000FF
+#guard Lsn.ofString? (Lsn.toString 0xFFFFFFFFFFFFFFFF) == some 0xFFFFFFFFFFFFFFFF
+#guard Lsn.ofString? "16B3748" == none
+#guard Lsn.ofString? "0/" == none
+#guard Lsn.ofString? "1/100000000" == none
+
+/-- Big-endian bytes of `v`, on `n` bytes. -/
+private def be (n v : Nat) : ByteArray :=
+  (List.range n).foldl (init := ByteArray.empty) fun b i => b.push (v / 256 ^ (n - 1 - i) % 256).toUInt8
+
+private def cstr (s : String) : ByteArray := s.toUTF8.push 0
+
+private def byte (c : Char) : ByteArray := ⟨#[c.toNat.toUInt8]⟩
+
+/-- An XLogData message at 0x10..0x20, sent at the PostgreSQL epoch, carrying `payload`. -/
+private def xlog (payload : ByteArray) : ByteArray :=
+  byte 'w' ++ be 8 0x10 ++ be 8 0x20 ++ be 8 0 ++ payload
+
+private def textField (s : String) : ByteArray := byte 't' ++ be 4 s.utf8ByteSize ++ s.toUTF8
+
+private def tuple (fields : Array ByteArray) : ByteArray :=
+  fields.foldl (· ++ ·) (be 2 fields.size)
+
+/-- 2000-01-01 00:00:00 UTC in microseconds since the Unix epoch. -/
+private def pgEpochMicros : Int64 := 946684800000000
+
+private def isText (f : TupleField) (s : String) : Bool :=
+  match f with | .text v => v == s | _ => false
+
+private def decode (payload : ByteArray) : IO ReplicationEvent := do
+  return (← run (PqDecodeReplicationMessage (xlog payload))).event
+
+/-- Checks of the `pgoutput` decoder on byte-level fixtures, run by the `tests` executable. -/
+def replicationDecodeChecks : IO Unit := do
+  let msg ← run (PqDecodeReplicationMessage (xlog (byte 'B' ++ be 8 0x30 ++ be 8 1000000 ++ be 4 7)))
+  check "XLogData header" (msg.walStart == 0x10 && msg.walEnd == 0x20 && msg.sendTime == pgEpochMicros)
+  check "Begin" (match msg.event with
+    | .begin lsn time xid => lsn == 0x30 && time == pgEpochMicros + 1000000 && xid == 7
+    | _ => false)
+
+  check "Commit" (match ← decode (byte 'C' ++ be 1 0 ++ be 8 1 ++ be 8 2 ++ be 8 0) with
+    | .commit lsn endLsn time => lsn == 1 && endLsn == 2 && time == pgEpochMicros
+    | _ => false)
+
+  let relation := byte 'R' ++ be 4 16384 ++ cstr "public" ++ cstr "t" ++ byte 'd' ++ be 2 2 ++
+    be 1 1 ++ cstr "id" ++ be 4 23 ++ be 4 0xFFFFFFFF ++
+    be 1 0 ++ cstr "v" ++ be 4 25 ++ be 4 0xFFFFFFFF
+  check "Relation" (match ← decode relation with
+    | .relation relid schema name identity columns =>
+      relid == 16384 && schema == "public" && name == "t" && identity == 'd'.toNat.toUInt8 &&
+        columns.map (·.name) == #["id", "v"] && columns.map (·.typeOid) == #[23, 25] &&
+        columns.map (·.key) == #[true, false] && columns.all (·.typmod == -1)
+    | _ => false)
+
+  check "Insert" (match ← decode (byte 'I' ++ be 4 16384 ++ byte 'N' ++ tuple #[textField "1", byte 'n']) with
+    | .insert relid #[a, .null] => relid == 16384 && isText a "1"
+    | _ => false)
+
+  -- Without an old key, and with an unchanged TOASTed value.
+  check "Update" (match ← decode (byte 'U' ++ be 4 16384 ++ byte 'N' ++ tuple #[textField "1", byte 'u']) with
+    | .update relid none #[a, .unchanged] => relid == 16384 && isText a "1"
+    | _ => false)
+
+  let binary := byte 'b' ++ be 4 2 ++ ⟨#[0xAB, 0xCD]⟩
+  let update := byte 'U' ++ be 4 16384 ++ byte 'K' ++ tuple #[textField "1", byte 'n'] ++
+    byte 'N' ++ tuple #[textField "2", binary]
+  check "Update with old key" (match ← decode update with
+    | .update _ (some #[old, .null]) #[new, .binary b] => isText old "1" && isText new "2" && b.data == #[0xAB, 0xCD]
+    | _ => false)
+
+  check "Delete" (match ← decode (byte 'D' ++ be 4 16384 ++ byte 'K' ++ tuple #[textField "1", byte 'n']) with
+    | .delete relid #[a, .null] => relid == 16384 && isText a "1"
+    | _ => false)
+
+  check "Truncate" (match ← decode (byte 'T' ++ be 4 2 ++ be 1 3 ++ be 4 16384 ++ be 4 16385) with
+    | .truncate relids options => relids == #[16384, 16385] && options == 3
+    | _ => false)
+
+  -- A field announcing more bytes than the message holds, and a cut header.
+  check "truncated field" (← fails (PqDecodeReplicationMessage
+    (xlog (byte 'I' ++ be 4 16384 ++ byte 'N' ++ be 2 1 ++ byte 't' ++ be 4 10 ++ "ab".toUTF8))))
+  check "truncated header" (← fails (PqDecodeReplicationMessage (byte 'w' ++ be 8 0x10)))
+  check "missing columns" (← fails (PqDecodeReplicationMessage
+    (xlog (byte 'I' ++ be 4 16384 ++ byte 'N' ++ be 2 2 ++ byte 'n'))))
+  check "unknown message" (← fails (PqDecodeReplicationMessage (byte 'x')))
+
+end Tests
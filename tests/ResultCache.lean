@@ -0,0 +1,82 @@
+/-
+Test file for the result cache's keys, eviction, invalidation and size estimates.
+-/
+
+import LeanPq.ResultCache
+open LeanPq
+
+namespace Tests
+
+#guard (CacheKey.paramBytes #[]).size == 0
+#guard (CacheKey.paramBytes #[.null]).data == #[0, 0, 0, 0, 0]
+#guard (CacheKey.paramBytes #[.text "ab" 25]).data == #[1, 0, 0, 0, 25, 0, 0, 0, 2, 97, 98]
+#guard (CacheKey.paramBytes #[.binary ⟨#[7]⟩]).data == #[2, 0, 0, 0, 0, 0, 0, 0, 1, 7]
+
+-- Lengths keep adjacent values apart, and the kind keeps NULL apart from the empty string.
+#guard CacheKey.ofQuery "db" "q" #[.text "ab", .text "c"] 1 !=
+  CacheKey.ofQuery "db" "q" #[.text "a", .text "bc"] 1
+#guard CacheKey.ofQuery "db" "q" #[.null] 1 != CacheKey.ofQuery "db" "q" #[.text ""] 1
+#guard CacheKey.ofQuery "db" "q" #[.text "1" 23] 1 != CacheKey.ofQuery "db" "q" #[.text "1" 20] 1
+#guard CacheKey.ofQuery "db" "SELECT 1" #[] 1 != CacheKey.ofQuery "db" "SELECT 2" #[] 1
+#guard CacheKey.ofQuery "db" "q" #[.text "x"] 1 == CacheKey.ofQuery "db" "q" #[.text "x"] 1
+-- Text and binary results decode differently, and other databases hold other rows.
+#guard CacheKey.ofQuery "db" "q" #[] 0 != CacheKey.ofQuery "db" "q" #[] 1
+#guard CacheKey.ofQuery "db" "q" #[] 1 != CacheKey.ofQuery "other" "q" #[] 1
+
+private def entry (tags : Array String) (bytes lastUse : Nat) : CacheEntry :=
+  { result := default, tags, bytes, expires := 0, lastUse }
+
+private def key (sql : String) : CacheKey := .ofQuery "db" sql #[] 1
+
+/-- Three entries of 10 bytes; `b` is the least recently used, then `a`. -/
+private def sample : CacheState :=
+  { entries := ({} : Std.HashMap CacheKey CacheEntry)
+      |>.insert (key "a") (entry #["users"] 10 2)
+      |>.insert (key "b") (entry #["orders"] 10 1)
+      |>.insert (key "c") (entry #[] 10 3),
+    bytes := 30, uses := 3 }
+
+#guard (sample.evict 40 10).entries.size == 3
+#guard
+  let s := sample.evict 40 15
+  !s.entries.contains (key "b") && s.entries.contains (key "a") && s.bytes == 20
+#guard
+  let s := sample.evict 30 15
+  s.entries.size == 1 && s.entries.contains (key "c") && s.bytes == 10
+#guard
+  let s := sample.evict 5 10
+  s.entries.isEmpty && s.bytes == 0
+
+-- Untagged entries go with any tag; the other tags stay.
+#guard
+  let s := sample.invalidate #["users"]
+  s.entries.size == 1 && s.entries.contains (key "b") && s.bytes == 10
+#guard
+  let s := sample.invalidate #["unrelated"]
+  s.entries.size == 2 && !s.entries.contains (key "c")
+#guard
+  let s := sample.invalidate #[]
+  s.entries.isEmpty && s.bytes == 0
+
+-- A result queried across an invalidation is not stored.
+#guard (sample.invalidate #["orders"]).invalidatedSince sample #["orders"]
+#guard !(sample.invalidate #["orders"]).invalidatedSince sample #["users"]
+#guard (sample.invalidate #["orders"]).invalidatedSince sample #[]
+#guard (sample.invalidate #[]).invalidatedSince sample #["users"]
+#guard !sample.invalidatedSince sample #[]
+
+#guard CachedResult.valueBytes .null == 0
+#guard CachedResult.valueBytes (.text "abcd") == CachedResult.valueBytes (.text "") + 4
+#guard CachedResult.valueBytes (.array 23 #[2] #[.int 1, .null]) >
+  CachedResult.valueBytes (.int 1)
+
+-- Retained bytes grow with the decoded values, not with the server's result.
+#guard
+  let col (data : ColumnData) (rows : Nat) : Column :=
+    { oid := 25, nulls := ⟨Array.replicate rows 0⟩, data }
+  let small : CachedResult := { names := #["t"], columns := #[col (.boxed #[.text "a"]) 1], rows := 1 }
+  let large : CachedResult :=
+    { names := #["t"], columns := #[col (.boxed #[.text (String.mk (List.replicate 1000 'a'))]) 1], rows := 1 }
+  large.retainedBytes == small.retainedBytes + 999
+
+end Tests
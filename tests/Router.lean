@@ -0,0 +1,26 @@
+/-
+Test file for the choice of the replica a read goes to, and of the replicas that may be read.
+-/
+
+import LeanPq.Router
+open LeanPq
+
+namespace Tests
+
+#guard Router.chooseReplica .leastOutstanding #[] == none
+#guard Router.chooseReplica .leastOutstanding #[(0, 3), (500, 1), (0, 2)] == some 1
+-- Ties go to the least lagging replica, then to the first one.
+#guard Router.chooseReplica .leastOutstanding #[(40, 2), (10, 2), (10, 2)] == some 1
+-- Replicas more than the tolerance behind the freshest one are skipped.
+#guard Router.chooseReplica (.lagAware 100) #[(0, 3), (500, 1), (50, 2)] == some 2
+#guard Router.chooseReplica (.lagAware 1000) #[(0, 3), (500, 1), (50, 2)] == some 1
+#guard Router.chooseReplica (.lagAware 0) #[(20, 0), (10, 5)] == some 1
+
+#guard Router.readable { hosts := #[] } { role := .replica, up := true, streaming := true, lagMs := 10 }
+-- A disconnected receiver may have replayed all it received and still be behind.
+#guard !Router.readable { hosts := #[] } { role := .replica, up := true, streaming := false, lagMs := 0 }
+#guard !Router.readable { hosts := #[], maxLagMs := 5 } { role := .replica, up := true, streaming := true, lagMs := 10 }
+#guard !Router.readable { hosts := #[] } { role := .replica, up := false, streaming := true }
+#guard !Router.readable { hosts := #[] } { role := .primary, up := true }
+
+end Tests
@@ -0,0 +1,48 @@
+/-
+Test file for the SQL builder (INSERT and ON CONFLICT clauses) and the escaping functions.
+-/
+
+import LeanPq.SqlBuilder
+import Tests.Native
+open LeanPq
+open Extern
+
+namespace Tests
+
+/-- Checks of the escaping that needs no server, run by the `tests` executable. -/
+def escapeChecks : IO Unit := do
+  check "unescape bytea" ((← run (PqUnescapeBytea "\\x00ff41")).data == #[0, 0xFF, 0x41])
+
+/-- Builds one INSERT of two rows with `onConflict`. -/
+def buildInsert (conn : Handle) (onConflict : OnConflict) : EIO LeanPq.Error String := do
+  let b ← PqSqlBuilderNew conn
+  b.appendInsert "t" #["a", "b\"c"] #[#[some "x'y", none], #[some "", some "z"]] onConflict
+  b.take
+
+/-- Checks of the builder and the escaping functions, run once a server is up. -/
+def sqlBuilderChecks : IO Unit := do
+  let conn ← run (PqConnectDb testConninfo)
+  let insert := "INSERT INTO t (\"a\", \"b\"\"c\") VALUES ('x''y', NULL), ('', 'z')"
+  check "insert" ((← run (buildInsert conn .error)) == insert)
+  check "do nothing" ((← run (buildInsert conn .doNothing)) == insert ++ " ON CONFLICT DO NOTHING")
+  check "do update" ((← run (buildInsert conn (.update #["a"] #["b\"c"]))) ==
+    insert ++ " ON CONFLICT (\"a\") DO UPDATE SET \"b\"\"c\" = EXCLUDED.\"b\"\"c\"")
+  check "update of no column" ((← run (buildInsert conn (.update #["a"] #[]))) ==
+    insert ++ " ON CONFLICT (\"a\") DO NOTHING")
+  check "update without target" (← fails (buildInsert conn (.update #[] #["a"])))
+
+  -- The builder is reused after `take`.
+  let b ← run (PqSqlBuilderNew conn)
+  run (PqSqlBuilderAppendBytea b (ByteArray.mk #[0, 0xAB]))
+  check "bytea literal" ((← run b.take) == "'\\x00ab'::bytea")
+  check "builder emptied" ((← run (PqSqlBuilderSize b)) == 0)
+  check "identifier with NUL" (← fails (PqSqlBuilderAppendIdentifier b "a\x00b"))
+  check "literal with NUL" (← fails (PqSqlBuilderAppendLiteral b (some "a\x00b")))
+
+  check "escape literal" ((← run (PqEscapeLiteral conn "it's")) == "'it''s'")
+  check "escape identifier" ((← run (PqEscapeIdentifier conn "a\"b")) == "\"a\"\"b\"")
+  check "escape string" ((← run (PqEscapeStringConn conn "it's")) == "it''s")
+  check "escape literal with NUL" (← fails (PqEscapeLiteral conn "a\x00b"))
+  check "escape bytea" ((← run (PqEscapeByteaConn conn (ByteArray.mk #[0, 0xFF]))) == "\\x00ff")
+
+end Tests
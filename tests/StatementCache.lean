@@ -0,0 +1,43 @@
+/-
+Test file for the prepared statement cache: eviction, re-preparation and statement names.
+-/
+
+import LeanPq.StatementCache
+import Tests.Native
+open LeanPq
+open Extern
+
+namespace Tests
+
+/-- Names of the statements prepared on the session of `conn`. -/
+private def preparedNames (conn : Handle) : IO (Array String) := do
+  let rows ← run (PqFetchAll (← run (PqExec conn "SELECT name FROM pg_prepared_statements")))
+  return rows.filterMap (·[0]?.join)
+
+/-- Checks of statement caches against a server, run by the `tests` executable once it is up. -/
+def statementCacheChecks : IO Unit := do
+  let conn ← run (PqConnectDb testConninfo)
+  let cache ← run (StatementCache.new conn (capacity := 2))
+  let one ← run (cache.lookup "SELECT 1")
+  let two ← run (cache.lookup "SELECT 2")
+  -- "SELECT 1" is used again, so "SELECT 2" is the least recently used one.
+  discard <| run (cache.lookup "SELECT 1")
+  let three ← run (cache.lookup "SELECT 3")
+  let names ← preparedNames conn
+  check "capacity" ((← cache.size) == 2)
+  check "LRU statement deallocated" (!names.contains two.name)
+  check "others kept" (names.contains one.name && names.contains three.name)
+
+  -- The server forgets every statement: the next execution prepares it again.
+  discard <| run (PqExec conn "DEALLOCATE ALL")
+  let res ← run (cache.exec "SELECT 1")
+  check "re-prepared after 26000" ((← run (PqResultStatus res)) == .tuplesOk && (← run (PqGetvalue res 0 0)) == "1")
+
+  let other ← run (StatementCache.new conn)
+  let a ← run (cache.lookup "SELECT 42")
+  let b ← run (other.lookup "SELECT 42")
+  check "distinct names across caches" (a.name != b.name)
+  let names ← preparedNames conn
+  check "both prepared" (names.contains a.name && names.contains b.name)
+
+end Tests
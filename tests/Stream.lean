@@ -0,0 +1,18 @@
+/-
+Test file for the classification of the results of a streamed query.
+-/
+
+import LeanPq.Stream
+open LeanPq
+open Extern
+
+namespace Tests
+
+#guard RowStream.resultKind .tuplesChunk == .batch
+#guard RowStream.resultKind .singleTuple == .batch
+#guard RowStream.resultKind .tuplesOk == .terminator
+#guard RowStream.resultKind .commandOk == .terminator
+#guard RowStream.resultKind .fatalError == .failure
+#guard RowStream.resultKind .copyOut == .failure
+
+end Tests
@@ -2,6 +2,29 @@ import LeanPq.Extern
 import LeanPq.Error
 
 import Tests.DataType
+import Tests.Value
+import Tests.Stream
+import Tests.Param
+import Tests.FromRow
+import Tests.Replication
+import Tests.ParallelScan
+import Tests.Arrow
+import Tests.Router
+import Tests.Copy
+import Tests.Pipeline
+import Tests.Async
+import Tests.Pool
+import Tests.FieldView
+import Tests.TypeRegistry
+import Tests.Array
+import Tests.SqlBuilder
+import Tests.Timeout
+import Tests.ResultCache
+import Tests.Fetch
+import Tests.StatementCache
+import Tests.Metrics
+import Tests.Notify
+import Tests.LargeObject
 
 open Lean
 open LeanPq
@@ -12,8 +35,7 @@ open ToString
 
 
 def testConnect : EIO LeanPq.Error PGresult := do
-  let conninfo := "host=localhost port=5432 user=postgres password=test dbname=postgres"
-  let conn ← PqConnectDb conninfo
+  let conn ← PqConnectDb Tests.testConninfo
   let db ← PqDb conn
   let query := "CREATE TABLE my_first_table (
     first_column text,
@@ -25,7 +47,26 @@ def testConnect : EIO LeanPq.Error PGresult := do
   return result
 
 def main : IO Unit := do
+  Tests.copyChecks
+  Tests.copyParserChecks
+  Tests.asyncChecks
+  Tests.poolChecks
+  Tests.arrayChecks
+  Tests.escapeChecks
+  Tests.replicationDecodeChecks
   let result ← testConnect.toIO (fun e => IO.Error.otherError 0 (toString e))
+  Tests.fieldViewChecks
+  Tests.arrayServerChecks
+  Tests.sqlBuilderChecks
+  Tests.timeoutChecks
+  Tests.fetchChecks
+  Tests.valueServerChecks
+  Tests.asyncServerChecks
+  Tests.poolServerChecks
+  Tests.statementCacheChecks
+  Tests.metricsChecks
+  Tests.notifyChecks
+  Tests.largeObjectChecks
   -- IO.println result
   IO.println s!"Test"
   -- let keywords := #["host", "port", "user", "password", "dbname"]
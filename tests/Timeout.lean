@@ -0,0 +1,80 @@
+/-
+Test file for query timeouts and cancellation: the error variants, the drain of a canceled
+query by the `...Timeout` execs, COPY through them, and the cancellation of a stream.
+-/
+
+import LeanPq.Stream
+import Tests.Native
+open LeanPq
+open Extern
+
+namespace Tests
+
+#guard (LeanPq.Error.queryTimeout 250) == .queryTimeout 250
+#guard (LeanPq.Error.queryTimeout 250) != .queryCanceled "250"
+#guard toString (LeanPq.Error.queryTimeout 250) == "Query timeout: canceled after 250 ms."
+#guard toString (LeanPq.Error.queryCanceled "by user") == "Query canceled: by user."
+
+#guard RowStream.failureError .fatalError "57014" "canceling statement" == .queryCanceled "canceling statement"
+#guard RowStream.failureError .fatalError "42P01" "no such table" ==
+  .otherError s!"{ExecStatus.fatalError}: no such table"
+
+def isTimeout (ms : UInt32) : Except LeanPq.Error α → Bool
+  | .error (.queryTimeout t) => t == ms
+  | _ => false
+
+/-- Reads batches until the stream ends or fails. -/
+partial def drainStream (s : RowStream) : EIO LeanPq.Error Unit := do
+  if (← s.next?).isSome then drainStream s
+
+/-- Checks against the test server, run by the `tests` executable. -/
+def timeoutChecks : IO Unit := do
+  let conn ← run (PqConnectDb testConninfo)
+  let usable : IO Bool := do
+    let res ← run (PqExec conn "SELECT 1")
+    return (← run (PqResultStatus res)) == .tuplesOk && (← run (PqGetvalue res 0 0)) == "1"
+
+  let res ← run (PqExecTimeout conn "SELECT 1" 5000)
+  check "fast query" ((← run (PqResultStatus res)) == .tuplesOk)
+  -- The canceled query's results are drained, so the connection can be used right away.
+  check "exec timeout" (isTimeout 100 (← (PqExecTimeout conn "SELECT pg_sleep(5)" 100).toBaseIO))
+  check "usable after exec timeout" (← usable)
+  check "multi-statement timeout" (isTimeout 100 (← (PqExecTimeout conn "SELECT 1; SELECT pg_sleep(5)" 100).toBaseIO))
+  check "usable after multi-statement timeout" (← usable)
+  check "params timeout" (isTimeout 100 (← (PqExecParamsTimeout conn "SELECT pg_sleep($1::float8)" #[.text "5"] 100).toBaseIO))
+  check "usable after params timeout" (← usable)
+  let failed := match ← (PqExecTimeout conn "SELECT * FROM no_such_table" 5000).toBaseIO with
+    | .error (.queryTimeout _) | .error (.queryCanceled _) => false
+    | _ => true
+  check "error is not a timeout" failed
+  check "usable after error" (← usable)
+
+  -- The deadline bounds the call: the wait for the canceled query ends within the grace period.
+  let started ← IO.monoMsNow
+  let timedOut := isTimeout 100 (← (PqExecTimeout conn "SELECT pg_sleep(30)" 100).toBaseIO)
+  let elapsed := (← IO.monoMsNow) - started
+  check "sleep timeout" timedOut
+  check "sleep timeout is bounded" (elapsed < 100 + 5000 + 1000)
+  check "usable after sleep timeout" (← usable)
+
+  -- A COPY ends the command with its result, as with `PqExec`.
+  let res ← run (PqExecTimeout conn "COPY (SELECT 1) TO STDOUT" 5000)
+  check "COPY result" ((← run (PqResultStatus res)) == .copyOut)
+  check "COPY rows" ((← run (PqGetCopyData conn)).map (·.data) == some "1\n".toUTF8.data)
+  check "COPY end" ((← run (PqGetCopyData conn)).isNone)
+  repeat
+    if (← run (PqGetResult conn)).isNone then break
+  check "usable after COPY" (← usable)
+
+  -- A stream canceled from another task fails with `queryCanceled`.
+  let s ← run (RowStream.start conn "SELECT pg_sleep(0.01) FROM generate_series(1, 1000)")
+  let _ ← IO.asTask do
+    IO.sleep 100
+    run (PqCancel conn)
+  let canceled := match ← (drainStream s).toBaseIO with
+    | .error (.queryCanceled _) => true
+    | _ => false
+  check "stream canceled" canceled
+  check "usable after stream cancel" (← usable)
+
+end Tests
@@ -0,0 +1,43 @@
+/-
+Test file for the built-in type table and the resolution of catalog rows to `DataType`.
+-/
+
+import LeanPq.TypeRegistry
+open LeanPq
+
+namespace Tests
+
+#guard match builtinTypes[23]? with | some .integer => true | _ => false
+#guard match builtinTypes[1184]? with | some (.timestamp none true) => true | _ => false
+#guard match builtinTypes[1007]? with | some (.array .integer none) => true | _ => false
+#guard match builtinTypes[3807]? with | some (.array .jsonb none) => true | _ => false
+#guard !builtinTypes.contains 16384
+
+/-- Catalog rows of an enum, a domain, a composite using both and arrays of them. -/
+def test_raw_types : Std.HashMap UInt32 RawType := Std.HashMap.ofList [
+  (16400, { name := "mood", kind := "e", elem := 0, enumLabels := #["sad", "happy"] }),
+  (16401, { name := "_mood", kind := "b", elem := 16400 }),
+  (16402, { name := "posint", kind := "d", elem := 0 }),
+  (16403, { name := "entry", kind := "c", elem := 0,
+            attributes := #[("id", 23), ("mood", 16400), ("missing", 99999)] }),
+  (16404, { name := "_entry", kind := "b", elem := 16403 }),
+  -- An array of a type that was not loaded (e.g. a table's row type).
+  (16405, { name := "_orders", kind := "b", elem := 16500 })
+]
+
+#guard match TypeRegistry.resolve test_raw_types 16 23 with | some .integer => true | _ => false
+#guard match TypeRegistry.resolve test_raw_types 16 16400 with | some (.enum "mood") => true | _ => false
+#guard match TypeRegistry.resolve test_raw_types 16 16401 with
+  | some (.array (.enum "mood") none) => true | _ => false
+#guard match TypeRegistry.resolve test_raw_types 16 16402 with | some (.domain "posint") => true | _ => false
+#guard match TypeRegistry.resolve test_raw_types 16 16403 with
+  | some (.composite "entry" [("id", .integer), ("mood", .enum "mood"), ("missing", .unknown)]) => true
+  | _ => false
+#guard match TypeRegistry.resolve test_raw_types 16 16404 with
+  | some (.array (.composite "entry" _) none) => true | _ => false
+#guard (TypeRegistry.resolve test_raw_types 16 16405).isNone
+#guard (TypeRegistry.resolve test_raw_types 16 16500).isNone
+-- Out of fuel: the array and its element need two steps.
+#guard (TypeRegistry.resolve test_raw_types 1 16401).isNone
+
+end Tests
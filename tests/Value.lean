@@ -0,0 +1,69 @@
+/-
+Test file for decoded values and packed columns.
+Checks the little-endian layout produced by `PqDecodeColumn`.
+-/
+
+import LeanPq.Extern
+import Tests.Native
+open LeanPq
+open Extern
+
+namespace Tests
+
+def test_int_column : Column :=
+  { oid := Oid.int8
+    nulls := ByteArray.mk #[0, 1, 0]
+    data := .int64 (ByteArray.mk #[
+      1, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 0,
+      0xFE, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF]) }
+
+#guard test_int_column.size == 3
+#guard test_int_column.getInt64! 0 == 1
+#guard test_int_column.getInt64! 2 == -2
+#guard test_int_column.isNull 1
+#guard ({ test_int_column with data := .int64 (ByteArray.mk #[8, 7, 6, 5, 4, 3, 2, 1]) } : Column).getInt64! 0
+  == 0x0102030405060708
+#guard match test_int_column.get 1 with | .null => true | _ => false
+#guard match test_int_column.get 2 with | .int v => v == -2 | _ => false
+
+def test_bool_column : Column :=
+  { oid := Oid.bool
+    nulls := ByteArray.mk #[0]
+    data := .int64 (ByteArray.mk #[1, 0, 0, 0, 0, 0, 0, 0]) }
+
+#guard match test_bool_column.get 0 with | .bool b => b | _ => false
+
+def test_float_column : Column :=
+  { oid := Oid.float8
+    nulls := ByteArray.mk #[0]
+    data := .float64 (FloatArray.mk #[1.5]) }
+
+#guard match test_float_column.get 0 with | .float f => f == 1.5 | _ => false
+
+def test_packed_array : PackedArray :=
+  { elemOid := Oid.int8
+    dims := #[2]
+    nulls := ByteArray.mk #[0, 1]
+    data := .int64 (ByteArray.mk #[7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0]) }
+
+#guard test_packed_array.size == 2
+#guard match test_packed_array.toColumn.get 0 with | .int v => v == 7 | _ => false
+#guard match test_packed_array.toColumn.get 1 with | .null => true | _ => false
+
+/-- Checks of `PqGetTypedValue` on both result formats, run by the `tests` executable once a
+server is up. -/
+def valueServerChecks : IO Unit := do
+  let conn ← run (PqConnectDb testConninfo)
+  let query := "SELECT '1 day'::interval, 'x'::varchar, '10.0.0.1'::inet, 42::int4, 1e-310::float8"
+  let binary ← run (PqExecParams conn query #[] 1)
+  let get (res : PGresult) (i : Int) := run (PqGetTypedValue res 0 i)
+  check "binary interval is bytes" (match ← get binary 0 with | .bytea b => b.size == 16 | _ => false)
+  check "binary varchar is text" (match ← get binary 1 with | .text s => s == "x" | _ => false)
+  check "binary inet is bytes" (match ← get binary 2 with | .bytea _ => true | _ => false)
+  let text ← run (PqExec conn query)
+  check "text interval is text" (match ← get text 0 with | .text s => s == "1 day" | _ => false)
+  check "text int4" (match ← get text 3 with | .int v => v == 42 | _ => false)
+  check "subnormal text float8" (match ← get text 4 with | .float v => v > 0 && v < 1e-300 | _ => false)
+
+end Tests